@@ -15,8 +15,22 @@ extern "C" {
 #define MS_VERSION_PATCH 0
 
 // 配置选项
+// 值栈和调用帧栈从 INITIAL 大小开始按需增长，MAX 是默认上限
+// (可用 ms_vm_set_stack_limit 按 VM 修改)
+#ifndef MS_INITIAL_STACK_SIZE
+#define MS_INITIAL_STACK_SIZE 256
+#endif
+
 #ifndef MS_MAX_STACK_SIZE
-#define MS_MAX_STACK_SIZE 1024
+#define MS_MAX_STACK_SIZE (1024 * 1024)
+#endif
+
+#ifndef MS_INITIAL_FRAMES
+#define MS_INITIAL_FRAMES 8
+#endif
+
+#ifndef MS_MAX_FRAMES
+#define MS_MAX_FRAMES 10000
 #endif
 
 #ifndef MS_MAX_LOCALS
@@ -32,6 +46,7 @@ typedef struct ms_vm ms_vm_t;
 typedef struct ms_object ms_object_t;
 typedef struct ms_native_func ms_native_func_t;
 typedef struct ms_value ms_value_t;
+struct ms_function;
 
 // 值类型
 typedef enum {
@@ -51,7 +66,9 @@ typedef enum {
     MS_VAL_CLASS,
     MS_VAL_INSTANCE,
     MS_VAL_BOUND_METHOD,
-    MS_VAL_EXCEPTION
+    MS_VAL_EXCEPTION,
+    MS_VAL_ITERATOR,   // range/enumerate/zip/reversed/iter() 的返回值
+    MS_VAL_GENERATOR   // 调用生成器函数或生成器表达式得到的生成器
 } ms_value_type_t;
 
 // Forward declare collection types
@@ -78,6 +95,14 @@ struct ms_native_func {
 };
 
 // 值结构
+// 编译时定义 MS_NAN_BOXING 时使用 8 字节的 NaN-boxing 表示 (见 src/core/value.h)，
+// 字段不再可见，只能通过下面的 ms_value_* 函数访问；
+// 扩展模块必须和解释器使用相同的设置编译
+#ifdef MS_NAN_BOXING
+struct ms_value {
+    uint64_t bits;
+};
+#else
 struct ms_value {
     ms_value_type_t type;
     union {
@@ -96,6 +121,7 @@ struct ms_value {
         ms_exception_t* exception;
     } as;
 };
+#endif
 
 // List 结构
 struct ms_list_s {
@@ -104,17 +130,23 @@ struct ms_list_s {
     int capacity;
 };
 
-// Dict 键值对
+// Dict 键值对，键可以是任意可哈希的值
 typedef struct {
-    char* key;
+    ms_value_t key;
     ms_value_t value;
+    uint32_t hash;
+    bool deleted;
 } ms_dict_entry_t;
 
-// Dict 结构
+// Dict 结构：按插入顺序排列的 entries 加上开放寻址的哈希索引
+// 遍历时取 entries[0..used) 中没有 deleted 的条目
 struct ms_dict_s {
     ms_dict_entry_t* entries;
-    int count;
-    int capacity;
+    int count;           // 存活的键数
+    int used;            // entries 已用的长度 (含已删除的条目)
+    int capacity;        // entries 分配的长度
+    int32_t* index;      // entries 下标，-1 空，-2 已删除
+    int index_capacity;  // 2 的幂
 };
 
 // Tuple 结构（不可变列表）
@@ -123,12 +155,23 @@ struct ms_tuple_s {
     int count;
 };
 
-// Set 结构（无序唯一元素集合）
-// 使用哈希表实现，键是字符串表示，值是原始值
+// Set 元素 (元素的哈希和相等与字典的键相同)
+typedef struct {
+    ms_value_t value;
+    uint32_t hash;
+    bool deleted;
+} ms_set_entry_t;
+
+// Set 结构（唯一元素集合）：按插入顺序排列的 entries 加上 Swiss table 式的索引
+// 遍历时取 entries[0..used) 中没有 deleted 的条目
 struct ms_set_s {
-    ms_dict_entry_t* entries;  // 复用dict的entry结构
-    int count;
-    int capacity;
+    ms_set_entry_t* entries;
+    int count;           // 元素个数
+    int used;            // entries 已用的长度 (含已删除的条目)
+    int capacity;        // entries 分配的长度
+    uint8_t* ctrl;       // 每个槽位一个控制字节
+    int32_t* slots;      // 槽位 -> entries 下标
+    int slot_capacity;   // 8 的倍数，2 的幂
 };
 
 // VM结果类型
@@ -143,6 +186,7 @@ ms_vm_t* ms_vm_new(void);
 void ms_vm_free(ms_vm_t* vm);
 ms_result_t ms_vm_exec_string(ms_vm_t* vm, const char* source);
 ms_result_t ms_vm_exec_file(ms_vm_t* vm, const char* filename);
+void ms_vm_set_stack_limit(ms_vm_t* vm, int max_stack_size, int max_frames);
 
 // 值操作
 ms_value_t ms_value_nil(void);
@@ -161,6 +205,7 @@ ms_value_t ms_value_class(void* klass);
 ms_value_t ms_value_instance(void* instance);
 ms_value_t ms_value_bound_method(void* bound);
 
+ms_value_type_t ms_value_type(ms_value_t value);
 bool ms_value_is_nil(ms_value_t value);
 bool ms_value_is_bool(ms_value_t value);
 bool ms_value_is_int(ms_value_t value);
@@ -180,6 +225,7 @@ bool ms_value_as_bool(ms_value_t value);
 int64_t ms_value_as_int(ms_value_t value);
 double ms_value_as_float(ms_value_t value);
 const char* ms_value_as_string(ms_value_t value);
+size_t ms_value_string_length(ms_value_t value);  // 字节数，O(1)
 ms_list_t* ms_value_as_list(ms_value_t value);
 ms_dict_t* ms_value_as_dict(ms_value_t value);
 ms_tuple_t* ms_value_as_tuple(ms_value_t value);
@@ -190,6 +236,8 @@ void* ms_value_as_instance(ms_value_t value);
 void* ms_value_as_bound_method(ms_value_t value);
 
 // Collection operations
+// 字符串、集合、类实例和异常由垃圾回收器管理，ms_*_free 只在回收时
+// 释放对象内部的数组，宿主不需要也不应该自己调用
 ms_list_t* ms_list_new(void);
 void ms_list_free(ms_list_t* list);
 void ms_list_append(ms_list_t* list, ms_value_t value);
@@ -202,8 +250,18 @@ void ms_dict_free(ms_dict_t* dict);
 void ms_dict_set(ms_dict_t* dict, const char* key, ms_value_t value);
 ms_value_t ms_dict_get(ms_dict_t* dict, const char* key);
 bool ms_dict_has(ms_dict_t* dict, const char* key);
+bool ms_dict_remove(ms_dict_t* dict, const char* key);
 int ms_dict_len(ms_dict_t* dict);
 
+// 以任意值为键 (int、float、bool、None、字符串、元素都可哈希的 tuple，
+// 以及按身份比较的函数/类/实例)；list、dict、set 不可哈希，
+// 这时 set 返回 false，get 返回 None
+bool ms_value_hashable(ms_value_t value);
+bool ms_dict_set_value(ms_dict_t* dict, ms_value_t key, ms_value_t value);
+ms_value_t ms_dict_get_value(ms_dict_t* dict, ms_value_t key);
+bool ms_dict_has_value(ms_dict_t* dict, ms_value_t key);
+bool ms_dict_remove_value(ms_dict_t* dict, ms_value_t key);
+
 ms_tuple_t* ms_tuple_new(int count);
 void ms_tuple_free(ms_tuple_t* tuple);
 ms_value_t ms_tuple_get(ms_tuple_t* tuple, int index);
@@ -215,6 +273,17 @@ bool ms_set_add(ms_set_t* set, ms_value_t value);
 bool ms_set_remove(ms_set_t* set, ms_value_t value);
 bool ms_set_contains(ms_set_t* set, ms_value_t value);
 int ms_set_len(ms_set_t* set);
+// 批量加入 (预先分配一次)；有不可哈希的元素时什么都不加，返回 false
+bool ms_set_add_values(ms_set_t* set, ms_value_t* values, int count);
+
+// 集合运算，返回新集合
+ms_set_t* ms_set_copy(ms_set_t* set);
+ms_set_t* ms_set_union(ms_set_t* a, ms_set_t* b);
+ms_set_t* ms_set_intersection(ms_set_t* a, ms_set_t* b);
+ms_set_t* ms_set_difference(ms_set_t* a, ms_set_t* b);
+ms_set_t* ms_set_symmetric_difference(ms_set_t* a, ms_set_t* b);
+bool ms_set_issubset(ms_set_t* a, ms_set_t* b);
+bool ms_set_isdisjoint(ms_set_t* a, ms_set_t* b);
 
 void ms_exception_free(ms_exception_t* exception);
 
@@ -237,6 +306,26 @@ ms_value_t ms_vm_peek(ms_vm_t* vm, int distance);
 const char* ms_vm_get_error(ms_vm_t* vm);
 void ms_vm_clear_error(ms_vm_t* vm);
 
+// 垃圾回收
+// 回收在脚本执行的安全点自动进行，根是各个 VM 的值栈、调用帧、全局变量。
+// 宿主或扩展在 C 变量里长期保存的值要用 ms_gc_add_root 登记，否则可能被回收
+typedef struct {
+    uint64_t collections;
+    uint64_t objects_allocated;   // 累计
+    uint64_t objects_freed;       // 累计
+    size_t live_objects;
+    size_t live_bytes;
+    size_t next_collection;       // live_bytes 超过它时触发下一次回收
+    double last_pause_ms;
+    double max_pause_ms;
+    double total_pause_ms;
+} ms_gc_stats_t;
+
+void ms_gc_collect(void);
+void ms_gc_get_stats(ms_gc_stats_t* stats);
+void ms_gc_add_root(ms_value_t* root);
+void ms_gc_remove_root(ms_value_t* root);
+
 #ifdef __cplusplus
 }
 #endif
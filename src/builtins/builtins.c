@@ -1,4 +1,10 @@
 #include "builtins.h"
+#include "../core/value.h"
+#include "../core/iterator.h"
+#include "../core/gc.h"
+#include "../core/class.h"
+#include "../vm/generator.h"
+#include "../core/format.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +19,7 @@ static void print_value(ms_value_t value, int depth) {
         return;
     }
     
-    switch (value.type) {
+    switch (ms_value_type(value)) {
         case MS_VAL_BOOL:
             printf(ms_value_as_bool(value) ? "True" : "False");
             break;
@@ -21,11 +27,15 @@ static void print_value(ms_value_t value, int depth) {
             printf("None");
             break;
         case MS_VAL_INT:
-            printf("%lld", (long long)ms_value_as_int(value));
-            break;
         case MS_VAL_FLOAT:
-            printf("%g", ms_value_as_float(value));
+        case MS_VAL_INSTANCE: {
+            // 实例只有异常对象有文本 (异常信息)，其余是 "<object>"
+            char buffer[MS_FORMAT_BUFFER_SIZE];
+            size_t length;
+            const char* text = ms_format_text(value, buffer, &length);
+            fwrite(text, 1, length, stdout);
             break;
+        }
         case MS_VAL_STRING:
             printf("%s", ms_value_as_string(value));
             break;
@@ -53,9 +63,18 @@ static void print_value(ms_value_t value, int depth) {
         case MS_VAL_DICT: {
             ms_dict_t* dict = ms_value_as_dict(value);
             printf("{");
-            for (int i = 0; i < ms_dict_len(dict); i++) {
-                if (i > 0) printf(", ");
-                printf("'%s': ", dict->entries[i].key);
+            bool first = true;
+            for (int i = 0; i < dict->used; i++) {
+                if (dict->entries[i].deleted) continue;
+                if (!first) printf(", ");
+                first = false;
+                ms_value_t key = dict->entries[i].key;
+                if (ms_value_is_string(key)) {
+                    printf("'%s'", ms_value_as_string(key));
+                } else {
+                    print_value(key, depth + 1);
+                }
+                printf(": ");
                 print_value(dict->entries[i].value, depth + 1);
             }
             printf("}");
@@ -64,8 +83,11 @@ static void print_value(ms_value_t value, int depth) {
         case MS_VAL_SET: {
             ms_set_t* set = ms_value_as_set(value);
             printf("{");
-            for (int i = 0; i < ms_set_len(set); i++) {
-                if (i > 0) printf(", ");
+            bool first = true;
+            for (int i = 0; i < set->used; i++) {
+                if (set->entries[i].deleted) continue;
+                if (!first) printf(", ");
+                first = false;
                 print_value(set->entries[i].value, depth + 1);
             }
             printf("}");
@@ -76,6 +98,22 @@ static void print_value(ms_value_t value, int depth) {
             printf("%s: %s", exc->type, exc->message);
             break;
         }
+        case MS_VAL_ITERATOR: {
+            ms_iterator_t* iterator = ms_value_as_iterator(value);
+            if (iterator->kind != MS_ITERATOR_RANGE) {
+                printf("<%s object>", ms_iterator_name(iterator));
+            } else if (iterator->step == 1) {
+                printf("range(%lld, %lld)", (long long)iterator->start, (long long)iterator->stop);
+            } else {
+                printf("range(%lld, %lld, %lld)", (long long)iterator->start,
+                       (long long)iterator->stop, (long long)iterator->step);
+            }
+            break;
+        }
+        case MS_VAL_GENERATOR:
+            printf(ms_value_is_coroutine(value) ? "<coroutine object %s>" : "<generator object %s>",
+                   ms_value_as_generator(value)->function->name);
+            break;
         default:
             printf("<object>");
             break;
@@ -149,18 +187,16 @@ ms_value_t builtin_str(ms_vm_t* vm, int argc, ms_value_t* args) {
     if (argc == 0) return ms_value_string("");
     
     ms_value_t arg = args[0];
-    char buffer[256];
+    char buffer[MS_FORMAT_BUFFER_SIZE];
     
     // TODO: 支持 __str__ 和 __repr__ 魔术方法
     
     if (ms_value_is_string(arg)) return arg;
     if (ms_value_is_int(arg)) {
-        snprintf(buffer, sizeof(buffer), "%lld", (long long)ms_value_as_int(arg));
-        return ms_value_string(buffer);
+        return ms_string_copy(buffer, ms_format_int(ms_value_as_int(arg), buffer));
     }
     if (ms_value_is_float(arg)) {
-        snprintf(buffer, sizeof(buffer), "%g", ms_value_as_float(arg));
-        return ms_value_string(buffer);
+        return ms_string_copy(buffer, ms_format_float(ms_value_as_float(arg), buffer));
     }
     if (ms_value_is_bool(arg)) {
         return ms_value_string(ms_value_as_bool(arg) ? "True" : "False");
@@ -168,6 +204,11 @@ ms_value_t builtin_str(ms_vm_t* vm, int argc, ms_value_t* args) {
     if (ms_value_is_nil(arg)) {
         return ms_value_string("None");
     }
+    if (ms_value_is_instance(arg)) {
+        size_t length;
+        const char* text = ms_format_text(arg, buffer, &length);
+        return ms_string_copy(text, length);
+    }
     return ms_value_string("<object>");
 }
 
@@ -185,7 +226,7 @@ ms_value_t builtin_len(ms_vm_t* vm, int argc, ms_value_t* args) {
     
     ms_value_t arg = args[0];
     if (ms_value_is_string(arg)) {
-        return ms_value_int(strlen(ms_value_as_string(arg)));
+        return ms_value_int((int64_t)ms_value_string_length(arg));
     }
     if (ms_value_is_list(arg)) {
         return ms_value_int(ms_list_len(ms_value_as_list(arg)));
@@ -196,6 +237,12 @@ ms_value_t builtin_len(ms_vm_t* vm, int argc, ms_value_t* args) {
     if (ms_value_is_dict(arg)) {
         return ms_value_int(ms_dict_len(ms_value_as_dict(arg)));
     }
+    if (ms_value_is_set(arg)) {
+        return ms_value_int(ms_set_len(ms_value_as_set(arg)));
+    }
+    if (ms_value_is_iterator(arg) && ms_value_as_iterator(arg)->kind == MS_ITERATOR_RANGE) {
+        return ms_value_int(ms_range_length(ms_value_as_iterator(arg)));
+    }
     // TODO: 支持 __len__ 魔术方法
     return ms_value_nil();
 }
@@ -217,20 +264,10 @@ ms_value_t builtin_range(ms_vm_t* vm, int argc, ms_value_t* args) {
         return ms_value_nil();
     }
     
-    if (step == 0) return ms_value_nil();
-    
-    ms_list_t* list = ms_list_new();
-    if (step > 0) {
-        for (int64_t i = start; i < stop; i += step) {
-            ms_list_append(list, ms_value_int(i));
-        }
-    } else {
-        for (int64_t i = start; i > stop; i += step) {
-            ms_list_append(list, ms_value_int(i));
-        }
-    }
-    
-    return ms_value_list(list);
+    // 不再建 list：返回常量大小的 range 对象，for 循环直接按下标算出元素
+    ms_iterator_t* range = ms_range_new(start, stop, step);
+    if (range == NULL) return ms_value_nil();
+    return ms_value_iterator(range);
 }
 
 ms_value_t builtin_list(ms_vm_t* vm, int argc, ms_value_t* args) {
@@ -247,12 +284,9 @@ ms_value_t builtin_list(ms_vm_t* vm, int argc, ms_value_t* args) {
         for (int i = 0; i < ms_list_len(src); i++) {
             ms_list_append(list, ms_list_get(src, i));
         }
-    } else if (ms_value_is_tuple(arg)) {
-        // Convert tuple to list
-        ms_tuple_t* tuple = ms_value_as_tuple(arg);
-        for (int i = 0; i < ms_tuple_len(tuple); i++) {
-            ms_list_append(list, ms_tuple_get(tuple, i));
-        }
+    } else {
+        // 其余可迭代对象 (包括迭代器) 逐个取出
+        ms_iter_collect(arg, list);
     }
     
     return ms_value_list(list);
@@ -276,8 +310,14 @@ ms_value_t builtin_tuple(ms_vm_t* vm, int argc, ms_value_t* args) {
         }
         return ms_value_tuple(tuple);
     }
-    
-    return ms_value_tuple(ms_tuple_new(0));
+
+    ms_list_t* items = ms_list_new();
+    ms_iter_collect(arg, items);
+    ms_tuple_t* tuple = ms_tuple_new(items->count);
+    for (int i = 0; i < items->count; i++) {
+        tuple->elements[i] = items->elements[i];
+    }
+    return ms_value_tuple(tuple);
 }
 
 ms_value_t builtin_dict(ms_vm_t* vm, int argc, ms_value_t* args) {
@@ -291,29 +331,211 @@ ms_value_t builtin_set(ms_vm_t* vm, int argc, ms_value_t* args) {
     (void)vm;
     if (argc == 0) return ms_value_set(ms_set_new());
     
-    // Convert iterable to set
+    // Convert iterable to set (一次预先分配，逐个哈希插入)
     ms_value_t arg = args[0];
+    if (ms_value_is_set(arg)) {
+        return ms_value_set(ms_set_copy(ms_value_as_set(arg)));
+    }
+
+    ms_list_t* items = NULL;
+    if (!ms_value_is_list(arg) && !ms_value_is_tuple(arg)) {
+        // 先取完再建集合：参数是生成器时取元素会执行脚本，期间可能回收
+        items = ms_list_new();
+        ms_iter_collect(arg, items);
+    }
     ms_set_t* set = ms_set_new();
-    
     if (ms_value_is_list(arg)) {
         ms_list_t* list = ms_value_as_list(arg);
-        for (int i = 0; i < ms_list_len(list); i++) {
-            ms_set_add(set, ms_list_get(list, i));
-        }
+        ms_set_add_values(set, list->elements, list->count);
     } else if (ms_value_is_tuple(arg)) {
         ms_tuple_t* tuple = ms_value_as_tuple(arg);
-        for (int i = 0; i < ms_tuple_len(tuple); i++) {
-            ms_set_add(set, ms_tuple_get(tuple, i));
+        ms_set_add_values(set, tuple->elements, tuple->count);
+    } else {
+        ms_set_add_values(set, items->elements, items->count);
+    }
+    return ms_value_set(set);
+}
+
+// ============ 集合方法 ============
+// s.union(x) 之类，args[0] 是接收者。参数可以是集合，也可以是任意可迭代对象
+// (先一次性建成临时集合)；参数不可迭代或元素不可哈希时报告 TypeError
+
+static ms_set_t* set_operand(ms_vm_t* vm, ms_value_t value) {
+    if (ms_value_is_set(value)) return ms_value_as_set(value);
+    ms_value_t* items;
+    int count;
+    if (ms_value_is_list(value)) {
+        items = ms_value_as_list(value)->elements;
+        count = ms_value_as_list(value)->count;
+    } else if (ms_value_is_tuple(value)) {
+        items = ms_value_as_tuple(value)->elements;
+        count = ms_value_as_tuple(value)->count;
+    } else {
+        // 先取完再建集合：参数是生成器时取元素会执行脚本，期间可能回收
+        ms_list_t* collected = ms_list_new();
+        if (!ms_iter_collect(value, collected)) {
+            if (!vm->has_error) {
+                ms_vm_raise(vm, MS_TYPE_ERROR, "Argument of type '%s' is not iterable.",
+                            MS_AS_STRING(builtin_type(vm, 1, &value)));
+            }
+            return NULL;
         }
-    } else if (ms_value_is_set(arg)) {
-        // Copy set
-        ms_set_t* src = ms_value_as_set(arg);
-        for (int i = 0; i < ms_set_len(src); i++) {
-            ms_set_add(set, src->entries[i].value);
+        items = collected->elements;
+        count = collected->count;
+    }
+    ms_set_t* set = ms_set_new();
+    if (!ms_set_add_values(set, items, count)) {
+        ms_vm_raise(vm, MS_TYPE_ERROR, "Unhashable type used as set element.");
+        return NULL;
+    }
+    return set;
+}
+
+// union/intersection/difference/symmetric_difference 可以带任意多个参数，
+// 依次和结果集合运算；不带参数时返回接收者的副本
+#define SET_FOLD_METHOD(name, combine) \
+    static ms_value_t set_method_##name(ms_vm_t* vm, int argc, ms_value_t* args) { \
+        if (argc < 1 || !ms_value_is_set(args[0])) { \
+            ms_vm_raise(vm, MS_TYPE_ERROR, "%s() must be called on a set.", #name); \
+            return ms_value_nil(); \
+        } \
+        if (argc == 1) return ms_value_set(ms_set_copy(ms_value_as_set(args[0]))); \
+        /* 后面的参数是生成器时取元素会执行脚本，中间结果要登记为根 */ \
+        ms_value_t result = args[0]; \
+        ms_gc_add_root(&result); \
+        for (int i = 1; i < argc; i++) { \
+            ms_set_t* other = set_operand(vm, args[i]); \
+            if (other == NULL) { \
+                result = ms_value_nil(); \
+                break; \
+            } \
+            result = ms_value_set(combine(ms_value_as_set(result), other)); \
+        } \
+        ms_gc_remove_root(&result); \
+        return result; \
+    }
+
+SET_FOLD_METHOD(union, ms_set_union)
+SET_FOLD_METHOD(intersection, ms_set_intersection)
+SET_FOLD_METHOD(difference, ms_set_difference)
+SET_FOLD_METHOD(symmetric_difference, ms_set_symmetric_difference)
+
+#undef SET_FOLD_METHOD
+
+#define SET_METHOD(name, body) \
+    static ms_value_t set_method_##name(ms_vm_t* vm, int argc, ms_value_t* args) { \
+        if (argc != 2 || !ms_value_is_set(args[0])) { \
+            ms_vm_raise(vm, MS_TYPE_ERROR, "%s() takes exactly one argument.", #name); \
+            return ms_value_nil(); \
+        } \
+        ms_set_t* self = ms_value_as_set(args[0]); \
+        ms_set_t* other = set_operand(vm, args[1]); \
+        if (other == NULL) return ms_value_nil(); \
+        body \
+    }
+
+SET_METHOD(issubset, return ms_value_bool(ms_set_issubset(self, other));)
+SET_METHOD(issuperset, return ms_value_bool(ms_set_issubset(other, self));)
+SET_METHOD(isdisjoint, return ms_value_bool(ms_set_isdisjoint(self, other));)
+
+#undef SET_METHOD
+
+// ============ 字符串方法 ============
+
+// sep.join(items)：先算出总长度，一次分配、一次复制。items 可以是任意可迭代对象
+// (list/tuple 直接用，其余先取完)，元素必须都是字符串，否则报告 TypeError
+static ms_value_t string_method_join(ms_vm_t* vm, int argc, ms_value_t* args) {
+    if (argc != 2 || !ms_value_is_string(args[0])) return ms_value_nil();
+    ms_value_t* items;
+    int count;
+    if (ms_value_is_list(args[1])) {
+        items = ms_value_as_list(args[1])->elements;
+        count = ms_value_as_list(args[1])->count;
+    } else if (ms_value_is_tuple(args[1])) {
+        items = ms_value_as_tuple(args[1])->elements;
+        count = ms_value_as_tuple(args[1])->count;
+    } else {
+        ms_list_t* collected = ms_list_new();
+        if (!ms_iter_collect(args[1], collected)) {
+            // 生成器出错时错误已经在 VM 上
+            if (!vm->has_error) ms_vm_raise(vm, MS_TYPE_ERROR, "Can only join an iterable.");
+            return ms_value_nil();
+        }
+        items = collected->elements;
+        count = collected->count;
+    }
+
+    const char* sep = MS_AS_STRING(args[0]);
+    size_t sep_length = ms_string_length(sep);
+    size_t length = count > 0 ? sep_length * (size_t)(count - 1) : 0;
+    for (int i = 0; i < count; i++) {
+        if (!ms_value_is_string(items[i])) {
+            ms_vm_raise(vm, MS_TYPE_ERROR, "Sequence item %d: expected str instance, %s found.",
+                        i, MS_AS_STRING(builtin_type(vm, 1, &items[i])));
+            return ms_value_nil();
         }
+        length += ms_string_value_length(items[i]);
     }
-    
-    return ms_value_set(set);
+
+    char* result = ms_string_alloc(length);
+    char* p = result;
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            memcpy(p, sep, sep_length);
+            p += sep_length;
+        }
+        const char* item = MS_AS_STRING(items[i]);
+        size_t item_length = ms_string_length(item);
+        memcpy(p, item, item_length);
+        p += item_length;
+    }
+    return MS_STRING_VALUE(result);
+}
+
+// ============ 方法查找 ============
+
+typedef struct {
+    const char* name;
+    ms_native_fn_t func;
+    ms_value_t value;  // 第一次用到时才创建原生函数值，之后复用
+    bool created;
+} builtin_method_t;
+
+static builtin_method_t set_methods[] = {
+    {.name = "union", .func = set_method_union},
+    {.name = "intersection", .func = set_method_intersection},
+    {.name = "difference", .func = set_method_difference},
+    {.name = "symmetric_difference", .func = set_method_symmetric_difference},
+    {.name = "issubset", .func = set_method_issubset},
+    {.name = "issuperset", .func = set_method_issuperset},
+    {.name = "isdisjoint", .func = set_method_isdisjoint},
+};
+
+static builtin_method_t string_methods[] = {
+    {.name = "join", .func = string_method_join},
+};
+
+static bool find_method(builtin_method_t* methods, size_t count, const char* name,
+                        ms_value_t* method) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(methods[i].name, name) != 0) continue;
+        if (!methods[i].created) {
+            methods[i].value = ms_value_native_func(methods[i].func);
+            methods[i].created = true;
+        }
+        *method = methods[i].value;
+        return true;
+    }
+    return false;
+}
+
+#define FIND_METHOD(methods, name, method) \
+    find_method(methods, sizeof(methods) / sizeof(methods[0]), name, method)
+
+bool ms_builtin_method(ms_value_t receiver, const char* name, ms_value_t* method) {
+    if (ms_value_is_set(receiver)) return FIND_METHOD(set_methods, name, method);
+    if (ms_value_is_string(receiver)) return FIND_METHOD(string_methods, name, method);
+    return false;
 }
 
 // ============ 数学函数 ============
@@ -381,16 +603,15 @@ ms_value_t builtin_sum(ms_vm_t* vm, int argc, ms_value_t* args) {
     double float_sum = 0.0;
     bool has_float = false;
     
-    if (ms_value_is_list(iterable)) {
-        ms_list_t* list = ms_value_as_list(iterable);
-        for (int i = 0; i < ms_list_len(list); i++) {
-            ms_value_t val = ms_list_get(list, i);
-            if (ms_value_is_float(val)) {
-                has_float = true;
-                float_sum += ms_value_as_float(val);
-            } else {
-                int_sum += ms_value_as_int(val);
-            }
+    // 任意可迭代对象都逐个取，sum(range(n)) 不会先建出 list
+    int64_t cursor = 0;
+    ms_value_t val;
+    while (ms_iter_next(iterable, &cursor, &val) == MS_ITER_ELEMENT) {
+        if (ms_value_is_float(val)) {
+            has_float = true;
+            float_sum += ms_value_as_float(val);
+        } else {
+            int_sum += ms_value_as_int(val);
         }
     }
     
@@ -406,7 +627,13 @@ ms_value_t builtin_pow(ms_vm_t* vm, int argc, ms_value_t* args) {
     
     double base = ms_value_as_float(args[0]);
     double exp = ms_value_as_float(args[1]);
-    return ms_value_float(pow(base, exp));
+    double value = pow(base, exp);
+    // 与 ** 一致：两个整数 (指数非负) 的结果是整数
+    if (ms_value_is_int(args[0]) && ms_value_is_int(args[1]) && exp >= 0 &&
+        value >= -9.2e18 && value <= 9.2e18) {
+        return ms_value_int((int64_t)value);
+    }
+    return ms_value_float(value);
 }
 
 ms_value_t builtin_round(ms_vm_t* vm, int argc, ms_value_t* args) {
@@ -435,6 +662,7 @@ ms_value_t builtin_chr(ms_vm_t* vm, int argc, ms_value_t* args) {
     if (argc != 1) return ms_value_nil();
     
     int code = (int)ms_value_as_int(args[0]);
+    if (code >= 0 && code < 256) return ms_string_char((unsigned char)code);
     char str[2] = {(char)code, '\0'};
     return ms_value_string(str);
 }
@@ -456,7 +684,7 @@ ms_value_t builtin_type(ms_vm_t* vm, int argc, ms_value_t* args) {
     if (argc != 1) return ms_value_string("unknown");
     
     ms_value_t arg = args[0];
-    switch (arg.type) {
+    switch (ms_value_type(arg)) {
         case MS_VAL_NIL: return ms_value_string("NoneType");
         case MS_VAL_BOOL: return ms_value_string("bool");
         case MS_VAL_INT: return ms_value_string("int");
@@ -466,6 +694,9 @@ ms_value_t builtin_type(ms_vm_t* vm, int argc, ms_value_t* args) {
         case MS_VAL_DICT: return ms_value_string("dict");
         case MS_VAL_TUPLE: return ms_value_string("tuple");
         case MS_VAL_FUNCTION: return ms_value_string("function");
+        case MS_VAL_ITERATOR: return ms_value_string(ms_iterator_name(ms_value_as_iterator(arg)));
+        case MS_VAL_GENERATOR:
+            return ms_value_string(ms_value_is_coroutine(arg) ? "coroutine" : "generator");
         default: return ms_value_string("object");
     }
 }
@@ -488,70 +719,34 @@ ms_value_t builtin_isinstance(ms_vm_t* vm, int argc, ms_value_t* args) {
     return ms_value_bool(false);
 }
 
+// enumerate/zip 返回一次性迭代器，元素 (元组) 在遍历时才建出来
 ms_value_t builtin_enumerate(ms_vm_t* vm, int argc, ms_value_t* args) {
     (void)vm;
     if (argc == 0) return ms_value_nil();
     
-    ms_value_t iterable = args[0];
-    int start = 0;
-    if (argc > 1) start = (int)ms_value_as_int(args[1]);
+    int64_t start = 0;
+    if (argc > 1) start = ms_value_as_int(args[1]);
     
-    ms_list_t* result = ms_list_new();
-    
-    if (ms_value_is_list(iterable)) {
-        ms_list_t* list = ms_value_as_list(iterable);
-        for (int i = 0; i < ms_list_len(list); i++) {
-            ms_tuple_t* pair = ms_tuple_new(2);
-            pair->elements[0] = ms_value_int(start + i);
-            pair->elements[1] = ms_list_get(list, i);
-            ms_list_append(result, ms_value_tuple(pair));
-        }
-    }
-    
-    return ms_value_list(result);
+    ms_iterator_t* iterator = ms_iterator_enumerate(args[0], start);
+    if (iterator == NULL) return ms_value_nil();
+    return ms_value_iterator(iterator);
 }
 
 ms_value_t builtin_zip(ms_vm_t* vm, int argc, ms_value_t* args) {
     (void)vm;
-    if (argc < 2) return ms_value_nil();
-    
-    // Find minimum length
-    int min_len = -1;
-    for (int i = 0; i < argc; i++) {
-        if (ms_value_is_list(args[i])) {
-            int len = ms_list_len(ms_value_as_list(args[i]));
-            if (min_len == -1 || len < min_len) min_len = len;
-        }
-    }
-    
-    if (min_len == -1) return ms_value_nil();
-    
-    ms_list_t* result = ms_list_new();
-    for (int i = 0; i < min_len; i++) {
-        ms_tuple_t* tuple = ms_tuple_new(argc);
-        for (int j = 0; j < argc; j++) {
-            if (ms_value_is_list(args[j])) {
-                tuple->elements[j] = ms_list_get(ms_value_as_list(args[j]), i);
-            }
-        }
-        ms_list_append(result, ms_value_tuple(tuple));
-    }
-    
-    return ms_value_list(result);
+    ms_iterator_t* iterator = ms_iterator_zip(argc, args);
+    if (iterator == NULL) return ms_value_nil();
+    return ms_value_iterator(iterator);
 }
 
 ms_value_t builtin_sorted(ms_vm_t* vm, int argc, ms_value_t* args) {
     (void)vm;
-    if (argc == 0 || !ms_value_is_list(args[0])) return ms_value_nil();
-    
-    ms_list_t* src = ms_value_as_list(args[0]);
-    int len = ms_list_len(src);
+    if (argc == 0) return ms_value_nil();
     
-    // Create a copy
+    // 复制一份 (参数可以是任意可迭代对象)
     ms_list_t* result = ms_list_new();
-    for (int i = 0; i < len; i++) {
-        ms_list_append(result, ms_list_get(src, i));
-    }
+    if (!ms_iter_collect(args[0], result)) return ms_value_nil();
+    int len = ms_list_len(result);
     
     // Simple bubble sort
     for (int i = 0; i < len - 1; i++) {
@@ -576,19 +771,48 @@ ms_value_t builtin_sorted(ms_vm_t* vm, int argc, ms_value_t* args) {
     return ms_value_list(result);
 }
 
+// 参数是 list/tuple/字符串/range 这样能按下标取的序列，倒着按下标走，不复制
 ms_value_t builtin_reversed(ms_vm_t* vm, int argc, ms_value_t* args) {
     (void)vm;
-    if (argc == 0 || !ms_value_is_list(args[0])) return ms_value_nil();
+    if (argc == 0) return ms_value_nil();
     
-    ms_list_t* src = ms_value_as_list(args[0]);
-    int len = ms_list_len(src);
+    ms_iterator_t* iterator = ms_iterator_reversed(args[0]);
+    if (iterator == NULL) return ms_value_nil();
+    return ms_value_iterator(iterator);
+}
+
+// iter(x)：给可迭代对象配一个自己的游标，之后可以用 next() 一个个取
+ms_value_t builtin_iter(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    if (argc != 1) return ms_value_nil();
     
-    ms_list_t* result = ms_list_new();
-    for (int i = len - 1; i >= 0; i--) {
-        ms_list_append(result, ms_list_get(src, i));
+    // 一次性迭代器和生成器本身就是迭代器 (协程不是)
+    if ((ms_value_is_generator(args[0]) && !ms_value_is_coroutine(args[0])) ||
+        (ms_value_is_iterator(args[0]) && ms_value_as_iterator(args[0])->kind != MS_ITERATOR_RANGE)) {
+        return args[0];
     }
+    ms_iterator_t* iterator = ms_iterator_sequence(args[0]);
+    if (iterator == NULL) return ms_value_nil();
+    return ms_value_iterator(iterator);
+}
+
+// next(it[, default])：取下一个元素。到头时返回 default
+// (没有 StopIteration 异常，没给 default 时返回 None)
+ms_value_t builtin_next(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    if (argc == 0) return ms_value_nil();
     
-    return ms_value_list(result);
+    ms_value_t fallback = argc > 1 ? args[1] : ms_value_nil();
+    ms_iterator_t* iterator = ms_value_as_iterator(args[0]);
+    if (!ms_value_is_generator(args[0]) &&
+        (iterator == NULL || iterator->kind == MS_ITERATOR_RANGE)) {
+        return fallback;
+    }
+    
+    int64_t cursor = 0;
+    ms_value_t element;
+    if (ms_iter_next(args[0], &cursor, &element) != MS_ITER_ELEMENT) return fallback;
+    return element;
 }
 
 // ============ OOP 函数 ============
@@ -602,6 +826,46 @@ ms_value_t builtin_super(ms_vm_t* vm, int argc, ms_value_t* args) {
     return ms_value_nil();
 }
 
+// ============ 异常类型 ============
+
+// 内置异常类型都是 Exception 的直接子类。报告错误时给出的种类
+// (vm->error_kind) 决定转换成哪个类的实例。下标越界和缺少的键得到 None，
+// 解释器不会抛出 IndexError/KeyError，它们留给脚本自己 raise (如 __getitem__ 里)
+static const char* const exception_class_names[MS_EXCEPTION_KIND_COUNT] = {
+    [MS_EXCEPTION] = "Exception",
+    [MS_RUNTIME_ERROR] = "RuntimeError",
+    [MS_TYPE_ERROR] = "TypeError",
+    [MS_VALUE_ERROR] = "ValueError",
+    [MS_NAME_ERROR] = "NameError",
+    [MS_ATTRIBUTE_ERROR] = "AttributeError",
+    [MS_INDEX_ERROR] = "IndexError",
+    [MS_KEY_ERROR] = "KeyError",
+    [MS_ZERO_DIVISION_ERROR] = "ZeroDivisionError",
+    [MS_ASSERTION_ERROR] = "AssertionError",
+};
+
+// Exception.__init__(self, message="")
+static ms_value_t exception_init(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    ms_instance_t* self = ms_value_as_instance(args[0]);
+    ms_instance_set(self, "message", argc > 1 ? args[1] : ms_value_string(""));
+    return ms_value_nil();
+}
+
+static void register_exception_classes(ms_vm_t* vm) {
+    ms_class_t* base = NULL;
+    for (int kind = 0; kind < MS_EXCEPTION_KIND_COUNT; kind++) {
+        ms_class_t* klass = ms_class_new(exception_class_names[kind]);
+        klass->parent = base;
+        klass->is_exception = true;
+        ms_dict_set(klass->methods, "__init__", ms_value_native_func(exception_init));
+        if (kind == MS_EXCEPTION) base = klass;
+
+        vm->exception_classes[kind] = ms_value_class(klass);
+        ms_vm_set_global(vm, exception_class_names[kind], vm->exception_classes[kind]);
+    }
+}
+
 // ============ 注册所有内置函数 ============
 
 void ms_register_builtins(ms_vm_t* vm) {
@@ -642,7 +906,12 @@ void ms_register_builtins(ms_vm_t* vm) {
     ms_vm_register_function(vm, "zip", builtin_zip);
     ms_vm_register_function(vm, "sorted", builtin_sorted);
     ms_vm_register_function(vm, "reversed", builtin_reversed);
+    ms_vm_register_function(vm, "iter", builtin_iter);
+    ms_vm_register_function(vm, "next", builtin_next);
     
     // OOP 函数
     ms_vm_register_function(vm, "super", builtin_super);
+
+    // 异常类型
+    register_exception_classes(vm);
 }
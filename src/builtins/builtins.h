@@ -20,6 +20,10 @@ ms_value_t builtin_tuple(ms_vm_t* vm, int argc, ms_value_t* args);
 ms_value_t builtin_dict(ms_vm_t* vm, int argc, ms_value_t* args);
 ms_value_t builtin_set(ms_vm_t* vm, int argc, ms_value_t* args);
 
+// 内置类型的方法 (集合的 union/intersection/issubset 等，字符串的 join)。
+// 找到时 *method 是原生函数，调用时接收者作为第一个参数传入
+bool ms_builtin_method(ms_value_t receiver, const char* name, ms_value_t* method);
+
 // 数学函数
 ms_value_t builtin_abs(ms_vm_t* vm, int argc, ms_value_t* args);
 ms_value_t builtin_min(ms_vm_t* vm, int argc, ms_value_t* args);
@@ -43,5 +47,7 @@ ms_value_t builtin_enumerate(ms_vm_t* vm, int argc, ms_value_t* args);
 ms_value_t builtin_zip(ms_vm_t* vm, int argc, ms_value_t* args);
 ms_value_t builtin_sorted(ms_vm_t* vm, int argc, ms_value_t* args);
 ms_value_t builtin_reversed(ms_vm_t* vm, int argc, ms_value_t* args);
+ms_value_t builtin_iter(ms_vm_t* vm, int argc, ms_value_t* args);
+ms_value_t builtin_next(ms_vm_t* vm, int argc, ms_value_t* args);
 
 #endif // BUILTINS_H
@@ -1,46 +1,139 @@
 #include "class.h"
+#include "gc.h"
 #include <stdlib.h>
 #include <string.h>
 
 ms_class_t* ms_class_new(const char* name) {
-    ms_class_t* klass = malloc(sizeof(ms_class_t));
+    ms_class_t* klass = ms_gc_alloc(MS_GC_CLASS, sizeof(ms_class_t));
     klass->name = strdup(name);
     klass->parent = NULL;
     klass->methods = ms_dict_new();
+    klass->root_shape = calloc(1, sizeof(ms_shape_t));
+    klass->is_exception = false;
+    klass->is_awaitable = false;
     return klass;
 }
 
+static void shape_free(ms_shape_t* shape) {
+    for (int i = 0; i < shape->transition_count; i++) {
+        shape_free(shape->transitions[i]);
+    }
+    // 只有最后一个名字属于这个 shape，前面的与父 shape 共用
+    if (shape->slot_count > 0) {
+        free(shape->names[shape->slot_count - 1]);
+    }
+    free(shape->names);
+    free(shape->transitions);
+    free(shape);
+}
+
+// 以下 *_free 由 GC 在回收对象时调用，只释放对象内部的内存
+// (methods 字典是单独的 GC 对象)
 void ms_class_free(ms_class_t* klass) {
     if (klass) {
         free(klass->name);
-        ms_dict_free(klass->methods);
-        free(klass);
+        shape_free(klass->root_shape);
+    }
+}
+
+// 属性在 shape 中的槽位，不存在返回 -1
+int ms_shape_find(ms_shape_t* shape, const char* name) {
+    for (int i = shape->slot_count - 1; i >= 0; i--) {
+        if (strcmp(shape->names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 给 shape 加一个属性得到的子 shape，已有的转换直接复用
+ms_shape_t* ms_shape_add(ms_shape_t* shape, const char* name) {
+    for (int i = 0; i < shape->transition_count; i++) {
+        ms_shape_t* child = shape->transitions[i];
+        if (strcmp(child->names[child->slot_count - 1], name) == 0) {
+            return child;
+        }
+    }
+
+    ms_shape_t* child = calloc(1, sizeof(ms_shape_t));
+    child->parent = shape;
+    child->slot_count = shape->slot_count + 1;
+    child->names = malloc(sizeof(char*) * child->slot_count);
+    if (shape->slot_count > 0) {
+        memcpy(child->names, shape->names, sizeof(char*) * shape->slot_count);
+    }
+    child->names[shape->slot_count] = strdup(name);
+
+    if (shape->transition_count == shape->transition_capacity) {
+        shape->transition_capacity = shape->transition_capacity < 4 ? 4 : shape->transition_capacity * 2;
+        shape->transitions = realloc(shape->transitions, sizeof(ms_shape_t*) * shape->transition_capacity);
     }
+    shape->transitions[shape->transition_count++] = child;
+    return child;
 }
 
 ms_instance_t* ms_instance_new(ms_class_t* klass) {
-    ms_instance_t* instance = malloc(sizeof(ms_instance_t));
+    ms_instance_t* instance = ms_gc_alloc(MS_GC_INSTANCE, sizeof(ms_instance_t));
     instance->klass = klass;
-    instance->attrs = ms_dict_new();
+    instance->shape = klass->root_shape;
+    instance->slots = NULL;
+    instance->slot_capacity = 0;
     return instance;
 }
 
 void ms_instance_free(ms_instance_t* instance) {
     if (instance) {
-        ms_dict_free(instance->attrs);
-        free(instance);
+        free(instance->slots);
     }
 }
 
+bool ms_instance_get(ms_instance_t* instance, const char* name, ms_value_t* value) {
+    int slot = ms_shape_find(instance->shape, name);
+    if (slot < 0) return false;
+    *value = instance->slots[slot];
+    return true;
+}
+
+// 写槽位 slot，shape 是写入后的 shape (新增属性时是子 shape)
+void ms_instance_set_slot(ms_instance_t* instance, ms_shape_t* shape, int slot, ms_value_t value) {
+    if (slot >= instance->slot_capacity) {
+        instance->slot_capacity = instance->slot_capacity < 4 ? 4 : instance->slot_capacity * 2;
+        instance->slots = realloc(instance->slots, sizeof(ms_value_t) * instance->slot_capacity);
+    }
+    instance->shape = shape;
+    instance->slots[slot] = value;
+}
+
+void ms_instance_set(ms_instance_t* instance, const char* name, ms_value_t value) {
+    int slot = ms_shape_find(instance->shape, name);
+    if (slot >= 0) {
+        instance->slots[slot] = value;
+        return;
+    }
+    ms_shape_t* shape = ms_shape_add(instance->shape, name);
+    ms_instance_set_slot(instance, shape, shape->slot_count - 1, value);
+}
+
+ms_instance_t* ms_exception_new(ms_class_t* klass, ms_value_t message) {
+    ms_instance_t* instance = ms_instance_new(klass);
+    ms_instance_set(instance, "message", message);
+    return instance;
+}
+
+// 没有 message 属性 (子类的 __init__ 没有设置) 时是空字符串
+ms_value_t ms_exception_message(ms_instance_t* instance) {
+    ms_value_t message;
+    if (!ms_instance_get(instance, "message", &message)) return ms_value_string("");
+    return message;
+}
+
 ms_bound_method_t* ms_bound_method_new(ms_value_t receiver, ms_value_t method) {
-    ms_bound_method_t* bound = malloc(sizeof(ms_bound_method_t));
+    ms_bound_method_t* bound = ms_gc_alloc(MS_GC_BOUND_METHOD, sizeof(ms_bound_method_t));
     bound->receiver = receiver;
     bound->method = method;
     return bound;
 }
 
 void ms_bound_method_free(ms_bound_method_t* bound) {
-    if (bound) {
-        free(bound);
-    }
+    (void)bound;  // 没有内部内存
 }
@@ -3,17 +3,34 @@
 
 #include "miniscript.h"
 
+// 隐藏类 (shape)：描述实例属性的布局，属性名在 names 中的下标就是槽位。
+// 同一个类中按相同顺序添加属性的实例共享同一个 shape，
+// 每个 shape 只属于一个类，所以 shape 相同也意味着类相同
+typedef struct ms_shape {
+    struct ms_shape* parent;
+    char** names;
+    int slot_count;
+    struct ms_shape** transitions;  // 多一个属性的子 shape
+    int transition_count;
+    int transition_capacity;
+} ms_shape_t;
+
 // 类对象
 typedef struct ms_class {
     char* name;
     struct ms_class* parent;
     ms_dict_t* methods;
+    ms_shape_t* root_shape;  // 没有属性的实例的 shape
+    bool is_exception;       // 内置的 Exception 或它的子类，实例可以 raise
+    bool is_awaitable;       // 扩展定义的等待请求类 (如 http.sleep 的结果)，实例可以直接 await
 } ms_class_t;
 
 // 实例对象
 typedef struct ms_instance {
     ms_class_t* klass;
-    ms_dict_t* attrs;
+    ms_shape_t* shape;
+    ms_value_t* slots;
+    int slot_capacity;
 } ms_instance_t;
 
 // 绑定方法
@@ -26,9 +43,20 @@ typedef struct ms_bound_method {
 ms_class_t* ms_class_new(const char* name);
 void ms_class_free(ms_class_t* klass);
 
+// shape 操作
+int ms_shape_find(ms_shape_t* shape, const char* name);
+ms_shape_t* ms_shape_add(ms_shape_t* shape, const char* name);
+
 // 实例操作
 ms_instance_t* ms_instance_new(ms_class_t* klass);
 void ms_instance_free(ms_instance_t* instance);
+bool ms_instance_get(ms_instance_t* instance, const char* name, ms_value_t* value);
+void ms_instance_set(ms_instance_t* instance, const char* name, ms_value_t value);
+void ms_instance_set_slot(ms_instance_t* instance, ms_shape_t* shape, int slot, ms_value_t value);
+
+// 异常对象：异常类的实例，异常信息 (str(e) 的文本) 存在 message 属性里
+ms_instance_t* ms_exception_new(ms_class_t* klass, ms_value_t message);
+ms_value_t ms_exception_message(ms_instance_t* instance);
 
 // 绑定方法操作
 ms_bound_method_t* ms_bound_method_new(ms_value_t receiver, ms_value_t method);
@@ -0,0 +1,31 @@
+#ifndef MS_FORMAT_H
+#define MS_FORMAT_H
+
+#include "miniscript.h"
+
+// 数字和格式说明的格式化，print、str()、字符串拼接和 f-string
+// (OP_BUILD_STRING / OP_FORMAT_VALUE) 共用。整数、浮点数的默认文本和定点小数
+// 都直接写进目标缓冲区，不经过 snprintf
+
+// 一个标量的文本最多占用的字节数 (含结尾的 '\0')
+#define MS_FORMAT_BUFFER_SIZE 32
+
+// 整数的十进制文本写进 buffer (至少 MS_FORMAT_BUFFER_SIZE 字节)，返回长度
+size_t ms_format_int(int64_t value, char* buffer);
+
+// 浮点数的最短往返文本 (与 Python 的 repr 一致，如 0.1、2.0、1e+16、1.5e-05)，
+// 写进 buffer (至少 MS_FORMAT_BUFFER_SIZE 字节)，返回长度
+size_t ms_format_float(double value, char* buffer);
+
+// 值的 str() 文本：字符串返回自身的字符，数字写进 buffer，
+// 异常对象是它的异常信息，其余是固定的常量文本 (容器和对象是 "<object>")。长度写进 *length
+const char* ms_format_text(ms_value_t value, char* buffer, size_t* length);
+
+// 按格式说明 [[fill]align][sign][#][0][width][,|_][.precision][type] 格式化 value，
+// 即 f"{value:spec}" 里冒号后面的部分。说明不合法或与值的类型不匹配时返回 false
+bool ms_format_spec(ms_value_t value, const char* spec, size_t spec_length, ms_value_t* result);
+
+// 值的 repr() 文本 (f"{value!r}")：字符串加上引号并转义，其余值与 ms_format_text 相同
+ms_value_t ms_format_repr(ms_value_t value);
+
+#endif // MS_FORMAT_H
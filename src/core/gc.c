@@ -0,0 +1,390 @@
+#include "gc.h"
+#include "class.h"
+#include "iterator.h"
+#include "value.h"
+#include "../vm/vm.h"
+#include "../vm/generator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+bool ms_gc_requested = false;
+
+// 回收器状态 (值的构造函数不带 VM 参数，所以堆是进程级的)
+static struct {
+    ms_gc_object_t* objects;
+    size_t bytes_allocated;
+    size_t next_collection;
+    size_t object_count;
+
+    ms_vm_t** vms;
+    int vm_count;
+    int vm_capacity;
+
+    ms_value_t** roots;
+    int root_count;
+    int root_capacity;
+
+    // 标记阶段待扫描的对象
+    ms_gc_object_t** gray;
+    int gray_count;
+    int gray_capacity;
+
+    // 本轮遍历到的字节码块，回收了类之后要清掉它们的属性缓存
+    ms_chunk_t** chunks;
+    int chunk_count;
+    int chunk_capacity;
+    uint32_t epoch;
+
+    // 短字符串的空闲格子 (用 next 串起来)
+    ms_gc_object_t* free_cells;
+
+    ms_gc_stats_t stats;
+} gc = {.next_collection = MS_GC_INITIAL_THRESHOLD};
+
+// 短字符串 (不超过 MS_SMALL_STRING_MAX 字节) 占用固定大小的格子：
+// 格子按块批量 malloc，回收时放回空闲链表，创建和回收都不经过 malloc/free。
+// 块不归还给系统，空闲格子留给之后的短字符串
+#define SMALL_CELL_SIZE \
+    ((sizeof(ms_gc_object_t) + sizeof(ms_string_t) + MS_SMALL_STRING_MAX + 1 + 7) & ~(size_t)7)
+#define SMALL_CELLS_PER_BLOCK 1024
+
+static bool is_small_cell(ms_gc_kind_t kind, size_t total) {
+    return kind == MS_GC_STRING && total <= SMALL_CELL_SIZE;
+}
+
+static ms_gc_object_t* take_small_cell(void) {
+    if (gc.free_cells == NULL) {
+        char* block = malloc(SMALL_CELL_SIZE * SMALL_CELLS_PER_BLOCK);
+        for (int i = SMALL_CELLS_PER_BLOCK - 1; i >= 0; i--) {
+            ms_gc_object_t* cell = (ms_gc_object_t*)(block + i * SMALL_CELL_SIZE);
+            cell->next = gc.free_cells;
+            gc.free_cells = cell;
+        }
+    }
+    ms_gc_object_t* cell = gc.free_cells;
+    gc.free_cells = cell->next;
+    return cell;
+}
+
+#define GROW_ARRAY(array, count, capacity) \
+    do { \
+        if ((count) == (capacity)) { \
+            (capacity) = (capacity) < 8 ? 8 : (capacity) * 2; \
+            (array) = realloc((array), sizeof(*(array)) * (capacity)); \
+        } \
+    } while (false)
+
+void* ms_gc_alloc(ms_gc_kind_t kind, size_t size) {
+    size_t total = sizeof(ms_gc_object_t) + size;
+    ms_gc_object_t* object = is_small_cell(kind, total) ? take_small_cell() : malloc(total);
+    object->next = gc.objects;
+    object->size = (uint32_t)total;
+    object->kind = (uint8_t)kind;
+    object->marked = false;
+    object->flags = 0;
+    gc.objects = object;
+
+    gc.object_count++;
+    gc.stats.objects_allocated++;
+    gc.bytes_allocated += total;
+    if (gc.bytes_allocated > gc.next_collection) {
+        ms_gc_requested = true;
+    }
+    return object + 1;
+}
+
+void ms_gc_register_vm(ms_vm_t* vm) {
+    GROW_ARRAY(gc.vms, gc.vm_count, gc.vm_capacity);
+    gc.vms[gc.vm_count++] = vm;
+}
+
+void ms_gc_unregister_vm(ms_vm_t* vm) {
+    for (int i = 0; i < gc.vm_count; i++) {
+        if (gc.vms[i] == vm) {
+            gc.vms[i] = gc.vms[--gc.vm_count];
+            return;
+        }
+    }
+}
+
+void ms_gc_add_root(ms_value_t* root) {
+    GROW_ARRAY(gc.roots, gc.root_count, gc.root_capacity);
+    gc.roots[gc.root_count++] = root;
+}
+
+void ms_gc_remove_root(ms_value_t* root) {
+    for (int i = gc.root_count - 1; i >= 0; i--) {
+        if (gc.roots[i] == root) {
+            gc.roots[i] = gc.roots[--gc.root_count];
+            return;
+        }
+    }
+}
+
+// ============ 标记 ============
+
+static void mark_object(void* pointer) {
+    if (pointer == NULL) return;
+    ms_gc_object_t* object = (ms_gc_object_t*)pointer - 1;
+    if (object->marked) return;
+    object->marked = true;
+    GROW_ARRAY(gc.gray, gc.gray_count, gc.gray_capacity);
+    gc.gray[gc.gray_count++] = object;
+}
+
+static void mark_function(ms_function_t* function);
+
+static void mark_value(ms_value_t value) {
+#ifdef MS_NAN_BOXING
+    if (ms_nanbox_tag(value.bits) == MS_NANBOX_TAG_BOX) {
+        mark_object(ms_nanbox_pointer(value));
+        return;
+    }
+#endif
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_STRING:
+            mark_object(MS_STRING_HEADER(MS_STRING_POINTER(value)));
+            break;
+        case MS_VAL_LIST:
+        case MS_VAL_DICT:
+        case MS_VAL_TUPLE:
+        case MS_VAL_SET:
+        case MS_VAL_CLASS:
+        case MS_VAL_INSTANCE:
+        case MS_VAL_BOUND_METHOD:
+        case MS_VAL_EXCEPTION:
+        case MS_VAL_ITERATOR:
+        case MS_VAL_GENERATOR:
+            mark_object(MS_AS_OBJECT(value));
+            break;
+        case MS_VAL_FUNCTION:
+            mark_function((ms_function_t*)MS_AS_FUNCTION(value));
+            break;
+        default:
+            break;
+    }
+}
+
+static void mark_values(ms_value_t* values, int count) {
+    for (int i = 0; i < count; i++) {
+        mark_value(values[i]);
+    }
+}
+
+// 常量表 (字符串常量、嵌套函数) 和内联缓存里的方法
+static void mark_chunk(ms_chunk_t* chunk) {
+    if (chunk->gc_epoch == gc.epoch) return;
+    chunk->gc_epoch = gc.epoch;
+    GROW_ARRAY(gc.chunks, gc.chunk_count, gc.chunk_capacity);
+    gc.chunks[gc.chunk_count++] = chunk;
+
+    mark_values(chunk->constants, chunk->constant_count);
+    for (int i = 0; i < chunk->property_cache_count; i++) {
+        ms_property_cache_entry_t* entries = chunk->property_caches[i].entries;
+        for (int j = 0; j < MS_PROPERTY_CACHE_WAYS && entries[j].shape != NULL; j++) {
+            if (entries[j].slot < 0) mark_value(entries[j].method);
+        }
+    }
+}
+
+static void mark_function(ms_function_t* function) {
+    if (function == NULL) return;
+    mark_chunk(function->chunk);
+    if (function->defaults != NULL) {
+        mark_values(function->defaults, function->default_count);
+    }
+}
+
+static void mark_vm(ms_vm_t* vm) {
+    for (ms_value_t* slot = vm->stack; slot < vm->stack_top; slot++) {
+        mark_value(*slot);
+    }
+    for (int i = 0; i < vm->frame_count; i++) {
+        ms_call_frame_t* frame = &vm->frames[i];
+        mark_chunk(frame->chunk);
+        // 寄存器帧的寄存器可能在栈顶之上
+        mark_values(frame->slots, frame->chunk->register_count);
+    }
+    for (int i = 0; i < vm->global_count; i++) {
+        if (vm->globals[i].defined) mark_value(vm->globals[i].value);
+    }
+    if (vm->has_exception) {
+        mark_value(vm->current_exception);
+    }
+    mark_values(vm->exception_classes, MS_EXCEPTION_KIND_COUNT);
+}
+
+static void trace_object(ms_gc_object_t* object) {
+    void* body = object + 1;
+    switch ((ms_gc_kind_t)object->kind) {
+        case MS_GC_LIST: {
+            ms_list_t* list = body;
+            mark_values(list->elements, list->count);
+            break;
+        }
+        case MS_GC_TUPLE: {
+            ms_tuple_t* tuple = body;
+            mark_values(tuple->elements, tuple->count);
+            break;
+        }
+        case MS_GC_DICT: {
+            ms_dict_t* dict = body;
+            for (int i = 0; i < dict->used; i++) {
+                if (dict->entries[i].deleted) continue;
+                mark_value(dict->entries[i].key);
+                mark_value(dict->entries[i].value);
+            }
+            break;
+        }
+        case MS_GC_SET: {
+            ms_set_t* set = body;
+            for (int i = 0; i < set->used; i++) {
+                if (!set->entries[i].deleted) mark_value(set->entries[i].value);
+            }
+            break;
+        }
+        case MS_GC_STRING:
+            if (object->flags & MS_GC_FLAG_ROPE) {
+                ms_rope_t* rope = body;
+                mark_value(rope->left);
+                mark_value(rope->right);
+                if (rope->flat != NULL) mark_object(MS_STRING_HEADER(rope->flat));
+            }
+            break;
+        case MS_GC_CLASS: {
+            ms_class_t* klass = body;
+            if (klass->parent != NULL) mark_object(klass->parent);
+            mark_object(klass->methods);
+            break;
+        }
+        case MS_GC_INSTANCE: {
+            ms_instance_t* instance = body;
+            mark_object(instance->klass);
+            mark_values(instance->slots, instance->shape->slot_count);
+            break;
+        }
+        case MS_GC_BOUND_METHOD: {
+            ms_bound_method_t* bound = body;
+            mark_value(bound->receiver);
+            mark_value(bound->method);
+            break;
+        }
+        case MS_GC_ITERATOR: {
+            ms_iterator_t* iterator = body;
+            for (int i = 0; i < iterator->source_count; i++) {
+                mark_value(iterator->sources[i].value);
+            }
+            break;
+        }
+        case MS_GC_GENERATOR: {
+            // 执行中的生成器的值都在值栈上，values 是空的
+            ms_generator_t* generator = body;
+            mark_function(generator->function);
+            mark_object(generator->awaiter);
+            mark_values(generator->values, generator->value_count);
+            break;
+        }
+        case MS_GC_EXCEPTION:
+        case MS_GC_BOX:
+            break;
+    }
+}
+
+// ============ 清除 ============
+
+// 释放对象自身持有的内存，返回是否回收的是类
+static bool finalize_object(ms_gc_object_t* object) {
+    void* body = object + 1;
+    switch ((ms_gc_kind_t)object->kind) {
+        case MS_GC_LIST: ms_list_free(body); break;
+        case MS_GC_DICT: ms_dict_free(body); break;
+        case MS_GC_TUPLE: ms_tuple_free(body); break;
+        case MS_GC_SET: ms_set_free(body); break;
+        case MS_GC_CLASS: ms_class_free(body); return true;
+        case MS_GC_INSTANCE: ms_instance_free(body); break;
+        case MS_GC_BOUND_METHOD: ms_bound_method_free(body); break;
+        case MS_GC_EXCEPTION: ms_exception_free(body); break;
+        case MS_GC_GENERATOR: ms_generator_free(body); break;
+        case MS_GC_STRING:
+            if (object->flags & MS_GC_FLAG_INTERNED) {
+                ms_string_unintern(((ms_string_t*)body)->chars);
+            }
+            break;
+        case MS_GC_BOX:
+        case MS_GC_ITERATOR:
+            break;
+    }
+    return false;
+}
+
+static bool sweep(void) {
+    bool freed_class = false;
+    ms_gc_object_t** link = &gc.objects;
+    while (*link != NULL) {
+        ms_gc_object_t* object = *link;
+        if (object->marked) {
+            object->marked = false;
+            link = &object->next;
+            continue;
+        }
+        *link = object->next;
+        if (finalize_object(object)) freed_class = true;
+        gc.bytes_allocated -= object->size;
+        gc.object_count--;
+        gc.stats.objects_freed++;
+        if (is_small_cell((ms_gc_kind_t)object->kind, object->size)) {
+            object->next = gc.free_cells;
+            gc.free_cells = object;
+        } else {
+            free(object);
+        }
+    }
+    return freed_class;
+}
+
+void ms_gc_collect(void) {
+    clock_t start = clock();
+
+    gc.epoch++;
+    gc.chunk_count = 0;
+    for (int i = 0; i < gc.vm_count; i++) {
+        mark_vm(gc.vms[i]);
+    }
+    for (int i = 0; i < gc.root_count; i++) {
+        mark_value(*gc.roots[i]);
+    }
+    while (gc.gray_count > 0) {
+        trace_object(gc.gray[--gc.gray_count]);
+    }
+
+    // 类被回收后它的 shape 也释放了，缓存里的 shape 指针可能被新 shape 复用
+    if (sweep()) {
+        for (int i = 0; i < gc.chunk_count; i++) {
+            ms_chunk_t* chunk = gc.chunks[i];
+            memset(chunk->property_caches, 0,
+                   sizeof(ms_property_cache_t) * chunk->property_cache_count);
+        }
+    }
+
+    gc.next_collection = gc.bytes_allocated * MS_GC_GROWTH_FACTOR;
+    if (gc.next_collection < MS_GC_INITIAL_THRESHOLD) {
+        gc.next_collection = MS_GC_INITIAL_THRESHOLD;
+    }
+    ms_gc_requested = false;
+
+    double pause_ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    gc.stats.collections++;
+    gc.stats.last_pause_ms = pause_ms;
+    gc.stats.total_pause_ms += pause_ms;
+    if (pause_ms > gc.stats.max_pause_ms) {
+        gc.stats.max_pause_ms = pause_ms;
+    }
+}
+
+void ms_gc_get_stats(ms_gc_stats_t* stats) {
+    *stats = gc.stats;
+    stats->live_objects = gc.object_count;
+    stats->live_bytes = gc.bytes_allocated;
+    stats->next_collection = gc.next_collection;
+}
@@ -0,0 +1,64 @@
+#ifndef MS_GC_H
+#define MS_GC_H
+
+#include "miniscript.h"
+
+// 标记-清除垃圾回收
+//
+// 字符串、list、dict、tuple、set、类、实例、绑定方法、异常、迭代器、生成器 (以及
+// NaN-boxing 下的装箱整数) 都由 ms_gc_alloc 分配：对象前面是一个 ms_gc_object_t 头，
+// 所有对象串成一条链表。函数对象、字节码块和原生函数属于编译/注册期的数据，
+// 不回收，但回收时会顺着它们找到常量表里的对象。
+//
+// 分配只记账，超过阈值时置 ms_gc_requested；真正的回收只在 VM 的安全点
+// (回跳和调用之后) 进行，那时所有活着的临时值都在值栈上。
+// 根：每个 VM 的值栈、调用帧的字节码块、全局变量、当前异常，以及宿主/扩展
+// 用 ms_gc_add_root 登记的值。
+
+#ifndef MS_GC_INITIAL_THRESHOLD
+#define MS_GC_INITIAL_THRESHOLD (1024 * 1024)
+#endif
+
+// 回收后下一次的阈值 = 存活字节数 * MS_GC_GROWTH_FACTOR
+// (压力测试可以编译成 -DMS_GC_INITIAL_THRESHOLD=1 -DMS_GC_GROWTH_FACTOR=0，每个安全点都回收)
+#ifndef MS_GC_GROWTH_FACTOR
+#define MS_GC_GROWTH_FACTOR 2
+#endif
+
+typedef enum {
+    MS_GC_STRING,
+    MS_GC_LIST,
+    MS_GC_DICT,
+    MS_GC_TUPLE,
+    MS_GC_SET,
+    MS_GC_CLASS,
+    MS_GC_INSTANCE,
+    MS_GC_BOUND_METHOD,
+    MS_GC_EXCEPTION,
+    MS_GC_BOX,
+    MS_GC_ITERATOR,
+    MS_GC_GENERATOR
+} ms_gc_kind_t;
+
+// 对象自用的标志位
+#define MS_GC_FLAG_INTERNED 0x01  // 字符串在驻留表里
+#define MS_GC_FLAG_ROPE     0x02  // 字符串对象其实是绳结点 (ms_rope_t)
+
+typedef struct ms_gc_object {
+    struct ms_gc_object* next;
+    uint32_t size;  // 含头部
+    uint8_t kind;
+    bool marked;
+    uint8_t flags;
+} ms_gc_object_t;
+
+extern bool ms_gc_requested;
+
+// 分配 size 字节的 kind 对象，返回头部之后的地址
+void* ms_gc_alloc(ms_gc_kind_t kind, size_t size);
+
+// VM 创建/销毁时登记/注销，回收时遍历所有 VM 的根
+void ms_gc_register_vm(ms_vm_t* vm);
+void ms_gc_unregister_vm(ms_vm_t* vm);
+
+#endif // MS_GC_H
@@ -0,0 +1,319 @@
+#include "iterator.h"
+#include "value.h"
+#include "gc.h"
+#include "../vm/generator.h"
+
+ms_value_t ms_value_iterator(ms_iterator_t* iterator) {
+#ifdef MS_NAN_BOXING
+    return ms_nanbox_make(MS_NANBOX_TAG_BOX, (uint64_t)(uintptr_t)iterator);
+#else
+    ms_value_t value;
+    value.type = MS_VAL_ITERATOR;
+    value.as.object = (ms_object_t*)iterator;
+    return value;
+#endif
+}
+
+bool ms_value_is_iterator(ms_value_t value) {
+    return MS_VALUE_TYPE(value) == MS_VAL_ITERATOR;
+}
+
+ms_iterator_t* ms_value_as_iterator(ms_value_t value) {
+    if (MS_VALUE_TYPE(value) == MS_VAL_ITERATOR) {
+        return (ms_iterator_t*)MS_AS_OBJECT(value);
+    }
+    return NULL;
+}
+
+static ms_iterator_t* iterator_new(ms_iterator_kind_t kind, int source_count) {
+    ms_iterator_t* iterator = ms_gc_alloc(MS_GC_ITERATOR, sizeof(ms_iterator_t) +
+                                          source_count * sizeof(ms_iterator_source_t));
+    iterator->type = MS_VAL_ITERATOR;
+    iterator->kind = kind;
+    iterator->exhausted = false;
+    iterator->start = 0;
+    iterator->stop = 0;
+    iterator->step = 1;
+    iterator->source_count = source_count;
+    return iterator;
+}
+
+static bool is_iterable(ms_value_t value) {
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_LIST:
+        case MS_VAL_TUPLE:
+        case MS_VAL_DICT:
+        case MS_VAL_SET:
+        case MS_VAL_STRING:
+        case MS_VAL_ITERATOR:
+            return true;
+        case MS_VAL_GENERATOR:
+            return !((ms_generator_t*)MS_AS_OBJECT(value))->is_coroutine;
+        default:
+            return false;
+    }
+}
+
+// 可以按下标取元素的序列 (reversed 的参数) 的长度，不是序列时返回 -1
+static int64_t sequence_length(ms_value_t value) {
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_LIST: return ((ms_list_t*)MS_AS_OBJECT(value))->count;
+        case MS_VAL_TUPLE: return ((ms_tuple_t*)MS_AS_OBJECT(value))->count;
+        case MS_VAL_STRING: return ms_string_value_length(value);
+        case MS_VAL_ITERATOR: {
+            ms_iterator_t* iterator = MS_AS_OBJECT(value);
+            return iterator->kind == MS_ITERATOR_RANGE ? ms_range_length(iterator) : -1;
+        }
+        default: return -1;
+    }
+}
+
+// 序列的第 index 个元素；越界 (序列在遍历过程中变短了) 时返回 false
+static bool sequence_item(ms_value_t value, int64_t index, ms_value_t* element) {
+    if (index < 0 || index >= sequence_length(value)) return false;
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_LIST:
+            *element = ((ms_list_t*)MS_AS_OBJECT(value))->elements[index];
+            return true;
+        case MS_VAL_TUPLE:
+            *element = ((ms_tuple_t*)MS_AS_OBJECT(value))->elements[index];
+            return true;
+        case MS_VAL_STRING:
+            *element = ms_string_char((unsigned char)MS_AS_STRING(value)[index]);
+            return true;
+        default: {
+            ms_iterator_t* range = MS_AS_OBJECT(value);
+            *element = MS_INT_VALUE(range->start + index * range->step);
+            return true;
+        }
+    }
+}
+
+ms_iterator_t* ms_range_new(int64_t start, int64_t stop, int64_t step) {
+    if (step == 0) return NULL;
+    ms_iterator_t* range = iterator_new(MS_ITERATOR_RANGE, 0);
+    range->start = start;
+    range->stop = stop;
+    range->step = step;
+    return range;
+}
+
+int64_t ms_range_length(const ms_iterator_t* range) {
+    // 用无符号数相减，两端相距超过 INT64_MAX 时也不溢出
+    if (range->step > 0) {
+        if (range->start >= range->stop) return 0;
+        return (int64_t)(((uint64_t)range->stop - (uint64_t)range->start - 1) /
+                         (uint64_t)range->step + 1);
+    }
+    if (range->start <= range->stop) return 0;
+    return (int64_t)(((uint64_t)range->start - (uint64_t)range->stop - 1) /
+                     (0 - (uint64_t)range->step) + 1);
+}
+
+bool ms_range_item(const ms_iterator_t* range, int64_t index, int64_t* value) {
+    int64_t length = ms_range_length(range);
+    if (index < 0) index += length;
+    if (index < 0 || index >= length) return false;
+    *value = range->start + index * range->step;
+    return true;
+}
+
+// 不用遍历：值在区间里并且与 start 相差 step 的整数倍
+bool ms_range_contains(const ms_iterator_t* range, ms_value_t value) {
+    int64_t i;
+    if (MS_VALUE_TYPE(value) == MS_VAL_INT) {
+        i = MS_AS_INTEGER(value);
+    } else if (MS_VALUE_TYPE(value) == MS_VAL_FLOAT) {
+        double d = MS_AS_FLOATING(value);
+        if (d != (double)(int64_t)d) return false;
+        i = (int64_t)d;
+    } else {
+        return false;
+    }
+    if (range->step > 0) {
+        if (i < range->start || i >= range->stop) return false;
+        return ((uint64_t)i - (uint64_t)range->start) % (uint64_t)range->step == 0;
+    }
+    if (i > range->start || i <= range->stop) return false;
+    return ((uint64_t)range->start - (uint64_t)i) % (0 - (uint64_t)range->step) == 0;
+}
+
+ms_iterator_t* ms_iterator_sequence(ms_value_t iterable) {
+    if (!is_iterable(iterable)) return NULL;
+    ms_iterator_t* iterator = iterator_new(MS_ITERATOR_SEQUENCE, 1);
+    iterator->sources[0].value = iterable;
+    iterator->sources[0].cursor = 0;
+    return iterator;
+}
+
+ms_iterator_t* ms_iterator_enumerate(ms_value_t iterable, int64_t start) {
+    if (!is_iterable(iterable)) return NULL;
+    ms_iterator_t* iterator = iterator_new(MS_ITERATOR_ENUMERATE, 1);
+    iterator->start = start;
+    iterator->sources[0].value = iterable;
+    iterator->sources[0].cursor = 0;
+    return iterator;
+}
+
+ms_iterator_t* ms_iterator_zip(int count, ms_value_t* iterables) {
+    for (int i = 0; i < count; i++) {
+        if (!is_iterable(iterables[i])) return NULL;
+    }
+    ms_iterator_t* iterator = iterator_new(MS_ITERATOR_ZIP, count);
+    for (int i = 0; i < count; i++) {
+        iterator->sources[i].value = iterables[i];
+        iterator->sources[i].cursor = 0;
+    }
+    return iterator;
+}
+
+ms_iterator_t* ms_iterator_reversed(ms_value_t sequence) {
+    int64_t length = sequence_length(sequence);
+    if (length < 0) return NULL;
+    ms_iterator_t* iterator = iterator_new(MS_ITERATOR_REVERSED, 1);
+    iterator->sources[0].value = sequence;
+    iterator->sources[0].cursor = length - 1;
+    return iterator;
+}
+
+// 一次性迭代器的下一个元素
+static ms_iter_result_t iterator_next(ms_iterator_t* iterator, ms_value_t* element) {
+    if (iterator->exhausted) return MS_ITER_END;
+
+    ms_iterator_source_t* source = &iterator->sources[0];
+    ms_iter_result_t result = MS_ITER_END;
+    switch (iterator->kind) {
+        case MS_ITERATOR_RANGE:
+        case MS_ITERATOR_SEQUENCE:
+            result = ms_iter_next(source->value, &source->cursor, element);
+            break;
+        case MS_ITERATOR_ENUMERATE: {
+            ms_value_t item;
+            result = ms_iter_next(source->value, &source->cursor, &item);
+            if (result == MS_ITER_ELEMENT) {
+                ms_tuple_t* pair = ms_tuple_new(2);
+                pair->elements[0] = MS_INT_VALUE(iterator->start++);
+                pair->elements[1] = item;
+                *element = ms_value_tuple(pair);
+            }
+            break;
+        }
+        case MS_ITERATOR_ZIP: {
+            // 任何一个先到头就结束 (没有参数的 zip() 一开始就是空的)
+            if (iterator->source_count == 0) break;
+            // 参数是生成器时取元素会执行脚本，填到一半的 tuple 要登记成根
+            ms_value_t tuple = ms_value_tuple(ms_tuple_new(iterator->source_count));
+            ms_value_t* elements = ((ms_tuple_t*)MS_AS_OBJECT(tuple))->elements;
+            ms_gc_add_root(&tuple);
+            for (int i = 0; i < iterator->source_count; i++) {
+                source = &iterator->sources[i];
+                result = ms_iter_next(source->value, &source->cursor, &elements[i]);
+                if (result != MS_ITER_ELEMENT) break;
+            }
+            ms_gc_remove_root(&tuple);
+            if (result == MS_ITER_ELEMENT) *element = tuple;
+            break;
+        }
+        case MS_ITERATOR_REVERSED:
+            if (sequence_item(source->value, source->cursor, element)) {
+                source->cursor--;
+                result = MS_ITER_ELEMENT;
+            }
+            break;
+    }
+
+    if (result == MS_ITER_ERROR) return result;
+    if (result != MS_ITER_ELEMENT) {
+        // 到头以后不再碰被迭代的对象，也让 GC 可以回收它们
+        iterator->exhausted = true;
+        iterator->source_count = 0;
+    }
+    return result;
+}
+
+ms_iter_result_t ms_iter_next(ms_value_t iterable, int64_t* cursor, ms_value_t* element) {
+    int64_t index = *cursor;
+    switch (MS_VALUE_TYPE(iterable)) {
+        case MS_VAL_LIST: {
+            ms_list_t* list = MS_AS_OBJECT(iterable);
+            if (index >= list->count) return MS_ITER_END;
+            *element = list->elements[index];
+            break;
+        }
+        case MS_VAL_TUPLE: {
+            ms_tuple_t* tuple = MS_AS_OBJECT(iterable);
+            if (index >= tuple->count) return MS_ITER_END;
+            *element = tuple->elements[index];
+            break;
+        }
+        case MS_VAL_DICT: {
+            // 遍历键，跳过已删除的条目
+            ms_dict_t* dict = MS_AS_OBJECT(iterable);
+            while (index < dict->used && dict->entries[index].deleted) index++;
+            if (index >= dict->used) return MS_ITER_END;
+            *element = dict->entries[index].key;
+            break;
+        }
+        case MS_VAL_SET: {
+            ms_set_t* set = MS_AS_OBJECT(iterable);
+            while (index < set->used && set->entries[index].deleted) index++;
+            if (index >= set->used) return MS_ITER_END;
+            *element = set->entries[index].value;
+            break;
+        }
+        case MS_VAL_STRING: {
+            if (index >= ms_string_value_length(iterable)) return MS_ITER_END;
+            *element = ms_string_char((unsigned char)MS_AS_STRING(iterable)[index]);
+            break;
+        }
+        case MS_VAL_ITERATOR: {
+            ms_iterator_t* iterator = MS_AS_OBJECT(iterable);
+            if (iterator->kind != MS_ITERATOR_RANGE) {
+                return iterator_next(iterator, element);
+            }
+            int64_t value = iterator->start + index * iterator->step;
+            if (iterator->step > 0 ? value >= iterator->stop : value <= iterator->stop) {
+                return MS_ITER_END;
+            }
+            *element = MS_INT_VALUE(value);
+            break;
+        }
+        case MS_VAL_GENERATOR: {
+            // 协程不能迭代；生成器返回时不动 *element (循环变量保持最后一个值)
+            ms_generator_t* generator = MS_AS_OBJECT(iterable);
+            if (generator->is_coroutine) return MS_ITER_NOT_ITERABLE;
+            ms_value_t value;
+            ms_iter_result_t result = ms_generator_resume(generator, ms_value_nil(), &value);
+            if (result == MS_ITER_ELEMENT) *element = value;
+            return result;
+        }
+        default:
+            return MS_ITER_NOT_ITERABLE;
+    }
+    *cursor = index + 1;
+    return MS_ITER_ELEMENT;
+}
+
+bool ms_iter_collect(ms_value_t iterable, ms_list_t* list) {
+    int64_t cursor = 0;
+    ms_value_t element;
+    ms_iter_result_t result;
+    // 生成器的函数体里可能回收，正在填的 list 还只在 C 变量里
+    ms_value_t root = ms_value_list(list);
+    ms_gc_add_root(&root);
+    while ((result = ms_iter_next(iterable, &cursor, &element)) == MS_ITER_ELEMENT) {
+        ms_list_append(list, element);
+    }
+    ms_gc_remove_root(&root);
+    return result == MS_ITER_END;
+}
+
+const char* ms_iterator_name(const ms_iterator_t* iterator) {
+    switch (iterator->kind) {
+        case MS_ITERATOR_RANGE: return "range";
+        case MS_ITERATOR_ENUMERATE: return "enumerate";
+        case MS_ITERATOR_ZIP: return "zip";
+        case MS_ITERATOR_REVERSED: return "reversed";
+        default: return "iterator";
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef MS_ITERATOR_H
+#define MS_ITERATOR_H
+
+#include "miniscript.h"
+
+// 迭代器对象：range、enumerate、zip、reversed 和 iter() 的返回值。
+// 它们不再一次建好整个 list，而是在 for 循环或 next() 取元素时才算出下一个，
+// 内存占用与长度无关。list(it)/tuple(it)/set(it)/sorted(it) 仍然可以一次取完。
+//
+// range 和 Python 一样是可以反复遍历的序列：for 循环用自己的下标槽位当游标，
+// 元素按 start + 下标 * step 算出，不改动 range 对象本身。其余几种是一次性的，
+// 游标保存在迭代器里，遍历到底之后就空了。
+typedef enum {
+    MS_ITERATOR_RANGE,
+    MS_ITERATOR_SEQUENCE,   // iter(x)：给任意可迭代对象配一个自己的游标
+    MS_ITERATOR_ENUMERATE,
+    MS_ITERATOR_ZIP,
+    MS_ITERATOR_REVERSED
+} ms_iterator_kind_t;
+
+// 被迭代的对象和它的游标 (按下标遍历的位置，reversed 是倒着走的下标)
+typedef struct {
+    ms_value_t value;
+    int64_t cursor;
+} ms_iterator_source_t;
+
+typedef struct ms_iterator {
+    // 总是 MS_VAL_ITERATOR。NaN-boxing 下 tag 已经用完，迭代器和装箱整数一样
+    // 用 MS_NANBOX_TAG_BOX 存放，ms_nanbox_type 从这个字段读出类型
+    ms_value_type_t type;
+    ms_iterator_kind_t kind;
+    bool exhausted;
+    int64_t start;  // range 的参数；enumerate 下一个元素的序号
+    int64_t stop;
+    int64_t step;
+    int source_count;
+    ms_iterator_source_t sources[];
+} ms_iterator_t;
+
+// 取元素的结果
+typedef enum {
+    MS_ITER_ELEMENT,        // 取到一个元素
+    MS_ITER_END,            // 已经遍历完
+    MS_ITER_NOT_ITERABLE,
+    MS_ITER_ERROR           // 生成器的函数体出错，VM 上已经设置了错误
+} ms_iter_result_t;
+
+ms_value_t ms_value_iterator(ms_iterator_t* iterator);
+bool ms_value_is_iterator(ms_value_t value);
+ms_iterator_t* ms_value_as_iterator(ms_value_t value);
+
+// 创建迭代器 (step 不能为 0；enumerate/zip/iter 的参数不可迭代、reversed 的参数
+// 不是序列时返回 NULL)
+ms_iterator_t* ms_range_new(int64_t start, int64_t stop, int64_t step);
+ms_iterator_t* ms_iterator_sequence(ms_value_t iterable);
+ms_iterator_t* ms_iterator_enumerate(ms_value_t iterable, int64_t start);
+ms_iterator_t* ms_iterator_zip(int count, ms_value_t* iterables);
+ms_iterator_t* ms_iterator_reversed(ms_value_t sequence);
+
+int64_t ms_range_length(const ms_iterator_t* range);
+// range 的第 index 个元素 (负数从末尾数起，和 Python 一样)，越界时返回 false
+bool ms_range_item(const ms_iterator_t* range, int64_t index, int64_t* value);
+bool ms_range_contains(const ms_iterator_t* range, ms_value_t value);
+
+// 所有可迭代对象 (list、tuple、dict 的键、set、字符串、迭代器、生成器) 共用的一步：
+// 取 iterable 在游标 *cursor 处的元素放进 *element 并前移游标。
+// 一次性迭代器和生成器忽略 *cursor，用自己保存的状态。
+// for 循环 (栈式和寄存器式两套解释器)、推导式和各个内置函数都走这里
+ms_iter_result_t ms_iter_next(ms_value_t iterable, int64_t* cursor, ms_value_t* element);
+
+// 把 iterable 剩下的元素依次追加到 list，不可迭代或生成器出错时返回 false
+bool ms_iter_collect(ms_value_t iterable, ms_list_t* list);
+
+// print/type() 用的名字，如 "range"、"zip"
+const char* ms_iterator_name(const ms_iterator_t* iterator);
+
+#endif // MS_ITERATOR_H
@@ -22,9 +22,8 @@ ms_result_t ms_vm_exec_string(ms_vm_t* vm, const char* source) {
 ms_result_t ms_vm_exec_file(ms_vm_t* vm, const char* filename) {
     FILE* file = fopen(filename, "rb");
     if (file == NULL) {
-        snprintf(vm->error_message, sizeof(vm->error_message), 
+        ms_vm_raise(vm, MS_RUNTIME_ERROR,
                 "Could not open file \"%s\".", filename);
-        vm->has_error = true;
         return MS_RESULT_RUNTIME_ERROR;
     }
     
@@ -34,18 +33,16 @@ ms_result_t ms_vm_exec_file(ms_vm_t* vm, const char* filename) {
     
     char* buffer = malloc(file_size + 1);
     if (buffer == NULL) {
-        snprintf(vm->error_message, sizeof(vm->error_message), 
+        ms_vm_raise(vm, MS_RUNTIME_ERROR,
                 "Not enough memory to read \"%s\".", filename);
-        vm->has_error = true;
         fclose(file);
         return MS_RESULT_RUNTIME_ERROR;
     }
     
     size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
     if (bytes_read < file_size) {
-        snprintf(vm->error_message, sizeof(vm->error_message), 
+        ms_vm_raise(vm, MS_RUNTIME_ERROR,
                 "Could not read file \"%s\".", filename);
-        vm->has_error = true;
         free(buffer);
         fclose(file);
         return MS_RESULT_RUNTIME_ERROR;
@@ -60,41 +57,20 @@ ms_result_t ms_vm_exec_file(ms_vm_t* vm, const char* filename) {
 }
 
 void ms_vm_register_function(ms_vm_t* vm, const char* name, ms_native_fn_t func) {
-    ms_global_t* global = malloc(sizeof(ms_global_t));
-    global->name = malloc(strlen(name) + 1);
-    strcpy(global->name, name);
-    global->value = ms_value_native_func(func);
-    global->next = vm->globals;
-    vm->globals = global;
+    ms_vm_set_global(vm, name, ms_value_native_func(func));
 }
 
 void ms_vm_set_global(ms_vm_t* vm, const char* name, ms_value_t value) {
-    // 查找现有全局变量
-    ms_global_t* current = vm->globals;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            current->value = value;
-            return;
-        }
-        current = current->next;
-    }
-    
-    // 创建新的全局变量
-    ms_global_t* global = malloc(sizeof(ms_global_t));
-    global->name = malloc(strlen(name) + 1);
-    strcpy(global->name, name);
+    int slot = ms_vm_global_slot(vm, name, true);
+    ms_global_t* global = &vm->globals[slot];
     global->value = value;
-    global->next = vm->globals;
-    vm->globals = global;
+    global->defined = true;
 }
 
 ms_value_t ms_vm_get_global(ms_vm_t* vm, const char* name) {
-    ms_global_t* current = vm->globals;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            return current->value;
-        }
-        current = current->next;
+    int slot = ms_vm_global_slot(vm, name, false);
+    if (slot < 0 || !vm->globals[slot].defined) {
+        return ms_value_nil();
     }
-    return ms_value_nil();
+    return vm->globals[slot].value;
 }
\ No newline at end of file
@@ -1,234 +1,457 @@
 #include "miniscript.h"
+#include "value.h"
+#include "gc.h"
 #include "../vm/vm.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifdef MS_NAN_BOXING
+// tag -> 值类型 (tag 0 是 double；SPECIAL 和 BOX 由 ms_nanbox_type 单独处理)
+const ms_value_type_t ms_nanbox_tag_types[16] = {
+    [0] = MS_VAL_FLOAT,
+    [MS_NANBOX_TAG_SPECIAL] = MS_VAL_NIL,
+    [MS_NANBOX_TAG_INT] = MS_VAL_INT,
+    [MS_NANBOX_TAG_STRING] = MS_VAL_STRING,
+    [MS_NANBOX_TAG_FUNCTION] = MS_VAL_FUNCTION,
+    [MS_NANBOX_TAG_NATIVE_FUNC] = MS_VAL_NATIVE_FUNC,
+    [MS_NANBOX_TAG_OBJECT] = MS_VAL_OBJECT,
+    [MS_NANBOX_TAG_LIST] = MS_VAL_LIST,
+    [MS_NANBOX_TAG_DICT] = MS_VAL_DICT,
+    [MS_NANBOX_TAG_TUPLE] = MS_VAL_TUPLE,
+    [MS_NANBOX_TAG_SET] = MS_VAL_SET,
+    [MS_NANBOX_TAG_CLASS] = MS_VAL_CLASS,
+    [MS_NANBOX_TAG_INSTANCE] = MS_VAL_INSTANCE,
+    [MS_NANBOX_TAG_BOUND_METHOD] = MS_VAL_BOUND_METHOD,
+    [MS_NANBOX_TAG_EXCEPTION] = MS_VAL_EXCEPTION,
+    [MS_NANBOX_TAG_BOX] = MS_VAL_NIL
+};
+
+#define POINTER_VALUE(kind, field, pointer) \
+    ms_nanbox_make(MS_NANBOX_TAG_##kind, (uint64_t)(uintptr_t)(pointer))
+
+static ms_value_t box_value(ms_value_type_t type, int64_t integer, void* module) {
+    ms_value_box_t* box = ms_gc_alloc(MS_GC_BOX, sizeof(ms_value_box_t));
+    box->type = type;
+    if (type == MS_VAL_INT) {
+        box->as.integer = integer;
+    } else {
+        box->as.module = module;
+    }
+    return ms_nanbox_make(MS_NANBOX_TAG_BOX, (uint64_t)(uintptr_t)box);
+}
+#else
+#define POINTER_VALUE(kind, field, pointer) \
+    ((ms_value_t){.type = MS_VAL_##kind, .as.field = (pointer)})
+#endif
+
 // 创建值
 ms_value_t ms_value_nil(void) {
+#ifdef MS_NAN_BOXING
+    return ms_nanbox_make(MS_NANBOX_TAG_SPECIAL, 0);
+#else
     ms_value_t value;
     value.type = MS_VAL_NIL;
     return value;
+#endif
 }
 
 ms_value_t ms_value_bool(bool val) {
-    ms_value_t value;
-    value.type = MS_VAL_BOOL;
-    value.as.boolean = val;
-    return value;
+    return MS_BOOL_VALUE(val);
 }
 
 ms_value_t ms_value_int(int64_t val) {
-    ms_value_t value;
-    value.type = MS_VAL_INT;
-    value.as.integer = val;
-    return value;
+#ifdef MS_NAN_BOXING
+    if (val < MS_NANBOX_INT_MIN || val > MS_NANBOX_INT_MAX) {
+        return box_value(MS_VAL_INT, val, NULL);
+    }
+#endif
+    return MS_INT_VALUE(val);
 }
 
 ms_value_t ms_value_float(double val) {
-    ms_value_t value;
-    value.type = MS_VAL_FLOAT;
-    value.as.floating = val;
-    return value;
+    return MS_FLOAT_VALUE(val);
 }
 
 ms_value_t ms_value_string(const char* str) {
-    ms_value_t value;
-    value.type = MS_VAL_STRING;
-    value.as.string = malloc(strlen(str) + 1);
-    strcpy(value.as.string, str);
-    return value;
+    return ms_string_copy(str, strlen(str));
+}
+
+// ============ 字符串对象 ============
+
+char* ms_string_alloc(size_t length) {
+    ms_string_t* string = ms_gc_alloc(MS_GC_STRING, sizeof(ms_string_t) + length + 1);
+    string->hash = 0;
+    string->chars[length] = '\0';
+    return string->chars;
+}
+
+ms_value_t ms_string_copy(const char* chars, size_t length) {
+    char* copy = ms_string_alloc(length);
+    memcpy(copy, chars, length);
+    return MS_STRING_VALUE(copy);
+}
+
+ms_value_t ms_string_concat(ms_value_t a, ms_value_t b) {
+    uint32_t a_length = ms_string_value_length(a);
+    uint32_t b_length = ms_string_value_length(b);
+    if (a_length == 0) return b;
+    if (b_length == 0) return a;
+    size_t length = (size_t)a_length + b_length;
+    if (length < MS_ROPE_MIN) {
+        // 两边都短于 MS_ROPE_MIN，不可能是绳结点
+        char* result = ms_string_alloc(length);
+        memcpy(result, MS_STRING_POINTER(a), a_length);
+        memcpy(result + a_length, MS_STRING_POINTER(b), b_length);
+        return MS_STRING_VALUE(result);
+    }
+    ms_rope_t* rope = ms_gc_alloc(MS_GC_STRING, sizeof(ms_rope_t));
+    ((ms_gc_object_t*)rope - 1)->flags |= MS_GC_FLAG_ROPE;
+    rope->hash = 0;
+    rope->length = (uint32_t)length;
+    rope->flat = NULL;
+    rope->left = a;
+    rope->right = b;
+    return MS_STRING_VALUE((char*)rope + offsetof(ms_string_t, chars));
+}
+
+char* ms_rope_flatten(char* chars) {
+    ms_rope_t* rope = MS_ROPE(chars);
+    if (rope->flat != NULL) return rope->flat;
+
+    // 从右往左填。用显式栈而不是递归：s = s + x 得到的是很深的左偏树，
+    // x + s 得到的是右偏树
+    char* flat = ms_string_alloc(rope->length);
+    size_t position = rope->length;
+    int capacity = 16;
+    int count = 0;
+    char** stack = malloc(capacity * sizeof(char*));
+    stack[count++] = chars;
+    while (count > 0) {
+        char* piece = stack[--count];
+        if (ms_string_is_rope(piece)) {
+            ms_rope_t* node = MS_ROPE(piece);
+            if (node->flat == NULL) {
+                if (count + 2 > capacity) {
+                    capacity *= 2;
+                    stack = realloc(stack, capacity * sizeof(char*));
+                }
+                stack[count++] = MS_STRING_POINTER(node->left);
+                stack[count++] = MS_STRING_POINTER(node->right);
+                continue;
+            }
+            piece = node->flat;
+        }
+        uint32_t length = ms_string_length(piece);
+        position -= length;
+        memcpy(flat + position, piece, length);
+    }
+    free(stack);
+
+    rope->flat = flat;
+    rope->left = ms_value_nil();
+    rope->right = ms_value_nil();
+    return flat;
+}
+
+// 驻留表：开放寻址 + 线性探测，只存 chars 指针 (弱引用)。
+// 删除留下墓碑，墓碑和存活项合计不超过容量的一半
+#define INTERN_TOMBSTONE ((char*)1)
+
+static struct {
+    char** slots;
+    int capacity;
+    int count;   // 存活项
+    int filled;  // 存活项 + 墓碑
+} interned;
+
+static int intern_find(const char* chars, size_t length, uint32_t hash) {
+    int mask = interned.capacity - 1;
+    int i = (int)(hash & (uint32_t)mask);
+    for (;;) {
+        char* string = interned.slots[i];
+        if (string == NULL) return -1;
+        if (string != INTERN_TOMBSTONE && MS_STRING_HEADER(string)->hash == hash &&
+            ms_string_length(string) == length && memcmp(string, chars, length) == 0) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static void intern_slot_insert(char* string) {
+    int mask = interned.capacity - 1;
+    int i = (int)(MS_STRING_HEADER(string)->hash & (uint32_t)mask);
+    while (interned.slots[i] != NULL && interned.slots[i] != INTERN_TOMBSTONE) {
+        i = (i + 1) & mask;
+    }
+    if (interned.slots[i] == NULL) interned.filled++;
+    interned.slots[i] = string;
+}
+
+// string 的哈希必须已经算好
+static void intern_add(char* string) {
+    if ((interned.filled + 1) * 2 > interned.capacity) {
+        int capacity = 64;
+        while (capacity < (interned.count + 1) * 4) capacity *= 2;
+        char** old = interned.slots;
+        int old_capacity = interned.capacity;
+        interned.slots = calloc(capacity, sizeof(char*));
+        interned.capacity = capacity;
+        interned.filled = 0;
+        for (int i = 0; i < old_capacity; i++) {
+            if (old[i] != NULL && old[i] != INTERN_TOMBSTONE) intern_slot_insert(old[i]);
+        }
+        free(old);
+    }
+    intern_slot_insert(string);
+    interned.count++;
+    MS_STRING_OBJECT(string)->flags |= MS_GC_FLAG_INTERNED;
+}
+
+ms_value_t ms_string_intern(ms_value_t value) {
+    char* chars = MS_AS_STRING(value);
+    if (ms_string_interned(chars)) return MS_STRING_VALUE(chars);
+    uint32_t hash = ms_string_hash(chars);
+    if (interned.count > 0) {
+        int i = intern_find(chars, ms_string_length(chars), hash);
+        if (i >= 0) return MS_STRING_VALUE(interned.slots[i]);
+    }
+    intern_add(chars);
+    return MS_STRING_VALUE(chars);
+}
+
+ms_value_t ms_string_intern_chars(const char* chars, size_t length) {
+    uint32_t hash = ms_hash_bytes(chars, length);
+    if (interned.count > 0) {
+        int i = intern_find(chars, length, hash);
+        if (i >= 0) return MS_STRING_VALUE(interned.slots[i]);
+    }
+    char* copy = ms_string_alloc(length);
+    memcpy(copy, chars, length);
+    MS_STRING_HEADER(copy)->hash = hash;
+    intern_add(copy);
+    return MS_STRING_VALUE(copy);
+}
+
+void ms_string_unintern(const char* chars) {
+    int mask = interned.capacity - 1;
+    int i = (int)(MS_STRING_HEADER(chars)->hash & (uint32_t)mask);
+    while (interned.slots[i] != chars) {
+        i = (i + 1) & mask;
+    }
+    interned.slots[i] = INTERN_TOMBSTONE;
+    interned.count--;
+}
+
+// 256 个单字节字符串，第一次用到时一起创建；放在一个登记为 GC 根的元组里保持存活
+static ms_value_t single_char_table;
+static ms_value_t* single_chars = NULL;
+
+ms_value_t ms_string_char(unsigned char c) {
+    if (single_chars == NULL) {
+        ms_tuple_t* table = ms_tuple_new(256);
+        for (int i = 0; i < 256; i++) {
+            char chars[1] = {(char)i};
+            table->elements[i] = ms_string_intern_chars(chars, 1);
+        }
+        single_char_table = ms_value_tuple(table);
+        ms_gc_add_root(&single_char_table);
+        single_chars = table->elements;
+    }
+    return single_chars[c];
 }
 
 ms_value_t ms_value_function(struct ms_function* func) {
-    ms_value_t value;
-    value.type = MS_VAL_FUNCTION;
-    value.as.function = func;
-    return value;
+    return POINTER_VALUE(FUNCTION, function, func);
 }
 
 ms_value_t ms_value_native_func(ms_native_fn_t func) {
-    ms_value_t value;
-    value.type = MS_VAL_NATIVE_FUNC;
-    value.as.native_func = malloc(sizeof(ms_native_func_t));
-    value.as.native_func->func = func;
-    value.as.native_func->name = NULL;
-    return value;
+    ms_native_func_t* native = malloc(sizeof(ms_native_func_t));
+    native->func = func;
+    native->name = NULL;
+    return POINTER_VALUE(NATIVE_FUNC, native_func, native);
+}
+
+ms_value_t ms_value_module(void* module) {
+#ifdef MS_NAN_BOXING
+    return box_value(MS_VAL_MODULE, 0, module);
+#else
+    return POINTER_VALUE(MODULE, module, module);
+#endif
 }
 
 // 类型检查
+ms_value_type_t ms_value_type(ms_value_t value) {
+    return MS_VALUE_TYPE(value);
+}
+
 bool ms_value_is_nil(ms_value_t value) {
-    return value.type == MS_VAL_NIL;
+    return MS_VALUE_TYPE(value) == MS_VAL_NIL;
 }
 
 bool ms_value_is_bool(ms_value_t value) {
-    return value.type == MS_VAL_BOOL;
+    return MS_VALUE_TYPE(value) == MS_VAL_BOOL;
 }
 
 bool ms_value_is_int(ms_value_t value) {
-    return value.type == MS_VAL_INT;
+    return MS_VALUE_TYPE(value) == MS_VAL_INT;
 }
 
 bool ms_value_is_float(ms_value_t value) {
-    return value.type == MS_VAL_FLOAT;
+    return MS_VALUE_TYPE(value) == MS_VAL_FLOAT;
 }
 
 bool ms_value_is_string(ms_value_t value) {
-    return value.type == MS_VAL_STRING;
+    return MS_VALUE_TYPE(value) == MS_VAL_STRING;
 }
 
 bool ms_value_is_function(ms_value_t value) {
-    return value.type == MS_VAL_FUNCTION || value.type == MS_VAL_NATIVE_FUNC;
+    ms_value_type_t type = MS_VALUE_TYPE(value);
+    return type == MS_VAL_FUNCTION || type == MS_VAL_NATIVE_FUNC;
 }
 
 // 值转换
 bool ms_value_as_bool(ms_value_t value) {
-    switch (value.type) {
-        case MS_VAL_BOOL: return value.as.boolean;
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_BOOL: return MS_AS_BOOLEAN(value);
         case MS_VAL_NIL: return false;
-        case MS_VAL_INT: return value.as.integer != 0;
-        case MS_VAL_FLOAT: return value.as.floating != 0.0;
-        case MS_VAL_STRING: return strlen(value.as.string) > 0;
+        case MS_VAL_INT: return MS_AS_INTEGER(value) != 0;
+        case MS_VAL_FLOAT: return MS_AS_FLOATING(value) != 0.0;
+        case MS_VAL_STRING: return ms_string_value_length(value) > 0;
         default: return true;
     }
 }
 
 int64_t ms_value_as_int(ms_value_t value) {
-    switch (value.type) {
-        case MS_VAL_INT: return value.as.integer;
-        case MS_VAL_FLOAT: return (int64_t)value.as.floating;
-        case MS_VAL_BOOL: return value.as.boolean ? 1 : 0;
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_INT: return MS_AS_INTEGER(value);
+        case MS_VAL_FLOAT: return (int64_t)MS_AS_FLOATING(value);
+        case MS_VAL_BOOL: return MS_AS_BOOLEAN(value) ? 1 : 0;
         default: return 0;
     }
 }
 
 double ms_value_as_float(ms_value_t value) {
-    switch (value.type) {
-        case MS_VAL_FLOAT: return value.as.floating;
-        case MS_VAL_INT: return (double)value.as.integer;
-        case MS_VAL_BOOL: return value.as.boolean ? 1.0 : 0.0;
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_FLOAT: return MS_AS_FLOATING(value);
+        case MS_VAL_INT: return (double)MS_AS_INTEGER(value);
+        case MS_VAL_BOOL: return MS_AS_BOOLEAN(value) ? 1.0 : 0.0;
         default: return 0.0;
     }
 }
 
 const char* ms_value_as_string(ms_value_t value) {
-    if (value.type == MS_VAL_STRING) {
-        return value.as.string;
+    if (MS_VALUE_TYPE(value) == MS_VAL_STRING) {
+        return MS_AS_STRING(value);
     }
     return "";
 }
 
+size_t ms_value_string_length(ms_value_t value) {
+    if (MS_VALUE_TYPE(value) == MS_VAL_STRING) {
+        return ms_string_value_length(value);
+    }
+    return 0;
+}
+
 
 // Collection value creation
 ms_value_t ms_value_list(ms_list_t* list) {
-    ms_value_t value;
-    value.type = MS_VAL_LIST;
-    value.as.list = list;
-    return value;
+    return POINTER_VALUE(LIST, list, list);
 }
 
 ms_value_t ms_value_dict(ms_dict_t* dict) {
-    ms_value_t value;
-    value.type = MS_VAL_DICT;
-    value.as.dict = dict;
-    return value;
+    return POINTER_VALUE(DICT, dict, dict);
 }
 
 ms_value_t ms_value_tuple(ms_tuple_t* tuple) {
-    ms_value_t value;
-    value.type = MS_VAL_TUPLE;
-    value.as.tuple = tuple;
-    return value;
+    return POINTER_VALUE(TUPLE, tuple, tuple);
 }
 
 ms_value_t ms_value_set(ms_set_t* set) {
-    ms_value_t value;
-    value.type = MS_VAL_SET;
-    value.as.set = set;
-    return value;
+    return POINTER_VALUE(SET, set, set);
 }
 
 // Exception value creation
 ms_value_t ms_value_exception(const char* type, const char* message, int line) {
-    ms_value_t value;
-    value.type = MS_VAL_EXCEPTION;
-    value.as.exception = malloc(sizeof(ms_exception_t));
-    value.as.exception->type = malloc(strlen(type) + 1);
-    strcpy(value.as.exception->type, type);
-    value.as.exception->message = malloc(strlen(message) + 1);
-    strcpy(value.as.exception->message, message);
-    value.as.exception->line = line;
-    return value;
+    ms_exception_t* exception = ms_gc_alloc(MS_GC_EXCEPTION, sizeof(ms_exception_t));
+    exception->type = malloc(strlen(type) + 1);
+    strcpy(exception->type, type);
+    exception->message = malloc(strlen(message) + 1);
+    strcpy(exception->message, message);
+    exception->line = line;
+    return POINTER_VALUE(EXCEPTION, exception, exception);
 }
 
 bool ms_value_is_exception(ms_value_t value) {
-    return value.type == MS_VAL_EXCEPTION;
+    return MS_VALUE_TYPE(value) == MS_VAL_EXCEPTION;
 }
 
 ms_exception_t* ms_value_as_exception(ms_value_t value) {
-    if (value.type == MS_VAL_EXCEPTION) {
-        return value.as.exception;
+    if (MS_VALUE_TYPE(value) == MS_VAL_EXCEPTION) {
+        return (ms_exception_t*)MS_AS_OBJECT(value);
     }
     return NULL;
 }
 
+// 以下 *_free 由 GC 在回收对象时调用，只释放对象内部的内存
 void ms_exception_free(ms_exception_t* exception) {
     if (exception) {
         if (exception->type) free(exception->type);
         if (exception->message) free(exception->message);
-        free(exception);
     }
 }
 
 // Collection type checks
 bool ms_value_is_list(ms_value_t value) {
-    return value.type == MS_VAL_LIST;
+    return MS_VALUE_TYPE(value) == MS_VAL_LIST;
 }
 
 bool ms_value_is_dict(ms_value_t value) {
-    return value.type == MS_VAL_DICT;
+    return MS_VALUE_TYPE(value) == MS_VAL_DICT;
 }
 
 bool ms_value_is_tuple(ms_value_t value) {
-    return value.type == MS_VAL_TUPLE;
+    return MS_VALUE_TYPE(value) == MS_VAL_TUPLE;
 }
 
 bool ms_value_is_set(ms_value_t value) {
-    return value.type == MS_VAL_SET;
+    return MS_VALUE_TYPE(value) == MS_VAL_SET;
 }
 
 // Collection value conversions
 ms_list_t* ms_value_as_list(ms_value_t value) {
-    if (value.type == MS_VAL_LIST) {
-        return value.as.list;
+    if (MS_VALUE_TYPE(value) == MS_VAL_LIST) {
+        return (ms_list_t*)MS_AS_OBJECT(value);
     }
     return NULL;
 }
 
 ms_dict_t* ms_value_as_dict(ms_value_t value) {
-    if (value.type == MS_VAL_DICT) {
-        return value.as.dict;
+    if (MS_VALUE_TYPE(value) == MS_VAL_DICT) {
+        return (ms_dict_t*)MS_AS_OBJECT(value);
     }
     return NULL;
 }
 
 ms_tuple_t* ms_value_as_tuple(ms_value_t value) {
-    if (value.type == MS_VAL_TUPLE) {
-        return value.as.tuple;
+    if (MS_VALUE_TYPE(value) == MS_VAL_TUPLE) {
+        return (ms_tuple_t*)MS_AS_OBJECT(value);
     }
     return NULL;
 }
 
 ms_set_t* ms_value_as_set(ms_value_t value) {
-    if (value.type == MS_VAL_SET) {
-        return value.as.set;
+    if (MS_VALUE_TYPE(value) == MS_VAL_SET) {
+        return (ms_set_t*)MS_AS_OBJECT(value);
     }
     return NULL;
 }
 
 // List operations
 ms_list_t* ms_list_new(void) {
-    ms_list_t* list = malloc(sizeof(ms_list_t));
+    ms_list_t* list = ms_gc_alloc(MS_GC_LIST, sizeof(ms_list_t));
     list->elements = NULL;
     list->count = 0;
     list->capacity = 0;
@@ -238,7 +461,6 @@ ms_list_t* ms_list_new(void) {
 void ms_list_free(ms_list_t* list) {
     if (list) {
         free(list->elements);
-        free(list);
     }
 }
 
@@ -268,61 +490,307 @@ int ms_list_len(ms_list_t* list) {
 }
 
 // Dict operations
+//
+// 紧凑字典 (CPython 3.6 的布局)：entries 是按插入顺序排列的稠密数组，
+// index 是开放寻址 (线性探测) 的哈希索引，槽位里存 entries 的下标。
+// 条目缓存键的哈希，探测时先比哈希再比键。删除时索引槽位留下
+// DICT_DUMMY 墓碑、条目标记 deleted；两者都要等下次扩容时才清理，
+// 所以遍历 entries 必须跳过已删除的条目。
+//
+// 键可以是任意可哈希的值，和 == 一样不同类型的键互不相等。
+// 键本身由 GC 追踪，字典不复制字符串键。
+#define DICT_EMPTY (-1)
+#define DICT_DUMMY (-2)
+#define DICT_MIN_INDEX 8
+
+// 索引里最多可用的条目数 (负载因子 2/3，已删除的条目也算)
+#define DICT_USABLE(index_capacity) (((index_capacity) * 2) / 3)
+
+bool ms_value_hashable(ms_value_t value) {
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_LIST:
+        case MS_VAL_DICT:
+        case MS_VAL_SET:
+            return false;
+        case MS_VAL_TUPLE: {
+            ms_tuple_t* tuple = (ms_tuple_t*)MS_AS_OBJECT(value);
+            for (int i = 0; i < tuple->count; i++) {
+                if (!ms_value_hashable(tuple->elements[i])) return false;
+            }
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+uint32_t ms_value_hash(ms_value_t value) {
+    switch (MS_VALUE_TYPE(value)) {
+        case MS_VAL_NIL:
+            return 0x9e3779b9u;
+        case MS_VAL_BOOL:
+            return ms_hash_int(MS_AS_BOOLEAN(value) ? 1 : 0) ^ 0x85ebca6bu;
+        case MS_VAL_INT:
+            return ms_hash_int(MS_AS_INTEGER(value));
+        case MS_VAL_FLOAT: {
+            double d = MS_AS_FLOATING(value);
+            if (d == 0.0) d = 0.0;  // -0.0 == 0.0
+            int64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return ms_hash_int(bits);
+        }
+        case MS_VAL_STRING:
+            return ms_string_hash(MS_AS_STRING(value));
+        case MS_VAL_TUPLE: {
+            // 和 CPython 早期的 tuple 哈希一样按位置混合
+            ms_tuple_t* tuple = (ms_tuple_t*)MS_AS_OBJECT(value);
+            uint32_t hash = 0x345678u;
+            for (int i = 0; i < tuple->count; i++) {
+                hash = (hash ^ ms_value_hash(tuple->elements[i])) * 1000003u;
+            }
+            return hash ^ (uint32_t)tuple->count;
+        }
+        case MS_VAL_MODULE:
+            return ms_hash_int((int64_t)(uintptr_t)MS_AS_MODULE(value));
+        default:
+            // 函数、类、实例等按身份比较
+            return ms_hash_int((int64_t)(uintptr_t)MS_AS_OBJECT(value));
+    }
+}
+
+bool ms_value_key_equal(ms_value_t a, ms_value_t b) {
+    ms_value_type_t type = MS_VALUE_TYPE(a);
+    if (type != MS_VALUE_TYPE(b)) return false;
+    switch (type) {
+        case MS_VAL_NIL: return true;
+        case MS_VAL_BOOL: return MS_AS_BOOLEAN(a) == MS_AS_BOOLEAN(b);
+        case MS_VAL_INT: return MS_AS_INTEGER(a) == MS_AS_INTEGER(b);
+        case MS_VAL_FLOAT: return MS_AS_FLOATING(a) == MS_AS_FLOATING(b);
+        case MS_VAL_STRING:
+            return ms_string_equal(MS_AS_STRING(a), MS_AS_STRING(b));
+        case MS_VAL_TUPLE: {
+            ms_tuple_t* x = (ms_tuple_t*)MS_AS_OBJECT(a);
+            ms_tuple_t* y = (ms_tuple_t*)MS_AS_OBJECT(b);
+            if (x == y) return true;
+            if (x->count != y->count) return false;
+            for (int i = 0; i < x->count; i++) {
+                if (!ms_value_key_equal(x->elements[i], y->elements[i])) return false;
+            }
+            return true;
+        }
+        case MS_VAL_MODULE: return MS_AS_MODULE(a) == MS_AS_MODULE(b);
+        default: return MS_AS_OBJECT(a) == MS_AS_OBJECT(b);
+    }
+}
+
 ms_dict_t* ms_dict_new(void) {
-    ms_dict_t* dict = malloc(sizeof(ms_dict_t));
-    dict->entries = NULL;
-    dict->count = 0;
-    dict->capacity = 0;
+    ms_dict_t* dict = ms_gc_alloc(MS_GC_DICT, sizeof(ms_dict_t));
+    memset(dict, 0, sizeof(ms_dict_t));
     return dict;
 }
 
 void ms_dict_free(ms_dict_t* dict) {
     if (dict) {
-        for (int i = 0; i < dict->count; i++) {
-            free(dict->entries[i].key);
-        }
         free(dict->entries);
-        free(dict);
+        free(dict->index);
     }
 }
 
-void ms_dict_set(ms_dict_t* dict, const char* key, ms_value_t value) {
-    // Check if key exists
-    for (int i = 0; i < dict->count; i++) {
-        if (strcmp(dict->entries[i].key, key) == 0) {
-            dict->entries[i].value = value;
-            return;
+// 以下三个查找函数返回 key 所在的索引槽位，找不到时返回 -1。
+// 整数键和字符串键各走一条不经过 ms_value_key_equal 的快速路径
+static int dict_lookup_int(ms_dict_t* dict, int64_t key, uint32_t hash) {
+    if (dict->index_capacity == 0) return -1;
+    int mask = dict->index_capacity - 1;
+    int i = (int)(hash & (uint32_t)mask);
+    for (;;) {
+        int32_t ix = dict->index[i];
+        if (ix == DICT_EMPTY) return -1;
+        if (ix >= 0) {
+            ms_dict_entry_t* entry = &dict->entries[ix];
+            if (entry->hash == hash && MS_VALUE_TYPE(entry->key) == MS_VAL_INT &&
+                MS_AS_INTEGER(entry->key) == key) {
+                return i;
+            }
         }
+        i = (i + 1) & mask;
     }
-    
-    // Add new entry
-    if (dict->count >= dict->capacity) {
-        dict->capacity = dict->capacity == 0 ? 8 : dict->capacity * 2;
-        dict->entries = realloc(dict->entries, dict->capacity * sizeof(ms_dict_entry_t));
+}
+
+// key 和条目的键都驻留时只需比较指针；key 可能是 C 字符串 (ms_dict_get 等)，
+// 这时 interned_key 为 false，只按内容比较
+static int dict_lookup_string(ms_dict_t* dict, const char* key, size_t length, bool interned_key,
+                              uint32_t hash) {
+    if (dict->index_capacity == 0) return -1;
+    int mask = dict->index_capacity - 1;
+    int i = (int)(hash & (uint32_t)mask);
+    for (;;) {
+        int32_t ix = dict->index[i];
+        if (ix == DICT_EMPTY) return -1;
+        if (ix >= 0) {
+            ms_dict_entry_t* entry = &dict->entries[ix];
+            if (entry->hash == hash && MS_VALUE_TYPE(entry->key) == MS_VAL_STRING) {
+                const char* chars = MS_AS_STRING(entry->key);
+                if (chars == key) return i;
+                if (!(interned_key && ms_string_interned(chars)) &&
+                    ms_string_length(chars) == length && memcmp(chars, key, length) == 0) {
+                    return i;
+                }
+            }
+        }
+        i = (i + 1) & mask;
     }
-    
-    dict->entries[dict->count].key = malloc(strlen(key) + 1);
-    strcpy(dict->entries[dict->count].key, key);
-    dict->entries[dict->count].value = value;
-    dict->count++;
 }
 
-ms_value_t ms_dict_get(ms_dict_t* dict, const char* key) {
-    for (int i = 0; i < dict->count; i++) {
-        if (strcmp(dict->entries[i].key, key) == 0) {
-            return dict->entries[i].value;
+static int dict_lookup(ms_dict_t* dict, ms_value_t key, uint32_t hash) {
+    switch (MS_VALUE_TYPE(key)) {
+        case MS_VAL_INT: return dict_lookup_int(dict, MS_AS_INTEGER(key), hash);
+        case MS_VAL_STRING: {
+            const char* chars = MS_AS_STRING(key);
+            return dict_lookup_string(dict, chars, ms_string_length(chars),
+                                      ms_string_interned(chars), hash);
+        }
+        default: break;
+    }
+    if (dict->index_capacity == 0) return -1;
+    int mask = dict->index_capacity - 1;
+    int i = (int)(hash & (uint32_t)mask);
+    for (;;) {
+        int32_t ix = dict->index[i];
+        if (ix == DICT_EMPTY) return -1;
+        if (ix >= 0) {
+            ms_dict_entry_t* entry = &dict->entries[ix];
+            if (entry->hash == hash && ms_value_key_equal(entry->key, key)) return i;
         }
+        i = (i + 1) & mask;
     }
-    return ms_value_nil();
 }
 
-bool ms_dict_has(ms_dict_t* dict, const char* key) {
-    for (int i = 0; i < dict->count; i++) {
-        if (strcmp(dict->entries[i].key, key) == 0) {
-            return true;
+static void dict_index_insert(ms_dict_t* dict, uint32_t hash, int32_t ix) {
+    int mask = dict->index_capacity - 1;
+    int i = (int)(hash & (uint32_t)mask);
+    while (dict->index[i] >= 0) {
+        i = (i + 1) & mask;
+    }
+    dict->index[i] = ix;
+}
+
+// 压实 entries (去掉已删除的条目) 并按存活条目数重建索引：
+// 存活条目最多占新索引的 1/3，删得多的字典会借此缩小
+static void dict_resize(ms_dict_t* dict) {
+    int index_capacity = DICT_MIN_INDEX;
+    while (index_capacity < dict->count * 3) {
+        index_capacity *= 2;
+    }
+
+    int live = 0;
+    for (int i = 0; i < dict->used; i++) {
+        if (!dict->entries[i].deleted) {
+            dict->entries[live++] = dict->entries[i];
         }
     }
-    return false;
+    dict->used = live;
+    dict->capacity = DICT_USABLE(index_capacity);
+    dict->entries = realloc(dict->entries, dict->capacity * sizeof(ms_dict_entry_t));
+
+    dict->index_capacity = index_capacity;
+    dict->index = realloc(dict->index, index_capacity * sizeof(int32_t));
+    memset(dict->index, 0xff, index_capacity * sizeof(int32_t));  // 全部 DICT_EMPTY
+    for (int i = 0; i < dict->used; i++) {
+        dict_index_insert(dict, dict->entries[i].hash, i);
+    }
+}
+
+// 追加一个调用方确认不存在的键
+static void dict_insert_new(ms_dict_t* dict, ms_value_t key, uint32_t hash, ms_value_t value) {
+    if (dict->used >= dict->capacity) {
+        dict_resize(dict);
+    }
+    ms_dict_entry_t* entry = &dict->entries[dict->used];
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+    entry->deleted = false;
+    dict_index_insert(dict, hash, dict->used);
+    dict->used++;
+    dict->count++;
+}
+
+static void dict_remove_slot(ms_dict_t* dict, int slot) {
+    ms_dict_entry_t* entry = &dict->entries[dict->index[slot]];
+    entry->deleted = true;
+    entry->key = ms_value_nil();
+    entry->value = ms_value_nil();
+    dict->index[slot] = DICT_DUMMY;
+    dict->count--;
+}
+
+ms_dict_entry_t* ms_dict_find(ms_dict_t* dict, const char* key) {
+    size_t length = strlen(key);
+    int slot = dict_lookup_string(dict, key, length, false, ms_hash_bytes(key, length));
+    return slot < 0 ? NULL : &dict->entries[dict->index[slot]];
+}
+
+ms_dict_entry_t* ms_dict_find_value(ms_dict_t* dict, ms_value_t key) {
+    int slot = dict_lookup(dict, key, ms_value_hash(key));
+    return slot < 0 ? NULL : &dict->entries[dict->index[slot]];
+}
+
+void ms_dict_set(ms_dict_t* dict, const char* key, ms_value_t value) {
+    size_t length = strlen(key);
+    uint32_t hash = ms_hash_bytes(key, length);
+    int slot = dict_lookup_string(dict, key, length, false, hash);
+    if (slot >= 0) {
+        dict->entries[dict->index[slot]].value = value;
+        return;
+    }
+    dict_insert_new(dict, ms_string_intern_chars(key, length), hash, value);
+}
+
+ms_value_t ms_dict_get(ms_dict_t* dict, const char* key) {
+    ms_dict_entry_t* entry = ms_dict_find(dict, key);
+    return entry != NULL ? entry->value : ms_value_nil();
+}
+
+bool ms_dict_has(ms_dict_t* dict, const char* key) {
+    return ms_dict_find(dict, key) != NULL;
+}
+
+bool ms_dict_remove(ms_dict_t* dict, const char* key) {
+    size_t length = strlen(key);
+    int slot = dict_lookup_string(dict, key, length, false, ms_hash_bytes(key, length));
+    if (slot < 0) return false;
+    dict_remove_slot(dict, slot);
+    return true;
+}
+
+bool ms_dict_set_value(ms_dict_t* dict, ms_value_t key, ms_value_t value) {
+    if (!ms_value_hashable(key)) return false;
+    uint32_t hash = ms_value_hash(key);
+    int slot = dict_lookup(dict, key, hash);
+    if (slot >= 0) {
+        dict->entries[dict->index[slot]].value = value;
+    } else {
+        dict_insert_new(dict, key, hash, value);
+    }
+    return true;
+}
+
+ms_value_t ms_dict_get_value(ms_dict_t* dict, ms_value_t key) {
+    if (!ms_value_hashable(key)) return ms_value_nil();
+    ms_dict_entry_t* entry = ms_dict_find_value(dict, key);
+    return entry != NULL ? entry->value : ms_value_nil();
+}
+
+bool ms_dict_has_value(ms_dict_t* dict, ms_value_t key) {
+    return ms_value_hashable(key) && ms_dict_find_value(dict, key) != NULL;
+}
+
+bool ms_dict_remove_value(ms_dict_t* dict, ms_value_t key) {
+    if (!ms_value_hashable(key)) return false;
+    int slot = dict_lookup(dict, key, ms_value_hash(key));
+    if (slot < 0) return false;
+    dict_remove_slot(dict, slot);
+    return true;
 }
 
 int ms_dict_len(ms_dict_t* dict) {
@@ -331,7 +799,7 @@ int ms_dict_len(ms_dict_t* dict) {
 
 // Tuple operations
 ms_tuple_t* ms_tuple_new(int count) {
-    ms_tuple_t* tuple = malloc(sizeof(ms_tuple_t));
+    ms_tuple_t* tuple = ms_gc_alloc(MS_GC_TUPLE, sizeof(ms_tuple_t));
     tuple->elements = malloc(count * sizeof(ms_value_t));
     tuple->count = count;
     for (int i = 0; i < count; i++) {
@@ -343,7 +811,6 @@ ms_tuple_t* ms_tuple_new(int count) {
 void ms_tuple_free(ms_tuple_t* tuple) {
     if (tuple) {
         free(tuple->elements);
-        free(tuple);
     }
 }
 
@@ -425,9 +892,7 @@ ms_value_t ms_slice_tuple(ms_tuple_t* tuple, int start, int stop, int step) {
     return ms_value_tuple(result);
 }
 
-ms_value_t ms_slice_string(const char* str, int start, int stop, int step) {
-    int len = strlen(str);
-    
+static ms_value_t slice_chars(const char* str, int len, int start, int stop, int step) {
     // Normalize negative indices
     if (start < 0) start = len + start;
     if (stop < 0) stop = len + stop;
@@ -446,7 +911,10 @@ ms_value_t ms_slice_string(const char* str, int start, int stop, int step) {
         for (int i = start; i > stop; i += step) result_len++;
     }
     
-    char* result = malloc(result_len + 1);
+    if (result_len == 1) return ms_string_char((unsigned char)str[start]);
+
+    // 直接写进新字符串对象，不再经过临时缓冲区
+    char* result = ms_string_alloc(result_len);
     int idx = 0;
     
     if (step > 0) {
@@ -459,154 +927,353 @@ ms_value_t ms_slice_string(const char* str, int start, int stop, int step) {
         }
     }
     
-    result[result_len] = '\0';
-    ms_value_t val = ms_value_string(result);
-    free(result);
-    return val;
+    return MS_STRING_VALUE(result);
+}
+
+ms_value_t ms_slice_string(const char* str, int start, int stop, int step) {
+    return slice_chars(str, (int)strlen(str), start, stop, step);
+}
+
+ms_value_t ms_string_slice(ms_value_t string, int start, int stop, int step) {
+    const char* str = MS_AS_STRING(string);
+    return slice_chars(str, (int)ms_string_length(str), start, stop, step);
 }
 
 // 类和实例值操作
 ms_value_t ms_value_class(void* klass) {
-    ms_value_t value;
-    value.type = MS_VAL_CLASS;
-    value.as.object = klass;
-    return value;
+    return POINTER_VALUE(CLASS, object, klass);
 }
 
 ms_value_t ms_value_instance(void* instance) {
-    ms_value_t value;
-    value.type = MS_VAL_INSTANCE;
-    value.as.object = instance;
-    return value;
+    return POINTER_VALUE(INSTANCE, object, instance);
 }
 
 ms_value_t ms_value_bound_method(void* bound) {
-    ms_value_t value;
-    value.type = MS_VAL_BOUND_METHOD;
-    value.as.object = bound;
-    return value;
+    return POINTER_VALUE(BOUND_METHOD, object, bound);
 }
 
 bool ms_value_is_class(ms_value_t value) {
-    return value.type == MS_VAL_CLASS;
+    return MS_VALUE_TYPE(value) == MS_VAL_CLASS;
 }
 
 bool ms_value_is_instance(ms_value_t value) {
-    return value.type == MS_VAL_INSTANCE;
+    return MS_VALUE_TYPE(value) == MS_VAL_INSTANCE;
 }
 
 bool ms_value_is_bound_method(ms_value_t value) {
-    return value.type == MS_VAL_BOUND_METHOD;
+    return MS_VALUE_TYPE(value) == MS_VAL_BOUND_METHOD;
 }
 
 void* ms_value_as_class(ms_value_t value) {
-    return value.as.object;
+    return MS_AS_OBJECT(value);
 }
 
 void* ms_value_as_instance(ms_value_t value) {
-    return value.as.object;
+    return MS_AS_OBJECT(value);
 }
 
 void* ms_value_as_bound_method(ms_value_t value) {
-    return value.as.object;
+    return MS_AS_OBJECT(value);
 }
 
 // Set operations
-// Helper function to convert value to string key for hashing
-static char* value_to_key(ms_value_t value) {
-    static char buffer[256];
-    switch (value.type) {
-        case MS_VAL_INT:
-            sprintf(buffer, "i:%lld", (long long)value.as.integer);
-            break;
-        case MS_VAL_FLOAT:
-            sprintf(buffer, "f:%g", value.as.floating);
-            break;
-        case MS_VAL_STRING:
-            sprintf(buffer, "s:%s", value.as.string);
-            break;
-        case MS_VAL_BOOL:
-            sprintf(buffer, "b:%d", value.as.boolean);
-            break;
-        case MS_VAL_NIL:
-            sprintf(buffer, "n:nil");
-            break;
-        default:
-            sprintf(buffer, "o:%p", (void*)&value);
-            break;
+//
+// 元素按插入顺序放在稠密的 entries 数组里 (打印和遍历的顺序稳定)，
+// 索引是 Swiss table 式的分组开放寻址：每个槽位一个控制字节，
+// 满槽位存哈希的低 7 位 (h2)，空槽位和墓碑的最高位为 1。探测按 8 个
+// 控制字节一组进行，一次 64 位读取、几条位运算就能在整组里找出 h2
+// 匹配的槽位和空槽位 (SWAR，不依赖具体的 SIMD 指令集)，只有 h2
+// 匹配的槽位才去比较元素。组之间按三角数序列跳跃。
+// 元素的哈希和相等与字典的键一致，list/dict/set 不可哈希。
+#define SET_GROUP_WIDTH 8
+#define SET_CTRL_EMPTY   ((uint8_t)0x80)
+#define SET_CTRL_DELETED ((uint8_t)0xfe)
+#define SET_LSBS ((uint64_t)0x0101010101010101)
+#define SET_MSBS ((uint64_t)0x8080808080808080)
+
+// 负载因子 7/8 (墓碑也算)
+#define SET_USABLE(slot_capacity) ((slot_capacity) - (slot_capacity) / 8)
+
+static inline uint64_t set_load_group(const uint8_t* ctrl) {
+    // 按小端序组装，字节 i 对应第 i 个槽位 (编译器会合并成一次读取)
+    uint64_t group = 0;
+    for (int i = 0; i < SET_GROUP_WIDTH; i++) {
+        group |= (uint64_t)ctrl[i] << (i * 8);
     }
-    return buffer;
+    return group;
+}
+
+// 控制字节等于 h2 的槽位 (可能有假阳性，调用方总会再比较元素)
+static inline uint64_t set_match_h2(uint64_t group, uint8_t h2) {
+    uint64_t x = group ^ (SET_LSBS * h2);
+    return (x - SET_LSBS) & ~x & SET_MSBS;
+}
+
+static inline uint64_t set_match_empty(uint64_t group) {
+    return group & ~(group << 6) & SET_MSBS;
+}
+
+static inline uint64_t set_match_empty_or_deleted(uint64_t group) {
+    return group & ~(group << 7) & SET_MSBS;
+}
+
+// 位掩码里最低的匹配对应组内第几个槽位
+static inline int set_lowest_match(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask) >> 3;
+#else
+    int i = 0;
+    while ((mask & 0x80) == 0) {
+        mask >>= 8;
+        i++;
+    }
+    return i;
+#endif
 }
 
 ms_set_t* ms_set_new(void) {
-    ms_set_t* set = malloc(sizeof(ms_set_t));
-    set->entries = NULL;
-    set->count = 0;
-    set->capacity = 0;
+    ms_set_t* set = ms_gc_alloc(MS_GC_SET, sizeof(ms_set_t));
+    memset(set, 0, sizeof(ms_set_t));
     return set;
 }
 
 void ms_set_free(ms_set_t* set) {
     if (set) {
-        for (int i = 0; i < set->count; i++) {
-            free(set->entries[i].key);
-        }
         free(set->entries);
-        free(set);
+        free(set->ctrl);
+        free(set->slots);
     }
 }
 
-bool ms_set_add(ms_set_t* set, ms_value_t value) {
-    char* key = value_to_key(value);
-    
-    // Check if already exists
-    for (int i = 0; i < set->count; i++) {
-        if (strcmp(set->entries[i].key, key) == 0) {
-            return false;  // Already exists
+// 返回元素所在的槽位，找不到时返回 -1
+static int set_lookup(ms_set_t* set, ms_value_t value, uint32_t hash) {
+    if (set->slot_capacity == 0) return -1;
+    uint8_t h2 = (uint8_t)(hash & 0x7f);
+    int group_mask = set->slot_capacity / SET_GROUP_WIDTH - 1;
+    int g = (int)((hash >> 7) & (uint32_t)group_mask);
+    for (int step = 1;; step++) {
+        const uint8_t* ctrl = set->ctrl + g * SET_GROUP_WIDTH;
+        uint64_t group = set_load_group(ctrl);
+        for (uint64_t match = set_match_h2(group, h2); match != 0; match &= match - 1) {
+            int i = set_lowest_match(match);
+            if (ctrl[i] != h2) continue;  // 假阳性
+            int slot = g * SET_GROUP_WIDTH + i;
+            ms_set_entry_t* entry = &set->entries[set->slots[slot]];
+            if (entry->hash == hash && ms_value_key_equal(entry->value, value)) {
+                return slot;
+            }
         }
+        if (set_match_empty(group) != 0) return -1;
+        g = (g + step) & group_mask;
     }
-    
-    // Add new entry
-    if (set->count >= set->capacity) {
-        set->capacity = set->capacity == 0 ? 8 : set->capacity * 2;
-        set->entries = realloc(set->entries, set->capacity * sizeof(ms_dict_entry_t));
+}
+
+static void set_index_insert(ms_set_t* set, uint32_t hash, int32_t ix) {
+    int group_mask = set->slot_capacity / SET_GROUP_WIDTH - 1;
+    int g = (int)((hash >> 7) & (uint32_t)group_mask);
+    for (int step = 1;; step++) {
+        uint64_t free_slots = set_match_empty_or_deleted(set_load_group(set->ctrl + g * SET_GROUP_WIDTH));
+        if (free_slots != 0) {
+            int slot = g * SET_GROUP_WIDTH + set_lowest_match(free_slots);
+            set->ctrl[slot] = (uint8_t)(hash & 0x7f);
+            set->slots[slot] = ix;
+            return;
+        }
+        g = (g + step) & group_mask;
     }
-    
-    set->entries[set->count].key = malloc(strlen(key) + 1);
-    strcpy(set->entries[set->count].key, key);
-    set->entries[set->count].value = value;
+}
+
+// 压实 entries 并重建索引，使至少能放下 usable 个元素
+static void set_resize(ms_set_t* set, int usable) {
+    int slot_capacity = SET_GROUP_WIDTH;
+    while (SET_USABLE(slot_capacity) < usable) {
+        slot_capacity *= 2;
+    }
+
+    int live = 0;
+    for (int i = 0; i < set->used; i++) {
+        if (!set->entries[i].deleted) {
+            set->entries[live++] = set->entries[i];
+        }
+    }
+    set->used = live;
+    set->capacity = SET_USABLE(slot_capacity);
+    set->entries = realloc(set->entries, set->capacity * sizeof(ms_set_entry_t));
+
+    set->slot_capacity = slot_capacity;
+    set->ctrl = realloc(set->ctrl, slot_capacity);
+    set->slots = realloc(set->slots, slot_capacity * sizeof(int32_t));
+    memset(set->ctrl, SET_CTRL_EMPTY, slot_capacity);
+    for (int i = 0; i < set->used; i++) {
+        set_index_insert(set, set->entries[i].hash, i);
+    }
+}
+
+// 预留空间，之后 count 个元素以内的插入不会再扩容
+static void set_reserve(ms_set_t* set, int count) {
+    if (set->used - set->count + count > set->capacity) {
+        set_resize(set, count);
+    }
+}
+
+static void set_append(ms_set_t* set, ms_value_t value, uint32_t hash) {
+    ms_set_entry_t* entry = &set->entries[set->used];
+    entry->value = value;
+    entry->hash = hash;
+    entry->deleted = false;
+    set->used++;
     set->count++;
-    return true;
 }
 
-bool ms_set_remove(ms_set_t* set, ms_value_t value) {
-    char* key = value_to_key(value);
-    
-    for (int i = 0; i < set->count; i++) {
-        if (strcmp(set->entries[i].key, key) == 0) {
-            free(set->entries[i].key);
-            // Shift remaining elements
-            for (int j = i; j < set->count - 1; j++) {
-                set->entries[j] = set->entries[j + 1];
+// 追加一个确定不在集合里的元素 (集合运算的结果)，沿用源集合缓存的哈希
+static void set_insert_unique(ms_set_t* set, ms_value_t value, uint32_t hash) {
+    if (set->used >= set->capacity) {
+        set_resize(set, (set->count + 1) * 2);
+    }
+    set_index_insert(set, hash, set->used);
+    set_append(set, value, hash);
+}
+
+// 查找并在不存在时插入，一次探测同时确定插入位置。返回是否插入了新元素
+static bool set_insert(ms_set_t* set, ms_value_t value, uint32_t hash) {
+    if (set->used >= set->capacity) {
+        set_resize(set, (set->count + 1) * 2);
+    }
+    uint8_t h2 = (uint8_t)(hash & 0x7f);
+    int group_mask = set->slot_capacity / SET_GROUP_WIDTH - 1;
+    int g = (int)((hash >> 7) & (uint32_t)group_mask);
+    int target = -1;
+    for (int step = 1;; step++) {
+        const uint8_t* ctrl = set->ctrl + g * SET_GROUP_WIDTH;
+        uint64_t group = set_load_group(ctrl);
+        for (uint64_t match = set_match_h2(group, h2); match != 0; match &= match - 1) {
+            int i = set_lowest_match(match);
+            if (ctrl[i] != h2) continue;
+            ms_set_entry_t* entry = &set->entries[set->slots[g * SET_GROUP_WIDTH + i]];
+            if (entry->hash == hash && ms_value_key_equal(entry->value, value)) {
+                return false;
             }
-            set->count--;
-            return true;
         }
+        if (target < 0) {
+            uint64_t free_slots = set_match_empty_or_deleted(group);
+            if (free_slots != 0) target = g * SET_GROUP_WIDTH + set_lowest_match(free_slots);
+        }
+        if (set_match_empty(group) != 0) break;
+        g = (g + step) & group_mask;
     }
-    return false;
+    set->ctrl[target] = h2;
+    set->slots[target] = set->used;
+    set_append(set, value, hash);
+    return true;
 }
 
-bool ms_set_contains(ms_set_t* set, ms_value_t value) {
-    char* key = value_to_key(value);
-    
-    for (int i = 0; i < set->count; i++) {
-        if (strcmp(set->entries[i].key, key) == 0) {
-            return true;
-        }
+bool ms_set_add(ms_set_t* set, ms_value_t value) {
+    if (!ms_value_hashable(value)) return false;
+    return set_insert(set, value, ms_value_hash(value));
+}
+
+bool ms_set_add_values(ms_set_t* set, ms_value_t* values, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!ms_value_hashable(values[i])) return false;
+    }
+    set_reserve(set, set->count + count);
+    for (int i = 0; i < count; i++) {
+        set_insert(set, values[i], ms_value_hash(values[i]));
     }
-    return false;
+    return true;
+}
+
+bool ms_set_remove(ms_set_t* set, ms_value_t value) {
+    if (!ms_value_hashable(value)) return false;
+    int slot = set_lookup(set, value, ms_value_hash(value));
+    if (slot < 0) return false;
+
+    ms_set_entry_t* entry = &set->entries[set->slots[slot]];
+    entry->deleted = true;
+    entry->value = ms_value_nil();
+    set->ctrl[slot] = SET_CTRL_DELETED;
+    set->count--;
+    return true;
+}
+
+bool ms_set_contains(ms_set_t* set, ms_value_t value) {
+    return ms_value_hashable(value) && set_lookup(set, value, ms_value_hash(value)) >= 0;
 }
 
 int ms_set_len(ms_set_t* set) {
     return set->count;
 }
+
+// 集合运算：结果按需要预先分配，元素沿用源集合缓存的哈希，不重新计算。
+// 并集和对称差保持 a 在前、b 在后的顺序；只读的判断遍历较小的一方。
+#define SET_FOR_EACH(set, entry) \
+    for (ms_set_entry_t* entry = (set)->entries; entry < (set)->entries + (set)->used; entry++) \
+        if (!entry->deleted)
+
+static bool set_has(ms_set_t* set, ms_set_entry_t* entry) {
+    return set_lookup(set, entry->value, entry->hash) >= 0;
+}
+
+ms_set_t* ms_set_copy(ms_set_t* set) {
+    ms_set_t* result = ms_set_new();
+    set_reserve(result, set->count);
+    SET_FOR_EACH(set, entry) set_insert_unique(result, entry->value, entry->hash);
+    return result;
+}
+
+ms_set_t* ms_set_union(ms_set_t* a, ms_set_t* b) {
+    ms_set_t* result = ms_set_new();
+    set_reserve(result, a->count + b->count);
+    SET_FOR_EACH(a, entry) set_insert_unique(result, entry->value, entry->hash);
+    SET_FOR_EACH(b, entry) set_insert(result, entry->value, entry->hash);
+    return result;
+}
+
+ms_set_t* ms_set_intersection(ms_set_t* a, ms_set_t* b) {
+    ms_set_t* small = a->count <= b->count ? a : b;
+    ms_set_t* large = small == a ? b : a;
+    ms_set_t* result = ms_set_new();
+    set_reserve(result, small->count);
+    SET_FOR_EACH(small, entry) {
+        if (set_has(large, entry)) set_insert_unique(result, entry->value, entry->hash);
+    }
+    return result;
+}
+
+ms_set_t* ms_set_difference(ms_set_t* a, ms_set_t* b) {
+    ms_set_t* result = ms_set_new();
+    set_reserve(result, a->count);
+    SET_FOR_EACH(a, entry) {
+        if (!set_has(b, entry)) set_insert_unique(result, entry->value, entry->hash);
+    }
+    return result;
+}
+
+ms_set_t* ms_set_symmetric_difference(ms_set_t* a, ms_set_t* b) {
+    ms_set_t* result = ms_set_new();
+    set_reserve(result, a->count + b->count);
+    SET_FOR_EACH(a, entry) {
+        if (!set_has(b, entry)) set_insert_unique(result, entry->value, entry->hash);
+    }
+    SET_FOR_EACH(b, entry) {
+        if (!set_has(a, entry)) set_insert_unique(result, entry->value, entry->hash);
+    }
+    return result;
+}
+
+bool ms_set_issubset(ms_set_t* a, ms_set_t* b) {
+    if (a->count > b->count) return false;
+    SET_FOR_EACH(a, entry) {
+        if (!set_has(b, entry)) return false;
+    }
+    return true;
+}
+
+bool ms_set_isdisjoint(ms_set_t* a, ms_set_t* b) {
+    ms_set_t* small = a->count <= b->count ? a : b;
+    ms_set_t* large = small == a ? b : a;
+    SET_FOR_EACH(small, entry) {
+        if (set_has(large, entry)) return false;
+    }
+    return true;
+}
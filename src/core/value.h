@@ -0,0 +1,318 @@
+#ifndef MS_VALUE_H
+#define MS_VALUE_H
+
+#include "miniscript.h"
+#include "gc.h"
+#include <stddef.h>
+#include <string.h>
+
+// 值表示的内部访问接口：解释器内部的热路径通过这些宏/内联函数读写 ms_value_t，
+// 不直接碰结构体字段，这样两种表示 (默认的 tag + union，以及 MS_NAN_BOXING
+// 的 8 字节 NaN-boxing) 共用同一份 VM 代码。
+//
+// MS_AS_* 不检查类型，调用前必须已经确认 MS_VALUE_TYPE。
+// MS_AS_STRING 总是得到平坦的 C 字符串 (绳结点会在这里拼平)；
+// MS_STRING_POINTER 是值里原样存的指针，只给 GC 和拼接本身用。
+// 扩展和嵌入方请继续使用 miniscript.h 里的 ms_value_* 函数。
+
+// 模块值只在 import 时由 VM 创建，不属于公开 API
+ms_value_t ms_value_module(void* module);
+
+// FNV-1a，字典和全局变量表共用
+static inline uint32_t ms_hash_string(const char* s) {
+    uint32_t hash = 2166136261u;
+    for (const char* p = s; *p; p++) {
+        hash ^= (uint8_t)*p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline uint32_t ms_hash_bytes(const char* s, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// 整数键的哈希 (murmur3 的 fmix64)，让连续或等差的整数也分散开
+static inline uint32_t ms_hash_int(int64_t i) {
+    uint64_t x = (uint64_t)i;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+// 字典键的哈希和相等 (调用前要确认 ms_value_hashable)
+uint32_t ms_value_hash(ms_value_t value);
+bool ms_value_key_equal(ms_value_t a, ms_value_t b);
+
+// 查找键对应的条目，不存在时返回 NULL (避免 has + get 查两遍)
+ms_dict_entry_t* ms_dict_find(ms_dict_t* dict, const char* key);
+ms_dict_entry_t* ms_dict_find_value(ms_dict_t* dict, ms_value_t key);
+
+#ifdef MS_NAN_BOXING
+
+// NaN-boxing 布局:
+//   普通 double 原样存放；运算得到的 NaN 一律规范成 MS_NANBOX_CANONICAL_NAN。
+//   其余静默 NaN 的空间里，符号位 + 第 48~50 位组成 4 位 tag (tag 0 留给
+//   规范 NaN)，低 48 位是负载：指针、48 位有符号整数或 nil/False/True。
+//   放不下的整数和模块名放在堆上的 ms_value_box_t 里 (tag BOX)；迭代器和生成器
+//   对象的第一个字段也是类型，同样用 tag BOX 存放 (见 iterator.h、generator.h)。
+#define MS_NANBOX_QNAN          ((uint64_t)0x7ff8000000000000)
+#define MS_NANBOX_PAYLOAD       ((uint64_t)0x0000ffffffffffff)
+#define MS_NANBOX_CANONICAL_NAN MS_NANBOX_QNAN
+
+enum {
+    MS_NANBOX_TAG_SPECIAL = 1,  // 负载 0 = None, 1 = False, 2 = True
+    MS_NANBOX_TAG_INT,
+    MS_NANBOX_TAG_STRING,
+    MS_NANBOX_TAG_FUNCTION,
+    MS_NANBOX_TAG_NATIVE_FUNC,
+    MS_NANBOX_TAG_OBJECT,
+    MS_NANBOX_TAG_LIST,
+    MS_NANBOX_TAG_DICT,
+    MS_NANBOX_TAG_TUPLE,
+    MS_NANBOX_TAG_SET,
+    MS_NANBOX_TAG_CLASS,
+    MS_NANBOX_TAG_INSTANCE,
+    MS_NANBOX_TAG_BOUND_METHOD,
+    MS_NANBOX_TAG_EXCEPTION,
+    MS_NANBOX_TAG_BOX
+};
+
+#define MS_NANBOX_INT_MIN (-((int64_t)1 << 47))
+#define MS_NANBOX_INT_MAX (((int64_t)1 << 47) - 1)
+
+typedef struct {
+    ms_value_type_t type;  // MS_VAL_INT 或 MS_VAL_MODULE
+    union {
+        int64_t integer;
+        void* module;
+    } as;
+} ms_value_box_t;
+
+extern const ms_value_type_t ms_nanbox_tag_types[16];
+
+static inline unsigned ms_nanbox_tag(uint64_t bits) {
+    if ((bits & MS_NANBOX_QNAN) != MS_NANBOX_QNAN) return 0;
+    return (unsigned)(((bits >> 60) & 8) | ((bits >> 48) & 7));
+}
+
+static inline ms_value_t ms_nanbox_make(unsigned tag, uint64_t payload) {
+    ms_value_t value;
+    value.bits = MS_NANBOX_QNAN | ((uint64_t)(tag & 8) << 60) |
+                 ((uint64_t)(tag & 7) << 48) | (payload & MS_NANBOX_PAYLOAD);
+    return value;
+}
+
+static inline void* ms_nanbox_pointer(ms_value_t value) {
+    return (void*)(uintptr_t)(value.bits & MS_NANBOX_PAYLOAD);
+}
+
+static inline ms_value_type_t ms_nanbox_type(ms_value_t value) {
+    unsigned tag = ms_nanbox_tag(value.bits);
+    if (tag == MS_NANBOX_TAG_BOX) return ((ms_value_box_t*)ms_nanbox_pointer(value))->type;
+    if (tag == MS_NANBOX_TAG_SPECIAL) {
+        return (value.bits & MS_NANBOX_PAYLOAD) == 0 ? MS_VAL_NIL : MS_VAL_BOOL;
+    }
+    return ms_nanbox_tag_types[tag];
+}
+
+static inline int64_t ms_nanbox_integer(ms_value_t value) {
+    if (ms_nanbox_tag(value.bits) == MS_NANBOX_TAG_INT) {
+        // 48 位负载符号扩展
+        return (int64_t)(value.bits << 16) >> 16;
+    }
+    return ((ms_value_box_t*)ms_nanbox_pointer(value))->as.integer;
+}
+
+static inline double ms_nanbox_floating(ms_value_t value) {
+    double d;
+    memcpy(&d, &value.bits, sizeof(d));
+    return d;
+}
+
+static inline ms_value_t ms_nanbox_from_float(double d) {
+    ms_value_t value;
+    if (d != d) {
+        value.bits = MS_NANBOX_CANONICAL_NAN;
+    } else {
+        memcpy(&value.bits, &d, sizeof(d));
+    }
+    return value;
+}
+
+static inline ms_value_t ms_nanbox_from_int(int64_t i) {
+    if (i >= MS_NANBOX_INT_MIN && i <= MS_NANBOX_INT_MAX) {
+        return ms_nanbox_make(MS_NANBOX_TAG_INT, (uint64_t)i);
+    }
+    return ms_value_int(i);  // 堆上装箱
+}
+
+#define MS_VALUE_TYPE(v)      ms_nanbox_type(v)
+#define MS_AS_BOOLEAN(v)      (((v).bits & MS_NANBOX_PAYLOAD) == 2)
+#define MS_AS_INTEGER(v)      ms_nanbox_integer(v)
+#define MS_AS_FLOATING(v)     ms_nanbox_floating(v)
+#define MS_STRING_POINTER(v)  ((char*)ms_nanbox_pointer(v))
+#define MS_AS_FUNCTION(v)     ms_nanbox_pointer(v)
+#define MS_AS_NATIVE_FUNC(v)  ((ms_native_func_t*)ms_nanbox_pointer(v))
+#define MS_AS_MODULE(v)       (((ms_value_box_t*)ms_nanbox_pointer(v))->as.module)
+#define MS_AS_OBJECT(v)       ms_nanbox_pointer(v)
+
+#define MS_BOOL_VALUE(b)      ms_nanbox_make(MS_NANBOX_TAG_SPECIAL, (b) ? 2 : 1)
+#define MS_INT_VALUE(i)       ms_nanbox_from_int(i)
+#define MS_FLOAT_VALUE(d)     ms_nanbox_from_float(d)
+#define MS_STRING_VALUE(s)    ms_nanbox_make(MS_NANBOX_TAG_STRING, (uint64_t)(uintptr_t)(s))
+
+#else
+
+static inline ms_value_t ms_value_make_bool(bool b) {
+    ms_value_t value;
+    value.type = MS_VAL_BOOL;
+    value.as.boolean = b;
+    return value;
+}
+
+static inline ms_value_t ms_value_make_int(int64_t i) {
+    ms_value_t value;
+    value.type = MS_VAL_INT;
+    value.as.integer = i;
+    return value;
+}
+
+static inline ms_value_t ms_value_make_float(double d) {
+    ms_value_t value;
+    value.type = MS_VAL_FLOAT;
+    value.as.floating = d;
+    return value;
+}
+
+static inline ms_value_t ms_value_make_string(char* s) {
+    ms_value_t value;
+    value.type = MS_VAL_STRING;
+    value.as.string = s;
+    return value;
+}
+
+#define MS_VALUE_TYPE(v)      ((v).type)
+#define MS_AS_BOOLEAN(v)      ((v).as.boolean)
+#define MS_AS_INTEGER(v)      ((v).as.integer)
+#define MS_AS_FLOATING(v)     ((v).as.floating)
+#define MS_STRING_POINTER(v)  ((v).as.string)
+#define MS_AS_FUNCTION(v)     ((void*)(v).as.function)
+#define MS_AS_NATIVE_FUNC(v)  ((v).as.native_func)
+#define MS_AS_MODULE(v)       ((v).as.module)
+#define MS_AS_OBJECT(v)       ((void*)(v).as.object)
+
+#define MS_BOOL_VALUE(b)      ms_value_make_bool(b)
+#define MS_INT_VALUE(i)       ms_value_make_int(i)
+#define MS_FLOAT_VALUE(d)     ms_value_make_float(d)
+#define MS_STRING_VALUE(s)    ms_value_make_string(s)  // 接管 s，不复制
+
+#endif
+
+// 字符串对象：值里存的是 chars 的地址 (MS_AS_STRING 仍然是以 '\0' 结尾的
+// C 字符串)，哈希放在它前面，第一次用到时计算并缓存 (0 表示还没算)。
+// 长度不单独存：GC 头里已经有对象大小，长度由它推出来，这样字符串只比原来
+// 多 4 字节，短字符串仍落在同一档 malloc 大小里。
+// 驻留 (interned) 的字符串内容唯一：两个驻留字符串相等当且仅当指针相同。
+// 字符串常量和以 C 字符串插入的字典键 (类的方法名、模块成员名) 是驻留的；
+// 驻留表是弱引用，字符串被回收时从表里删除。
+typedef struct {
+    uint32_t hash;
+    char chars[];
+} ms_string_t;
+
+// 不超过这个长度的字符串从 GC 的固定大小格子里分配 (见 gc.c)
+#ifndef MS_SMALL_STRING_MAX
+#define MS_SMALL_STRING_MAX 15
+#endif
+
+#define MS_STRING_HEADER(s) ((ms_string_t*)((char*)(s) - offsetof(ms_string_t, chars)))
+#define MS_STRING_OBJECT(s) ((ms_gc_object_t*)MS_STRING_HEADER(s) - 1)
+
+static inline uint32_t ms_string_length(const char* s) {
+    return MS_STRING_OBJECT(s)->size - (uint32_t)(sizeof(ms_gc_object_t) + sizeof(ms_string_t) + 1);
+}
+
+static inline bool ms_string_interned(const char* s) {
+    return (MS_STRING_OBJECT(s)->flags & MS_GC_FLAG_INTERNED) != 0;
+}
+
+static inline uint32_t ms_string_hash(const char* s) {
+    ms_string_t* string = MS_STRING_HEADER(s);
+    if (string->hash == 0) {
+        string->hash = ms_hash_bytes(s, ms_string_length(s));
+    }
+    return string->hash;
+}
+
+// 绳结点：拼接出的长字符串先只记下左右两段 (都是字符串值，也可能还是绳结点)，
+// 第一次需要内容时一次拼成平坦字符串缓存在 flat 里，并放掉左右两段。
+// s = s + x 这样的循环因此每步只分配一个结点，不再反复复制整个字符串。
+// 结点也是 MS_GC_STRING 对象，GC 头里的 MS_GC_FLAG_ROPE 区分两者；值里的指针
+// 同样指向 hash 之后的位置，所以 MS_STRING_HEADER/MS_STRING_OBJECT 对两者都适用。
+typedef struct {
+    uint32_t hash;  // 只占位，和 ms_string_t.hash 对齐
+    uint32_t length;
+    char* flat;
+    ms_value_t left;
+    ms_value_t right;
+} ms_rope_t;
+
+// 结果短于这个长度的拼接直接复制，不建绳结点
+#ifndef MS_ROPE_MIN
+#define MS_ROPE_MIN 64
+#endif
+
+#define MS_ROPE(s) ((ms_rope_t*)MS_STRING_HEADER(s))
+
+static inline bool ms_string_is_rope(const char* s) {
+    return (MS_STRING_OBJECT(s)->flags & MS_GC_FLAG_ROPE) != 0;
+}
+
+char* ms_rope_flatten(char* rope);
+
+static inline char* ms_string_chars(char* s) {
+    return ms_string_is_rope(s) ? ms_rope_flatten(s) : s;
+}
+
+#define MS_AS_STRING(v) ms_string_chars(MS_STRING_POINTER(v))
+
+// 字符串值的长度，绳结点不必拼平
+static inline uint32_t ms_string_value_length(ms_value_t value) {
+    char* s = MS_STRING_POINTER(value);
+    return ms_string_is_rope(s) ? MS_ROPE(s)->length : ms_string_length(s);
+}
+
+static inline bool ms_string_equal(const char* a, const char* b) {
+    if (a == b) return true;
+    uint32_t length = ms_string_length(a);
+    if (length != ms_string_length(b)) return false;
+    if (ms_string_interned(a) && ms_string_interned(b)) return false;
+    uint32_t x = MS_STRING_HEADER(a)->hash;
+    uint32_t y = MS_STRING_HEADER(b)->hash;
+    if (x != 0 && y != 0 && x != y) return false;
+    return memcmp(a, b, length) == 0;
+}
+
+// 分配 length 字节 (另加结尾的 '\0') 的字符串，返回可写的 chars，
+// 调用方填好内容后用 MS_STRING_VALUE 包装
+char* ms_string_alloc(size_t length);
+ms_value_t ms_string_copy(const char* chars, size_t length);
+// a + b (两边都是字符串值)：短结果直接复制，长结果建绳结点
+ms_value_t ms_string_concat(ms_value_t a, ms_value_t b);
+// 返回内容相同的驻留字符串；没有时把 string 自己登记进驻留表，不复制
+ms_value_t ms_string_intern(ms_value_t string);
+ms_value_t ms_string_intern_chars(const char* chars, size_t length);
+// 回收驻留字符串时由 GC 调用
+void ms_string_unintern(const char* chars);
+// 单字节字符串 (驻留，整个进程共用一份)，字符串遍历、下标和切片用它代替每次分配
+ms_value_t ms_string_char(unsigned char c);
+ms_value_t ms_string_slice(ms_value_t string, int start, int stop, int step);
+
+#endif // MS_VALUE_H
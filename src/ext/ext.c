@@ -21,34 +21,77 @@
 #endif
 
 // 扩展注册表
+// 每个模块名一张命名空间 dict：函数名 -> 原生函数值 (注册时创建一次)。
+// 同名模块 (比如重复 import 的动态库) 共用一个命名空间，同名函数以先注册的为准。
+// modules (模块名 -> 命名空间) 登记为 GC 根，第一次注册时创建
 typedef struct {
     ms_extension_t* extensions[32];
     int count;
+    ms_value_t modules;
+    bool initialized;
 } ms_extension_registry_t;
 
 static ms_extension_registry_t registry = {0};
 
 void ms_register_extension(ms_vm_t* vm, ms_extension_t* ext) {
+    (void)vm;
     if (registry.count >= 32) {
         return;
     }
-    registry.extensions[registry.count++] = ext;
+    if (!registry.initialized) {
+        registry.modules = ms_value_dict(ms_dict_new());
+        ms_gc_add_root(&registry.modules);
+        registry.initialized = true;
+    }
+    int index = registry.count++;
+    registry.extensions[index] = ext;
+
+    ms_dict_t* modules = ms_value_as_dict(registry.modules);
+    ms_dict_entry_t* module_entry = ms_dict_find(modules, ext->name);
+    ms_dict_t* ns;
+    if (module_entry != NULL) {
+        ns = ms_value_as_dict(module_entry->value);
+    } else {
+        ns = ms_dict_new();
+        ms_dict_set(modules, ext->name, ms_value_dict(ns));
+    }
+    for (int j = 0; j < ext->function_count; j++) {
+        if (!ms_dict_has(ns, ext->functions[j].name)) {
+            ms_dict_set(ns, ext->functions[j].name, ms_value_native_func(ext->functions[j].func));
+        }
+    }
 }
 
-ms_value_t ms_call_extension_function(ms_vm_t* vm, const char* module, const char* func, int argc, ms_value_t* args) {
-    // 查找模块
-    for (int i = 0; i < registry.count; i++) {
-        if (strcmp(registry.extensions[i]->name, module) == 0) {
-            // 查找函数
-            for (int j = 0; j < registry.extensions[i]->function_count; j++) {
-                if (strcmp(registry.extensions[i]->functions[j].name, func) == 0) {
-                    return registry.extensions[i]->functions[j].func(vm, argc, args);
-                }
+// 模块里没有的函数：调用时返回 None
+static ms_value_t missing_function(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    (void)argc;
+    (void)args;
+    return ms_value_nil();
+}
+
+ms_value_t ms_extension_function(const char* module, const char* func) {
+    static ms_value_t missing;
+    static bool missing_created = false;
+    if (registry.initialized) {
+        ms_dict_entry_t* module_entry = ms_dict_find(ms_value_as_dict(registry.modules), module);
+        if (module_entry != NULL) {
+            ms_dict_entry_t* func_entry = ms_dict_find(ms_value_as_dict(module_entry->value), func);
+            if (func_entry != NULL) {
+                return func_entry->value;
             }
         }
     }
-    
-    return ms_value_nil();
+    if (!missing_created) {
+        missing = ms_value_native_func(missing_function);
+        missing_created = true;
+    }
+    return missing;
+}
+
+ms_value_t ms_call_extension_function(ms_vm_t* vm, const char* module, const char* func, int argc, ms_value_t* args) {
+    ms_value_t function = ms_extension_function(module, func);
+    return MS_AS_NATIVE_FUNC(function)->func(vm, argc, args);
 }
 
 // 动态库加载函数
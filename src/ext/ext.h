@@ -27,6 +27,9 @@ typedef struct {
 // 扩展API
 void ms_register_extension(ms_vm_t* vm, ms_extension_t* ext);
 ms_value_t ms_call_extension_function(ms_vm_t* vm, const char* module, const char* func, int argc, ms_value_t* args);
+// 模块函数对应的原生函数值 (module.func 取属性的结果)；没有这个函数时
+// 返回一个调用后得到 None 的占位函数
+ms_value_t ms_extension_function(const char* module, const char* func);
 
 // 动态库加载API
 ms_dynamic_extension_t* ms_load_extension_library(const char* lib_path);
@@ -1,7 +1,12 @@
 #include "http.h"
+#include "../vm/generator.h"
+#include "../core/class.h"
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -24,22 +29,68 @@
     #define ASYNC_IO_KQUEUE 1
 #endif
 
-// 异步请求结构
+// 协程任务。任务号就是下标，一次 http.run() 结束后清空
+typedef enum {
+    MS_TASK_READY,       // 在就绪队列里等着恢复
+    MS_TASK_SLEEPING,    // 在定时器堆里
+    MS_TASK_WAITING_IO,  // 在某个 fd 的等待链表里
+    MS_TASK_JOINING,     // 等另一个任务结束
+    MS_TASK_DONE
+} ms_task_state_t;
+
+typedef struct {
+    ms_task_state_t state;
+    int next_waiter;     // 等同一个 fd 同一方向的下一个任务，-1 结束
+    int first_joiner;    // 等这个任务结束的任务，经 next_joiner 串成链表，-1 结束
+    int next_joiner;
+} ms_async_task_t;
+
+// 一个 fd 上等待的任务：可读和可写分成两个链表，同一个 fd 可以有多个任务在等，
+// 也可以一个任务读、一个任务写。events 是登记在 epoll 里的事件 (EPOLLIN/EPOLLOUT)
+typedef struct {
+    int first_reader;
+    int first_writer;
+    int events;
+} ms_async_fd_t;
+
 typedef struct {
-    ms_http_request_t request;
-    ms_http_response_t response;
-    int socket;
-    char* buffer;
-    int buffer_size;
-    int bytes_received;
-} ms_http_async_request_t;
+    int64_t deadline;    // 单调时钟毫秒
+    int task;
+} ms_async_timer_t;
 
 // 事件循环状态
 typedef struct {
     int running;
-    int max_requests;
-    ms_http_async_request_t* requests;
-    int request_count;
+    bool initialized;
+    ms_vm_t* vm;         // 报告等待请求错误用
+    int main_task;       // http.run() 的协程，结束时事件循环停下；-1 表示跑完所有任务
+
+    ms_async_task_t* tasks;
+    int task_count;
+    int task_capacity;
+
+    // 任务的协程和下一次恢复时送进去的值 (结束后是返回值)，下标是任务号。
+    // 两个 list 登记为 GC 根：恢复协程会执行脚本，期间可能回收
+    ms_value_t coroutines;
+    ms_value_t values;
+
+    // http.sleep/wait_readable/wait_writable/join 返回的等待请求的类 (可以直接 await)，
+    // 实例的 kind 属性是 "sleep"/"read"/"write"/"join"，arg 是毫秒数、fd 或任务号
+    ms_value_t wait_request_class;
+    ms_shape_t* wait_request_shape;  // 有 kind、arg 两个属性的 shape，创建请求时直接写槽位
+
+    int* ready;          // 就绪队列，ready[ready_head..ready_count) 还没执行
+    int ready_head;
+    int ready_count;
+    int ready_capacity;
+
+    ms_async_timer_t* timers;  // 按 deadline 的最小堆
+    int timer_count;
+    int timer_capacity;
+
+    ms_async_fd_t* fds;  // 下标是 fd
+    int fd_capacity;
+    int io_waiting;      // 正在等 fd 的任务数
     
 #ifdef ASYNC_IO_IOCP
     HANDLE completion_port;
@@ -97,12 +148,102 @@ static ms_value_t http_request(ms_vm_t* vm, int argc, ms_value_t* args) {
     return ms_value_string(response);
 }
 
-// 初始化事件循环
+// ============ 协程事件循环 ============
+//
+// async def 函数返回的协程 (src/vm/generator.h) 由这里驱动：每个任务是一个
+// 协程，恢复它一直执行到最外层的 await 交出等待请求。等待请求是
+// http.sleep()/http.wait_readable()/http.wait_writable()/http.join() 返回的
+// (种类, 参数) 元组，事件循环把任务挂到定时器堆、epoll/kqueue 或被等待的任务上，
+// 条件满足后把结果送回协程继续执行。任务在等待时只占一个挂起的协程，
+// 一个 VM 可以同时挂着成千上万个任务。
+
+#define GROW_CAPACITY(capacity) ((capacity) < 16 ? 16 : (capacity) * 2)
+
+static int64_t monotonic_ms(void) {
+#ifdef _WIN32
+    return (int64_t)GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+static bool loop_error(ms_exception_kind_t kind, const char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    ms_vm_raise(event_loop.vm, kind, "%s", message);
+    return false;
+}
+
+static ms_value_t* task_coroutines(void) {
+    return ms_value_as_list(event_loop.coroutines)->elements;
+}
+
+static ms_value_t* task_values(void) {
+    return ms_value_as_list(event_loop.values)->elements;
+}
+
+static void make_ready(int task, ms_value_t sent) {
+    if (event_loop.ready_count == event_loop.ready_capacity) {
+        event_loop.ready_capacity = GROW_CAPACITY(event_loop.ready_capacity);
+        event_loop.ready = realloc(event_loop.ready, sizeof(int) * event_loop.ready_capacity);
+    }
+    event_loop.ready[event_loop.ready_count++] = task;
+    event_loop.tasks[task].state = MS_TASK_READY;
+    task_values()[task] = sent;
+}
+
+static void timer_push(int64_t deadline, int task) {
+    if (event_loop.timer_count == event_loop.timer_capacity) {
+        event_loop.timer_capacity = GROW_CAPACITY(event_loop.timer_capacity);
+        event_loop.timers = realloc(event_loop.timers,
+                                    sizeof(ms_async_timer_t) * event_loop.timer_capacity);
+    }
+    ms_async_timer_t* heap = event_loop.timers;
+    int i = event_loop.timer_count++;
+    while (i > 0 && heap[(i - 1) / 2].deadline > deadline) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i].deadline = deadline;
+    heap[i].task = task;
+}
+
+static void timer_pop(void) {
+    ms_async_timer_t* heap = event_loop.timers;
+    ms_async_timer_t last = heap[--event_loop.timer_count];
+    int count = event_loop.timer_count;
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= count) break;
+        if (child + 1 < count && heap[child + 1].deadline < heap[child].deadline) child++;
+        if (heap[child].deadline >= last.deadline) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (count > 0) heap[i] = last;
+}
+
+// 初始化事件循环 (第一次提交任务或创建等待请求时自动调用)
 void ms_http_event_loop_init(void) {
+    if (event_loop.initialized) return;
+    event_loop.initialized = true;
     event_loop.running = 0;
-    event_loop.max_requests = 256;
-    event_loop.request_count = 0;
-    event_loop.requests = malloc(sizeof(ms_http_async_request_t) * event_loop.max_requests);
+    event_loop.main_task = -1;
+    event_loop.coroutines = ms_value_list(ms_list_new());
+    event_loop.values = ms_value_list(ms_list_new());
+    ms_class_t* request_class = ms_class_new("WaitRequest");
+    request_class->is_awaitable = true;
+    event_loop.wait_request_class = ms_value_class(request_class);
+    event_loop.wait_request_shape = ms_shape_add(ms_shape_add(request_class->root_shape, "kind"), "arg");
+    ms_gc_add_root(&event_loop.coroutines);
+    ms_gc_add_root(&event_loop.values);
+    ms_gc_add_root(&event_loop.wait_request_class);
     
 #ifdef ASYNC_IO_IOCP
     event_loop.completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
@@ -113,44 +254,253 @@ void ms_http_event_loop_init(void) {
 #endif
 }
 
-// 运行事件循环
-void ms_http_event_loop_run(void) {
-    event_loop.running = 1;
-    
-#ifdef ASYNC_IO_IOCP
-    // Windows IOCP实现
-    OVERLAPPED_ENTRY entries[64];
-    ULONG count;
-    
-    while (event_loop.running) {
-        if (GetQueuedCompletionStatusEx(event_loop.completion_port, entries, 64, &count, 100, FALSE)) {
-            for (ULONG i = 0; i < count; i++) {
-                // 处理完成的I/O操作
-            }
+int ms_http_event_loop_spawn(ms_vm_t* vm, ms_value_t coroutine) {
+    ms_http_event_loop_init();
+    event_loop.vm = vm;
+    if (event_loop.task_count == event_loop.task_capacity) {
+        event_loop.task_capacity = GROW_CAPACITY(event_loop.task_capacity);
+        event_loop.tasks = realloc(event_loop.tasks,
+                                   sizeof(ms_async_task_t) * event_loop.task_capacity);
+    }
+    int task = event_loop.task_count++;
+    event_loop.tasks[task].next_waiter = -1;
+    event_loop.tasks[task].first_joiner = -1;
+    event_loop.tasks[task].next_joiner = -1;
+    // 协程归事件循环驱动，不能再被别的协程 await
+    ms_generator_t* generator = ms_value_as_generator(coroutine);
+    generator->awaiter = generator;
+    ms_list_append(ms_value_as_list(event_loop.coroutines), coroutine);
+    ms_list_append(ms_value_as_list(event_loop.values), ms_value_nil());
+    make_ready(task, ms_value_nil());
+    return task;
+}
+
+// 任务结束：记下返回值，叫醒等它的任务
+static void finish_task(int task, ms_value_t result) {
+    ms_async_task_t* done = &event_loop.tasks[task];
+    done->state = MS_TASK_DONE;
+    task_coroutines()[task] = ms_value_nil();
+    task_values()[task] = result;
+    for (int joiner = done->first_joiner; joiner >= 0; ) {
+        int next = event_loop.tasks[joiner].next_joiner;
+        make_ready(joiner, result);
+        joiner = next;
+    }
+    done->first_joiner = -1;
+    if (task == event_loop.main_task) {
+        event_loop.running = 0;
+    }
+}
+
+static ms_async_fd_t* fd_record(int fd) {
+    if (fd >= event_loop.fd_capacity) {
+        int capacity = GROW_CAPACITY(event_loop.fd_capacity);
+        while (capacity <= fd) capacity *= 2;
+        event_loop.fds = realloc(event_loop.fds, sizeof(ms_async_fd_t) * capacity);
+        for (int i = event_loop.fd_capacity; i < capacity; i++) {
+            event_loop.fds[i].first_reader = -1;
+            event_loop.fds[i].first_writer = -1;
+            event_loop.fds[i].events = 0;
         }
+        event_loop.fd_capacity = capacity;
     }
-#elif defined(ASYNC_IO_EPOLL)
-    // Linux epoll实现
-    struct epoll_event events[64];
+    return &event_loop.fds[fd];
+}
+
+#ifdef ASYNC_IO_EPOLL
+// 让 epoll 里登记的事件和 fd 上还在等的方向一致
+static int update_fd_events(int fd, ms_async_fd_t* record, int events) {
+    if (events == record->events) return 0;
+    int result;
+    if (events == 0) {
+        result = epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    } else {
+        struct epoll_event event;
+        event.events = (uint32_t)events;
+        event.data.fd = fd;
+        result = epoll_ctl(event_loop.epoll_fd, record->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                           fd, &event);
+    }
+    if (result == 0) record->events = events;
+    return result;
+}
+#endif
+
+// 叫醒一个方向上等着的所有任务，结果是 fd 本身
+static void wake_waiters(int* first, int fd) {
+    for (int task = *first; task >= 0; ) {
+        int next = event_loop.tasks[task].next_waiter;
+        event_loop.io_waiting--;
+        make_ready(task, ms_value_int(fd));
+        task = next;
+    }
+    *first = -1;
+}
+
+// 让任务等 fd 可读/可写，结果是 fd 本身。普通文件总是就绪 (epoll 不接受它们)
+static bool wait_fd(int task, int fd, bool writable) {
+    if (fd < 0) {
+        return loop_error(MS_VALUE_ERROR, "Cannot wait on file descriptor: %s.", strerror(EBADF));
+    }
+    ms_async_fd_t* record = fd_record(fd);
+#ifdef ASYNC_IO_EPOLL
+    if (update_fd_events(fd, record, record->events | (writable ? EPOLLOUT : EPOLLIN)) < 0) {
+        if (errno == EPERM) {
+            make_ready(task, ms_value_int(fd));
+            return true;
+        }
+        return loop_error(MS_RUNTIME_ERROR, "Cannot wait on file descriptor: %s.", strerror(errno));
+    }
+#elif defined(ASYNC_IO_KQUEUE)
+    // 读写是两个过滤器，各自触发一次后由 kqueue 删除
+    struct kevent event;
+    EV_SET(&event, fd, writable ? EVFILT_WRITE : EVFILT_READ, EV_ADD | EV_ONESHOT, 0, 0, NULL);
+    if (kevent(event_loop.kqueue_fd, &event, 1, NULL, 0, NULL) < 0) {
+        return loop_error(MS_RUNTIME_ERROR, "Cannot wait on file descriptor: %s.", strerror(errno));
+    }
+#else
+    (void)record;
+    (void)writable;
+    return loop_error(MS_RUNTIME_ERROR, "Waiting on file descriptors is not supported on this platform.");
+#endif
+    int* first = writable ? &record->first_writer : &record->first_reader;
+    event_loop.tasks[task].state = MS_TASK_WAITING_IO;
+    event_loop.tasks[task].next_waiter = *first;
+    *first = task;
+    event_loop.io_waiting++;
+    return true;
+}
+
+// 按协程交出的等待请求挂起任务
+static bool handle_request(int task, ms_value_t request) {
+    ms_instance_t* instance = ms_value_is_instance(request) ? ms_value_as_instance(request) : NULL;
+    ms_value_t kind_value;
+    ms_value_t arg;
+    if (instance == NULL || instance->klass != ms_value_as_class(event_loop.wait_request_class) ||
+        !ms_instance_get(instance, "kind", &kind_value) || !ms_instance_get(instance, "arg", &arg) ||
+        !ms_value_is_string(kind_value) || !ms_value_is_int(arg)) {
+        return loop_error(MS_TYPE_ERROR, "Coroutine yielded a value that is not an http wait request.");
+    }
+    const char* kind = ms_value_as_string(kind_value);
     
-    while (event_loop.running) {
-        int nfds = epoll_wait(event_loop.epoll_fd, events, 64, 100);
-        for (int i = 0; i < nfds; i++) {
-            // 处理事件
+    if (strcmp(kind, "sleep") == 0) {
+        int64_t delay = ms_value_as_int(arg);
+        if (delay <= 0) {
+            make_ready(task, ms_value_nil());
+        } else {
+            event_loop.tasks[task].state = MS_TASK_SLEEPING;
+            timer_push(monotonic_ms() + delay, task);
         }
+        return true;
+    }
+    if (strcmp(kind, "read") == 0 || strcmp(kind, "write") == 0) {
+        return wait_fd(task, (int)ms_value_as_int(arg), kind[0] == 'w');
+    }
+    if (strcmp(kind, "join") == 0) {
+        int64_t target = ms_value_as_int(arg);
+        if (target < 0 || target >= event_loop.task_count || target == task) {
+            return loop_error(MS_VALUE_ERROR, "Task %lld can't be joined.", (long long)target);
+        }
+        ms_async_task_t* joined = &event_loop.tasks[target];
+        if (joined->state == MS_TASK_DONE) {
+            make_ready(task, task_values()[target]);
+        } else {
+            event_loop.tasks[task].state = MS_TASK_JOINING;
+            event_loop.tasks[task].next_joiner = joined->first_joiner;
+            joined->first_joiner = task;
+        }
+        return true;
+    }
+    return loop_error(MS_VALUE_ERROR, "Unknown wait request '%s'.", kind);
+}
+
+// 恢复一个就绪的任务，执行到它下一次等待或结束
+static bool step_task(int task) {
+    ms_value_t coroutine = task_coroutines()[task];
+    ms_value_t sent = task_values()[task];
+    task_values()[task] = ms_value_nil();
+    
+    ms_value_t request;
+    ms_iter_result_t result = ms_generator_resume(ms_value_as_generator(coroutine), sent, &request);
+    if (result == MS_ITER_ERROR) return false;
+    if (result == MS_ITER_END) {
+        finish_task(task, request);
+        return true;
+    }
+    return handle_request(task, request);
+}
+
+// 等 I/O 或下一个定时器，最多 timeout 毫秒 (-1 表示一直等)，把就绪的任务放进队列
+static void poll_events(int timeout) {
+#ifdef ASYNC_IO_EPOLL
+    struct epoll_event events[64];
+    int nfds = epoll_wait(event_loop.epoll_fd, events, 64, timeout);
+    for (int i = 0; i < nfds; i++) {
+        // 出错或挂断时两个方向都叫醒，由任务自己去读写时发现
+        int fd = events[i].data.fd;
+        ms_async_fd_t* record = &event_loop.fds[fd];
+        uint32_t ready = events[i].events;
+        if (ready & (EPOLLIN | EPOLLERR | EPOLLHUP)) wake_waiters(&record->first_reader, fd);
+        if (ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)) wake_waiters(&record->first_writer, fd);
+        update_fd_events(fd, record, (record->first_reader >= 0 ? EPOLLIN : 0) |
+                                     (record->first_writer >= 0 ? EPOLLOUT : 0));
     }
 #elif defined(ASYNC_IO_KQUEUE)
-    // macOS kqueue实现
     struct kevent events[64];
-    struct timespec timeout = {0, 100000000}; // 100ms
+    struct timespec wait = {timeout / 1000, (timeout % 1000) * 1000000L};
+    int nfds = kevent(event_loop.kqueue_fd, NULL, 0, events, 64, timeout < 0 ? NULL : &wait);
+    for (int i = 0; i < nfds; i++) {
+        int fd = (int)events[i].ident;
+        ms_async_fd_t* record = &event_loop.fds[fd];
+        wake_waiters(events[i].filter == EVFILT_WRITE ? &record->first_writer
+                                                      : &record->first_reader, fd);
+    }
+#elif defined(ASYNC_IO_IOCP)
+    // 不支持等 fd，只用来睡到下一个定时器
+    OVERLAPPED_ENTRY entries[64];
+    ULONG count;
+    GetQueuedCompletionStatusEx(event_loop.completion_port, entries, 64, &count,
+                                timeout < 0 ? INFINITE : (DWORD)timeout, FALSE);
+#endif
+    
+    int64_t now = monotonic_ms();
+    while (event_loop.timer_count > 0 && event_loop.timers[0].deadline <= now) {
+        int task = event_loop.timers[0].task;
+        timer_pop();
+        make_ready(task, ms_value_nil());
+    }
+}
+
+// 运行事件循环，直到 main_task 结束或者没有任务可执行、可等待。
+// 任务出错时停下并返回 false，错误留在 VM 上
+bool ms_http_event_loop_run(void) {
+    if (!event_loop.initialized) return true;
+    event_loop.running = 1;
+    bool ok = true;
     
     while (event_loop.running) {
-        int nfds = kevent(event_loop.kqueue_fd, NULL, 0, events, 64, &timeout);
-        for (int i = 0; i < nfds; i++) {
-            // 处理事件
+        while (event_loop.ready_head < event_loop.ready_count && event_loop.running) {
+            int task = event_loop.ready[event_loop.ready_head++];
+            if (!step_task(task)) {
+                ok = false;
+                event_loop.running = 0;
+            }
         }
+        if (event_loop.ready_head == event_loop.ready_count) {
+            event_loop.ready_head = event_loop.ready_count = 0;
+        }
+        if (!event_loop.running) break;
+        if (event_loop.timer_count == 0 && event_loop.io_waiting == 0) break;
+        
+        int timeout = -1;
+        if (event_loop.timer_count > 0) {
+            int64_t delay = event_loop.timers[0].deadline - monotonic_ms();
+            timeout = delay < 0 ? 0 : (int)delay;
+        }
+        poll_events(timeout);
     }
-#endif
+    event_loop.running = 0;
+    return ok;
 }
 
 // 停止事件循环
@@ -158,8 +508,40 @@ void ms_http_event_loop_stop(void) {
     event_loop.running = 0;
 }
 
+// 丢弃所有任务 (还在等的 fd 从 epoll/kqueue 里注销)，任务号从 0 重新开始
+static void reset_tasks(void) {
+    for (int fd = 0; fd < event_loop.fd_capacity; fd++) {
+        ms_async_fd_t* record = &event_loop.fds[fd];
+#ifdef ASYNC_IO_EPOLL
+        update_fd_events(fd, record, 0);
+#elif defined(ASYNC_IO_KQUEUE)
+        struct kevent event;
+        if (record->first_reader >= 0) {
+            EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+            kevent(event_loop.kqueue_fd, &event, 1, NULL, 0, NULL);
+        }
+        if (record->first_writer >= 0) {
+            EV_SET(&event, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+            kevent(event_loop.kqueue_fd, &event, 1, NULL, 0, NULL);
+        }
+#endif
+        record->first_reader = -1;
+        record->first_writer = -1;
+        record->events = 0;
+    }
+    event_loop.task_count = 0;
+    event_loop.ready_head = event_loop.ready_count = 0;
+    event_loop.timer_count = 0;
+    event_loop.io_waiting = 0;
+    event_loop.main_task = -1;
+    ms_value_as_list(event_loop.coroutines)->count = 0;
+    ms_value_as_list(event_loop.values)->count = 0;
+}
+
 // 清理事件循环
 void ms_http_event_loop_cleanup(void) {
+    if (!event_loop.initialized) return;
+    reset_tasks();
 #ifdef ASYNC_IO_IOCP
     if (event_loop.completion_port) {
         CloseHandle(event_loop.completion_port);
@@ -173,17 +555,103 @@ void ms_http_event_loop_cleanup(void) {
         close(event_loop.kqueue_fd);
     }
 #endif
-    
-    if (event_loop.requests) {
-        free(event_loop.requests);
+    ms_gc_remove_root(&event_loop.wait_request_class);
+    ms_gc_remove_root(&event_loop.values);
+    ms_gc_remove_root(&event_loop.coroutines);
+    free(event_loop.tasks);
+    free(event_loop.ready);
+    free(event_loop.timers);
+    free(event_loop.fds);
+    memset(&event_loop, 0, sizeof(event_loop));
+}
+
+// 还没开始执行、也没有被 await 的协程才能作为任务提交
+static bool is_new_coroutine(ms_value_t value) {
+    return ms_value_is_coroutine(value) &&
+           ms_value_as_generator(value)->state == MS_GENERATOR_CREATED &&
+           ms_value_as_generator(value)->awaiter == NULL;
+}
+
+// http.run(coro)：在事件循环里执行协程 (以及它 spawn 出来的任务)，返回协程的返回值。
+// 协程结束时还没完成的其他任务被丢弃
+static ms_value_t http_run(ms_vm_t* vm, int argc, ms_value_t* args) {
+    if (argc != 1 || !is_new_coroutine(args[0])) {
+        ms_vm_raise(vm, MS_TYPE_ERROR, "run() expects a new coroutine.");
+        return ms_value_nil();
     }
+    if (event_loop.running) {
+        ms_vm_raise(vm, MS_RUNTIME_ERROR, "Event loop is already running.");
+        return ms_value_nil();
+    }
+    int task = ms_http_event_loop_spawn(vm, args[0]);
+    event_loop.main_task = task;
+    bool ok = ms_http_event_loop_run();
+    ms_value_t result = ms_value_nil();
+    if (ok && event_loop.tasks[task].state != MS_TASK_DONE) {
+        loop_error(MS_RUNTIME_ERROR, "Coroutine never finished: every task is waiting on another task.");
+    } else if (ok) {
+        result = task_values()[task];
+    }
+    reset_tasks();
+    return result;
+}
+
+// http.spawn(coro)：提交一个并发任务，返回任务号 (给 http.join 用)
+static ms_value_t http_spawn(ms_vm_t* vm, int argc, ms_value_t* args) {
+    if (argc != 1 || !is_new_coroutine(args[0])) {
+        ms_vm_raise(vm, MS_TYPE_ERROR, "spawn() expects a new coroutine.");
+        return ms_value_nil();
+    }
+    return ms_value_int(ms_http_event_loop_spawn(vm, args[0]));
+}
+
+// 等待请求：WaitRequest 实例，只能 await (OP_AWAIT 按类的 is_awaitable 把它交给事件循环)
+static ms_value_t wait_request(const char* kind, int64_t arg) {
+    ms_http_event_loop_init();
+    ms_instance_t* request = ms_instance_new(ms_value_as_class(event_loop.wait_request_class));
+    ms_shape_t* shape = event_loop.wait_request_shape;
+    ms_instance_set_slot(request, shape->parent, 0, ms_string_intern_chars(kind, strlen(kind)));
+    ms_instance_set_slot(request, shape, 1, ms_value_int(arg));
+    return ms_value_instance(request);
+}
+
+// await http.sleep(seconds)
+static ms_value_t http_sleep(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    double seconds = 0;
+    if (argc > 0 && ms_value_is_int(args[0])) {
+        seconds = (double)ms_value_as_int(args[0]);
+    } else if (argc > 0 && ms_value_is_float(args[0])) {
+        seconds = ms_value_as_float(args[0]);
+    }
+    return wait_request("sleep", (int64_t)(seconds * 1000));
+}
+
+// await http.wait_readable(fd) / await http.wait_writable(fd)，结果是 fd
+static ms_value_t http_wait_readable(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    if (argc < 1 || !ms_value_is_int(args[0])) return ms_value_nil();
+    return wait_request("read", ms_value_as_int(args[0]));
+}
+
+static ms_value_t http_wait_writable(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    if (argc < 1 || !ms_value_is_int(args[0])) return ms_value_nil();
+    return wait_request("write", ms_value_as_int(args[0]));
+}
+
+// await http.join(task)：等 spawn 出来的任务结束，结果是它的返回值
+static ms_value_t http_join(ms_vm_t* vm, int argc, ms_value_t* args) {
+    (void)vm;
+    if (argc < 1 || !ms_value_is_int(args[0])) return ms_value_nil();
+    return wait_request("join", ms_value_as_int(args[0]));
 }
 
 // 创建HTTP扩展
 ms_extension_t* ms_http_extension_create(void) {
     ms_extension_t* ext = malloc(sizeof(ms_extension_t));
     ext->name = "http";
-    ext->function_count = 3;
+    ext->function_count = 9;
     
     ext->functions[0].name = "get";
     ext->functions[0].func = http_get;
@@ -194,6 +662,24 @@ ms_extension_t* ms_http_extension_create(void) {
     ext->functions[2].name = "request";
     ext->functions[2].func = http_request;
     
+    ext->functions[3].name = "run";
+    ext->functions[3].func = http_run;
+    
+    ext->functions[4].name = "spawn";
+    ext->functions[4].func = http_spawn;
+    
+    ext->functions[5].name = "sleep";
+    ext->functions[5].func = http_sleep;
+    
+    ext->functions[6].name = "wait_readable";
+    ext->functions[6].func = http_wait_readable;
+    
+    ext->functions[7].name = "wait_writable";
+    ext->functions[7].func = http_wait_writable;
+    
+    ext->functions[8].name = "join";
+    ext->functions[8].func = http_join;
+    
     return ext;
 }
 
@@ -26,9 +26,12 @@ typedef void (*ms_http_callback_t)(ms_http_response_t* response, void* userdata)
 ms_extension_t* ms_http_extension_create(void);
 void ms_http_extension_destroy(ms_extension_t* ext);
 
-// 异步I/O事件循环
+// 异步I/O事件循环：驱动 async def 协程 (脚本里用 http.run/http.spawn)
 void ms_http_event_loop_init(void);
-void ms_http_event_loop_run(void);
+// 提交协程，返回任务号
+int ms_http_event_loop_spawn(ms_vm_t* vm, ms_value_t coroutine);
+// 运行到没有任务可执行或可等待；任务出错时返回 false，错误留在 VM 上
+bool ms_http_event_loop_run(void);
 void ms_http_event_loop_stop(void);
 void ms_http_event_loop_cleanup(void);
 
@@ -48,8 +48,7 @@ static ms_value_t string_len(ms_vm_t* vm, int argc, ms_value_t* args) {
         return ms_value_nil();
     }
     
-    const char* str = ms_value_as_string(args[0]);
-    return ms_value_int((int64_t)strlen(str));
+    return ms_value_int((int64_t)ms_value_string_length(args[0]));
 }
 
 static ms_value_t string_reverse(ms_vm_t* vm, int argc, ms_value_t* args) {
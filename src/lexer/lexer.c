@@ -431,6 +431,9 @@ ms_token_t ms_lexer_scan_token(ms_lexer_t* lexer) {
         case '+': return make_token(lexer, TOKEN_PLUS);
         case ';': return make_token(lexer, TOKEN_SEMICOLON);
         case '@': return make_token(lexer, TOKEN_AT);
+        case '|': return make_token(lexer, TOKEN_PIPE);
+        case '&': return make_token(lexer, TOKEN_AMPERSAND);
+        case '^': return make_token(lexer, TOKEN_CARET);
         case '/':
             return make_token(lexer, match(lexer, '/') ? TOKEN_SLASH_SLASH : TOKEN_SLASH);
         case '*':
@@ -13,6 +13,7 @@ typedef enum {
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
     TOKEN_COLON, TOKEN_NEWLINE, TOKEN_AT,
+    TOKEN_PIPE, TOKEN_AMPERSAND, TOKEN_CARET,  // | & ^
 
     // 一个或两个字符token
     TOKEN_BANG, TOKEN_BANG_EQUAL,
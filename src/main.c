@@ -69,6 +69,7 @@ int main(int argc, const char* argv[]) {
         exit(64);
     }
     
+    ms_http_event_loop_cleanup();
     ms_http_extension_destroy(http_ext);
     ms_math_extension_destroy(math_ext);
     ms_string_extension_destroy(string_ext);
@@ -18,6 +18,7 @@ static int emit_jump(ms_parser_t* parser, uint8_t instruction);
 static void patch_jump(ms_parser_t* parser, int offset);
 static void emit_loop(ms_parser_t* parser, int loop_start);
 static void with_statement(ms_parser_t* parser);
+static void try_statement(ms_parser_t* parser);
 static void match_statement(ms_parser_t* parser);
 static void string(ms_parser_t* parser);
 static void import_statement(ms_parser_t* parser);
@@ -157,9 +158,39 @@ static int break_count = 0;
 static int continue_jumps[256];  // continue 跳转位置列表
 static int continue_count = 0;
 
+// break/continue 跳转前要先弹出循环体开始之后才有的局部变量
+// (except 子句里的异常、finally 块的值和原因，见 try_statement)
+static int loop_local_count = 0;
+
+// 正在编译的带 finally 的 try 语句，从外到内。break/continue/return 离开
+// try 语句时要先调用途经的 finally 块：depth 是 finally 块的值槽位
+// (try 语句开始时的 local_count)，calls 记录跳到 finally 块的 OP_CALL_FINALLY。
+// return 只经过当前函数的 (function_finally_base 起)，break/continue
+// 只经过当前循环里的 (loop_finally_base 起)
+typedef struct {
+    int depth;
+    int calls[64];
+    int call_count;
+} ms_finally_block_t;
+
+static ms_finally_block_t finally_blocks[32];
+static int finally_count = 0;
+static int function_finally_base = 0;
+static int loop_finally_base = 0;
+
+// 正在编译的 except 子句里异常所在的槽位，不带表达式的 raise 重新抛出它
+static int handler_exception_slot = -1;
+
 // 列表推导式计数器（用于生成唯一的临时变量名）
 static int listcomp_counter = 0;
 
+// 正在编译函数体时 in_function 为 true；函数体里出现过 yield 时 function_yields
+// 为 true，这个函数编译成生成器函数；async def 的函数体里 function_async 为 true，
+// 只有这时才能用 await。编译嵌套的函数时保存并恢复这几个值
+static bool in_function = false;
+static bool function_yields = false;
+static bool function_async = false;
+
 static void begin_scope() {
     scope_depth++;
 }
@@ -305,6 +336,9 @@ static void binary(ms_parser_t* parser) {
         case TOKEN_SLASH_SLASH:   emit_byte(parser, OP_FLOOR_DIVIDE); break;
         case TOKEN_STAR_STAR:     emit_byte(parser, OP_POWER); break;
         case TOKEN_PERCENT:       emit_byte(parser, OP_MODULO); break;
+        case TOKEN_PIPE:          emit_byte(parser, OP_BIT_OR); break;
+        case TOKEN_AMPERSAND:     emit_byte(parser, OP_BIT_AND); break;
+        case TOKEN_CARET:         emit_byte(parser, OP_BIT_XOR); break;
         default: return; // Unreachable.
     }
 }
@@ -320,6 +354,145 @@ static void literal(ms_parser_t* parser) {
 }
 
 // Parse list: [1, 2, 3] or list comprehension: [expr for var in iterable]
+// 用临时的词法分析器重新解析一段已经扫描过的表达式源码。推导式的元素表达式
+// 写在 for 之前，要等循环变量进入作用域之后才能生成代码
+static void reparse_expression(ms_parser_t* parser, const char* start, int length, int line) {
+    char* expr_copy = malloc(length + 1);
+    memcpy(expr_copy, start, length);
+    expr_copy[length] = '\0';
+    
+    ms_lexer_t temp_lexer;
+    ms_lexer_init(&temp_lexer, expr_copy);
+    temp_lexer.line = line;
+    
+    // Save current parser state
+    ms_lexer_t* original_lexer = parser->lexer;
+    ms_token_t original_current = parser->current;
+    ms_token_t original_previous = parser->previous;
+    
+    // Set up parser to use temporary lexer
+    parser->lexer = &temp_lexer;
+    parser->previous = (ms_token_t){.type = TOKEN_ERROR, .start = "", .length = 0, .line = line};
+    parser->current = ms_lexer_scan_token(&temp_lexer);
+    
+    expression(parser);
+    
+    // Restore parser state
+    parser->lexer = original_lexer;
+    parser->current = original_current;
+    parser->previous = original_previous;
+    
+    free(expr_copy);
+}
+
+// 生成器表达式 (expr for var in iterable [if cond])，调用时已经解析过 expr
+// (生成的代码已撤销)，当前 token 是 for。
+//
+// 编译成一个匿名的生成器函数并立即调用：参数是 iterable (和 Python 一样在
+// 创建时求值) 以及外层当前所有的局部变量 (按值传入，函数没有闭包)，
+// 函数体就是 for 循环里 yield expr
+static void generator_expression(ms_parser_t* parser, const char* expr_start,
+                                 int expr_length, int expr_line) {
+    ms_chunk_t* body_chunk = create_function_chunk(parser);
+    if (body_chunk == NULL) {
+        error(parser, "Too many functions.");
+        return;
+    }
+    ms_function_t* function = malloc(sizeof(ms_function_t));
+    function->chunk = body_chunk;
+    function->name = strdup("<genexpr>");
+    function->default_count = 0;
+    function->defaults = NULL;
+    function->is_generator = true;
+    function->is_coroutine = false;
+    emit_constant(parser, ms_value_function((struct ms_function*)function));
+    
+    consume(parser, TOKEN_FOR, "Expect 'for'.");
+    consume(parser, TOKEN_IDENTIFIER, "Expect variable name.");
+    ms_token_t var_name = parser->previous;
+    consume(parser, TOKEN_IN, "Expect 'in' after variable.");
+    parse_precedence(parser, PREC_OR);
+    
+    int captured = local_count;
+    if (captured >= 255) {
+        error(parser, "Too many local variables for generator expression.");
+        return;
+    }
+    for (int i = 0; i < captured; i++) {
+        emit_bytes(parser, OP_GET_LOCAL, (uint8_t)i);
+    }
+    emit_bytes(parser, OP_CALL, (uint8_t)(captured + 1));
+    function->arity = captured + 1;
+    
+    // 切换到函数体
+    ms_chunk_t* enclosing_chunk = parser->compiling_chunk;
+    ms_local_t saved_locals[256];
+    int saved_local_count = local_count;
+    int saved_scope_depth = scope_depth;
+    bool saved_in_function = in_function;
+    bool saved_function_yields = function_yields;
+    bool saved_function_async = function_async;
+    memcpy(saved_locals, locals, sizeof(locals));
+    parser->compiling_chunk = body_chunk;
+    local_count = 0;
+    scope_depth = 0;
+    in_function = true;
+    function_async = false;
+    begin_scope();
+    
+    add_local(parser, (ms_token_t){.start = "__iter__", .length = 8});
+    mark_initialized();
+    for (int i = 0; i < captured; i++) {
+        add_local(parser, saved_locals[i].name);
+        mark_initialized();
+    }
+    uint8_t iter_slot = 0;
+    emit_constant(parser, ms_value_int(0));
+    add_local(parser, (ms_token_t){.start = "__index__", .length = 9});
+    mark_initialized();
+    uint8_t index_slot = local_count - 1;
+    emit_byte(parser, OP_NIL);
+    add_local(parser, var_name);
+    mark_initialized();
+    uint8_t var_slot = local_count - 1;
+    
+    int loop_start = current_chunk(parser)->count;
+    emit_bytes(parser, OP_FOR_ITER_LOCAL, var_slot);
+    emit_byte(parser, iter_slot);
+    emit_byte(parser, index_slot);
+    int exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+    
+    int skip_jump = -1;
+    if (match(parser, TOKEN_IF)) {
+        parse_precedence(parser, PREC_OR);
+        skip_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+        emit_byte(parser, OP_POP);
+    }
+    reparse_expression(parser, expr_start, expr_length, expr_line);
+    emit_byte(parser, OP_YIELD);
+    emit_byte(parser, OP_POP);
+    emit_loop(parser, loop_start);
+    if (skip_jump >= 0) {
+        patch_jump(parser, skip_jump);
+        emit_byte(parser, OP_POP);
+        emit_loop(parser, loop_start);
+    }
+    
+    patch_jump(parser, exit_jump);
+    emit_byte(parser, OP_POP);
+    emit_byte(parser, OP_NIL);
+    emit_byte(parser, OP_RETURN);
+    
+    parser->compiling_chunk = enclosing_chunk;
+    local_count = saved_local_count;
+    scope_depth = saved_scope_depth;
+    in_function = saved_in_function;
+    function_yields = saved_function_yields;
+    function_async = saved_function_async;
+    memcpy(locals, saved_locals, sizeof(locals));
+}
+
 static void list_literal(ms_parser_t* parser) {
     // Check for empty list
     if (check(parser, TOKEN_RIGHT_BRACKET)) {
@@ -400,39 +573,7 @@ static void list_literal(ms_parser_t* parser) {
         emit_byte(parser, OP_DUP);
         
         // Re-parse the expression with the loop variable now in scope
-        // Create a temporary lexer for the expression
-        char* expr_copy = malloc(expr_length + 1);
-        memcpy(expr_copy, expr_start, expr_length);
-        expr_copy[expr_length] = '\0';
-        
-        // DEBUG: Print the expression
-        // printf("DEBUG: Reparsing expression: '%s'\n", expr_copy);
-        
-        ms_lexer_t temp_lexer;
-        ms_lexer_init(&temp_lexer, expr_copy);
-        temp_lexer.line = expr_start_line;
-        
-        // Save current parser state
-        ms_lexer_t* original_lexer = parser->lexer;
-        ms_token_t original_current = parser->current;
-        ms_token_t original_previous = parser->previous;
-        
-        // Set up parser to use temporary lexer
-        parser->lexer = &temp_lexer;
-        // Initialize previous to a dummy token
-        parser->previous = (ms_token_t){.type = TOKEN_ERROR, .start = "", .length = 0, .line = expr_start_line};
-        parser->current = ms_lexer_scan_token(&temp_lexer);
-        
-        // Parse the expression
-        expression(parser);
-        
-        // Restore parser state
-        parser->lexer = original_lexer;
-        parser->current = original_current;
-        parser->previous = original_previous;
-        
-        // Free the expression copy
-        free(expr_copy);
+        reparse_expression(parser, expr_start, expr_length, expr_start_line);
         
         // Append to list
         // Stack: [..., iter, index, var, list, list, element]
@@ -488,13 +629,8 @@ static void dict_literal(ms_parser_t* parser) {
     int first_expr_start_line = parser->current.line;
     int chunk_size_before = current_chunk(parser)->count;
     
-    // Parse first element/key
-    if (parser->current.type == TOKEN_STRING) {
-        advance(parser);
-        string(parser);
-    } else {
-        expression(parser);
-    }
+    // Parse first element/key (字典的键可以是任意表达式)
+    expression(parser);
     
     // Save first element end position
     const char* first_expr_end = parser->previous.start + parser->previous.length;
@@ -622,14 +758,7 @@ static void dict_literal(ms_parser_t* parser) {
         while (match(parser, TOKEN_COMMA)) {
             if (check(parser, TOKEN_RIGHT_BRACE)) break;
             
-            if (parser->current.type == TOKEN_STRING) {
-                advance(parser);
-                string(parser);
-            } else {
-                error(parser, "Dictionary keys must be strings.");
-                return;
-            }
-            
+            expression(parser);
             consume(parser, TOKEN_COLON, "Expect ':' after dictionary key.");
             expression(parser);
             pair_count++;
@@ -757,8 +886,20 @@ static void grouping(ms_parser_t* parser) {
         return;
     }
     
+    const char* expr_start = parser->current.start;
+    int expr_line = parser->current.line;
+    int chunk_size_before = current_chunk(parser)->count;
     expression(parser);
     
+    // (expr for x in it)：撤销 expr 的代码，编译成生成器表达式
+    if (check(parser, TOKEN_FOR)) {
+        current_chunk(parser)->count = chunk_size_before;
+        const char* expr_end = parser->previous.start + parser->previous.length;
+        generator_expression(parser, expr_start, (int)(expr_end - expr_start), expr_line);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after generator expression.");
+        return;
+    }
+    
     // Check if this is a tuple (has comma)
     if (match(parser, TOKEN_COMMA)) {
         int element_count = 1;
@@ -782,13 +923,27 @@ static void grouping(ms_parser_t* parser) {
 static void call(ms_parser_t* parser) {
     uint8_t arg_count = 0;
     if (!check(parser, TOKEN_RIGHT_PAREN)) {
-        do {
+        // 唯一的参数可以是不带括号的生成器表达式：sum(x * x for x in data)
+        const char* expr_start = parser->current.start;
+        int expr_line = parser->current.line;
+        int chunk_size_before = current_chunk(parser)->count;
+        expression(parser);
+        if (check(parser, TOKEN_FOR)) {
+            current_chunk(parser)->count = chunk_size_before;
+            const char* expr_end = parser->previous.start + parser->previous.length;
+            generator_expression(parser, expr_start, (int)(expr_end - expr_start), expr_line);
+            consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after generator expression.");
+            emit_bytes(parser, OP_CALL, 1);
+            return;
+        }
+        arg_count++;
+        while (match(parser, TOKEN_COMMA)) {
             expression(parser);
             if (arg_count == 255) {
                 error(parser, "Can't have more than 255 arguments.");
             }
             arg_count++;
-        } while (match(parser, TOKEN_COMMA));
+        }
     }
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
     
@@ -877,6 +1032,7 @@ static void attribute(ms_parser_t* parser) {
         // 属性访问: obj.attr
         emit_bytes(parser, OP_GET_PROPERTY, attr_index);
     }
+    emit_byte(parser, ms_chunk_add_property_cache(current_chunk(parser)));
 }
 
 // 全局变量名表（简化实现）
@@ -943,16 +1099,58 @@ static void string(ms_parser_t* parser) {
         quote_len = 3;  // 三引号
     }
     
-    // 去掉引号
+    // 去掉引号；字符串常量都驻留，相同内容的常量和字典键共用一个对象
     int str_len = parser->previous.length - 2 * quote_len;
-    char* str = malloc(str_len + 1);
-    memcpy(str, parser->previous.start + quote_len, str_len);
-    str[str_len] = '\0';
-    emit_constant(parser, ms_value_string(str));
-    free(str);
+    emit_constant(parser, ms_string_intern_chars(parser->previous.start + quote_len, str_len));
+}
+
+// 在 f-string 的 {...} 里找分隔格式说明的冒号：不在括号和引号里的第一个 ':'，
+// 没有时返回 end
+static int find_format_spec(const char* content, int start, int end) {
+    int depth = 0;
+    char quote = 0;
+    for (int i = start; i < end; i++) {
+        char c = content[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '(' || c == '[' || c == '{') {
+            depth++;
+        } else if (c == ')' || c == ']' || c == '}') {
+            depth--;
+        } else if (c == ':' && depth == 0) {
+            return i;
+        }
+    }
+    return end;
+}
+
+// {expr!r} / {expr!s}：表达式后面、格式说明前面的转换标记，没有时返回 end。
+// '!=' 是比较运算符，括号和引号里的 '!' 也不算
+static int find_conversion(const char* content, int start, int end) {
+    int depth = 0;
+    char quote = 0;
+    for (int i = start; i < end; i++) {
+        char c = content[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '(' || c == '[' || c == '{') {
+            depth++;
+        } else if (c == ')' || c == ']' || c == '}') {
+            depth--;
+        } else if (c == '!' && depth == 0 && (i + 1 >= end || content[i + 1] != '=')) {
+            return i;
+        }
+    }
+    return end;
 }
 
-// Parse f-string: f"text {expr} more text"
+// Parse f-string: f"text {expr!conv:spec} more text"
+// 字面部分是常量，表达式的值留在栈上 (有格式说明的先经过 OP_FORMAT_VALUE)，
+// 最后由一条 OP_BUILD_STRING 一次拼成结果
 static void fstring(ms_parser_t* parser) {
     const char* start = parser->previous.start;
     int total_length = parser->previous.length;
@@ -968,6 +1166,7 @@ static void fstring(ms_parser_t* parser) {
     
     // Parse the f-string and collect parts
     int parts_count = 0;
+    int expression_count = 0;
     int pos = 0;
     
     for (int i = 0; i < content_length; i++) {
@@ -975,11 +1174,7 @@ static void fstring(ms_parser_t* parser) {
             // Found expression start
             if (i > pos) {
                 // Emit string part before expression
-                char* str_part = malloc(i - pos + 1);
-                memcpy(str_part, content + pos, i - pos);
-                str_part[i - pos] = '\0';
-                emit_constant(parser, ms_value_string(str_part));
-                free(str_part);
+                emit_constant(parser, ms_string_intern_chars(content + pos, i - pos));
                 parts_count++;
             }
             
@@ -1000,8 +1195,21 @@ static void fstring(ms_parser_t* parser) {
                 return;
             }
             
+            // {expr!conv:spec}：表达式只到 '!' 或冒号为止
+            int spec_start = find_format_spec(content, expr_start, expr_end);
+            int conversion_start = find_conversion(content, expr_start, spec_start);
+            char conversion = 0;
+            if (conversion_start < spec_start) {
+                conversion = content[conversion_start + 1];
+                if (conversion_start + 2 != spec_start || (conversion != 'r' && conversion != 's')) {
+                    free(content);
+                    error(parser, "Invalid conversion in f-string: expected '!r' or '!s'.");
+                    return;
+                }
+            }
+
             // Extract and parse the expression
-            int expr_length = expr_end - expr_start;
+            int expr_length = conversion_start - expr_start;
             char* expr_str = malloc(expr_length + 1);
             memcpy(expr_str, content + expr_start, expr_length);
             expr_str[expr_length] = '\0';
@@ -1032,14 +1240,18 @@ static void fstring(ms_parser_t* parser) {
             advance(&expr_parser);
             expression(&expr_parser);
             
-            // Convert the result to string using str() function
-            // We'll emit a call to the built-in str() function
-            // For now, we'll use a simple approach: wrap with str() call
-            // Actually, let's just emit the value and let OP_ADD handle it
-            // But we need to ensure it's a string, so we'll use a conversion
+            if (conversion != 0) {
+                emit_bytes(parser, OP_CONVERT_VALUE, (uint8_t)conversion);
+            }
+            if (spec_start < expr_end) {
+                ms_value_t spec = ms_string_intern_chars(content + spec_start + 1,
+                                                         expr_end - spec_start - 1);
+                emit_bytes(parser, OP_FORMAT_VALUE, make_constant(parser, spec));
+            }
             
             free(expr_str);
             parts_count++;
+            expression_count++;
             
             pos = expr_end + 1;
             i = expr_end;
@@ -1048,22 +1260,17 @@ static void fstring(ms_parser_t* parser) {
     
     // Emit remaining string part
     if (pos < content_length) {
-        char* str_part = malloc(content_length - pos + 1);
-        memcpy(str_part, content + pos, content_length - pos);
-        str_part[content_length - pos] = '\0';
-        emit_constant(parser, ms_value_string(str_part));
-        free(str_part);
+        emit_constant(parser, ms_string_intern_chars(content + pos, content_length - pos));
         parts_count++;
     }
     
     // If no parts, emit empty string
     if (parts_count == 0) {
-        emit_constant(parser, ms_value_string(""));
-    } else if (parts_count > 1) {
-        // Emit ADD operations to concatenate all parts
-        for (int i = 1; i < parts_count; i++) {
-            emit_byte(parser, OP_ADD);
-        }
+        emit_constant(parser, ms_string_intern_chars("", 0));
+    } else if (parts_count > 255) {
+        error(parser, "Too many parts in f-string.");
+    } else if (expression_count > 0) {
+        emit_bytes(parser, OP_BUILD_STRING, (uint8_t)parts_count);
     }
     
     free(content);
@@ -1117,11 +1324,17 @@ static void lambda_expression(ms_parser_t* parser) {
     ms_chunk_t* enclosing_chunk = parser->compiling_chunk;
     int enclosing_local_count = local_count;
     int enclosing_scope_depth = scope_depth;
+    bool enclosing_in_function = in_function;
+    bool enclosing_function_yields = function_yields;
+    bool enclosing_function_async = function_async;
     
     // Set up lambda compilation
     parser->compiling_chunk = lambda_chunk;
     local_count = 0;
     scope_depth = 0;
+    in_function = true;
+    function_yields = false;
+    function_async = false;
     begin_scope();
     
     // Parse parameters
@@ -1155,20 +1368,62 @@ static void lambda_expression(ms_parser_t* parser) {
     end_scope(parser);
     
     // Restore compilation state
+    bool is_generator = function_yields;
     parser->compiling_chunk = enclosing_chunk;
     local_count = enclosing_local_count;
     scope_depth = enclosing_scope_depth;
+    in_function = enclosing_in_function;
+    function_yields = enclosing_function_yields;
+    function_async = enclosing_function_async;
     
     // Create function object
     ms_function_t* function = malloc(sizeof(ms_function_t));
     function->chunk = lambda_chunk;
     function->arity = arity;
     function->name = strdup("<lambda>");
+    function->default_count = 0;
+    function->defaults = NULL;
+    function->is_generator = is_generator;
+    function->is_coroutine = false;
     
     // Emit lambda instruction with function constant
     emit_constant(parser, ms_value_function((struct ms_function*)function));
 }
 
+// yield [expr]：交出 expr (省略时是 None)，表达式的值是恢复时送进来的值
+static void yield_expression(ms_parser_t* parser) {
+    if (!in_function) {
+        error(parser, "'yield' outside function.");
+        return;
+    }
+    if (function_async) {
+        error(parser, "'yield' inside async function.");
+        return;
+    }
+    function_yields = true;
+    
+    if (check(parser, TOKEN_NEWLINE) || check(parser, TOKEN_EOF) || check(parser, TOKEN_DEDENT) ||
+        check(parser, TOKEN_RIGHT_PAREN)) {
+        emit_byte(parser, OP_NIL);
+    } else {
+        expression(parser);
+    }
+    emit_byte(parser, OP_YIELD);
+}
+
+// await expr：等 expr 执行完并取得它的结果。expr 是协程时在当前协程里驱动它，
+// 否则 (比如 http.sleep() 返回的等待请求) 把它交给驱动协程的事件循环，
+// 恢复时送进来的值就是结果。初始送进的值是 None (见 OP_AWAIT)
+static void await_expression(ms_parser_t* parser) {
+    if (!function_async) {
+        error(parser, "'await' outside async function.");
+        return;
+    }
+    parse_precedence(parser, PREC_CALL);
+    emit_byte(parser, OP_NIL);
+    emit_byte(parser, OP_AWAIT);
+}
+
 static void walrus(ms_parser_t* parser) {
     // 海象运算符 := (infix)
     // 左侧应该是标识符，已经被 identifier() 处理并加载到栈上
@@ -1204,6 +1459,9 @@ ms_parse_rule_t rules[] = {
     [TOKEN_SLASH_SLASH]   = {NULL,     binary,    PREC_FACTOR},
     [TOKEN_STAR_STAR]     = {NULL,     binary,    PREC_POWER},
     [TOKEN_PERCENT]       = {NULL,     binary,    PREC_FACTOR},
+    [TOKEN_PIPE]          = {NULL,     binary,    PREC_BIT_OR},
+    [TOKEN_AMPERSAND]     = {NULL,     binary,    PREC_BIT_AND},
+    [TOKEN_CARET]         = {NULL,     binary,    PREC_BIT_XOR},
     [TOKEN_BANG]          = {unary,    NULL,      PREC_NONE},
     [TOKEN_BANG_EQUAL]    = {NULL,     binary,    PREC_EQUALITY},
     [TOKEN_EQUAL]         = {NULL,     NULL,      PREC_NONE},
@@ -1237,6 +1495,8 @@ ms_parse_rule_t rules[] = {
     [TOKEN_NOT]           = {unary,    NULL,      PREC_NONE},
     [TOKEN_IS]            = {NULL,     NULL,      PREC_NONE},
     [TOKEN_LAMBDA]        = {lambda_expression, NULL, PREC_NONE},
+    [TOKEN_YIELD]         = {yield_expression, NULL, PREC_NONE},
+    [TOKEN_AWAIT]         = {await_expression, NULL, PREC_NONE},
     [TOKEN_ERROR]         = {NULL,     NULL,      PREC_NONE},
     [TOKEN_EOF]           = {NULL,     NULL,      PREC_NONE},
 };
@@ -1305,6 +1565,9 @@ static void var_declaration(ms_parser_t* parser) {
     }
     
     define_variable(parser, global);
+    if (scope_depth == 0) {
+        emit_byte(parser, OP_POP);
+    }
 }
 
 static void if_statement(ms_parser_t* parser) {
@@ -1405,6 +1668,10 @@ static void while_statement(ms_parser_t* parser) {
     loop_depth++;
     int saved_break_count = break_count;
     int saved_continue_count = continue_count;
+    int saved_loop_local_count = loop_local_count;
+    int saved_loop_finally_base = loop_finally_base;
+    loop_local_count = local_count;
+    loop_finally_base = finally_count;
     
     expression(parser);
     consume(parser, TOKEN_COLON, "Expect ':' after while condition.");
@@ -1469,6 +1736,19 @@ static void while_statement(ms_parser_t* parser) {
     loop_depth--;
     break_count = saved_break_count;
     continue_count = saved_continue_count;
+    loop_local_count = saved_loop_local_count;
+    loop_finally_base = saved_loop_finally_base;
+}
+
+// 接下来的表达式在语法上是对 range 的调用：for 语句为它生成 OP_FOR_RANGE。
+// range 可能已经被重新绑定，这只是个提示，运行时由 OP_FOR_RANGE 检查
+static bool is_range_call(ms_parser_t* parser) {
+    if (!check(parser, TOKEN_IDENTIFIER) || parser->current.length != 5 ||
+        memcmp(parser->current.start, "range", 5) != 0) {
+        return false;
+    }
+    ms_lexer_t probe = *parser->lexer;
+    return ms_lexer_scan_token(&probe).type == TOKEN_LEFT_PAREN;
 }
 
 static void for_statement(ms_parser_t* parser) {
@@ -1496,6 +1776,7 @@ static void for_statement(ms_parser_t* parser) {
     
     // Parse the iterable expression (leaves value on stack)
     // Use PREC_COMPARISON + 1 to avoid parsing 'in' as part of the expression
+    bool counting = is_range_call(parser);
     parse_precedence(parser, PREC_COMPARISON + 1);
     
     // Store iterable in a local variable (slot 1) - value is already on stack
@@ -1508,6 +1789,10 @@ static void for_statement(ms_parser_t* parser) {
     add_local(parser, (ms_token_t){.start = "__index__", .length = 9});
     mark_initialized();
     uint8_t index_slot = local_count - 1;
+    int saved_loop_local_count = loop_local_count;
+    int saved_loop_finally_base = loop_finally_base;
+    loop_local_count = local_count;
+    loop_finally_base = finally_count;
     
     consume(parser, TOKEN_COLON, "Expect ':' after for clause.");
     consume(parser, TOKEN_NEWLINE, "Expect newline after ':'.");
@@ -1517,15 +1802,24 @@ static void for_statement(ms_parser_t* parser) {
     // Loop start
     int loop_start = current_chunk(parser)->count;
     
-    // Emit FOR_ITER_LOCAL instruction
-    // This will check if there are more elements and set the loop variable
-    emit_bytes(parser, OP_FOR_ITER_LOCAL, var_slot);
-    emit_byte(parser, iter_slot);
-    emit_byte(parser, index_slot);
-    
-    // Jump if no more elements
-    int exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
-    emit_byte(parser, OP_POP);  // Pop the boolean result
+    int exit_jump;
+    if (counting) {
+        // 计数循环：一条指令完成取值和到头时的跳转，不压布尔值
+        emit_bytes(parser, OP_FOR_RANGE, var_slot);
+        emit_bytes(parser, iter_slot, index_slot);
+        emit_bytes(parser, 0xff, 0xff);
+        exit_jump = current_chunk(parser)->count - 2;
+    } else {
+        // Emit FOR_ITER_LOCAL instruction
+        // This will check if there are more elements and set the loop variable
+        emit_bytes(parser, OP_FOR_ITER_LOCAL, var_slot);
+        emit_byte(parser, iter_slot);
+        emit_byte(parser, index_slot);
+        
+        // Jump if no more elements
+        exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+        emit_byte(parser, OP_POP);  // Pop the boolean result
+    }
     
     // Parse loop body
     while (!check(parser, TOKEN_DEDENT) && !check(parser, TOKEN_EOF)) {
@@ -1548,7 +1842,7 @@ static void for_statement(ms_parser_t* parser) {
     
     // Patch exit jump
     patch_jump(parser, exit_jump);
-    emit_byte(parser, OP_POP);  // Pop the boolean result
+    if (!counting) emit_byte(parser, OP_POP);  // Pop the boolean result
     
     // 处理 else 子句
     if (match(parser, TOKEN_ELSE)) {
@@ -1581,6 +1875,8 @@ static void for_statement(ms_parser_t* parser) {
     loop_depth--;
     break_count = saved_break_count;
     continue_count = saved_continue_count;
+    loop_local_count = saved_loop_local_count;
+    loop_finally_base = saved_loop_finally_base;
     
     end_scope(parser);
 }
@@ -1603,11 +1899,9 @@ static void with_statement(ms_parser_t* parser) {
     expression(parser);
     
     // Store the manager in a temporary variable
+    // OP_DEFINE_GLOBAL leaves the manager on the stack
     uint8_t manager_var = add_name(temp_name, strlen(temp_name));
     emit_bytes(parser, OP_DEFINE_GLOBAL, manager_var);
-    
-    // Load the manager back for __enter__ call
-    emit_bytes(parser, OP_GET_GLOBAL, manager_var);
     emit_byte(parser, OP_DUP);
     
     // Call __enter__() method
@@ -1616,6 +1910,7 @@ static void with_statement(ms_parser_t* parser) {
     // Stack: [manager, enter_result]
     
     // Pop the manager (we have it stored in temp variable)
+    emit_byte(parser, OP_SWAP);
     emit_byte(parser, OP_POP);
     // Stack: [enter_result]
     
@@ -1626,6 +1921,7 @@ static void with_statement(ms_parser_t* parser) {
         
         // Store __enter__() result in variable
         emit_bytes(parser, OP_DEFINE_GLOBAL, var_index);
+        emit_byte(parser, OP_POP);
     } else {
         // No 'as' clause, just pop the __enter__() result
         emit_byte(parser, OP_POP);
@@ -1662,6 +1958,228 @@ static void with_statement(ms_parser_t* parser) {
     end_scope(parser);
 }
 
+// try 语句有没有 finally 子句：break/continue/return 在 try 块里就要调用它，
+// 所以编译 try 块之前先用词法分析器的副本往后看，跳过 try 块和各个
+// except/else 子句，看同一缩进层上是否接着 finally
+static bool try_has_finally(ms_parser_t* parser) {
+    ms_lexer_t probe = *parser->lexer;
+    int depth = 0;
+    bool line_start = false;
+    for (;;) {
+        ms_token_t token = ms_lexer_scan_token(&probe);
+        switch (token.type) {
+            case TOKEN_EOF:
+                return false;
+            case TOKEN_NEWLINE:
+                line_start = true;
+                continue;
+            case TOKEN_INDENT:
+                depth++;
+                continue;
+            case TOKEN_DEDENT:
+                if (--depth < 0) return false;
+                continue;
+            default:
+                break;
+        }
+        if (line_start && depth == 0) {
+            if (token.type == TOKEN_FINALLY) return true;
+            if (token.type != TOKEN_EXCEPT && token.type != TOKEN_ELSE) return false;
+        }
+        line_start = false;
+    }
+}
+
+// try 语句的隐藏局部变量 (异常、finally 的值和原因) 占据语句开始时栈顶之上的槽位。
+// 不开新的作用域，子句里的 def/class 仍然按所在的作用域定义
+static void add_hidden_local(ms_parser_t* parser, const char* name) {
+    add_local(parser, (ms_token_t){.start = name, .length = (int)strlen(name)});
+    locals[local_count - 1].depth = scope_depth;
+}
+
+// break/continue/return 离开 try 语句：从内到外调用 base 之后的 finally 块。
+// 栈顶是要带出去的值 (return 的返回值，break/continue 时是 None)，每次调用前把它
+// 移到 finally 块的值槽位、弹掉之上的局部变量。返回值之下的栈高
+static int call_finally_blocks(ms_parser_t* parser, int base) {
+    int depth = local_count;
+    for (int i = finally_count - 1; i >= base; i--) {
+        ms_finally_block_t* block = &finally_blocks[i];
+        if (depth > block->depth) {
+            emit_bytes(parser, OP_SET_LOCAL, (uint8_t)block->depth);
+            emit_byte(parser, OP_POP);
+            for (int j = block->depth + 1; j < depth; j++) {
+                emit_byte(parser, OP_POP);
+            }
+            depth = block->depth;
+        }
+        if (block->call_count == 64) {
+            error(parser, "Too many jumps out of try statement.");
+            return depth;
+        }
+        block->calls[block->call_count++] = emit_jump(parser, OP_CALL_FINALLY);
+    }
+    return depth;
+}
+
+// break/continue 跳转之前：执行循环里途经的 finally 块，弹出循环体开始之后的局部变量
+static void leave_loop_body(ms_parser_t* parser) {
+    int depth = local_count;
+    if (finally_count > loop_finally_base) {
+        emit_byte(parser, OP_NIL);
+        depth = call_finally_blocks(parser, loop_finally_base);
+        emit_byte(parser, OP_POP);
+    }
+    for (int i = loop_local_count; i < depth; i++) {
+        emit_byte(parser, OP_POP);
+    }
+}
+
+// 子句的语句块 (冒号之后)
+static void clause_block(ms_parser_t* parser, const char* message) {
+    consume(parser, TOKEN_COLON, message);
+    consume(parser, TOKEN_NEWLINE, "Expect newline after ':'.");
+    skip_newlines(parser);
+    consume(parser, TOKEN_INDENT, "Expect indentation after ':'.");
+    
+    while (!check(parser, TOKEN_DEDENT) && !check(parser, TOKEN_EOF)) {
+        skip_newlines(parser);
+        if (check(parser, TOKEN_DEDENT) || check(parser, TOKEN_EOF)) break;
+        declaration(parser);
+    }
+    
+    if (!check(parser, TOKEN_EOF)) {
+        consume(parser, TOKEN_DEDENT, "Expect dedent after block.");
+    }
+    skip_newlines(parser);
+}
+
+static void try_statement(ms_parser_t* parser) {
+    // try:                     try 块                 (异常表: -> 处理代码)
+    //     ...                  JUMP else
+    // except T as e:           处理代码: [e]          (异常表: try 块 -> 这里)
+    //     ...                    GET_LOCAL e; T; EXCEPTION_MATCH; JUMP_IF_FALSE 下一个
+    // except:                    ...; JUMP 结束
+    //     ...                  (都不匹配) GET_LOCAL e; RAISE
+    // else:                    结束: POP e
+    //     ...                  else: ...
+    // finally:                 NIL NIL; JUMP finally  (异常表: 以上全部 -> DUP)
+    //     ...                  DUP
+    //                          finally: ...; END_FINALLY
+    //
+    // 异常表项在编译完对应的代码后登记，内层的 try 总是排在外层前面。
+    // 正常执行时 try 块不多执行任何指令
+    ms_chunk_t* chunk = current_chunk(parser);
+    int depth = local_count;
+    bool has_finally = try_has_finally(parser);
+    if (has_finally) {
+        if (finally_count == 32) {
+            error(parser, "Too many nested try statements.");
+            return;
+        }
+        finally_blocks[finally_count].depth = depth;
+        finally_blocks[finally_count].call_count = 0;
+        finally_count++;
+    }
+    
+    int try_start = chunk->count;
+    clause_block(parser, "Expect ':' after 'try'.");
+    int try_end = chunk->count;
+    
+    if (!check(parser, TOKEN_EXCEPT) && !has_finally) {
+        error_at_current(parser, "Expect 'except' or 'finally' after try block.");
+        return;
+    }
+    
+    if (check(parser, TOKEN_EXCEPT)) {
+        int else_jump = emit_jump(parser, OP_JUMP);
+        ms_chunk_add_handler(chunk, try_start, try_end, chunk->count, depth);
+        
+        // 异常在槽位 depth，except ... as name 时这个槽位改名为 name
+        add_hidden_local(parser, "__exception__");
+        int saved_handler_slot = handler_exception_slot;
+        handler_exception_slot = depth;
+        
+        int done_jumps[64];
+        int done_count = 0;
+        bool catch_all = false;
+        while (match(parser, TOKEN_EXCEPT)) {
+            if (catch_all) {
+                error(parser, "default 'except:' must be last.");
+            }
+            int next_jump = -1;
+            if (!check(parser, TOKEN_COLON)) {
+                emit_bytes(parser, OP_GET_LOCAL, (uint8_t)depth);
+                expression(parser);
+                emit_byte(parser, OP_EXCEPTION_MATCH);
+                next_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+                emit_byte(parser, OP_POP);
+                if (match(parser, TOKEN_AS)) {
+                    consume(parser, TOKEN_IDENTIFIER, "Expect exception name after 'as'.");
+                    locals[depth].name = parser->previous;
+                }
+            } else {
+                catch_all = true;
+            }
+            
+            clause_block(parser, "Expect ':' after except clause.");
+            locals[depth].name = (ms_token_t){.start = "__exception__", .length = 13};
+            
+            if (done_count == 64) {
+                error(parser, "Too many except clauses.");
+            } else {
+                done_jumps[done_count++] = emit_jump(parser, OP_JUMP);
+            }
+            if (next_jump >= 0) {
+                patch_jump(parser, next_jump);
+                emit_byte(parser, OP_POP);
+            }
+        }
+        
+        // 没有子句匹配：重新抛出，继续在外层找
+        if (!catch_all) {
+            emit_bytes(parser, OP_GET_LOCAL, (uint8_t)depth);
+            emit_byte(parser, OP_RAISE);
+        }
+        for (int i = 0; i < done_count; i++) {
+            patch_jump(parser, done_jumps[i]);
+        }
+        emit_byte(parser, OP_POP);
+        local_count--;
+        handler_exception_slot = saved_handler_slot;
+        
+        if (match(parser, TOKEN_ELSE)) {
+            int end_jump = emit_jump(parser, OP_JUMP);
+            patch_jump(parser, else_jump);
+            clause_block(parser, "Expect ':' after 'else'.");
+            patch_jump(parser, end_jump);
+        } else {
+            patch_jump(parser, else_jump);
+        }
+    }
+    
+    if (!has_finally) return;
+    
+    // finally 块不再属于这条 try 语句：里面的 break/return 不用再调用它
+    ms_finally_block_t* block = &finally_blocks[--finally_count];
+    consume(parser, TOKEN_FINALLY, "Expect 'finally'.");
+    int protected_end = chunk->count;
+    emit_byte(parser, OP_NIL);
+    emit_byte(parser, OP_NIL);
+    int finally_jump = emit_jump(parser, OP_JUMP);
+    ms_chunk_add_handler(chunk, try_start, protected_end, chunk->count, depth);
+    emit_byte(parser, OP_DUP);
+    patch_jump(parser, finally_jump);
+    for (int i = 0; i < block->call_count; i++) {
+        patch_jump(parser, block->calls[i]);
+    }
+    
+    add_hidden_local(parser, "__finally_value__");
+    add_hidden_local(parser, "__finally_reason__");
+    clause_block(parser, "Expect ':' after 'finally'.");
+    emit_byte(parser, OP_END_FINALLY);
+    local_count -= 2;
+}
+
 static void import_statement(ms_parser_t* parser) {
     // import module
     // import module as alias
@@ -1833,6 +2351,25 @@ static void statement(ms_parser_t* parser) {
         for_statement(parser);
     } else if (match(parser, TOKEN_WITH)) {
         with_statement(parser);
+    } else if (match(parser, TOKEN_TRY)) {
+        try_statement(parser);
+    } else if (match(parser, TOKEN_RAISE)) {
+        // raise 表达式；except 子句里不带表达式时重新抛出正在处理的异常
+        if (check(parser, TOKEN_NEWLINE) || check(parser, TOKEN_EOF) || check(parser, TOKEN_DEDENT)) {
+            if (handler_exception_slot < 0) {
+                error(parser, "No active exception to re-raise.");
+            }
+            emit_bytes(parser, OP_GET_LOCAL, (uint8_t)handler_exception_slot);
+        } else {
+            expression(parser);
+        }
+        emit_byte(parser, OP_RAISE);
+        
+        if (match(parser, TOKEN_NEWLINE)) {
+            // 换行符已消费
+        } else if (!check(parser, TOKEN_EOF) && !check(parser, TOKEN_DEDENT)) {
+            error(parser, "Expect newline after raise.");
+        }
     } else if (match(parser, TOKEN_BREAK)) {
         // break 语句
         if (loop_depth == 0) {
@@ -1845,6 +2382,7 @@ static void statement(ms_parser_t* parser) {
             error(parser, "Too many break statements.");
             return;
         }
+        leave_loop_body(parser);
         break_jumps[break_count++] = emit_jump(parser, OP_JUMP);
         
         // 消费换行符
@@ -1865,6 +2403,7 @@ static void statement(ms_parser_t* parser) {
             error(parser, "Too many continue statements.");
             return;
         }
+        leave_loop_body(parser);
         continue_jumps[continue_count++] = emit_jump(parser, OP_JUMP);
         
         // 消费换行符
@@ -1908,6 +2447,9 @@ static void statement(ms_parser_t* parser) {
             // return 有值
             expression(parser);
         }
+        if (finally_count > function_finally_base) {
+            call_finally_blocks(parser, function_finally_base);
+        }
         emit_byte(parser, OP_RETURN);
         
         // 消费语句后的换行符（如果有）
@@ -1969,8 +2511,12 @@ static void class_declaration(ms_parser_t* parser) {
         skip_newlines(parser);
         if (check(parser, TOKEN_DEDENT) || check(parser, TOKEN_EOF)) break;
         
-        if (match(parser, TOKEN_DEF)) {
+        if (match(parser, TOKEN_DEF) || match(parser, TOKEN_ASYNC)) {
             // 解析方法
+            bool is_async = parser->previous.type == TOKEN_ASYNC;
+            if (is_async) {
+                consume(parser, TOKEN_DEF, "Expect 'def' after 'async'.");
+            }
             consume(parser, TOKEN_IDENTIFIER, "Expect method name.");
             uint8_t method_constant = add_name(parser->previous.start, parser->previous.length);
             
@@ -1995,10 +2541,13 @@ static void class_declaration(ms_parser_t* parser) {
                     // 检查是否有默认值
                     if (match(parser, TOKEN_EQUAL)) {
                         has_default = true;
+                        int code_start = parser->compiling_chunk->count;
                         expression(parser);
                         defaults[default_count] = parser->compiling_chunk->constants[parser->compiling_chunk->constant_count - 1];
                         default_count++;
                         parser->compiling_chunk->constant_count--;
+                        // 撤销刚生成的加载指令，默认值不应留在栈上
+                        parser->compiling_chunk->count = code_start;
                     } else {
                         if (has_default) {
                             error(parser, "Non-default parameter follows default parameter.");
@@ -2029,9 +2578,23 @@ static void class_declaration(ms_parser_t* parser) {
             ms_local_t saved_locals[256];
             int saved_local_count = local_count;
             int saved_scope_depth = scope_depth;
+            bool saved_in_function = in_function;
+            bool saved_function_yields = function_yields;
+            bool saved_function_async = function_async;
+            int saved_function_finally_base = function_finally_base;
+            int saved_loop_finally_base = loop_finally_base;
+            int saved_loop_local_count = loop_local_count;
+            int saved_handler_slot = handler_exception_slot;
             memcpy(saved_locals, locals, sizeof(locals));
             local_count = 0;
             scope_depth = 0;
+            in_function = true;
+            function_yields = false;
+            function_async = is_async;
+            function_finally_base = finally_count;
+            loop_finally_base = finally_count;
+            loop_local_count = 0;
+            handler_exception_slot = -1;
             
             // 编译方法体
             begin_scope();
@@ -2059,9 +2622,17 @@ static void class_declaration(ms_parser_t* parser) {
             end_scope(parser);
             
             // 恢复状态
+            bool is_generator = function_yields;
             parser->compiling_chunk = prev_chunk;
             local_count = saved_local_count;
             scope_depth = saved_scope_depth;
+            in_function = saved_in_function;
+            function_yields = saved_function_yields;
+            function_async = saved_function_async;
+            function_finally_base = saved_function_finally_base;
+            loop_finally_base = saved_loop_finally_base;
+            loop_local_count = saved_loop_local_count;
+            handler_exception_slot = saved_handler_slot;
             memcpy(locals, saved_locals, sizeof(locals));
             
             // 创建方法函数对象
@@ -2075,6 +2646,9 @@ static void class_declaration(ms_parser_t* parser) {
                 method->name[0] = '\0';
             }
             
+            // 协程和生成器一样调用时不执行函数体 (见 generator.h)
+            method->is_generator = is_generator || is_async;
+            method->is_coroutine = is_async;
             method->default_count = default_count;
             if (default_count > 0) {
                 method->defaults = malloc(sizeof(ms_value_t) * default_count);
@@ -2083,9 +2657,7 @@ static void class_declaration(ms_parser_t* parser) {
                 method->defaults = NULL;
             }
             
-            ms_value_t method_value;
-            method_value.type = MS_VAL_FUNCTION;
-            method_value.as.function = method;
+            ms_value_t method_value = ms_value_function((struct ms_function*)method);
             
             uint8_t method_const = make_constant(parser, method_value);
             emit_bytes(parser, OP_CONSTANT, method_const);
@@ -2106,8 +2678,8 @@ static void class_declaration(ms_parser_t* parser) {
     emit_byte(parser, OP_POP);
 }
 
-static void function_declaration(ms_parser_t* parser) {
-    // def name(params):
+static void function_declaration(ms_parser_t* parser, bool is_async) {
+    // [async] def name(params):
     uint8_t name_index = parse_variable(parser, "Expect function name.");
     
     consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
@@ -2132,12 +2704,14 @@ static void function_declaration(ms_parser_t* parser) {
             if (match(parser, TOKEN_EQUAL)) {
                 has_default = true;
                 // 解析默认值表达式
+                int code_start = parser->compiling_chunk->count;
                 expression(parser);
                 // 获取栈顶的值作为默认值
                 defaults[default_count] = parser->compiling_chunk->constants[parser->compiling_chunk->constant_count - 1];
                 default_count++;
-                // 移除刚添加的常量（我们会在函数对象中存储）
+                // 移除刚添加的常量和加载指令（我们会在函数对象中存储）
                 parser->compiling_chunk->constant_count--;
+                parser->compiling_chunk->count = code_start;
             } else {
                 if (has_default) {
                     error(parser, "Non-default parameter follows default parameter.");
@@ -2170,9 +2744,23 @@ static void function_declaration(ms_parser_t* parser) {
     ms_local_t saved_locals[256];
     int saved_local_count = local_count;
     int saved_scope_depth = scope_depth;
+    bool saved_in_function = in_function;
+    bool saved_function_yields = function_yields;
+    bool saved_function_async = function_async;
+    int saved_function_finally_base = function_finally_base;
+    int saved_loop_finally_base = loop_finally_base;
+    int saved_loop_local_count = loop_local_count;
+    int saved_handler_slot = handler_exception_slot;
     memcpy(saved_locals, locals, sizeof(locals));
     local_count = 0;
     scope_depth = 0;
+    in_function = true;
+    function_yields = false;
+    function_async = is_async;
+    function_finally_base = finally_count;
+    loop_finally_base = finally_count;
+    loop_local_count = 0;
+    handler_exception_slot = -1;
     
     // 编译函数体
     begin_scope();
@@ -2200,9 +2788,17 @@ static void function_declaration(ms_parser_t* parser) {
     end_scope(parser);
     
     // 恢复之前的chunk和局部变量状态
+    bool is_generator = function_yields;
     parser->compiling_chunk = prev_chunk;
     local_count = saved_local_count;
     scope_depth = saved_scope_depth;
+    in_function = saved_in_function;
+    function_yields = saved_function_yields;
+    function_async = saved_function_async;
+    function_finally_base = saved_function_finally_base;
+    loop_finally_base = saved_loop_finally_base;
+    loop_local_count = saved_loop_local_count;
+    handler_exception_slot = saved_handler_slot;
     memcpy(locals, saved_locals, sizeof(locals));
     
     // 创建函数对象并存储为常量
@@ -2216,6 +2812,10 @@ static void function_declaration(ms_parser_t* parser) {
         function->name[0] = '\0';
     }
     
+    // 协程和生成器一样调用时不执行函数体 (见 generator.h)
+    function->is_generator = is_generator || is_async;
+    function->is_coroutine = is_async;
+    
     // 存储默认值
     function->default_count = default_count;
     if (default_count > 0) {
@@ -2225,9 +2825,7 @@ static void function_declaration(ms_parser_t* parser) {
         function->defaults = NULL;
     }
     
-    ms_value_t func_value;
-    func_value.type = MS_VAL_FUNCTION;
-    func_value.as.function = function;
+    ms_value_t func_value = ms_value_function((struct ms_function*)function);
     
     // 发出OP_FUNCTION指令
     uint8_t func_const = make_constant(parser, func_value);
@@ -2287,8 +2885,17 @@ static void declaration(ms_parser_t* parser) {
             emit_bytes(parser, OP_CALL_DECORATOR, decorator_count - i);
         }
         
-    } else if (match(parser, TOKEN_DEF)) {
-        function_declaration(parser);
+        // 顶层的 OP_DEFINE_GLOBAL 不会弹出类对象，这里丢弃它
+        if (scope_depth == 0) {
+            emit_byte(parser, OP_POP);
+        }
+        
+    } else if (match(parser, TOKEN_DEF) || match(parser, TOKEN_ASYNC)) {
+        bool is_async = parser->previous.type == TOKEN_ASYNC;
+        if (is_async) {
+            consume(parser, TOKEN_DEF, "Expect 'def' after 'async'.");
+        }
+        function_declaration(parser, is_async);
         
         // Apply decorators to function (from innermost to outermost)
         // Stack is now: [dec1, dec2, ..., decN, function]
@@ -2298,6 +2905,11 @@ static void declaration(ms_parser_t* parser) {
             emit_bytes(parser, OP_CALL_DECORATOR, decorator_count - i);
         }
         
+        // 顶层的 OP_DEFINE_GLOBAL 不会弹出函数对象，这里丢弃它
+        if (scope_depth == 0) {
+            emit_byte(parser, OP_POP);
+        }
+        
     } else if (match(parser, TOKEN_IMPORT) || check(parser, TOKEN_FROM)) {
         if (decorator_count > 0) {
             error(parser, "Cannot decorate import statements.");
@@ -2344,12 +2956,15 @@ static void declaration(ms_parser_t* parser) {
             switch (parser->current.type) {
                 case TOKEN_CLASS:
                 case TOKEN_DEF:
+                case TOKEN_ASYNC:
                 case TOKEN_VAR:
                 case TOKEN_FOR:
                 case TOKEN_IF:
                 case TOKEN_WHILE:
                 case TOKEN_RETURN:
                 case TOKEN_IMPORT:
+                case TOKEN_TRY:
+                case TOKEN_RAISE:
                     return;
                 default:
                     ; // Do nothing.
@@ -2367,6 +2982,17 @@ void ms_parser_init(ms_parser_t* parser, ms_lexer_t* lexer) {
     parser->function_chunk_count = 0;
 }
 
+#ifdef MS_REGISTER_VM
+// 常量表中的函数对象（def、方法和 lambda）尽量换成寄存器格式
+static void translate_functions(ms_chunk_t* chunk) {
+    for (int i = 0; i < chunk->constant_count; i++) {
+        if (MS_VALUE_TYPE(chunk->constants[i]) == MS_VAL_FUNCTION) {
+            ms_function_to_registers((ms_function_t*)MS_AS_FUNCTION(chunk->constants[i]));
+        }
+    }
+}
+#endif
+
 bool ms_compile(const char* source, ms_chunk_t* chunk) {
     ms_lexer_t lexer;
     ms_lexer_init(&lexer, source);
@@ -2374,6 +3000,11 @@ bool ms_compile(const char* source, ms_chunk_t* chunk) {
     ms_parser_t parser;
     ms_parser_init(&parser, &lexer);
     parser.compiling_chunk = chunk;
+    // 上次编译出错时可能停在 try 语句中间
+    finally_count = 0;
+    function_finally_base = 0;
+    loop_finally_base = 0;
+    handler_exception_slot = -1;
     
     advance(&parser);
     
@@ -2391,5 +3022,26 @@ bool ms_compile(const char* source, ms_chunk_t* chunk) {
     }
     
     end_compiler(&parser);
+    
+#ifdef MS_REGISTER_VM
+    // 函数体翻译成寄存器格式；翻译读取原始字节码，所以在超级指令改写之前
+    if (!parser.had_error) {
+        translate_functions(chunk);
+        for (int i = 0; i < parser.function_chunk_count; i++) {
+            translate_functions(parser.function_chunks[i]);
+        }
+    }
+#endif
+
+#ifndef MS_PROFILE_OPCODES
+    // 超级指令改写（统计操作码频率时保留原始字节码）
+    if (!parser.had_error) {
+        ms_chunk_optimize(chunk);
+        for (int i = 0; i < parser.function_chunk_count; i++) {
+            ms_chunk_optimize(parser.function_chunks[i]);
+        }
+    }
+#endif
+    
     return !parser.had_error;
 }
\ No newline at end of file
@@ -26,6 +26,9 @@ typedef enum {
     PREC_AND,         // and
     PREC_EQUALITY,    // == !=
     PREC_COMPARISON,  // > >= < <=
+    PREC_BIT_OR,      // |
+    PREC_BIT_XOR,     // ^
+    PREC_BIT_AND,     // &
     PREC_TERM,        // + -
     PREC_FACTOR,      // * / // %
     PREC_POWER,       // **
@@ -1,5 +1,6 @@
 #include "vm.h"
 #include <stdlib.h>
+#include <string.h>
 
 void ms_chunk_init(ms_chunk_t* chunk) {
     chunk->count = 0;
@@ -9,12 +10,20 @@ void ms_chunk_init(ms_chunk_t* chunk) {
     chunk->constants = NULL;
     chunk->constant_count = 0;
     chunk->constant_capacity = 0;
+    chunk->register_count = 0;
+    chunk->property_caches = NULL;
+    chunk->property_cache_count = 0;
+    chunk->handlers = NULL;
+    chunk->handler_count = 0;
+    chunk->gc_epoch = 0;
 }
 
 void ms_chunk_free(ms_chunk_t* chunk) {
     free(chunk->code);
     free(chunk->lines);
     free(chunk->constants);
+    free(chunk->property_caches);
+    free(chunk->handlers);
     ms_chunk_init(chunk);
 }
 
@@ -41,4 +50,27 @@ int ms_chunk_add_constant(ms_chunk_t* chunk, ms_value_t value) {
 
     chunk->constants[chunk->constant_count] = value;
     return chunk->constant_count++;
-}
\ No newline at end of file
+}
+
+// 分配一个属性内联缓存，返回缓存号。缓存号只有一个字节，
+// 用完后返回 MS_NO_PROPERTY_CACHE，对应的指令不做缓存
+uint8_t ms_chunk_add_property_cache(ms_chunk_t* chunk) {
+    if (chunk->property_cache_count >= MS_NO_PROPERTY_CACHE) {
+        return MS_NO_PROPERTY_CACHE;
+    }
+    chunk->property_caches = realloc(chunk->property_caches,
+                                     sizeof(ms_property_cache_t) * (chunk->property_cache_count + 1));
+    memset(&chunk->property_caches[chunk->property_cache_count], 0, sizeof(ms_property_cache_t));
+    return (uint8_t)chunk->property_cache_count++;
+}
+
+// 登记 try 块的异常表项 (见 ms_exception_entry_t)，编译器在内层 try 之后登记外层
+void ms_chunk_add_handler(ms_chunk_t* chunk, int start, int end, int handler, int depth) {
+    chunk->handlers = realloc(chunk->handlers,
+                              sizeof(ms_exception_entry_t) * (chunk->handler_count + 1));
+    ms_exception_entry_t* entry = &chunk->handlers[chunk->handler_count++];
+    entry->start = start;
+    entry->end = end;
+    entry->handler = handler;
+    entry->depth = depth;
+}
@@ -0,0 +1,66 @@
+#include "generator.h"
+#include "../core/gc.h"
+#include <stdlib.h>
+#include <string.h>
+
+ms_value_t ms_value_generator(ms_generator_t* generator) {
+#ifdef MS_NAN_BOXING
+    return ms_nanbox_make(MS_NANBOX_TAG_BOX, (uint64_t)(uintptr_t)generator);
+#else
+    ms_value_t value;
+    value.type = MS_VAL_GENERATOR;
+    value.as.object = (ms_object_t*)generator;
+    return value;
+#endif
+}
+
+bool ms_value_is_generator(ms_value_t value) {
+    return MS_VALUE_TYPE(value) == MS_VAL_GENERATOR;
+}
+
+bool ms_value_is_coroutine(ms_value_t value) {
+    return MS_VALUE_TYPE(value) == MS_VAL_GENERATOR &&
+           ((ms_generator_t*)MS_AS_OBJECT(value))->is_coroutine;
+}
+
+ms_generator_t* ms_value_as_generator(ms_value_t value) {
+    if (MS_VALUE_TYPE(value) == MS_VAL_GENERATOR) {
+        return (ms_generator_t*)MS_AS_OBJECT(value);
+    }
+    return NULL;
+}
+
+ms_generator_t* ms_generator_new(ms_vm_t* vm, ms_function_t* function,
+                                 ms_value_t* args, int arg_count) {
+    ms_generator_t* generator = ms_gc_alloc(MS_GC_GENERATOR, sizeof(ms_generator_t));
+    generator->type = MS_VAL_GENERATOR;
+    generator->state = MS_GENERATOR_CREATED;
+    generator->vm = vm;
+    generator->function = function;
+    generator->is_coroutine = function->is_coroutine;
+    generator->awaiter = NULL;
+    generator->ip = 0;
+    generator->values = NULL;
+    generator->value_count = 0;
+    generator->value_capacity = 0;
+    ms_generator_suspend(generator, args, arg_count, 0);
+    generator->state = MS_GENERATOR_CREATED;
+    return generator;
+}
+
+void ms_generator_suspend(ms_generator_t* generator, ms_value_t* slots, int count, int ip) {
+    if (count > generator->value_capacity) {
+        int capacity = generator->value_capacity < 8 ? 8 : generator->value_capacity;
+        while (capacity < count) capacity *= 2;
+        generator->values = realloc(generator->values, sizeof(ms_value_t) * capacity);
+        generator->value_capacity = capacity;
+    }
+    if (count > 0) memcpy(generator->values, slots, sizeof(ms_value_t) * count);
+    generator->value_count = count;
+    generator->ip = ip;
+    generator->state = MS_GENERATOR_SUSPENDED;
+}
+
+void ms_generator_free(ms_generator_t* generator) {
+    free(generator->values);
+}
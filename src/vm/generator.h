@@ -0,0 +1,64 @@
+#ifndef MS_GENERATOR_H
+#define MS_GENERATOR_H
+
+#include "vm.h"
+#include "../core/iterator.h"
+
+// 生成器：调用函数体里有 yield 的函数 (或求值生成器表达式 (x for x in it))
+// 时不执行函数体，而是返回一个生成器对象。
+//
+// 生成器的帧不常驻在 VM 的帧栈上：每次 next()/for 循环取元素时，把保存的
+// 局部变量和临时值搬回值栈、压一个帧，从上次停下的位置接着执行；遇到
+// OP_YIELD 时把帧里的值搬回堆上的 values，弹出帧，交出的值就是这次取到的
+// 元素。函数体返回以后生成器就结束了。所以一条 filter/map 流水线
+// 每一级同时只持有一个元素，内存占用与数据量无关。
+//
+// async def 函数的调用结果 (协程) 也是这个对象，只是 is_coroutine 为 true：
+// 它不能被迭代，只能被 await (OP_AWAIT 在外层协程里逐步驱动它) 或者交给
+// 事件循环 (src/ext/http.c) 执行。协程交出的值是等待请求，由事件循环处理。
+typedef enum {
+    MS_GENERATOR_CREATED,    // 还没开始执行
+    MS_GENERATOR_SUSPENDED,  // 停在某个 yield 上
+    MS_GENERATOR_RUNNING,    // 正在执行 (帧在帧栈上，values 是空的)
+    MS_GENERATOR_DONE
+} ms_generator_state_t;
+
+typedef struct ms_generator {
+    // 总是 MS_VAL_GENERATOR，NaN-boxing 下和迭代器一样用 MS_NANBOX_TAG_BOX 存放
+    ms_value_type_t type;
+    ms_generator_state_t state;
+    ms_vm_t* vm;              // 创建它的 VM，恢复时在这个 VM 上执行
+    ms_function_t* function;
+    bool is_coroutine;        // 来自 async def (function->is_coroutine)
+    struct ms_generator* awaiter;  // 正在 await 这个协程的外层协程；作为事件循环的任务时是它自己
+    int ip;                   // 恢复执行的位置 (相对 function->chunk->code)
+    ms_value_t* values;       // 挂起时帧的局部变量和临时值 (从 slots[0] 起)
+    int value_count;
+    int value_capacity;
+} ms_generator_t;
+
+ms_value_t ms_value_generator(ms_generator_t* generator);
+bool ms_value_is_generator(ms_value_t value);
+bool ms_value_is_coroutine(ms_value_t value);
+ms_generator_t* ms_value_as_generator(ms_value_t value);
+
+// 创建处于 CREATED 状态的生成器，args 是函数的全部参数 (默认值已补齐)
+ms_generator_t* ms_generator_new(ms_vm_t* vm, ms_function_t* function,
+                                 ms_value_t* args, int arg_count);
+
+// OP_YIELD：把从 slots 开始的 count 个值和恢复位置保存到生成器里
+void ms_generator_suspend(ms_generator_t* generator, ms_value_t* slots, int count, int ip);
+
+void ms_generator_free(ms_generator_t* generator);
+
+// 让生成器执行到下一个 yield (vm.c)。sent 是这次 yield 表达式的值
+// (还没开始执行时忽略)。交出值时放进 *element 并返回 MS_ITER_ELEMENT，
+// 函数体返回后把返回值放进 *element 并返回 MS_ITER_END，
+// 函数体出错时设置 VM 的错误并返回 MS_ITER_ERROR。
+//
+// 函数体里可能触发垃圾回收：调用者在 C 变量里持有的新对象要先用
+// ms_gc_add_root 登记 (见 ms_iter_collect)
+ms_iter_result_t ms_generator_resume(ms_generator_t* generator, ms_value_t sent,
+                                     ms_value_t* element);
+
+#endif // MS_GENERATOR_H
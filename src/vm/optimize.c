@@ -0,0 +1,284 @@
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// 操作码元信息：名称和操作数字节数
+typedef struct {
+    const char* name;
+    int operand_bytes;
+} ms_opcode_info_t;
+
+static const ms_opcode_info_t opcode_info[] = {
+    [OP_CONSTANT]          = {"OP_CONSTANT", 1},
+    [OP_NIL]               = {"OP_NIL", 0},
+    [OP_TRUE]              = {"OP_TRUE", 0},
+    [OP_FALSE]             = {"OP_FALSE", 0},
+    [OP_POP]               = {"OP_POP", 0},
+    [OP_GET_LOCAL]         = {"OP_GET_LOCAL", 1},
+    [OP_SET_LOCAL]         = {"OP_SET_LOCAL", 1},
+    [OP_GET_GLOBAL]        = {"OP_GET_GLOBAL", 1},
+    [OP_DEFINE_GLOBAL]     = {"OP_DEFINE_GLOBAL", 1},
+    [OP_SET_GLOBAL]        = {"OP_SET_GLOBAL", 1},
+    [OP_GET_UPVALUE]       = {"OP_GET_UPVALUE", 1},
+    [OP_SET_UPVALUE]       = {"OP_SET_UPVALUE", 1},
+    [OP_GET_PROPERTY]      = {"OP_GET_PROPERTY", 2},
+    [OP_SET_PROPERTY]      = {"OP_SET_PROPERTY", 2},
+    [OP_EQUAL]             = {"OP_EQUAL", 0},
+    [OP_GREATER]           = {"OP_GREATER", 0},
+    [OP_LESS]              = {"OP_LESS", 0},
+    [OP_GREATER_EQUAL]     = {"OP_GREATER_EQUAL", 0},
+    [OP_LESS_EQUAL]        = {"OP_LESS_EQUAL", 0},
+    [OP_IN]                = {"OP_IN", 0},
+    [OP_ADD]               = {"OP_ADD", 0},
+    [OP_SUBTRACT]          = {"OP_SUBTRACT", 0},
+    [OP_MULTIPLY]          = {"OP_MULTIPLY", 0},
+    [OP_DIVIDE]            = {"OP_DIVIDE", 0},
+    [OP_FLOOR_DIVIDE]      = {"OP_FLOOR_DIVIDE", 0},
+    [OP_POWER]             = {"OP_POWER", 0},
+    [OP_MODULO]            = {"OP_MODULO", 0},
+    [OP_BIT_OR]            = {"OP_BIT_OR", 0},
+    [OP_BIT_AND]           = {"OP_BIT_AND", 0},
+    [OP_BIT_XOR]           = {"OP_BIT_XOR", 0},
+    [OP_NOT]               = {"OP_NOT", 0},
+    [OP_NEGATE]            = {"OP_NEGATE", 0},
+    [OP_PRINT]             = {"OP_PRINT", 0},
+    [OP_JUMP]              = {"OP_JUMP", 2},
+    [OP_JUMP_IF_FALSE]     = {"OP_JUMP_IF_FALSE", 2},
+    [OP_JUMP_IF_TRUE]      = {"OP_JUMP_IF_TRUE", 2},
+    [OP_LOOP]              = {"OP_LOOP", 2},
+    [OP_CALL]              = {"OP_CALL", 1},
+    [OP_CALL_METHOD]       = {"OP_CALL_METHOD", 1},
+    [OP_CALL_DECORATOR]    = {"OP_CALL_DECORATOR", 1},
+    [OP_CALL_ENTER]        = {"OP_CALL_ENTER", 0},
+    [OP_CALL_EXIT]         = {"OP_CALL_EXIT", 0},
+    [OP_FUNCTION]          = {"OP_FUNCTION", 1},
+    [OP_CLOSURE]           = {"OP_CLOSURE", 1},
+    [OP_CLOSE_UPVALUE]     = {"OP_CLOSE_UPVALUE", 0},
+    [OP_RETURN]            = {"OP_RETURN", 0},
+    [OP_YIELD]             = {"OP_YIELD", 0},
+    [OP_AWAIT]             = {"OP_AWAIT", 0},
+    [OP_LOAD_MODULE]       = {"OP_LOAD_MODULE", 1},
+    [OP_CLASS]             = {"OP_CLASS", 1},
+    [OP_INHERIT]           = {"OP_INHERIT", 0},
+    [OP_METHOD]            = {"OP_METHOD", 1},
+    [OP_BUILD_LIST]        = {"OP_BUILD_LIST", 1},
+    [OP_BUILD_DICT]        = {"OP_BUILD_DICT", 1},
+    [OP_BUILD_TUPLE]       = {"OP_BUILD_TUPLE", 1},
+    [OP_BUILD_SET]         = {"OP_BUILD_SET", 1},
+    [OP_BUILD_STRING]      = {"OP_BUILD_STRING", 1},
+    [OP_FORMAT_VALUE]      = {"OP_FORMAT_VALUE", 1},
+    [OP_CONVERT_VALUE]     = {"OP_CONVERT_VALUE", 1},
+    [OP_SET_ADD]           = {"OP_SET_ADD", 0},
+    [OP_INDEX_GET]         = {"OP_INDEX_GET", 0},
+    [OP_INDEX_SET]         = {"OP_INDEX_SET", 0},
+    [OP_SLICE_GET]         = {"OP_SLICE_GET", 0},
+    [OP_FOR_ITER]          = {"OP_FOR_ITER", 1},
+    [OP_FOR_ITER_LOCAL]    = {"OP_FOR_ITER_LOCAL", 3},
+    [OP_FOR_RANGE]         = {"OP_FOR_RANGE", 5},
+    [OP_FOR_END]           = {"OP_FOR_END", 0},
+    [OP_TERNARY]           = {"OP_TERNARY", 0},
+    [OP_DUP]               = {"OP_DUP", 0},
+    [OP_SWAP]              = {"OP_SWAP", 0},
+    [OP_BUILD_LIST_COMP]   = {"OP_BUILD_LIST_COMP", 2},
+    [OP_LIST_APPEND]       = {"OP_LIST_APPEND", 0},
+    [OP_BUILD_DICT_COMP]   = {"OP_BUILD_DICT_COMP", 0},
+    [OP_LAMBDA]            = {"OP_LAMBDA", 1},
+    [OP_ASSERT]            = {"OP_ASSERT", 0},
+    [OP_DELETE]            = {"OP_DELETE", 1},
+    [OP_RAISE]             = {"OP_RAISE", 0},
+    [OP_EXCEPTION_MATCH]   = {"OP_EXCEPTION_MATCH", 0},
+    [OP_CALL_FINALLY]      = {"OP_CALL_FINALLY", 2},
+    [OP_END_FINALLY]       = {"OP_END_FINALLY", 0},
+
+    // 超级指令的长度覆盖整个被融合的序列
+    [OP_GET_LOCAL_LOCAL]    = {"OP_GET_LOCAL_LOCAL", 3},
+    [OP_SET_LOCAL_POP]      = {"OP_SET_LOCAL_POP", 2},
+    [OP_DEFINE_GLOBAL_POP]  = {"OP_DEFINE_GLOBAL_POP", 2},
+    [OP_JUMP_IF_FALSE_POP]  = {"OP_JUMP_IF_FALSE_POP", 3},
+    [OP_POP_LOOP]           = {"OP_POP_LOOP", 3},
+    [OP_EQUAL_JUMP]         = {"OP_EQUAL_JUMP", 4},
+    [OP_GREATER_JUMP]       = {"OP_GREATER_JUMP", 4},
+    [OP_LESS_JUMP]          = {"OP_LESS_JUMP", 4},
+    [OP_LESS_EQUAL_JUMP]    = {"OP_LESS_EQUAL_JUMP", 4},
+    [OP_GREATER_EQUAL_JUMP] = {"OP_GREATER_EQUAL_JUMP", 4},
+    [OP_INC_LOCAL]          = {"OP_INC_LOCAL", 7},
+    [OP_RETURN_CONSTANT]    = {"OP_RETURN_CONSTANT", 2},
+
+    // 运行时特化
+    [OP_ADD_INT]            = {"OP_ADD_INT", 0},
+    [OP_SUBTRACT_INT]       = {"OP_SUBTRACT_INT", 0},
+    [OP_MULTIPLY_INT]       = {"OP_MULTIPLY_INT", 0},
+    [OP_EQUAL_INT]          = {"OP_EQUAL_INT", 0},
+    [OP_GREATER_INT]        = {"OP_GREATER_INT", 0},
+    [OP_LESS_INT]           = {"OP_LESS_INT", 0},
+    [OP_GREATER_EQUAL_INT]  = {"OP_GREATER_EQUAL_INT", 0},
+    [OP_LESS_EQUAL_INT]     = {"OP_LESS_EQUAL_INT", 0},
+    [OP_SUBTRACT_FLOAT]     = {"OP_SUBTRACT_FLOAT", 0},
+    [OP_MULTIPLY_FLOAT]     = {"OP_MULTIPLY_FLOAT", 0},
+    [OP_DIVIDE_FLOAT]       = {"OP_DIVIDE_FLOAT", 0},
+    [OP_GREATER_FLOAT]      = {"OP_GREATER_FLOAT", 0},
+    [OP_LESS_FLOAT]         = {"OP_LESS_FLOAT", 0},
+    [OP_ADD_STRING]         = {"OP_ADD_STRING", 0},
+
+    // 寄存器格式；融合的条件跳转同样覆盖随后的 OP_R_JUMP_IF_FALSE
+    [OP_R_MOVE]               = {"OP_R_MOVE", 2},
+    [OP_R_LOAD_CONSTANT]      = {"OP_R_LOAD_CONSTANT", 2},
+    [OP_R_GET_GLOBAL]         = {"OP_R_GET_GLOBAL", 2},
+    [OP_R_DEFINE_GLOBAL]      = {"OP_R_DEFINE_GLOBAL", 2},
+    [OP_R_SET_GLOBAL]         = {"OP_R_SET_GLOBAL", 2},
+    [OP_R_GET_PROPERTY]       = {"OP_R_GET_PROPERTY", 4},
+    [OP_R_SET_PROPERTY]       = {"OP_R_SET_PROPERTY", 5},
+    [OP_R_ADD]                = {"OP_R_ADD", 3},
+    [OP_R_SUBTRACT]           = {"OP_R_SUBTRACT", 3},
+    [OP_R_MULTIPLY]           = {"OP_R_MULTIPLY", 3},
+    [OP_R_DIVIDE]             = {"OP_R_DIVIDE", 3},
+    [OP_R_FLOOR_DIVIDE]       = {"OP_R_FLOOR_DIVIDE", 3},
+    [OP_R_POWER]              = {"OP_R_POWER", 3},
+    [OP_R_MODULO]             = {"OP_R_MODULO", 3},
+    [OP_R_BIT_OR]             = {"OP_R_BIT_OR", 3},
+    [OP_R_BIT_AND]            = {"OP_R_BIT_AND", 3},
+    [OP_R_BIT_XOR]            = {"OP_R_BIT_XOR", 3},
+    [OP_R_EQUAL]              = {"OP_R_EQUAL", 3},
+    [OP_R_GREATER]            = {"OP_R_GREATER", 3},
+    [OP_R_LESS]               = {"OP_R_LESS", 3},
+    [OP_R_GREATER_EQUAL]      = {"OP_R_GREATER_EQUAL", 3},
+    [OP_R_LESS_EQUAL]         = {"OP_R_LESS_EQUAL", 3},
+    [OP_R_NOT]                = {"OP_R_NOT", 2},
+    [OP_R_NEGATE]             = {"OP_R_NEGATE", 2},
+    [OP_R_JUMP]               = {"OP_R_JUMP", 2},
+    [OP_R_LOOP]               = {"OP_R_LOOP", 2},
+    [OP_R_JUMP_IF_FALSE]      = {"OP_R_JUMP_IF_FALSE", 3},
+    [OP_R_JUMP_IF_TRUE]       = {"OP_R_JUMP_IF_TRUE", 3},
+    [OP_R_FOR_ITER]           = {"OP_R_FOR_ITER", 4},
+    [OP_R_CALL]               = {"OP_R_CALL", 2},
+    [OP_R_RETURN]             = {"OP_R_RETURN", 1},
+    [OP_R_EQUAL_JUMP]         = {"OP_R_EQUAL_JUMP", 7},
+    [OP_R_GREATER_JUMP]       = {"OP_R_GREATER_JUMP", 7},
+    [OP_R_LESS_JUMP]          = {"OP_R_LESS_JUMP", 7},
+    [OP_R_GREATER_EQUAL_JUMP] = {"OP_R_GREATER_EQUAL_JUMP", 7},
+    [OP_R_LESS_EQUAL_JUMP]    = {"OP_R_LESS_EQUAL_JUMP", 7},
+    [OP_R_FOR_ITER_JUMP]      = {"OP_R_FOR_ITER_JUMP", 8},
+    [OP_R_FOR_RANGE]          = {"OP_R_FOR_RANGE", 5},
+};
+
+#define OPCODE_INFO_COUNT ((int)(sizeof(opcode_info) / sizeof(opcode_info[0])))
+
+const char* ms_opcode_name(uint8_t opcode) {
+    if (opcode >= OPCODE_INFO_COUNT || opcode_info[opcode].name == NULL) {
+        return "OP_UNKNOWN";
+    }
+    return opcode_info[opcode].name;
+}
+
+int ms_opcode_length(uint8_t opcode) {
+    if (opcode >= OPCODE_INFO_COUNT) return 1;
+    return 1 + opcode_info[opcode].operand_bytes;
+}
+
+// 超级指令改写规则：原始操作码序列 -> 替换第一个字节的超级指令。
+// 规则按长度从长到短排列，同一位置优先匹配更长的序列。
+// 选择依据是 tools/opstats 在 examples/ 和 benchmarks/ 上统计的操作码对频率。
+typedef struct {
+    uint8_t ops[5];
+    int op_count;
+    uint8_t fused;
+} ms_fusion_rule_t;
+
+static const ms_fusion_rule_t fusion_rules[] = {
+    {{OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP}, 5, OP_INC_LOCAL},
+    {{OP_EQUAL, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_EQUAL_JUMP},
+    {{OP_GREATER, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_GREATER_JUMP},
+    {{OP_LESS, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_LESS_JUMP},
+    {{OP_LESS_EQUAL, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_LESS_EQUAL_JUMP},
+    {{OP_GREATER_EQUAL, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_GREATER_EQUAL_JUMP},
+    {{OP_GET_LOCAL, OP_GET_LOCAL}, 2, OP_GET_LOCAL_LOCAL},
+    {{OP_SET_LOCAL, OP_POP}, 2, OP_SET_LOCAL_POP},
+    {{OP_DEFINE_GLOBAL, OP_POP}, 2, OP_DEFINE_GLOBAL_POP},
+    {{OP_JUMP_IF_FALSE, OP_POP}, 2, OP_JUMP_IF_FALSE_POP},
+    {{OP_POP, OP_LOOP}, 2, OP_POP_LOOP},
+    {{OP_CONSTANT, OP_RETURN}, 2, OP_RETURN_CONSTANT},
+};
+
+#define FUSION_RULE_COUNT ((int)(sizeof(fusion_rules) / sizeof(fusion_rules[0])))
+
+// 检查 offset 处是否以 rule 描述的原始序列开头
+static bool match_rule(const ms_chunk_t* chunk, int offset, const ms_fusion_rule_t* rule) {
+    int pos = offset;
+    for (int i = 0; i < rule->op_count; i++) {
+        if (pos >= chunk->count || chunk->code[pos] != rule->ops[i]) return false;
+        pos += ms_opcode_length(rule->ops[i]);
+        if (pos > chunk->count) return false;
+    }
+
+    // a = a + k 要求读写的是同一个局部变量
+    if (rule->fused == OP_INC_LOCAL && chunk->code[offset + 1] != chunk->code[offset + 6]) {
+        return false;
+    }
+    return true;
+}
+
+// 编译后的超级指令改写。
+// 只覆盖每个匹配序列的第一个操作码字节：其余字节保持不变，
+// 跳转偏移无需修正，跳到序列中间的代码仍按原始指令执行。
+void ms_chunk_optimize(ms_chunk_t* chunk) {
+    int offset = 0;
+    while (offset < chunk->count) {
+        uint8_t opcode = chunk->code[offset];
+
+        for (int i = 0; i < FUSION_RULE_COUNT; i++) {
+            if (match_rule(chunk, offset, &fusion_rules[i])) {
+                chunk->code[offset] = fusion_rules[i].fused;
+                break;
+            }
+        }
+
+        // 按原始指令长度前进，序列内部的指令也会被尝试匹配
+        offset += ms_opcode_length(opcode);
+    }
+}
+
+#ifdef MS_PROFILE_OPCODES
+// 运行时统计的操作码对计数：[前一条][当前条]
+unsigned long ms_opcode_pair_counts[256][256];
+
+typedef struct {
+    uint8_t first;
+    uint8_t second;
+    unsigned long count;
+} ms_opcode_pair_t;
+
+static int compare_pairs(const void* a, const void* b) {
+    unsigned long ca = ((const ms_opcode_pair_t*)a)->count;
+    unsigned long cb = ((const ms_opcode_pair_t*)b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+void ms_opcode_profile_dump(FILE* out, int limit) {
+    static ms_opcode_pair_t pairs[256 * 256];
+    int pair_count = 0;
+    unsigned long total = 0;
+
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            unsigned long count = ms_opcode_pair_counts[a][b];
+            if (count == 0) continue;
+            pairs[pair_count].first = (uint8_t)a;
+            pairs[pair_count].second = (uint8_t)b;
+            pairs[pair_count].count = count;
+            pair_count++;
+            total += count;
+        }
+    }
+
+    qsort(pairs, pair_count, sizeof(ms_opcode_pair_t), compare_pairs);
+
+    fprintf(out, "%-24s %-24s %12s %7s\n", "first", "second", "count", "share");
+    for (int i = 0; i < pair_count && i < limit; i++) {
+        fprintf(out, "%-24s %-24s %12lu %6.2f%%\n",
+                ms_opcode_name(pairs[i].first), ms_opcode_name(pairs[i].second),
+                pairs[i].count, total ? 100.0 * pairs[i].count / total : 0.0);
+    }
+    fprintf(out, "total pairs: %lu\n", total);
+}
+#endif
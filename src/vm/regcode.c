@@ -0,0 +1,691 @@
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// 栈字节码 -> 寄存器字节码翻译 (MS_REGISTER_VM)
+//
+// 栈上第 p 个位置（相对帧的 slots）直接作为寄存器 p，参数、for 循环的
+// 隐藏局部变量和表达式临时值都落在同一组寄存器里。调用约定也和栈 VM
+// 一样：OP_R_CALL A n 的被调函数在 R[A]，参数紧随其后，返回值写回 R[A]，
+// 所以两种格式的函数可以互相调用。
+//
+// 翻译时模拟栈深度，并记录每个栈位置上的值现在在哪里 (operand_t)。
+// GET_LOCAL 和常量只记下来源，不生成指令，由使用它们的指令直接作为
+// RK 操作数读取，省掉栈 VM 的 push/pop。分支、调用和跳转目标之前把
+// 所有位置物化到各自的寄存器，保证各条路径汇合时寄存器内容一致。
+//
+// 只支持一部分操作码。遇到其他操作码、栈深度不一致或超出 RK 编码范围时
+// 放弃翻译，函数继续使用栈字节码。
+
+#define RK_CONSTANT 0x80
+#define MAX_REGISTERS 0x80
+
+typedef enum {
+    OPERAND_REGISTER,  // 值就在这个位置自己的寄存器里
+    OPERAND_ALIAS,     // 值在更低位置的寄存器 index 里（通常是局部变量）
+    OPERAND_CONSTANT   // 值是常量 constants[index]
+} operand_kind_t;
+
+typedef struct {
+    operand_kind_t kind;
+    int index;
+} operand_t;
+
+typedef struct {
+    const ms_chunk_t* source;
+    ms_chunk_t* out;
+    bool ok;
+
+    operand_t stack[MAX_REGISTERS];
+    int depth;
+    int max_depth;
+    bool live;      // 当前指令是否可达
+    int line;
+
+    // 按源字节码偏移索引
+    bool* is_target;
+    int* target_depth;  // 跳转目标处的栈深度，-1 表示还不知道
+    int* out_offset;    // 对应的输出偏移，-1 表示还没生成
+
+    // 等待回填的前向跳转：偏移字段位置、跳转后的位置、源目标
+    int* patch_at;
+    int* patch_from;
+    int* patch_target;
+    int patch_count;
+
+    // 刚生成的指令：可以改写目标寄存器，或与随后的条件跳转融合
+    int last_offset;
+    int last_register;
+} translator_t;
+
+static void emit_byte(translator_t* t, uint8_t byte) {
+    ms_chunk_write(t->out, byte, t->line);
+}
+
+// 开始一条新指令；写单个寄存器的指令随后设置 last_register
+static void emit_op(translator_t* t, uint8_t op) {
+    t->last_offset = t->out->count;
+    t->last_register = -1;
+    emit_byte(t, op);
+}
+
+static void emit_short(translator_t* t, int value) {
+    emit_byte(t, (uint8_t)((value >> 8) & 0xff));
+    emit_byte(t, (uint8_t)(value & 0xff));
+}
+
+static void fail(translator_t* t) {
+    t->ok = false;
+}
+
+static void push(translator_t* t, operand_kind_t kind, int index) {
+    if (t->depth >= MAX_REGISTERS) {
+        fail(t);
+        return;
+    }
+    t->stack[t->depth].kind = kind;
+    t->stack[t->depth].index = index;
+    t->depth++;
+    if (t->depth > t->max_depth) t->max_depth = t->depth;
+}
+
+// nil/True/False 没有常量槽，需要时追加到输出块的常量表
+static int constant_index(translator_t* t, ms_value_t value) {
+    ms_chunk_t* out = t->out;
+    for (int i = 0; i < out->constant_count; i++) {
+        ms_value_t c = out->constants[i];
+        if (MS_VALUE_TYPE(c) != MS_VALUE_TYPE(value)) continue;
+        if (MS_VALUE_TYPE(c) == MS_VAL_NIL) return i;
+        if (MS_VALUE_TYPE(c) == MS_VAL_BOOL && MS_AS_BOOLEAN(c) == MS_AS_BOOLEAN(value)) return i;
+    }
+    if (out->constant_count > UINT8_MAX) {
+        fail(t);
+        return 0;
+    }
+    return ms_chunk_add_constant(out, value);
+}
+
+// 把位置 p 的值放进寄存器 p
+static void materialize(translator_t* t, int p) {
+    operand_t* operand = &t->stack[p];
+    if (operand->kind == OPERAND_ALIAS) {
+        emit_op(t, OP_R_MOVE);
+        emit_byte(t, (uint8_t)p);
+        emit_byte(t, (uint8_t)operand->index);
+    } else if (operand->kind == OPERAND_CONSTANT) {
+        emit_op(t, OP_R_LOAD_CONSTANT);
+        emit_byte(t, (uint8_t)p);
+        emit_byte(t, (uint8_t)operand->index);
+    } else {
+        return;
+    }
+    t->last_register = p;
+    operand->kind = OPERAND_REGISTER;
+    operand->index = p;
+}
+
+static void materialize_range(translator_t* t, int from, int to) {
+    for (int p = from; p < to; p++) materialize(t, p);
+}
+
+// 位置 p 作为 RK 操作数
+static uint8_t rk(translator_t* t, int p) {
+    operand_t operand = t->stack[p];
+    switch (operand.kind) {
+        case OPERAND_ALIAS:
+            return (uint8_t)operand.index;
+        case OPERAND_CONSTANT:
+            if (operand.index < RK_CONSTANT) return (uint8_t)(RK_CONSTANT | operand.index);
+            materialize(t, p);
+            return (uint8_t)p;
+        default:
+            return (uint8_t)p;
+    }
+}
+
+// 覆盖寄存器 r 之前，先物化仍然引用它旧值的位置
+static void materialize_aliases(translator_t* t, int r, int below) {
+    for (int p = 0; p < below; p++) {
+        if (t->stack[p].kind == OPERAND_ALIAS && t->stack[p].index == r) materialize(t, p);
+    }
+}
+
+static bool has_alias(translator_t* t, int r, int below) {
+    for (int p = 0; p < below; p++) {
+        if (t->stack[p].kind == OPERAND_ALIAS && t->stack[p].index == r) return true;
+    }
+    return false;
+}
+
+// 只写一个目标寄存器、且先读完操作数再写的指令，可以直接改写目标寄存器
+static bool retargetable(uint8_t op) {
+    switch (op) {
+        case OP_R_MOVE:
+        case OP_R_LOAD_CONSTANT:
+        case OP_R_GET_GLOBAL:
+        case OP_R_GET_PROPERTY:
+        case OP_R_ADD:
+        case OP_R_SUBTRACT:
+        case OP_R_MULTIPLY:
+        case OP_R_DIVIDE:
+        case OP_R_FLOOR_DIVIDE:
+        case OP_R_POWER:
+        case OP_R_MODULO:
+        case OP_R_BIT_OR:
+        case OP_R_BIT_AND:
+        case OP_R_BIT_XOR:
+        case OP_R_NOT:
+        case OP_R_NEGATE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint8_t fused_jump(uint8_t op) {
+    switch (op) {
+        case OP_R_EQUAL: return OP_R_EQUAL_JUMP;
+        case OP_R_GREATER: return OP_R_GREATER_JUMP;
+        case OP_R_LESS: return OP_R_LESS_JUMP;
+        case OP_R_GREATER_EQUAL: return OP_R_GREATER_EQUAL_JUMP;
+        case OP_R_LESS_EQUAL: return OP_R_LESS_EQUAL_JUMP;
+        case OP_R_FOR_ITER: return OP_R_FOR_ITER_JUMP;
+        default: return 0;
+    }
+}
+
+static uint8_t register_binary_op(uint8_t op) {
+    switch (op) {
+        case OP_ADD: return OP_R_ADD;
+        case OP_SUBTRACT: return OP_R_SUBTRACT;
+        case OP_MULTIPLY: return OP_R_MULTIPLY;
+        case OP_DIVIDE: return OP_R_DIVIDE;
+        case OP_FLOOR_DIVIDE: return OP_R_FLOOR_DIVIDE;
+        case OP_POWER: return OP_R_POWER;
+        case OP_MODULO: return OP_R_MODULO;
+        case OP_BIT_OR: return OP_R_BIT_OR;
+        case OP_BIT_AND: return OP_R_BIT_AND;
+        case OP_BIT_XOR: return OP_R_BIT_XOR;
+        case OP_EQUAL: return OP_R_EQUAL;
+        case OP_GREATER: return OP_R_GREATER;
+        case OP_LESS: return OP_R_LESS;
+        case OP_GREATER_EQUAL: return OP_R_GREATER_EQUAL;
+        case OP_LESS_EQUAL: return OP_R_LESS_EQUAL;
+        default: return 0;
+    }
+}
+
+// 记录一条到 target 的边，栈深度必须与其他边一致
+static void add_edge(translator_t* t, int target) {
+    if (target < 0 || target >= t->source->count || !t->is_target[target]) {
+        fail(t);
+        return;
+    }
+    if (t->target_depth[target] == -1) {
+        t->target_depth[target] = t->depth;
+    } else if (t->target_depth[target] != t->depth) {
+        fail(t);
+    }
+}
+
+// 生成前向跳转的偏移字段，翻译结束后回填
+static void emit_forward_offset(translator_t* t, int target) {
+    t->patch_at[t->patch_count] = t->out->count;
+    t->patch_from[t->patch_count] = t->out->count + 2;
+    t->patch_target[t->patch_count] = target;
+    t->patch_count++;
+    emit_short(t, 0);
+}
+
+static void conditional_jump(translator_t* t, uint8_t op, int offset, int target) {
+    const uint8_t* code = t->source->code;
+    int cond = t->depth - 1;
+    if (cond < 0) {
+        fail(t);
+        return;
+    }
+
+    // 两条路径都立即弹出条件值时，条件值不必放进自己的寄存器
+    bool cond_dead = offset + 3 < t->source->count && code[offset + 3] == OP_POP &&
+                     target < t->source->count && code[target] == OP_POP;
+
+    materialize_range(t, 0, cond);
+    if (!cond_dead) materialize(t, cond);
+    uint8_t condition = rk(t, cond);
+
+    // 比较或 FOR_ITER 紧跟着对其结果的条件跳转：改写成融合指令
+    if (op == OP_R_JUMP_IF_FALSE && t->stack[cond].kind == OPERAND_REGISTER &&
+        t->last_offset >= 0 && t->last_register == cond) {
+        uint8_t fused = fused_jump(t->out->code[t->last_offset]);
+        if (fused != 0) t->out->code[t->last_offset] = fused;
+    }
+
+    add_edge(t, target);
+    emit_op(t, op);
+    emit_byte(t, condition);
+    emit_forward_offset(t, target);
+}
+
+static void set_local(translator_t* t, int slot) {
+    int top = t->depth - 1;
+    if (top < 0 || slot >= top) {
+        fail(t);
+        return;
+    }
+
+    operand_t value = t->stack[top];
+    if (value.kind == OPERAND_ALIAS && value.index == slot) return;  // x = x
+
+    if (value.kind == OPERAND_REGISTER && t->last_offset >= 0 && t->last_register == top &&
+        retargetable(t->out->code[t->last_offset]) && !has_alias(t, slot, top)) {
+        // 刚算出的值直接写进局部变量：把上一条指令的目标改成 slot
+        t->out->code[t->last_offset + 1] = (uint8_t)slot;
+        t->last_offset = -1;
+        t->stack[top].kind = OPERAND_ALIAS;
+        t->stack[top].index = slot;
+    } else {
+        materialize_aliases(t, slot, top);
+        value = t->stack[top];
+        if (value.kind == OPERAND_CONSTANT) {
+            emit_op(t, OP_R_LOAD_CONSTANT);
+            emit_byte(t, (uint8_t)slot);
+            emit_byte(t, (uint8_t)value.index);
+        } else {
+            emit_op(t, OP_R_MOVE);
+            emit_byte(t, (uint8_t)slot);
+            emit_byte(t, (uint8_t)(value.kind == OPERAND_ALIAS ? value.index : top));
+        }
+    }
+    t->stack[slot].kind = OPERAND_REGISTER;
+    t->stack[slot].index = slot;
+}
+
+// 翻译一条源指令
+static void translate_instruction(translator_t* t, int offset) {
+    const uint8_t* code = t->source->code;
+    uint8_t op = code[offset];
+    int d = t->depth;
+
+    switch (op) {
+        case OP_CONSTANT:
+            push(t, OPERAND_CONSTANT, code[offset + 1]);
+            break;
+        case OP_NIL:
+            push(t, OPERAND_CONSTANT, constant_index(t, ms_value_nil()));
+            break;
+        case OP_TRUE:
+            push(t, OPERAND_CONSTANT, constant_index(t, ms_value_bool(true)));
+            break;
+        case OP_FALSE:
+            push(t, OPERAND_CONSTANT, constant_index(t, ms_value_bool(false)));
+            break;
+        case OP_POP:
+            if (d < 1) {
+                fail(t);
+                break;
+            }
+            t->depth--;
+            break;
+        case OP_DUP:
+            if (d < 1) {
+                fail(t);
+                break;
+            }
+            if (t->stack[d - 1].kind == OPERAND_REGISTER) {
+                push(t, OPERAND_ALIAS, d - 1);
+            } else {
+                push(t, t->stack[d - 1].kind, t->stack[d - 1].index);
+            }
+            break;
+        case OP_GET_LOCAL: {
+            int slot = code[offset + 1];
+            if (slot >= d) {
+                fail(t);
+                break;
+            }
+            if (t->stack[slot].kind == OPERAND_REGISTER) {
+                push(t, OPERAND_ALIAS, slot);
+            } else {
+                push(t, t->stack[slot].kind, t->stack[slot].index);
+            }
+            break;
+        }
+        case OP_SET_LOCAL:
+            set_local(t, code[offset + 1]);
+            break;
+        case OP_GET_GLOBAL:
+            if (d >= MAX_REGISTERS) {
+                fail(t);
+                break;
+            }
+            emit_op(t, OP_R_GET_GLOBAL);
+            emit_byte(t, (uint8_t)d);
+            emit_byte(t, code[offset + 1]);
+            push(t, OPERAND_REGISTER, d);
+            t->last_register = d;
+            break;
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL: {
+            if (d < 1) {
+                fail(t);
+                break;
+            }
+            uint8_t value = rk(t, d - 1);
+            emit_op(t, op == OP_DEFINE_GLOBAL ? OP_R_DEFINE_GLOBAL : OP_R_SET_GLOBAL);
+            emit_byte(t, code[offset + 1]);
+            emit_byte(t, value);
+            break;
+        }
+        case OP_GET_PROPERTY: {
+            if (d < 1) {
+                fail(t);
+                break;
+            }
+            uint8_t object = rk(t, d - 1);
+            emit_op(t, OP_R_GET_PROPERTY);
+            emit_byte(t, (uint8_t)(d - 1));
+            emit_byte(t, object);
+            emit_byte(t, code[offset + 1]);
+            emit_byte(t, code[offset + 2]);
+            t->stack[d - 1].kind = OPERAND_REGISTER;
+            t->stack[d - 1].index = d - 1;
+            t->last_register = d - 1;
+            break;
+        }
+        case OP_SET_PROPERTY: {
+            if (d < 2) {
+                fail(t);
+                break;
+            }
+            uint8_t object = rk(t, d - 2);
+            uint8_t value = rk(t, d - 1);
+            emit_op(t, OP_R_SET_PROPERTY);
+            emit_byte(t, (uint8_t)(d - 2));
+            emit_byte(t, object);
+            emit_byte(t, code[offset + 1]);
+            emit_byte(t, value);
+            emit_byte(t, code[offset + 2]);
+            t->depth -= 2;
+            push(t, OPERAND_REGISTER, d - 2);
+            break;
+        }
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_FLOOR_DIVIDE:
+        case OP_POWER:
+        case OP_MODULO:
+        case OP_BIT_OR:
+        case OP_BIT_AND:
+        case OP_BIT_XOR:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL: {
+            if (d < 2) {
+                fail(t);
+                break;
+            }
+            uint8_t left = rk(t, d - 2);
+            uint8_t right = rk(t, d - 1);
+            emit_op(t, register_binary_op(op));
+            emit_byte(t, (uint8_t)(d - 2));
+            emit_byte(t, left);
+            emit_byte(t, right);
+            t->depth -= 2;
+            push(t, OPERAND_REGISTER, d - 2);
+            t->last_register = d - 2;
+            break;
+        }
+        case OP_NOT:
+        case OP_NEGATE: {
+            if (d < 1) {
+                fail(t);
+                break;
+            }
+            uint8_t operand = rk(t, d - 1);
+            emit_op(t, op == OP_NOT ? OP_R_NOT : OP_R_NEGATE);
+            emit_byte(t, (uint8_t)(d - 1));
+            emit_byte(t, operand);
+            t->stack[d - 1].kind = OPERAND_REGISTER;
+            t->stack[d - 1].index = d - 1;
+            t->last_register = d - 1;
+            break;
+        }
+        case OP_JUMP: {
+            int target = offset + 3 + ((code[offset + 1] << 8) | code[offset + 2]);
+            materialize_range(t, 0, d);
+            add_edge(t, target);
+            emit_op(t, OP_R_JUMP);
+            emit_forward_offset(t, target);
+            t->live = false;
+            break;
+        }
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE: {
+            int target = offset + 3 + ((code[offset + 1] << 8) | code[offset + 2]);
+            conditional_jump(t, op == OP_JUMP_IF_FALSE ? OP_R_JUMP_IF_FALSE : OP_R_JUMP_IF_TRUE,
+                             offset, target);
+            break;
+        }
+        case OP_LOOP: {
+            int target = offset + 3 - ((code[offset + 1] << 8) | code[offset + 2]);
+            materialize_range(t, 0, d);
+            if (target < 0 || t->out_offset[target] < 0 || t->target_depth[target] != d) {
+                fail(t);
+                break;
+            }
+            emit_op(t, OP_R_LOOP);
+            int jump = t->out->count + 2 - t->out_offset[target];
+            if (jump > UINT16_MAX) {
+                fail(t);
+                break;
+            }
+            emit_short(t, jump);
+            t->live = false;
+            break;
+        }
+        case OP_FOR_ITER_LOCAL: {
+            uint8_t var_slot = code[offset + 1];
+            uint8_t iter_slot = code[offset + 2];
+            uint8_t index_slot = code[offset + 3];
+            if (var_slot >= d || iter_slot >= d || index_slot >= d || d >= MAX_REGISTERS) {
+                fail(t);
+                break;
+            }
+            materialize_range(t, 0, d);
+            emit_op(t, OP_R_FOR_ITER);
+            emit_byte(t, (uint8_t)d);
+            emit_byte(t, var_slot);
+            emit_byte(t, iter_slot);
+            emit_byte(t, index_slot);
+            push(t, OPERAND_REGISTER, d);
+            t->last_register = d;
+            break;
+        }
+        case OP_FOR_RANGE: {
+            // 自带条件跳转，不产生条件值
+            uint8_t var_slot = code[offset + 1];
+            uint8_t iter_slot = code[offset + 2];
+            uint8_t index_slot = code[offset + 3];
+            int target = offset + 6 + ((code[offset + 4] << 8) | code[offset + 5]);
+            if (var_slot >= d || iter_slot >= d || index_slot >= d) {
+                fail(t);
+                break;
+            }
+            materialize_range(t, 0, d);
+            add_edge(t, target);
+            emit_op(t, OP_R_FOR_RANGE);
+            emit_byte(t, var_slot);
+            emit_byte(t, iter_slot);
+            emit_byte(t, index_slot);
+            emit_forward_offset(t, target);
+            break;
+        }
+        case OP_CALL: {
+            int arg_count = code[offset + 1];
+            int callee = d - arg_count - 1;
+            if (callee < 0) {
+                fail(t);
+                break;
+            }
+            materialize_range(t, callee, d);
+            emit_op(t, OP_R_CALL);
+            emit_byte(t, (uint8_t)callee);
+            emit_byte(t, (uint8_t)arg_count);
+            t->depth = callee;
+            push(t, OPERAND_REGISTER, callee);
+            break;
+        }
+        case OP_RETURN: {
+            if (d < 1) {
+                fail(t);
+                break;
+            }
+            uint8_t value = rk(t, d - 1);
+            emit_op(t, OP_R_RETURN);
+            emit_byte(t, value);
+            t->live = false;
+            break;
+        }
+        default:
+            fail(t);
+            break;
+    }
+}
+
+// 先找出所有跳转目标：它们是基本块的开头，到达时所有位置都要已物化
+static bool find_targets(translator_t* t) {
+    const ms_chunk_t* source = t->source;
+    int offset = 0;
+    while (offset < source->count) {
+        uint8_t op = source->code[offset];
+        int length = ms_opcode_length(op);
+        if (offset + length > source->count) return false;
+
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_LOOP) {
+            int jump = (source->code[offset + 1] << 8) | source->code[offset + 2];
+            int target = op == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+            if (target < 0 || target >= source->count) return false;
+            t->is_target[target] = true;
+        } else if (op == OP_FOR_RANGE) {
+            int target = offset + 6 + ((source->code[offset + 4] << 8) | source->code[offset + 5]);
+            if (target >= source->count) return false;
+            t->is_target[target] = true;
+        }
+        offset += length;
+    }
+    return true;
+}
+
+static void translate(translator_t* t, int arity) {
+    const ms_chunk_t* source = t->source;
+
+    if (arity >= MAX_REGISTERS || !find_targets(t)) {
+        fail(t);
+        return;
+    }
+
+    for (int i = 0; i < arity; i++) push(t, OPERAND_REGISTER, i);
+    t->live = true;
+
+    int offset = 0;
+    while (t->ok && offset < source->count) {
+        t->line = source->lines[offset];
+
+        if (t->is_target[offset]) {
+            if (t->live) {
+                materialize_range(t, 0, t->depth);
+                add_edge(t, offset);
+            } else if (t->target_depth[offset] >= 0) {
+                // 只能从跳转到达：所有位置都在各自的寄存器里
+                t->live = true;
+                t->depth = t->target_depth[offset];
+                for (int p = 0; p < t->depth; p++) {
+                    t->stack[p].kind = OPERAND_REGISTER;
+                    t->stack[p].index = p;
+                }
+            }
+            t->last_offset = -1;
+        }
+
+        if (t->live) {
+            t->out_offset[offset] = t->out->count;
+            translate_instruction(t, offset);
+        }
+        offset += ms_opcode_length(source->code[offset]);
+    }
+
+    // 函数总以 OP_RETURN 结束，末尾仍可达说明字节码不是预期的形式
+    if (t->live) fail(t);
+
+    for (int i = 0; t->ok && i < t->patch_count; i++) {
+        int target = t->out_offset[t->patch_target[i]];
+        int jump = target - t->patch_from[i];
+        if (target < 0 || jump < 0 || jump > UINT16_MAX) {
+            fail(t);
+            break;
+        }
+        t->out->code[t->patch_at[i]] = (uint8_t)((jump >> 8) & 0xff);
+        t->out->code[t->patch_at[i] + 1] = (uint8_t)(jump & 0xff);
+    }
+}
+
+// 把函数体翻译成寄存器格式。成功时 function->chunk 换成新的块；
+// 失败时函数保持不变，仍由栈 VM 执行。
+bool ms_function_to_registers(ms_function_t* function) {
+    const ms_chunk_t* source = function->chunk;
+    // 有 try 语句的函数留给栈 VM：异常表的偏移和栈高都是按栈字节码算的
+    if (source->count == 0 || source->register_count > 0 || source->handler_count > 0) return false;
+
+    ms_chunk_t* out = malloc(sizeof(ms_chunk_t));
+    ms_chunk_init(out);
+    for (int i = 0; i < source->constant_count; i++) {
+        ms_chunk_add_constant(out, source->constants[i]);
+    }
+    // 缓存号原样保留，新块分配同样多的缓存
+    for (int i = 0; i < source->property_cache_count; i++) {
+        ms_chunk_add_property_cache(out);
+    }
+
+    translator_t t;
+    memset(&t, 0, sizeof(t));
+    t.source = source;
+    t.out = out;
+    t.ok = true;
+    t.last_offset = -1;
+    t.last_register = -1;
+    t.is_target = calloc(source->count, sizeof(bool));
+    t.target_depth = malloc(sizeof(int) * source->count);
+    t.out_offset = malloc(sizeof(int) * source->count);
+    // 每条源指令至少一个字节，最多生成一个前向跳转
+    t.patch_at = malloc(sizeof(int) * source->count);
+    t.patch_from = malloc(sizeof(int) * source->count);
+    t.patch_target = malloc(sizeof(int) * source->count);
+    for (int i = 0; i < source->count; i++) {
+        t.target_depth[i] = -1;
+        t.out_offset[i] = -1;
+    }
+
+    translate(&t, function->arity);
+
+    free(t.is_target);
+    free(t.target_depth);
+    free(t.out_offset);
+    free(t.patch_at);
+    free(t.patch_from);
+    free(t.patch_target);
+
+    if (!t.ok) {
+        ms_chunk_free(out);
+        free(out);
+        return false;
+    }
+
+    out->register_count = t.max_depth > 0 ? t.max_depth : 1;
+    function->chunk = out;
+    return true;
+}
@@ -1,6 +1,11 @@
 #include "vm.h"
+#include "generator.h"
 #include "../ext/ext.h"
 #include "../core/class.h"
+#include "../core/iterator.h"
+#include "../core/gc.h"
+#include "../core/format.h"
+#include "../builtins/builtins.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +20,27 @@
     #define PATH_SEPARATOR "/"
 #endif
 
+// 指令分派方式：GCC/Clang 下默认使用 labels-as-values 直接跳转，
+// 编译时定义 MS_COMPUTED_GOTO=0 可回退到可移植的 switch 分派
+// (开启 MS_PROFILE_OPCODES 统计时也使用 switch，统计点只有一个)
+#ifndef MS_COMPUTED_GOTO
+    #if defined(__GNUC__) && !defined(MS_PROFILE_OPCODES)
+        #define MS_COMPUTED_GOTO 1
+    #else
+        #define MS_COMPUTED_GOTO 0
+    #endif
+#endif
+
+#if MS_COMPUTED_GOTO
+    #define CASE(op) op_##op: case op
+    #define DEFAULT_CASE op_unhandled: default
+    #define DISPATCH() goto *dispatch_table[*frame->ip++]
+#else
+    #define CASE(op) case op
+    #define DEFAULT_CASE default
+    #define DISPATCH() break
+#endif
+
 // 外部名称表
 char* name_table_names[256];
 int name_table_count = 0;
@@ -84,451 +110,1603 @@ static ms_dynamic_extension_t* try_load_library(const char* module_name) {
     return NULL;
 }
 
+static void set_error(ms_vm_t* vm, ms_exception_kind_t kind, const char* format, va_list args) {
+    vsnprintf(vm->error_message, sizeof(vm->error_message), format, args);
+    vm->has_error = true;
+    vm->error_kind = kind;
+    vm->has_exception = false;
+}
+
+// 解释器内部状态出错 (下标越界的名字表、栈溢出等) 报告为 RuntimeError
 static void runtime_error(ms_vm_t* vm, const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vsnprintf(vm->error_message, sizeof(vm->error_message), format, args);
+    set_error(vm, MS_RUNTIME_ERROR, format, args);
+    va_end(args);
+}
+
+static void runtime_error_kind(ms_vm_t* vm, ms_exception_kind_t kind, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    set_error(vm, kind, format, args);
+    va_end(args);
+}
+
+void ms_vm_raise(ms_vm_t* vm, ms_exception_kind_t kind, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    set_error(vm, kind, format, args);
     va_end(args);
-    vm->has_error = true;
 }
 
 static ms_value_t peek(ms_vm_t* vm, int distance) {
     return vm->stack_top[-1 - distance];
 }
 
-static bool is_falsey(ms_value_t value) {
-    return ms_value_is_nil(value) || 
-           (ms_value_is_bool(value) && !ms_value_as_bool(value));
+static inline bool is_falsey(ms_value_t value) {
+    ms_value_type_t type = MS_VALUE_TYPE(value);
+    return type == MS_VAL_NIL || (type == MS_VAL_BOOL && !MS_AS_BOOLEAN(value));
 }
 
 static bool values_equal(ms_value_t a, ms_value_t b) {
-    if (a.type != b.type) return false;
+    if (MS_VALUE_TYPE(a) != MS_VALUE_TYPE(b)) return false;
     
-    switch (a.type) {
-        case MS_VAL_BOOL: return a.as.boolean == b.as.boolean;
+    switch (MS_VALUE_TYPE(a)) {
+        case MS_VAL_BOOL: return MS_AS_BOOLEAN(a) == MS_AS_BOOLEAN(b);
         case MS_VAL_NIL: return true;
-        case MS_VAL_INT: return a.as.integer == b.as.integer;
-        case MS_VAL_FLOAT: return a.as.floating == b.as.floating;
-        case MS_VAL_STRING: return strcmp(a.as.string, b.as.string) == 0;
+        case MS_VAL_INT: return MS_AS_INTEGER(a) == MS_AS_INTEGER(b);
+        case MS_VAL_FLOAT: return MS_AS_FLOATING(a) == MS_AS_FLOATING(b);
+        case MS_VAL_STRING: return ms_string_equal(MS_AS_STRING(a), MS_AS_STRING(b));
         default: return false;
     }
 }
 
-static ms_result_t run(ms_vm_t* vm) {
+// 查找实例所属类上的魔术方法，只有脚本函数才返回
+static ms_function_t* find_magic_method(ms_value_t value, const char* name) {
+    if (!ms_value_is_instance(value)) return NULL;
+
+    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(value);
+    ms_value_t method = ms_dict_get(instance->klass->methods, name);
+    if (MS_VALUE_TYPE(method) != MS_VAL_FUNCTION) return NULL;
+    return (ms_function_t*)MS_AS_FUNCTION(method);
+}
+
+// 用缺省值补齐缺失的参数
+static void push_defaults(ms_vm_t* vm, ms_function_t* function, int arg_count) {
+    int missing_args = function->arity - arg_count;
+    if (missing_args > 0) {
+        int default_start = function->default_count - missing_args;
+        for (int i = 0; i < missing_args; i++) {
+            ms_vm_push(vm, function->defaults[default_start + i]);
+        }
+    }
+}
+
+// 每个帧开始执行时值栈上至少留出的空位。帧内的压栈一般不会超过它，
+// 超过时由 ms_vm_push 兜底扩容，所以调度循环里只有帧切换之后才需要重新取指针
+#define FRAME_STACK_RESERVE 128
+
+// 把值栈扩大到至少能容纳 needed 个值，并修正所有指向旧栈的指针
+static void grow_stack(ms_vm_t* vm, size_t needed) {
+    size_t capacity = (size_t)(vm->stack_end - vm->stack);
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    // 旧地址只作为整数参与计算，避免使用 realloc 之后的旧指针
+    uintptr_t old_stack = (uintptr_t)vm->stack;
+    vm->stack = realloc(vm->stack, sizeof(ms_value_t) * capacity);
+#define REBASE(pointer) (vm->stack + ((uintptr_t)(pointer) - old_stack) / sizeof(ms_value_t))
+    vm->stack_top = REBASE(vm->stack_top);
+    vm->stack_end = vm->stack + capacity;
+    for (int i = 0; i < vm->frame_count; i++) {
+        vm->frames[i].slots = REBASE(vm->frames[i].slots);
+        vm->frames[i].base = REBASE(vm->frames[i].base);
+    }
+#undef REBASE
+}
+
+// 确保栈顶之上还有 FRAME_STACK_RESERVE 个空位，超过上限时报错
+static bool reserve_frame_stack(ms_vm_t* vm) {
+    size_t needed = (size_t)(vm->stack_top - vm->stack) + FRAME_STACK_RESERVE;
+    if (needed <= (size_t)(vm->stack_end - vm->stack)) return true;
+    if (needed > (size_t)vm->max_stack_size) {
+        runtime_error(vm, "Stack overflow.");
+        return false;
+    }
+    grow_stack(vm, needed);
+    return true;
+}
+
+// 按调用方式把返回值交给调用者 (栈顶已经恢复到调用前)
+static void deliver_result(ms_vm_t* vm, ms_frame_return_t on_return,
+                           ms_value_t self, ms_value_t result) {
+    switch (on_return) {
+        case MS_FRAME_RETURN_VALUE:
+            ms_vm_push(vm, result);
+            break;
+        case MS_FRAME_RETURN_INSTANCE:
+            ms_vm_push(vm, self);
+            break;
+        case MS_FRAME_RETURN_PRINT:
+            if (ms_value_is_string(result)) {
+                printf("%s\n", ms_value_as_string(result));
+            } else {
+                printf("<object>\n");
+            }
+            break;
+        case MS_FRAME_RETURN_DISCARD:
+            break;
+    }
+}
+
+// 压入帧，不区分是不是生成器函数 (push_frame 和恢复生成器共用)
+static bool enter_frame(ms_vm_t* vm, ms_function_t* function, int arg_count,
+                        ms_value_t* base, ms_frame_return_t on_return) {
+    if (vm->frame_count == vm->frame_capacity) {
+        if (vm->frame_capacity >= vm->max_frames) {
+            runtime_error(vm, "Stack overflow.");
+            return false;
+        }
+        vm->frame_capacity *= 2;
+        if (vm->frame_capacity > vm->max_frames) vm->frame_capacity = vm->max_frames;
+        vm->frames = realloc(vm->frames, sizeof(ms_call_frame_t) * vm->frame_capacity);
+    }
+    ptrdiff_t base_offset = base - vm->stack;
+    if (!reserve_frame_stack(vm)) {
+        return false;
+    }
+    base = vm->stack + base_offset;
+
+    ms_call_frame_t* frame = &vm->frames[vm->frame_count++];
+    frame->chunk = function->chunk;
+    frame->ip = function->chunk->code;
+    frame->slots = vm->stack_top - arg_count;
+    frame->base = base;
+    frame->on_return = on_return;
+    vm->chunk = function->chunk;
+
+#ifdef MS_REGISTER_VM
+    // 寄存器格式：参数之后的寄存器在使用前清成 nil
+    for (int i = arg_count; i < function->chunk->register_count; i++) {
+        frame->slots[i] = ms_value_nil();
+    }
+#endif
+    return true;
+}
+
+// 压入调用帧：栈顶的 arg_count 个值成为被调函数的局部变量槽，
+// 返回时栈顶恢复到 base，并按 on_return 处理返回值。
+// 不会递归进入 run()，调用和返回都只是切换 frame。
+// 值栈或帧栈可能在这里扩容，调用之后要重新取 frame 和栈上的指针。
+//
+// 生成器函数不压帧：参数存进新建的生成器，像函数立刻返回一样把生成器交给调用者
+static bool push_frame(ms_vm_t* vm, ms_function_t* function, int arg_count,
+                       ms_value_t* base, ms_frame_return_t on_return) {
+    if (function->is_generator) {
+        ms_value_t* args = vm->stack_top - arg_count;
+        ms_value_t self = arg_count > 0 ? args[0] : ms_value_nil();
+        ms_generator_t* generator = ms_generator_new(vm, function, args, arg_count);
+        vm->stack_top = base;
+        deliver_result(vm, on_return, self, ms_value_generator(generator));
+        return true;
+    }
+    return enter_frame(vm, function, arg_count, base, on_return);
+}
+
+// 按编译期名字下标取全局变量槽位，第一次访问时按名字解析并缓存到 name_slots
+static inline ms_global_t* global_at(ms_vm_t* vm, uint8_t name_index) {
+    int slot = vm->name_slots[name_index];
+    if (slot < 0) {
+        slot = ms_vm_global_slot(vm, name_table_names[name_index], true);
+        vm->name_slots[name_index] = slot;
+    }
+    return &vm->globals[slot];
+}
+
+static inline void define_global(ms_vm_t* vm, uint8_t name_index, ms_value_t value) {
+    ms_global_t* global = global_at(vm, name_index);
+    global->value = value;
+    global->defined = true;
+}
+
+// 字符串拼接时非字符串操作数的文本，字符串本身直接使用
+// "n=" + 5 这样只有一边是字符串的拼接：另一边的文本写在栈上，结果一次分配。
+// 结果够长时仍交给 ms_string_concat，保留绳结构
+static ms_value_t concat_text(ms_value_t a, ms_value_t b) {
+    bool text_first = !ms_value_is_string(a);
+    ms_value_t string = text_first ? b : a;
+    char buffer[MS_FORMAT_BUFFER_SIZE];
+    size_t text_length;
+    const char* text = ms_format_text(text_first ? a : b, buffer, &text_length);
+    size_t string_length = ms_string_value_length(string);
+    if (text_length + string_length >= MS_ROPE_MIN) {
+        ms_value_t converted = ms_string_copy(text, text_length);
+        return text_first ? ms_string_concat(converted, string) : ms_string_concat(string, converted);
+    }
+    // 总长度不到 MS_ROPE_MIN，字符串一边不可能是绳结点
+    const char* chars = MS_STRING_POINTER(string);
+    char* result = ms_string_alloc(text_length + string_length);
+    if (text_first) {
+        memcpy(result, text, text_length);
+        memcpy(result + text_length, chars, string_length);
+    } else {
+        memcpy(result, chars, string_length);
+        memcpy(result + string_length, text, text_length);
+    }
+    return MS_STRING_VALUE(result);
+}
+
+// f-string 的拼接：先取出每个值的文本、算出总长度，再一次分配写完。
+// 数字的文本写在暂存区里，字符串直接引用自身的字符
+static ms_value_t build_string(const ms_value_t* parts, int count) {
+    if (count == 1 && ms_value_is_string(parts[0])) return parts[0];
+    const char* texts[256];
+    size_t lengths[256];
+    char scratch[256][MS_FORMAT_BUFFER_SIZE];
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        texts[i] = ms_format_text(parts[i], scratch[i], &lengths[i]);
+        total += lengths[i];
+    }
+    char* result = ms_string_alloc(total);
+    char* p = result;
+    for (int i = 0; i < count; i++) {
+        memcpy(p, texts[i], lengths[i]);
+        p += lengths[i];
+    }
+    return MS_STRING_VALUE(result);
+}
+
+// 算术结果：两个整数得到整数，否则是浮点数；比较结果总是布尔值
+#define NUMBER_OP(int_type, float_type, op) \
+    do { \
+        if (ms_value_is_int(a) && ms_value_is_int(b)) { \
+            *result = int_type(ms_value_as_int(a) op ms_value_as_int(b)); \
+        } else if ((ms_value_is_int(a) || ms_value_is_float(a)) && \
+                   (ms_value_is_int(b) || ms_value_is_float(b))) { \
+            *result = float_type(ms_value_as_float(a) op ms_value_as_float(b)); \
+        } else { \
+            runtime_error_kind(vm, MS_TYPE_ERROR, "Operands must be numbers."); \
+            return false; \
+        } \
+    } while (false)
+
+
+#ifndef MS_PROFILE_OPCODES
+// 运行时特化：按这次看到的操作数类型选出 op 的专用版本，没有合适的返回 op 本身。
+// 专用版本与 binary_values 的语义一致
+static uint8_t specialize_binary(uint8_t op, ms_value_t a, ms_value_t b) {
+    if (MS_VALUE_TYPE(a) == MS_VAL_INT && MS_VALUE_TYPE(b) == MS_VAL_INT) {
+        switch (op) {
+            case OP_ADD: return OP_ADD_INT;
+            case OP_SUBTRACT: return OP_SUBTRACT_INT;
+            case OP_MULTIPLY: return OP_MULTIPLY_INT;
+            case OP_EQUAL: return OP_EQUAL_INT;
+            case OP_GREATER: return OP_GREATER_INT;
+            case OP_LESS: return OP_LESS_INT;
+            case OP_GREATER_EQUAL: return OP_GREATER_EQUAL_INT;
+            case OP_LESS_EQUAL: return OP_LESS_EQUAL_INT;
+            default: return op;
+        }
+    }
+    if (MS_VALUE_TYPE(a) == MS_VAL_FLOAT && MS_VALUE_TYPE(b) == MS_VAL_FLOAT) {
+        switch (op) {
+            case OP_SUBTRACT: return OP_SUBTRACT_FLOAT;
+            case OP_MULTIPLY: return OP_MULTIPLY_FLOAT;
+            case OP_DIVIDE: return OP_DIVIDE_FLOAT;
+            case OP_GREATER: return OP_GREATER_FLOAT;
+            case OP_LESS: return OP_LESS_FLOAT;
+            default: return op;
+        }
+    }
+    if (MS_VALUE_TYPE(a) == MS_VAL_STRING && MS_VALUE_TYPE(b) == MS_VAL_STRING && op == OP_ADD) {
+        return OP_ADD_STRING;
+    }
+    return op;
+}
+#endif
+
+// 二元运算（不含魔术方法）的完整语义，栈和寄存器两个解释循环共用。
+// 整数的快速路径由各自的处理代码内联。出错时设置错误并返回 false。
+// | & ^：两个整数按位运算，两个集合求并集、交集、对称差
+static bool bitwise_values(ms_vm_t* vm, uint8_t op, ms_value_t a, ms_value_t b,
+                           ms_value_t* result) {
+    if (ms_value_is_int(a) && ms_value_is_int(b)) {
+        int64_t x = ms_value_as_int(a);
+        int64_t y = ms_value_as_int(b);
+        *result = ms_value_int(op == OP_BIT_OR ? (x | y) : op == OP_BIT_AND ? (x & y) : (x ^ y));
+        return true;
+    }
+    if (ms_value_is_set(a) && ms_value_is_set(b)) {
+        ms_set_t* x = ms_value_as_set(a);
+        ms_set_t* y = ms_value_as_set(b);
+        ms_set_t* set = op == OP_BIT_OR ? ms_set_union(x, y)
+                      : op == OP_BIT_AND ? ms_set_intersection(x, y)
+                      : ms_set_symmetric_difference(x, y);
+        *result = ms_value_set(set);
+        return true;
+    }
+    runtime_error_kind(vm, MS_TYPE_ERROR, "Operands must be two integers or two sets.");
+    return false;
+}
+
+// / 的除数是 0 或 0.0：和 // 一样报告 ZeroDivisionError，整数 0 不能交给 C 的除法
+static inline bool is_zero_divisor(ms_value_t b) {
+    return (MS_VALUE_TYPE(b) == MS_VAL_INT && MS_AS_INTEGER(b) == 0) ||
+           (MS_VALUE_TYPE(b) == MS_VAL_FLOAT && MS_AS_FLOATING(b) == 0.0);
+}
+
+static bool binary_values(ms_vm_t* vm, uint8_t op, ms_value_t a, ms_value_t b,
+                          ms_value_t* result) {
+    switch (op) {
+        case OP_ADD:
+            // If either operand is a string, convert the other one to text and concatenate
+            if (ms_value_is_string(a) && ms_value_is_string(b)) {
+                *result = ms_string_concat(a, b);
+            } else if (ms_value_is_string(a) || ms_value_is_string(b)) {
+                *result = concat_text(a, b);
+            } else if (ms_value_is_int(a) && ms_value_is_int(b)) {
+                *result = ms_value_int(ms_value_as_int(a) + ms_value_as_int(b));
+            } else if ((ms_value_is_int(a) || ms_value_is_float(a)) &&
+                       (ms_value_is_int(b) || ms_value_is_float(b))) {
+                *result = ms_value_float(ms_value_as_float(a) + ms_value_as_float(b));
+            } else {
+                runtime_error_kind(vm, MS_TYPE_ERROR, "Operands must be two numbers or two strings.");
+                return false;
+            }
+            return true;
+        case OP_SUBTRACT:
+            if (ms_value_is_set(a) && ms_value_is_set(b)) {
+                *result = ms_value_set(ms_set_difference(ms_value_as_set(a), ms_value_as_set(b)));
+                return true;
+            }
+            NUMBER_OP(ms_value_int, ms_value_float, -);
+            return true;
+        case OP_MULTIPLY: NUMBER_OP(ms_value_int, ms_value_float, *); return true;
+        case OP_DIVIDE: NUMBER_OP(ms_value_int, ms_value_float, /); return true;
+        case OP_GREATER: NUMBER_OP(ms_value_bool, ms_value_bool, >); return true;
+        case OP_LESS: NUMBER_OP(ms_value_bool, ms_value_bool, <); return true;
+        case OP_GREATER_EQUAL: NUMBER_OP(ms_value_bool, ms_value_bool, >=); return true;
+        case OP_LESS_EQUAL: NUMBER_OP(ms_value_bool, ms_value_bool, <=); return true;
+        case OP_EQUAL:
+            *result = ms_value_bool(values_equal(a, b));
+            return true;
+        case OP_FLOOR_DIVIDE:
+            if (ms_value_is_int(a) && ms_value_is_int(b)) {
+                int64_t divisor = ms_value_as_int(b);
+                if (divisor == 0) {
+                    runtime_error_kind(vm, MS_ZERO_DIVISION_ERROR, "Division by zero.");
+                    return false;
+                }
+                *result = ms_value_int(ms_value_as_int(a) / divisor);
+            } else {
+                double da = ms_value_as_float(a);
+                double db = ms_value_as_float(b);
+                if (db == 0.0) {
+                    runtime_error_kind(vm, MS_ZERO_DIVISION_ERROR, "Division by zero.");
+                    return false;
+                }
+                *result = ms_value_int((int64_t)(da / db));
+            }
+            return true;
+        case OP_POWER: {
+            double value = pow(ms_value_as_float(a), ms_value_as_float(b));
+            // 如果结果是整数，返回整数类型
+            if (value == (int64_t)value && value >= INT64_MIN && value <= INT64_MAX) {
+                *result = ms_value_int((int64_t)value);
+            } else {
+                *result = ms_value_float(value);
+            }
+            return true;
+        }
+        case OP_MODULO:
+            if (ms_value_is_int(a) && ms_value_is_int(b)) {
+                int64_t divisor = ms_value_as_int(b);
+                if (divisor == 0) {
+                    runtime_error_kind(vm, MS_ZERO_DIVISION_ERROR, "Modulo by zero.");
+                    return false;
+                }
+                *result = ms_value_int(ms_value_as_int(a) % divisor);
+            } else {
+                runtime_error_kind(vm, MS_TYPE_ERROR, "Modulo operands must be integers.");
+                return false;
+            }
+            return true;
+        case OP_BIT_OR:
+        case OP_BIT_AND:
+        case OP_BIT_XOR:
+            return bitwise_values(vm, op, a, b, result);
+        default:
+            runtime_error(vm, "Unknown binary operator.");
+            return false;
+    }
+}
+
+#undef NUMBER_OP
+
+// 调用栈顶下方 arg_count 处的值，参数在其上方。
+// 原生函数和无 __init__ 的类立即完成，结果写回被调值所在的位置；
+// 脚本函数压入新帧，由调用者切换到新帧执行。
+static bool call_value(ms_vm_t* vm, int arg_count) {
+    ms_value_t func_val = peek(vm, arg_count);
+
+    // 检查是否是绑定方法调用
+    if (ms_value_is_bound_method(func_val)) {
+        ms_bound_method_t* bound = (ms_bound_method_t*)ms_value_as_bound_method(func_val);
+        ms_value_t method = bound->method;
+        ms_value_t receiver = bound->receiver;
+
+        // 将 receiver (self) 插入到参数列表的开头
+        // 栈布局: [bound_method, arg1, arg2, ...] -> [receiver, arg1, arg2, ...]
+        vm->stack_top[-arg_count - 1] = receiver;
+
+        // 调用方法
+        if (MS_VALUE_TYPE(method) == MS_VAL_FUNCTION) {
+            ms_function_t* function = MS_AS_FUNCTION(method);
+
+            // 检查参数数量（包括 self）
+            int min_args = function->arity - function->default_count;
+            int max_args = function->arity;
+            int total_args = arg_count + 1;  // +1 for self
+
+            if (total_args < min_args || total_args > max_args) {
+                runtime_error_kind(vm, MS_TYPE_ERROR, "Expected %d to %d arguments but got %d.",
+                            min_args, max_args, total_args);
+                return false;
+            }
+
+            // 填充默认参数
+            push_defaults(vm, function, total_args);
+
+            // 注意：栈上现在是 [receiver, arg1, arg2, ...]，没有bound_method
+            // 返回值写回 receiver 所在的位置
+            ms_value_t* call_stack_base = vm->stack_top - function->arity;
+            return push_frame(vm, function, function->arity, call_stack_base, MS_FRAME_RETURN_VALUE);
+        }
+        if (MS_VALUE_TYPE(method) == MS_VAL_NATIVE_FUNC) {
+            // 内置类型的方法：receiver 作为第一个参数
+            ptrdiff_t args_offset = vm->stack_top - arg_count - 1 - vm->stack;
+            ms_value_t result = MS_AS_NATIVE_FUNC(method)->func(vm, arg_count + 1, vm->stack + args_offset);
+            vm->stack_top = vm->stack + args_offset;
+            ms_vm_push(vm, result);
+            return !vm->has_error;
+        }
+        return true;
+    }
+
+    // 检查是否是类实例化
+    if (ms_value_is_class(func_val)) {
+        ms_class_t* klass = (ms_class_t*)ms_value_as_class(func_val);
+
+        // 创建实例
+        ms_instance_t* instance = ms_instance_new(klass);
+        ms_value_t instance_val = ms_value_instance(instance);
+
+        // 查找 __init__ 方法
+        ms_dict_entry_t* init_entry = ms_dict_find(klass->methods, "__init__");
+        if (init_entry != NULL) {
+            ms_value_t init_method = init_entry->value;
+
+            // 将实例作为第一个参数（self）
+            // 栈布局: [class, arg1, arg2, ...] -> [instance, arg1, arg2, ...]
+            vm->stack_top[-arg_count - 1] = instance_val;
+
+            // 调用 __init__
+            if (MS_VALUE_TYPE(init_method) == MS_VAL_FUNCTION) {
+                ms_function_t* function = MS_AS_FUNCTION(init_method);
+
+                // 检查参数数量（包括 self）
+                int min_args = function->arity - function->default_count;
+                int max_args = function->arity;
+                int total_args = arg_count + 1;  // +1 for self
+
+                if (total_args < min_args || total_args > max_args) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "__init__() takes %d to %d arguments but %d were given.",
+                                min_args, max_args, total_args);
+                    return false;
+                }
+
+                // 填充默认参数
+                push_defaults(vm, function, total_args);
+
+                // 注意：栈上现在是 [instance, arg1, arg2, ...]，没有class
+                // __init__ 返回 None，返回时改为推送实例
+                ms_value_t* call_stack_base = vm->stack_top - function->arity;
+                return push_frame(vm, function, function->arity, call_stack_base, MS_FRAME_RETURN_INSTANCE);
+            }
+            if (MS_VALUE_TYPE(init_method) == MS_VAL_NATIVE_FUNC) {
+                // 内置类 (异常类型) 的 __init__：instance 作为第一个参数，返回后留下实例
+                ptrdiff_t args_offset = vm->stack_top - arg_count - 1 - vm->stack;
+                MS_AS_NATIVE_FUNC(init_method)->func(vm, arg_count + 1, vm->stack + args_offset);
+                vm->stack_top = vm->stack + args_offset;
+                ms_vm_push(vm, instance_val);
+                return !vm->has_error;
+            }
+        } else {
+            // 没有 __init__，直接返回实例
+            vm->stack_top -= arg_count + 1;
+            ms_vm_push(vm, instance_val);
+        }
+        return true;
+    }
+
+    if (MS_VALUE_TYPE(func_val) == MS_VAL_NATIVE_FUNC && MS_AS_NATIVE_FUNC(func_val) != NULL) {
+        // 原生函数调用。参数是生成器时原生函数里会执行脚本，值栈可能搬家，
+        // 所以按下标记住栈基址；脚本出的错在返回后报告
+        ptrdiff_t base_offset = vm->stack_top - arg_count - 1 - vm->stack;
+        ms_value_t result = MS_AS_NATIVE_FUNC(func_val)->func(vm, arg_count, vm->stack + base_offset + 1);
+        vm->stack_top = vm->stack + base_offset;  // 恢复到函数调用前
+        ms_vm_push(vm, result);
+        if (vm->has_error) return false;
+    } else if (MS_VALUE_TYPE(func_val) == MS_VAL_FUNCTION) {
+        // 用户定义的函数调用
+        ms_function_t* function = MS_AS_FUNCTION(func_val);
+
+        // 检查参数数量（考虑默认参数）
+        int min_args = function->arity - function->default_count;
+        int max_args = function->arity;
+
+        if (arg_count < min_args || arg_count > max_args) {
+            if (function->default_count > 0) {
+                runtime_error_kind(vm, MS_TYPE_ERROR, "Expected %d to %d arguments but got %d.",
+                            min_args, max_args, arg_count);
+            } else {
+                runtime_error_kind(vm, MS_TYPE_ERROR, "Expected %d arguments but got %d.",
+                            function->arity, arg_count);
+            }
+            return false;
+        }
+
+        // 填充缺失的默认参数
+        push_defaults(vm, function, arg_count);
+
+        // 返回时栈指针恢复到函数和参数之前，再推送返回值
+        ms_value_t* call_stack_base = vm->stack_top - function->arity - 1;
+        return push_frame(vm, function, function->arity, call_stack_base, MS_FRAME_RETURN_VALUE);
+    } else {
+        runtime_error_kind(vm, MS_TYPE_ERROR, "Can only call functions.");
+        return false;
+    }
+    return true;
+}
+
+// 弹出当前帧：清理参数和局部变量，再按调用方式处理返回值
+static void return_from_frame(ms_vm_t* vm, ms_value_t result) {
+    ms_call_frame_t* done = &vm->frames[--vm->frame_count];
+    ms_value_t self = done->slots[0];
+
+    vm->stack_top = done->base;
+    deliver_result(vm, done->on_return, self, result);
+    vm->chunk = vm->frames[vm->frame_count - 1].chunk;
+}
+
+// 指令操作数里的缓存号对应的内联缓存
+static inline ms_property_cache_t* property_cache(ms_chunk_t* chunk, uint8_t cache_index) {
+    return cache_index == MS_NO_PROPERTY_CACHE ? NULL : &chunk->property_caches[cache_index];
+}
+
+static inline ms_property_cache_entry_t* cache_probe(ms_property_cache_t* cache, ms_shape_t* shape) {
+    for (int i = 0; i < MS_PROPERTY_CACHE_WAYS; i++) {
+        if (cache->entries[i].shape == shape) return &cache->entries[i];
+    }
+    return NULL;
+}
+
+// 新项放在最前面，缓存满时丢掉最旧的一项
+static void cache_fill(ms_property_cache_t* cache, ms_shape_t* shape, ms_shape_t* next_shape,
+                       int slot, ms_value_t method) {
+    if (cache == NULL) return;
+    memmove(&cache->entries[1], &cache->entries[0],
+            sizeof(ms_property_cache_entry_t) * (MS_PROPERTY_CACHE_WAYS - 1));
+    cache->entries[0].shape = shape;
+    cache->entries[0].next_shape = next_shape;
+    cache->entries[0].slot = slot;
+    cache->entries[0].method = method;
+}
+
+// 读取属性：实例属性、绑定方法或模块方法名。出错时返回 false。
+// cache 为 NULL 时不使用内联缓存
+static bool get_property(ms_vm_t* vm, ms_value_t obj, uint8_t name_index,
+                         ms_property_cache_t* cache, ms_value_t* result) {
+    // 快速路径：shape 命中缓存时直接按槽位读取，或者绑定缓存的方法
+    if (MS_VALUE_TYPE(obj) == MS_VAL_INSTANCE && cache != NULL) {
+        ms_instance_t* instance = (ms_instance_t*)MS_AS_OBJECT(obj);
+        ms_property_cache_entry_t* entry = cache_probe(cache, instance->shape);
+        if (entry != NULL) {
+            if (entry->slot >= 0) {
+                *result = instance->slots[entry->slot];
+            } else {
+                *result = ms_value_bound_method(ms_bound_method_new(obj, entry->method));
+            }
+            return true;
+        }
+    }
+
+    if (name_index >= name_table_count) {
+        runtime_error(vm, "Invalid property name index.");
+        return false;
+    }
+    const char* prop_name = name_table_names[name_index];
+
+    // 检查是否是实例对象
+    if (ms_value_is_instance(obj)) {
+        ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(obj);
+
+        // 先查找实例属性
+        int slot = ms_shape_find(instance->shape, prop_name);
+        if (slot >= 0) {
+            cache_fill(cache, instance->shape, instance->shape, slot, ms_value_nil());
+            *result = instance->slots[slot];
+            return true;
+        }
+
+        // 查找方法，创建绑定方法。类的方法只在类定义时加入，
+        // 而 shape 只属于一个类，所以可以按 shape 缓存方法
+        ms_dict_entry_t* entry = ms_dict_find(instance->klass->methods, prop_name);
+        if (entry != NULL) {
+            ms_value_t method = entry->value;
+            cache_fill(cache, instance->shape, instance->shape, -1, method);
+            ms_bound_method_t* bound = ms_bound_method_new(obj, method);
+            *result = ms_value_bound_method(bound);
+            return true;
+        }
+
+        runtime_error_kind(vm, MS_ATTRIBUTE_ERROR, "Undefined property '%s'.", prop_name);
+        return false;
+    }
+    // 模块的属性是扩展函数本身 (原生函数值)，
+    // 参数里再调用别的方法或模块函数也不会互相干扰
+    else if (MS_VALUE_TYPE(obj) == MS_VAL_MODULE) {
+        *result = ms_extension_function((const char*)MS_AS_MODULE(obj), prop_name);
+    } else if (ms_value_is_set(obj) || ms_value_is_string(obj)) {
+        ms_value_t method;
+        if (!ms_builtin_method(obj, prop_name, &method)) {
+            runtime_error_kind(vm, MS_ATTRIBUTE_ERROR, "Undefined property '%s'.", prop_name);
+            return false;
+        }
+        *result = ms_value_bound_method(ms_bound_method_new(obj, method));
+    } else {
+        // For other types, just return nil
+        *result = ms_value_nil();
+    }
+    return true;
+}
+
+static bool set_property(ms_vm_t* vm, ms_value_t obj, uint8_t name_index,
+                         ms_property_cache_t* cache, ms_value_t value) {
+    if (!ms_value_is_instance(obj)) {
+        runtime_error_kind(vm, MS_ATTRIBUTE_ERROR, "Only instances have properties.");
+        return false;
+    }
+
+    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(obj);
+    if (cache != NULL) {
+        // 命中时是已有属性 (next_shape 与 shape 相同) 或者一次已知的 shape 转换
+        ms_property_cache_entry_t* entry = cache_probe(cache, instance->shape);
+        if (entry != NULL && entry->slot >= 0) {
+            ms_instance_set_slot(instance, entry->next_shape, entry->slot, value);
+            return true;
+        }
+    }
+
+    if (name_index >= name_table_count) {
+        runtime_error(vm, "Invalid property name index.");
+        return false;
+    }
+    ms_shape_t* shape = instance->shape;
+    int slot = ms_shape_find(shape, name_table_names[name_index]);
+    ms_shape_t* next_shape = shape;
+    if (slot < 0) {
+        next_shape = ms_shape_add(shape, name_table_names[name_index]);
+        slot = next_shape->slot_count - 1;
+    }
+    cache_fill(cache, shape, next_shape, slot, ms_value_nil());
+    ms_instance_set_slot(instance, next_shape, slot, value);
+    return true;
+}
+
+// for 循环的一步：取 slots[iter_slot] 的第 slots[index_slot] 个元素放进
+// slots[var_slot]，并把下标加一 (一次性迭代器用自己的游标，见 iterator.h)。
+// 出错时设置错误并返回 false。
+//
+// slots 是当前帧的槽位。被迭代的是生成器时会嵌套执行它的函数体，值栈和帧栈
+// 都可能搬家：这里按当前帧重新取 slots，调用者返回后也要重新取 frame 和寄存器
+static bool for_iter_next(ms_vm_t* vm, ms_value_t* slots, uint8_t var_slot,
+                          uint8_t iter_slot, uint8_t index_slot, bool* has_next) {
+    ms_value_t index_val = slots[index_slot];
+    if (!ms_value_is_int(index_val)) {
+        runtime_error(vm, "For loop index must be an integer.");
+        return false;
+    }
+
+    int64_t cursor = MS_AS_INTEGER(index_val);
+    ms_value_t current_element = ms_value_nil();
+    ms_iter_result_t result = ms_iter_next(slots[iter_slot], &cursor, &current_element);
+    if (result == MS_ITER_NOT_ITERABLE) {
+        runtime_error_kind(vm, MS_TYPE_ERROR, "Can only iterate over lists, dicts, tuples, sets, strings, and iterators.");
+        return false;
+    }
+    if (result == MS_ITER_ERROR) return false;
+    *has_next = result == MS_ITER_ELEMENT;
+    slots = vm->frames[vm->frame_count - 1].slots;
+
+    if (var_slot < MS_MAX_LOCALS) {
+        slots[var_slot] = current_element;
+    }
+    slots[index_slot] = MS_INT_VALUE(cursor);
+    return true;
+}
+
+// for x in range(...) 的一步 (OP_FOR_RANGE / OP_R_FOR_RANGE)。下标槽位和通用循环一样
+// 从 0 数起，iter 槽位是 range 对象时直接用它的 start/stop/step 算出当前值，
+// 不经过 ms_iter_next 的类型分派。range 被重新绑定、调用返回了别的东西时
+// 这个检查不成立，退回通用的 for_iter_next，语义不变
+static inline bool for_range_next(ms_vm_t* vm, ms_value_t* slots, uint8_t var_slot,
+                                  uint8_t iter_slot, uint8_t index_slot, bool* has_next) {
+    ms_value_t iterable = slots[iter_slot];
+    ms_value_t index_val = slots[index_slot];
+    if (MS_VALUE_TYPE(iterable) == MS_VAL_ITERATOR && MS_VALUE_TYPE(index_val) == MS_VAL_INT) {
+        ms_iterator_t* range = (ms_iterator_t*)MS_AS_OBJECT(iterable);
+        if (range->kind == MS_ITERATOR_RANGE) {
+            int64_t index = MS_AS_INTEGER(index_val);
+            int64_t value = range->start + index * range->step;
+            *has_next = range->step > 0 ? value < range->stop : value > range->stop;
+            slots[var_slot] = *has_next ? MS_INT_VALUE(value) : ms_value_nil();
+            slots[index_slot] = MS_INT_VALUE(index + 1);
+            return true;
+        }
+    }
+    return for_iter_next(vm, slots, var_slot, iter_slot, index_slot, has_next);
+}
+
+// GC 安全点：只放在回跳和调用之后，这时所有活着的临时值都在值栈 (或寄存器) 上，
+// 原生函数和魔术方法调用过程中不会回收
+#define GC_SAFEPOINT() \
+    do { \
+        if (ms_gc_requested) ms_gc_collect(); \
+    } while (false)
+
+#ifdef MS_REGISTER_VM
+// 寄存器格式字节码的解释循环 (见 regcode.c)。
+//
+// 寄存器就是帧的 slots，执行期间 vm->stack_top 停在所有寄存器之上，
+// 魔术方法的参数压在那里。调用和返回都只切换帧：新的当前帧仍是寄存器
+// 格式时留在本循环，否则返回 run() 由栈解释循环继续。
+static ms_result_t run_registers(ms_vm_t* vm) {
+    ms_call_frame_t* frame;
+    uint8_t* ip;
+    ms_value_t* regs;
+    ms_value_t* constants;
+
+#define LOAD_FRAME() \
+    do { \
+        frame = &vm->frames[vm->frame_count - 1]; \
+        if (frame->chunk->register_count == 0) return MS_RESULT_OK; \
+        ip = frame->ip; \
+        regs = frame->slots; \
+        constants = frame->chunk->constants; \
+        vm->stack_top = regs + frame->chunk->register_count; \
+    } while (false)
+// 取元素可能恢复生成器、嵌套执行它的函数体，值栈和帧栈都可能搬家
+#define RELOAD_REGISTERS() \
+    do { \
+        frame = &vm->frames[vm->frame_count - 1]; \
+        regs = frame->slots; \
+    } while (false)
+#define RK(operand) ((operand) & 0x80 ? constants[(operand) & 0x7f] : regs[(operand)])
+#define READ_JUMP(at) ((uint16_t)((ip[(at)] << 8) | ip[(at) + 1]))
+
+// 调用魔术方法：self 和 other 压在寄存器之上，返回值写回 R[dst]
+#define CALL_MAGIC(function, dst, self, other) \
+    do { \
+        frame->ip = ip; \
+        ms_vm_push(vm, (self)); \
+        ms_vm_push(vm, (other)); \
+        if (!push_frame(vm, (function), 2, &frame->slots[(dst)], MS_FRAME_RETURN_VALUE)) { \
+            return MS_RESULT_RUNTIME_ERROR; \
+        } \
+        LOAD_FRAME(); \
+    } while (false)
+
+// A RK RK：两个整数时内联计算，实例先找魔术方法，其余交给 binary_values
+#define REGISTER_BINARY(value_type, op, opcode, magic_name) \
+    do { \
+        uint8_t dst = ip[0]; \
+        ms_value_t a = RK(ip[1]); \
+        ms_value_t b = RK(ip[2]); \
+        ip += 3; \
+        if (MS_VALUE_TYPE(a) == MS_VAL_INT && MS_VALUE_TYPE(b) == MS_VAL_INT) { \
+            regs[dst] = value_type(MS_AS_INTEGER(a) op MS_AS_INTEGER(b)); \
+            break; \
+        } \
+        ms_function_t* magic = (magic_name) ? find_magic_method(a, (magic_name)) : NULL; \
+        if (magic != NULL) { \
+            CALL_MAGIC(magic, dst, a, b); \
+            break; \
+        } \
+        if (!binary_values(vm, (opcode), a, b, &regs[dst])) return MS_RESULT_RUNTIME_ERROR; \
+    } while (false)
+
+// 比较后紧跟 OP_R_JUMP_IF_FALSE A off：两个整数时直接分支，
+// 否则回到比较指令本身，随后照常执行那条条件跳转
+#define REGISTER_COMPARE_JUMP(op, generic) \
+    do { \
+        ms_value_t a = RK(ip[1]); \
+        ms_value_t b = RK(ip[2]); \
+        if (!ms_value_is_int(a) || !ms_value_is_int(b)) goto generic; \
+        bool condition = ms_value_as_int(a) op ms_value_as_int(b); \
+        regs[ip[0]] = ms_value_bool(condition); \
+        ip += condition ? 7 : 7 + READ_JUMP(5); \
+    } while (false)
+
+#if MS_COMPUTED_GOTO
+#define REGISTER_DISPATCH() goto *register_table[*ip++]
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static void* register_table[256] = {
+        [0 ... 255] = &&op_unhandled,
+        [OP_R_MOVE] = &&op_OP_R_MOVE,
+        [OP_R_LOAD_CONSTANT] = &&op_OP_R_LOAD_CONSTANT,
+        [OP_R_GET_GLOBAL] = &&op_OP_R_GET_GLOBAL,
+        [OP_R_DEFINE_GLOBAL] = &&op_OP_R_DEFINE_GLOBAL,
+        [OP_R_SET_GLOBAL] = &&op_OP_R_SET_GLOBAL,
+        [OP_R_GET_PROPERTY] = &&op_OP_R_GET_PROPERTY,
+        [OP_R_SET_PROPERTY] = &&op_OP_R_SET_PROPERTY,
+        [OP_R_ADD] = &&op_OP_R_ADD,
+        [OP_R_SUBTRACT] = &&op_OP_R_SUBTRACT,
+        [OP_R_MULTIPLY] = &&op_OP_R_MULTIPLY,
+        [OP_R_DIVIDE] = &&op_OP_R_DIVIDE,
+        [OP_R_FLOOR_DIVIDE] = &&op_OP_R_FLOOR_DIVIDE,
+        [OP_R_POWER] = &&op_OP_R_POWER,
+        [OP_R_MODULO] = &&op_OP_R_MODULO,
+        [OP_R_BIT_OR] = &&op_OP_R_BIT_OR,
+        [OP_R_BIT_AND] = &&op_OP_R_BIT_AND,
+        [OP_R_BIT_XOR] = &&op_OP_R_BIT_XOR,
+        [OP_R_EQUAL] = &&op_OP_R_EQUAL,
+        [OP_R_GREATER] = &&op_OP_R_GREATER,
+        [OP_R_LESS] = &&op_OP_R_LESS,
+        [OP_R_GREATER_EQUAL] = &&op_OP_R_GREATER_EQUAL,
+        [OP_R_LESS_EQUAL] = &&op_OP_R_LESS_EQUAL,
+        [OP_R_NOT] = &&op_OP_R_NOT,
+        [OP_R_NEGATE] = &&op_OP_R_NEGATE,
+        [OP_R_JUMP] = &&op_OP_R_JUMP,
+        [OP_R_LOOP] = &&op_OP_R_LOOP,
+        [OP_R_JUMP_IF_FALSE] = &&op_OP_R_JUMP_IF_FALSE,
+        [OP_R_JUMP_IF_TRUE] = &&op_OP_R_JUMP_IF_TRUE,
+        [OP_R_FOR_ITER] = &&op_OP_R_FOR_ITER,
+        [OP_R_CALL] = &&op_OP_R_CALL,
+        [OP_R_RETURN] = &&op_OP_R_RETURN,
+        [OP_R_EQUAL_JUMP] = &&op_OP_R_EQUAL_JUMP,
+        [OP_R_GREATER_JUMP] = &&op_OP_R_GREATER_JUMP,
+        [OP_R_LESS_JUMP] = &&op_OP_R_LESS_JUMP,
+        [OP_R_GREATER_EQUAL_JUMP] = &&op_OP_R_GREATER_EQUAL_JUMP,
+        [OP_R_LESS_EQUAL_JUMP] = &&op_OP_R_LESS_EQUAL_JUMP,
+        [OP_R_FOR_ITER_JUMP] = &&op_OP_R_FOR_ITER_JUMP,
+        [OP_R_FOR_RANGE] = &&op_OP_R_FOR_RANGE,
+    };
+#pragma GCC diagnostic pop
+#else
+#define REGISTER_DISPATCH() break
+#endif
+
+    LOAD_FRAME();
+
+    for (;;) {
+#if MS_COMPUTED_GOTO
+        REGISTER_DISPATCH();
+#endif
+        switch (*ip++) {
+            CASE(OP_R_MOVE):
+                regs[ip[0]] = regs[ip[1]];
+                ip += 2;
+                REGISTER_DISPATCH();
+            CASE(OP_R_LOAD_CONSTANT):
+                regs[ip[0]] = constants[ip[1]];
+                ip += 2;
+                REGISTER_DISPATCH();
+            CASE(OP_R_GET_GLOBAL): {
+                uint8_t dst = ip[0];
+                uint8_t name_index = ip[1];
+                ip += 2;
+                if (name_index >= name_table_count) {
+                    runtime_error_kind(vm, MS_NAME_ERROR, "Undefined variable.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                ms_global_t* global = global_at(vm, name_index);
+                if (!global->defined) {
+                    runtime_error_kind(vm, MS_NAME_ERROR, "Undefined variable '%s'.", global->name);
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                regs[dst] = global->value;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_DEFINE_GLOBAL): {
+                uint8_t name_index = ip[0];
+                ms_value_t value = RK(ip[1]);
+                ip += 2;
+                if (name_index >= name_table_count) {
+                    runtime_error(vm, "Invalid variable name index.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                define_global(vm, name_index, value);
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_SET_GLOBAL): {
+                uint8_t name_index = ip[0];
+                ms_value_t value = RK(ip[1]);
+                ip += 2;
+                if (name_index >= name_table_count) {
+                    runtime_error(vm, "Invalid variable name index.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                ms_global_t* global = global_at(vm, name_index);
+                if (!global->defined) {
+                    runtime_error_kind(vm, MS_NAME_ERROR, "Undefined variable '%s'.", global->name);
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                global->value = value;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_GET_PROPERTY): {
+                uint8_t dst = ip[0];
+                ms_value_t object = RK(ip[1]);
+                uint8_t name_index = ip[2];
+                ms_property_cache_t* cache = property_cache(frame->chunk, ip[3]);
+                ip += 4;
+                if (!get_property(vm, object, name_index, cache, &regs[dst])) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_SET_PROPERTY): {
+                uint8_t dst = ip[0];
+                ms_value_t value = RK(ip[3]);
+                if (!set_property(vm, RK(ip[1]), ip[2], property_cache(frame->chunk, ip[4]), value)) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                regs[dst] = value;
+                ip += 5;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_ADD):
+                REGISTER_BINARY(MS_INT_VALUE, +, OP_ADD, "__add__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_SUBTRACT):
+                REGISTER_BINARY(MS_INT_VALUE, -, OP_SUBTRACT, "__sub__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_MULTIPLY):
+                REGISTER_BINARY(MS_INT_VALUE, *, OP_MULTIPLY, "__mul__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_DIVIDE): {
+                // 与 OP_DIVIDE 一样优先 __truediv__，其次 __div__
+                ms_value_t a = RK(ip[1]);
+                ms_function_t* magic = find_magic_method(a, "__truediv__");
+                if (magic == NULL) magic = find_magic_method(a, "__div__");
+                if (magic != NULL) {
+                    uint8_t dst = ip[0];
+                    ms_value_t b = RK(ip[2]);
+                    ip += 3;
+                    CALL_MAGIC(magic, dst, a, b);
+                    REGISTER_DISPATCH();
+                }
+                if (is_zero_divisor(RK(ip[2]))) {
+                    runtime_error_kind(vm, MS_ZERO_DIVISION_ERROR, "Division by zero.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                REGISTER_BINARY(MS_INT_VALUE, /, OP_DIVIDE, NULL);
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_FLOOR_DIVIDE):
+            CASE(OP_R_POWER): {
+                uint8_t opcode = ip[-1] == OP_R_POWER ? OP_POWER : OP_FLOOR_DIVIDE;
+                if (!binary_values(vm, opcode, RK(ip[1]), RK(ip[2]), &regs[ip[0]])) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                ip += 3;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_MODULO): {
+                ms_value_t a = RK(ip[1]);
+                ms_value_t b = RK(ip[2]);
+                if (MS_VALUE_TYPE(a) == MS_VAL_INT && MS_VALUE_TYPE(b) == MS_VAL_INT && MS_AS_INTEGER(b) != 0) {
+                    regs[ip[0]] = MS_INT_VALUE(MS_AS_INTEGER(a) % MS_AS_INTEGER(b));
+                } else if (!binary_values(vm, OP_MODULO, a, b, &regs[ip[0]])) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                ip += 3;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_BIT_OR):
+            CASE(OP_R_BIT_AND):
+            CASE(OP_R_BIT_XOR): {
+                uint8_t opcode = ip[-1] == OP_R_BIT_OR ? OP_BIT_OR
+                               : ip[-1] == OP_R_BIT_AND ? OP_BIT_AND : OP_BIT_XOR;
+                if (!bitwise_values(vm, opcode, RK(ip[1]), RK(ip[2]), &regs[ip[0]])) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                ip += 3;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_EQUAL): r_equal_generic:
+                REGISTER_BINARY(MS_BOOL_VALUE, ==, OP_EQUAL, "__eq__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_GREATER): r_greater_generic:
+                REGISTER_BINARY(MS_BOOL_VALUE, >, OP_GREATER, "__gt__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_LESS): r_less_generic:
+                REGISTER_BINARY(MS_BOOL_VALUE, <, OP_LESS, "__lt__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_GREATER_EQUAL): r_greater_equal_generic:
+                REGISTER_BINARY(MS_BOOL_VALUE, >=, OP_GREATER_EQUAL, "__ge__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_LESS_EQUAL): r_less_equal_generic:
+                REGISTER_BINARY(MS_BOOL_VALUE, <=, OP_LESS_EQUAL, "__le__");
+                REGISTER_DISPATCH();
+            CASE(OP_R_NOT):
+                regs[ip[0]] = ms_value_bool(is_falsey(RK(ip[1])));
+                ip += 2;
+                REGISTER_DISPATCH();
+            CASE(OP_R_NEGATE): {
+                ms_value_t value = RK(ip[1]);
+                if (!ms_value_is_int(value)) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Operand must be a number.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                regs[ip[0]] = ms_value_int(-ms_value_as_int(value));
+                ip += 2;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_JUMP):
+                ip += 2 + READ_JUMP(0);
+                REGISTER_DISPATCH();
+            CASE(OP_R_LOOP):
+                ip += 2 - READ_JUMP(0);
+                GC_SAFEPOINT();
+                REGISTER_DISPATCH();
+            CASE(OP_R_JUMP_IF_FALSE):
+                ip += is_falsey(RK(ip[0])) ? 3 + READ_JUMP(1) : 3;
+                REGISTER_DISPATCH();
+            CASE(OP_R_JUMP_IF_TRUE):
+                ip += !is_falsey(RK(ip[0])) ? 3 + READ_JUMP(1) : 3;
+                REGISTER_DISPATCH();
+            CASE(OP_R_FOR_ITER): {
+                bool has_next;
+                if (!for_iter_next(vm, regs, ip[1], ip[2], ip[3], &has_next)) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                RELOAD_REGISTERS();
+                regs[ip[0]] = ms_value_bool(has_next);
+                ip += 4;
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_CALL): {
+                // 参数已经在被调值之后的寄存器里，栈顶放到最后一个参数之后
+                uint8_t callee = ip[0];
+                uint8_t arg_count = ip[1];
+                ip += 2;
+                frame->ip = ip;
+                vm->stack_top = regs + callee + arg_count + 1;
+                if (!call_value(vm, arg_count)) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                // 没有压帧时也重新取：原生函数可能执行了生成器
+                LOAD_FRAME();
+                GC_SAFEPOINT();
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_RETURN):
+                return_from_frame(vm, RK(ip[0]));
+                LOAD_FRAME();
+                REGISTER_DISPATCH();
+            CASE(OP_R_EQUAL_JUMP):
+                REGISTER_COMPARE_JUMP(==, r_equal_generic);
+                REGISTER_DISPATCH();
+            CASE(OP_R_GREATER_JUMP):
+                REGISTER_COMPARE_JUMP(>, r_greater_generic);
+                REGISTER_DISPATCH();
+            CASE(OP_R_LESS_JUMP):
+                REGISTER_COMPARE_JUMP(<, r_less_generic);
+                REGISTER_DISPATCH();
+            CASE(OP_R_GREATER_EQUAL_JUMP):
+                REGISTER_COMPARE_JUMP(>=, r_greater_equal_generic);
+                REGISTER_DISPATCH();
+            CASE(OP_R_LESS_EQUAL_JUMP):
+                REGISTER_COMPARE_JUMP(<=, r_less_equal_generic);
+                REGISTER_DISPATCH();
+            CASE(OP_R_FOR_ITER_JUMP): {
+                // A var iter index; JUMP_IF_FALSE A off
+                bool has_next;
+                if (!for_iter_next(vm, regs, ip[1], ip[2], ip[3], &has_next)) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                RELOAD_REGISTERS();
+                regs[ip[0]] = ms_value_bool(has_next);
+                ip += has_next ? 8 : 8 + READ_JUMP(6);
+                REGISTER_DISPATCH();
+            }
+            CASE(OP_R_FOR_RANGE): {
+                bool has_next;
+                if (!for_range_next(vm, regs, ip[0], ip[1], ip[2], &has_next)) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                RELOAD_REGISTERS();
+                ip += has_next ? 5 : 5 + READ_JUMP(3);
+                REGISTER_DISPATCH();
+            }
+            DEFAULT_CASE:
+                runtime_error(vm, "Unknown register opcode %d.", ip[-1]);
+                return MS_RESULT_RUNTIME_ERROR;
+        }
+    }
+
+#undef LOAD_FRAME
+#undef RELOAD_REGISTERS
+#undef RK
+#undef READ_JUMP
+#undef CALL_MAGIC
+#undef REGISTER_BINARY
+#undef REGISTER_COMPARE_JUMP
+#undef REGISTER_DISPATCH
+}
+#endif
+
+// ============ 异常 ============
+
+// 正在传播的错误对应的异常对象。还只有错误信息时按 error_kind 创建一个，
+// 之后在别的 run() 里继续传播时用的是同一个对象。没有注册内置异常类时返回 nil
+static ms_value_t current_exception(ms_vm_t* vm) {
+    if (vm->has_exception) return vm->current_exception;
+
+    ms_exception_kind_t kind = vm->error_kind;
+    ms_value_t klass = vm->exception_classes[kind];
+    if (!ms_value_is_class(klass)) return ms_value_nil();
+
+    // assert 的信息是 "AssertionError: 消息"，异常信息只保留消息
+    const char* message = vm->error_message;
+    if (kind == MS_ASSERTION_ERROR) {
+        const char* colon = strchr(message, ':');
+        message = colon != NULL ? colon + 2 : "";
+    }
+    ms_instance_t* instance = ms_exception_new((ms_class_t*)ms_value_as_class(klass),
+                                               ms_value_string(message));
+    vm->current_exception = ms_value_instance(instance);
+    vm->has_exception = true;
+    return vm->current_exception;
+}
+
+// raise：异常类先不带参数实例化。错误信息是 "类名: 异常信息"，没有捕获时由宿主报告
+static void throw_exception(ms_vm_t* vm, ms_value_t value) {
+    if (ms_value_is_class(value) && ((ms_class_t*)ms_value_as_class(value))->is_exception) {
+        value = ms_value_instance(ms_exception_new((ms_class_t*)ms_value_as_class(value),
+                                                   ms_value_string("")));
+    }
+    ms_instance_t* instance = ms_value_is_instance(value) ? ms_value_as_instance(value) : NULL;
+    if (instance == NULL || !instance->klass->is_exception) {
+        runtime_error_kind(vm, MS_TYPE_ERROR, "exceptions must derive from Exception");
+        return;
+    }
+
+    char buffer[MS_FORMAT_BUFFER_SIZE];
+    size_t length;
+    const char* text = ms_format_text(ms_exception_message(instance), buffer, &length);
+    if (length == 0) {
+        runtime_error(vm, "%s", instance->klass->name);
+    } else {
+        runtime_error(vm, "%s: %.*s", instance->klass->name, (int)length, text);
+    }
+    vm->current_exception = value;
+    vm->has_exception = true;
+}
+
+// except 子句：异常是不是 type (异常类，或者异常类的元组) 的实例
+static bool exception_matches(ms_vm_t* vm, ms_value_t exception, ms_value_t type, bool* matches) {
+    if (ms_value_is_tuple(type)) {
+        ms_tuple_t* types = ms_value_as_tuple(type);
+        *matches = false;
+        for (int i = 0; i < types->count && !*matches; i++) {
+            if (!exception_matches(vm, exception, types->elements[i], matches)) return false;
+        }
+        return true;
+    }
+    if (!ms_value_is_class(type) || !((ms_class_t*)ms_value_as_class(type))->is_exception) {
+        runtime_error_kind(vm, MS_TYPE_ERROR, "catching classes that do not inherit from Exception is not allowed");
+        return false;
+    }
+
+    ms_class_t* target = (ms_class_t*)ms_value_as_class(type);
+    ms_class_t* klass = ((ms_instance_t*)ms_value_as_instance(exception))->klass;
+    while (klass != NULL && klass != target) {
+        klass = klass->parent;
+    }
+    *matches = klass != NULL;
+    return true;
+}
+
+// 出错后按帧从内到外查异常表：出错位置 (ip 的前一个字节，调用者的帧是
+// 调用指令) 落在某个 try 块里就把栈退回到 try 语句开始时的高度，压入异常对象，
+// 从处理代码继续执行。入口帧之下的帧属于外层的 run()，找不到时停在入口帧，
+// 错误和异常对象留在 VM 上，由外层 run() 在原生函数或生成器返回后接着找
+static bool unwind_exception(ms_vm_t* vm, int entry_frame_count) {
+    for (;;) {
+        ms_call_frame_t* frame = &vm->frames[vm->frame_count - 1];
+        ms_chunk_t* chunk = frame->chunk;
+        int offset = (int)(frame->ip - chunk->code) - 1;
+        for (int i = 0; i < chunk->handler_count; i++) {
+            ms_exception_entry_t* entry = &chunk->handlers[i];
+            if (offset < entry->start || offset >= entry->end) continue;
+
+            ms_value_t exception = current_exception(vm);
+            if (ms_value_is_nil(exception)) return false;
+            vm->stack_top = frame->slots + entry->depth;
+            ms_vm_push(vm, exception);
+            frame->ip = chunk->code + entry->handler;
+            vm->chunk = chunk;
+            vm->has_error = false;
+            vm->error_kind = MS_RUNTIME_ERROR;
+            vm->has_exception = false;
+            vm->current_exception = ms_value_nil();
+            return true;
+        }
+        if (vm->frame_count == entry_frame_count) return false;
+        vm->frame_count--;
+    }
+}
+
+// 字节码解释循环。出错时直接返回 MS_RESULT_RUNTIME_ERROR，由 run() 查异常表
+static ms_result_t execute(ms_vm_t* vm, int entry_frame_count) {
     ms_call_frame_t* frame = &vm->frames[vm->frame_count - 1];
-    
+
 #define READ_BYTE() (*frame->ip++)
-#define READ_CONSTANT() (vm->chunk->constants[READ_BYTE()])
+#define READ_CONSTANT() (frame->chunk->constants[READ_BYTE()])
 #define READ_SHORT() \
     (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 #define READ_STRING() (name_table_names[READ_BYTE()])
 
-#define BINARY_OP(value_type, op) \
+// 两个整数时内联计算，其余情况交给 binary_values
+#define BINARY_OP(value_type, op, opcode) \
     do { \
         ms_value_t b = peek(vm, 0); \
         ms_value_t a = peek(vm, 1); \
-        if (ms_value_is_int(a) && ms_value_is_int(b)) { \
+        QUICKEN(opcode, a, b); \
+        if (MS_VALUE_TYPE(a) == MS_VAL_INT && MS_VALUE_TYPE(b) == MS_VAL_INT) { \
             ms_vm_pop(vm); \
             ms_vm_pop(vm); \
-            ms_vm_push(vm, value_type(ms_value_as_int(a) op ms_value_as_int(b))); \
-        } else if ((ms_value_is_int(a) || ms_value_is_float(a)) && \
-                   (ms_value_is_int(b) || ms_value_is_float(b))) { \
+            ms_vm_push(vm, value_type(MS_AS_INTEGER(a) op MS_AS_INTEGER(b))); \
+        } else { \
+            ms_value_t result; \
+            if (!binary_values(vm, opcode, a, b, &result)) return MS_RESULT_RUNTIME_ERROR; \
             ms_vm_pop(vm); \
             ms_vm_pop(vm); \
-            ms_vm_push(vm, ms_value_float(ms_value_as_float(a) op ms_value_as_float(b))); \
-        } else { \
-            runtime_error(vm, "Operands must be numbers."); \
+            ms_vm_push(vm, result); \
+        } \
+    } while (false)
+
+// 执行通用指令时按操作数类型改写成专用指令。只在字节确实是这条通用指令时改写：
+// 超级指令回退到通用代码时 ip[-1] 是超级指令本身，保持不变。
+// 统计操作码时不改写，统计的是编译器生成的指令
+#ifndef MS_PROFILE_OPCODES
+#define QUICKEN(opcode, a, b) \
+    do { \
+        if (frame->ip[-1] == (opcode)) frame->ip[-1] = specialize_binary((opcode), (a), (b)); \
+    } while (false)
+#else
+#define QUICKEN(opcode, a, b) do {} while (false)
+#endif
+
+// 专用指令：两个操作数都是 operand_type 时直接计算，否则改回通用指令并跳到通用代码
+// (read 取出操作数的 C 值，make 把结果包装回 ms_value_t)
+#define QUICK_BINARY(operand_type, read, make, op, generic, generic_label) \
+    do { \
+        ms_value_t* a = vm->stack_top - 2; \
+        ms_value_t* b = vm->stack_top - 1; \
+        if (MS_VALUE_TYPE(*a) != (operand_type) || MS_VALUE_TYPE(*b) != (operand_type)) { \
+            frame->ip[-1] = (generic); \
+            goto generic_label; \
+        } \
+        *a = make(read(*a) op read(*b)); \
+        vm->stack_top--; \
+    } while (false)
+
+// 没有整数快速路径的二元运算
+#define BINARY_VALUES(opcode) \
+    do { \
+        ms_value_t result; \
+        if (!binary_values(vm, opcode, peek(vm, 1), peek(vm, 0), &result)) { \
             return MS_RESULT_RUNTIME_ERROR; \
         } \
+        ms_vm_pop(vm); \
+        ms_vm_pop(vm); \
+        ms_vm_push(vm, result); \
     } while (false)
 
+// 当前帧换成了寄存器格式时交给 run_registers() 执行
+#ifdef MS_REGISTER_VM
+#define CHECK_REGISTER_FRAME() \
+    do { \
+        if (frame->chunk->register_count > 0) goto run_register_frame; \
+    } while (false)
+#else
+#define CHECK_REGISTER_FRAME() do {} while (false)
+#endif
+
+// 在当前调度循环中调用脚本函数，成功后切换到新帧
+#define CALL_FRAME(function, arg_count, base, on_return) \
+    do { \
+        if (!push_frame(vm, (function), (arg_count), (base), (on_return))) { \
+            return MS_RESULT_RUNTIME_ERROR; \
+        } \
+        frame = &vm->frames[vm->frame_count - 1]; \
+        CHECK_REGISTER_FRAME(); \
+    } while (false)
+
+#if MS_COMPUTED_GOTO
+    // 直接跳转表：未实现的操作码落到 op_unhandled（与 switch 的 default 一致）
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static void* dispatch_table[256] = {
+        [0 ... 255] = &&op_unhandled,
+        [OP_CONSTANT] = &&op_OP_CONSTANT,
+        [OP_NIL] = &&op_OP_NIL,
+        [OP_TRUE] = &&op_OP_TRUE,
+        [OP_FALSE] = &&op_OP_FALSE,
+        [OP_POP] = &&op_OP_POP,
+        [OP_GET_LOCAL] = &&op_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&op_OP_SET_LOCAL,
+        [OP_GET_GLOBAL] = &&op_OP_GET_GLOBAL,
+        [OP_DEFINE_GLOBAL] = &&op_OP_DEFINE_GLOBAL,
+        [OP_SET_GLOBAL] = &&op_OP_SET_GLOBAL,
+        [OP_EQUAL] = &&op_OP_EQUAL,
+        [OP_GREATER] = &&op_OP_GREATER,
+        [OP_LESS] = &&op_OP_LESS,
+        [OP_LESS_EQUAL] = &&op_OP_LESS_EQUAL,
+        [OP_GREATER_EQUAL] = &&op_OP_GREATER_EQUAL,
+        [OP_IN] = &&op_OP_IN,
+        [OP_ADD] = &&op_OP_ADD,
+        [OP_SUBTRACT] = &&op_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&op_OP_MULTIPLY,
+        [OP_DIVIDE] = &&op_OP_DIVIDE,
+        [OP_FLOOR_DIVIDE] = &&op_OP_FLOOR_DIVIDE,
+        [OP_POWER] = &&op_OP_POWER,
+        [OP_MODULO] = &&op_OP_MODULO,
+        [OP_BIT_OR] = &&op_OP_BIT_OR,
+        [OP_BIT_AND] = &&op_OP_BIT_AND,
+        [OP_BIT_XOR] = &&op_OP_BIT_XOR,
+        [OP_NOT] = &&op_OP_NOT,
+        [OP_NEGATE] = &&op_OP_NEGATE,
+        [OP_PRINT] = &&op_OP_PRINT,
+        [OP_JUMP] = &&op_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&op_OP_JUMP_IF_TRUE,
+        [OP_LOOP] = &&op_OP_LOOP,
+        [OP_CALL] = &&op_OP_CALL,
+        [OP_CALL_DECORATOR] = &&op_OP_CALL_DECORATOR,
+        [OP_CALL_ENTER] = &&op_OP_CALL_ENTER,
+        [OP_CALL_EXIT] = &&op_OP_CALL_EXIT,
+        [OP_ASSERT] = &&op_OP_ASSERT,
+        [OP_DELETE] = &&op_OP_DELETE,
+        [OP_RAISE] = &&op_OP_RAISE,
+        [OP_EXCEPTION_MATCH] = &&op_OP_EXCEPTION_MATCH,
+        [OP_CALL_FINALLY] = &&op_OP_CALL_FINALLY,
+        [OP_END_FINALLY] = &&op_OP_END_FINALLY,
+        [OP_RETURN] = &&op_OP_RETURN,
+        [OP_YIELD] = &&op_OP_YIELD,
+        [OP_AWAIT] = &&op_OP_AWAIT,
+        [OP_GET_PROPERTY] = &&op_OP_GET_PROPERTY,
+        [OP_LOAD_MODULE] = &&op_OP_LOAD_MODULE,
+        [OP_BUILD_LIST] = &&op_OP_BUILD_LIST,
+        [OP_BUILD_DICT] = &&op_OP_BUILD_DICT,
+        [OP_BUILD_TUPLE] = &&op_OP_BUILD_TUPLE,
+        [OP_BUILD_SET] = &&op_OP_BUILD_SET,
+        [OP_BUILD_STRING] = &&op_OP_BUILD_STRING,
+        [OP_FORMAT_VALUE] = &&op_OP_FORMAT_VALUE,
+        [OP_CONVERT_VALUE] = &&op_OP_CONVERT_VALUE,
+        [OP_SET_ADD] = &&op_OP_SET_ADD,
+        [OP_INDEX_GET] = &&op_OP_INDEX_GET,
+        [OP_INDEX_SET] = &&op_OP_INDEX_SET,
+        [OP_SLICE_GET] = &&op_OP_SLICE_GET,
+        [OP_FOR_ITER] = &&op_OP_FOR_ITER,
+        [OP_FOR_ITER_LOCAL] = &&op_OP_FOR_ITER_LOCAL,
+        [OP_FOR_RANGE] = &&op_OP_FOR_RANGE,
+        [OP_TERNARY] = &&op_OP_TERNARY,
+        [OP_DUP] = &&op_OP_DUP,
+        [OP_SWAP] = &&op_OP_SWAP,
+        [OP_BUILD_LIST_COMP] = &&op_OP_BUILD_LIST_COMP,
+        [OP_LIST_APPEND] = &&op_OP_LIST_APPEND,
+        [OP_CLASS] = &&op_OP_CLASS,
+        [OP_INHERIT] = &&op_OP_INHERIT,
+        [OP_METHOD] = &&op_OP_METHOD,
+        [OP_SET_PROPERTY] = &&op_OP_SET_PROPERTY,
+        [OP_GET_LOCAL_LOCAL] = &&op_OP_GET_LOCAL_LOCAL,
+        [OP_SET_LOCAL_POP] = &&op_OP_SET_LOCAL_POP,
+        [OP_DEFINE_GLOBAL_POP] = &&op_OP_DEFINE_GLOBAL_POP,
+        [OP_JUMP_IF_FALSE_POP] = &&op_OP_JUMP_IF_FALSE_POP,
+        [OP_POP_LOOP] = &&op_OP_POP_LOOP,
+        [OP_EQUAL_JUMP] = &&op_OP_EQUAL_JUMP,
+        [OP_GREATER_JUMP] = &&op_OP_GREATER_JUMP,
+        [OP_LESS_JUMP] = &&op_OP_LESS_JUMP,
+        [OP_LESS_EQUAL_JUMP] = &&op_OP_LESS_EQUAL_JUMP,
+        [OP_GREATER_EQUAL_JUMP] = &&op_OP_GREATER_EQUAL_JUMP,
+        [OP_INC_LOCAL] = &&op_OP_INC_LOCAL,
+        [OP_RETURN_CONSTANT] = &&op_OP_RETURN_CONSTANT,
+        [OP_ADD_INT] = &&op_OP_ADD_INT,
+        [OP_SUBTRACT_INT] = &&op_OP_SUBTRACT_INT,
+        [OP_MULTIPLY_INT] = &&op_OP_MULTIPLY_INT,
+        [OP_EQUAL_INT] = &&op_OP_EQUAL_INT,
+        [OP_GREATER_INT] = &&op_OP_GREATER_INT,
+        [OP_LESS_INT] = &&op_OP_LESS_INT,
+        [OP_GREATER_EQUAL_INT] = &&op_OP_GREATER_EQUAL_INT,
+        [OP_LESS_EQUAL_INT] = &&op_OP_LESS_EQUAL_INT,
+        [OP_SUBTRACT_FLOAT] = &&op_OP_SUBTRACT_FLOAT,
+        [OP_MULTIPLY_FLOAT] = &&op_OP_MULTIPLY_FLOAT,
+        [OP_DIVIDE_FLOAT] = &&op_OP_DIVIDE_FLOAT,
+        [OP_GREATER_FLOAT] = &&op_OP_GREATER_FLOAT,
+        [OP_LESS_FLOAT] = &&op_OP_LESS_FLOAT,
+        [OP_ADD_STRING] = &&op_OP_ADD_STRING,
+    };
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef MS_PROFILE_OPCODES
+    uint8_t previous_instruction = OP_RETURN;
+#endif
+
     for (;;) {
         uint8_t instruction = READ_BYTE();
+#ifdef MS_PROFILE_OPCODES
+        ms_opcode_pair_counts[previous_instruction][instruction]++;
+        previous_instruction = instruction;
+#endif
+#if MS_COMPUTED_GOTO
+        goto *dispatch_table[instruction];
+#endif
         switch (instruction) {
-            case OP_CONSTANT: {
+            CASE(OP_CONSTANT): {
                 ms_value_t constant = READ_CONSTANT();
                 ms_vm_push(vm, constant);
-                break;
+                DISPATCH();
             }
-            case OP_NIL: ms_vm_push(vm, ms_value_nil()); break;
-            case OP_TRUE: ms_vm_push(vm, ms_value_bool(true)); break;
-            case OP_FALSE: ms_vm_push(vm, ms_value_bool(false)); break;
-            case OP_POP: ms_vm_pop(vm); break;
-            case OP_GET_LOCAL: {
+            CASE(OP_NIL): ms_vm_push(vm, ms_value_nil()); DISPATCH();
+            CASE(OP_TRUE): ms_vm_push(vm, ms_value_bool(true)); DISPATCH();
+            CASE(OP_FALSE): ms_vm_push(vm, ms_value_bool(false)); DISPATCH();
+            CASE(OP_POP): ms_vm_pop(vm); DISPATCH();
+            CASE(OP_GET_LOCAL): get_local_generic: {
                 uint8_t slot = READ_BYTE();
                 ms_value_t val = frame->slots[slot];
                 ms_vm_push(vm, val);
-                break;
+                DISPATCH();
             }
-            case OP_SET_LOCAL: {
+            CASE(OP_SET_LOCAL): {
+                // 与 OP_SET_GLOBAL 一样保留栈顶值，赋值语句之后会有 OP_POP
                 uint8_t slot = READ_BYTE();
                 frame->slots[slot] = peek(vm, 0);
-                ms_vm_pop(vm);
-                break;
+                DISPATCH();
             }
-            case OP_GET_GLOBAL: {
+            CASE(OP_GET_GLOBAL): {
                 uint8_t name_index = READ_BYTE();
                 if (name_index >= name_table_count) {
-                    runtime_error(vm, "Undefined variable.");
+                    runtime_error_kind(vm, MS_NAME_ERROR, "Undefined variable.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
-                char* name = name_table_names[name_index];
-                ms_global_t* current = vm->globals;
-                while (current != NULL) {
-                    if (strcmp(current->name, name) == 0) {
-                        ms_vm_push(vm, current->value);
-                        goto found_global;
-                    }
-                    current = current->next;
+                ms_global_t* global = global_at(vm, name_index);
+                if (!global->defined) {
+                    runtime_error_kind(vm, MS_NAME_ERROR, "Undefined variable '%s'.", global->name);
+                    return MS_RESULT_RUNTIME_ERROR;
                 }
-                
-                runtime_error(vm, "Undefined variable '%s'.", name);
-                return MS_RESULT_RUNTIME_ERROR;
-                
-            found_global:
-                break;
+                ms_vm_push(vm, global->value);
+                DISPATCH();
             }
-            case OP_DEFINE_GLOBAL: {
+            CASE(OP_DEFINE_GLOBAL): define_global_generic: {
                 uint8_t name_index = READ_BYTE();
                 if (name_index >= name_table_count) {
                     runtime_error(vm, "Invalid variable name index.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
-                char* name = name_table_names[name_index];
-                ms_vm_set_global(vm, name, peek(vm, 0));
-                break;
+                define_global(vm, name_index, peek(vm, 0));
+                DISPATCH();
             }
-            case OP_SET_GLOBAL: {
+            CASE(OP_SET_GLOBAL): {
                 uint8_t name_index = READ_BYTE();
                 if (name_index >= name_table_count) {
                     runtime_error(vm, "Invalid variable name index.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
-                char* name = name_table_names[name_index];
-                
                 // 检查变量是否存在
-                ms_global_t* current = vm->globals;
-                while (current != NULL) {
-                    if (strcmp(current->name, name) == 0) {
-                        current->value = peek(vm, 0);
-                        goto set_global_done;
-                    }
-                    current = current->next;
+                ms_global_t* global = global_at(vm, name_index);
+                if (!global->defined) {
+                    runtime_error_kind(vm, MS_NAME_ERROR, "Undefined variable '%s'.", global->name);
+                    return MS_RESULT_RUNTIME_ERROR;
                 }
-                
-                runtime_error(vm, "Undefined variable '%s'.", name);
-                return MS_RESULT_RUNTIME_ERROR;
-                
-            set_global_done:
-                break;
+                global->value = peek(vm, 0);
+                DISPATCH();
             }
-            case OP_EQUAL: {
-                ms_value_t b = ms_vm_pop(vm);
-                ms_value_t a = ms_vm_pop(vm);
-                
+            CASE(OP_EQUAL): equal_generic: {
                 // 检查是否是实例对象，如果是则尝试调用 __eq__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__eq__")) {
-                        ms_value_t eq_method = ms_dict_get(instance->klass->methods, "__eq__");
-                        
-                        if (eq_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = eq_method.as.function;
-                            
-                            // 调用 __eq__(self, other)
-                            ms_vm_push(vm, a);
-                            ms_vm_push(vm, b);
-                            
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - 2;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - 2;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 获取返回值
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(peek(vm, 1), "__eq__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
+                ms_value_t b = ms_vm_pop(vm);
+                ms_value_t a = ms_vm_pop(vm);
+                QUICKEN(OP_EQUAL, a, b);
                 ms_vm_push(vm, ms_value_bool(values_equal(a, b)));
-                break;
+                DISPATCH();
             }
-            case OP_GREATER: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_GREATER): greater_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __gt__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__gt__")) {
-                        ms_value_t gt_method = ms_dict_get(instance->klass->methods, "__gt__");
-                        
-                        if (gt_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = gt_method.as.function;
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(a, "__gt__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
-                BINARY_OP(ms_value_bool, >);
-                break;
+                BINARY_OP(MS_BOOL_VALUE, >, OP_GREATER);
+                DISPATCH();
             }
-            case OP_LESS: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_LESS): less_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __lt__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__lt__")) {
-                        ms_value_t lt_method = ms_dict_get(instance->klass->methods, "__lt__");
-                        
-                        if (lt_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = lt_method.as.function;
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(a, "__lt__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
-                BINARY_OP(ms_value_bool, <);
-                break;
+                BINARY_OP(MS_BOOL_VALUE, <, OP_LESS);
+                DISPATCH();
             }
-            case OP_LESS_EQUAL: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_LESS_EQUAL): less_equal_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __le__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__le__")) {
-                        ms_value_t le_method = ms_dict_get(instance->klass->methods, "__le__");
-                        
-                        if (le_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = le_method.as.function;
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(a, "__le__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
-                BINARY_OP(ms_value_bool, <=);
-                break;
+                BINARY_OP(MS_BOOL_VALUE, <=, OP_LESS_EQUAL);
+                DISPATCH();
             }
-            case OP_GREATER_EQUAL: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_GREATER_EQUAL): greater_equal_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __ge__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__ge__")) {
-                        ms_value_t ge_method = ms_dict_get(instance->klass->methods, "__ge__");
-                        
-                        if (ge_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = ge_method.as.function;
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(a, "__ge__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
-                BINARY_OP(ms_value_bool, >=);
-                break;
+                BINARY_OP(MS_BOOL_VALUE, >=, OP_GREATER_EQUAL);
+                DISPATCH();
             }
-            case OP_IN: {
+            CASE(OP_IN): {
                 ms_value_t container = peek(vm, 0);  // Top of stack (right operand)
                 ms_value_t item = peek(vm, 1);       // Below top (left operand)
                 
                 // 检查是否是实例对象，如果是则尝试调用 __contains__ 方法
-                if (ms_value_is_instance(container)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(container);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__contains__")) {
-                        ms_value_t contains_method = ms_dict_get(instance->klass->methods, "__contains__");
-                        
-                        if (contains_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = contains_method.as.function;
-                            
-                            // 调用 __contains__(self, item)
-                            // 栈上是 [item, container]，需要调整为 [container, item]
-                            ms_vm_pop(vm);  // container
-                            ms_vm_pop(vm);  // item
-                            ms_vm_push(vm, container);  // self
-                            ms_vm_push(vm, item);       // parameter
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - 2;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - 2;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                ms_function_t* magic = find_magic_method(container, "__contains__");
+                if (magic != NULL) {
+                    // 调用 __contains__(self, item)
+                    // 栈上是 [item, container]，需要调整为 [container, item]
+                    vm->stack_top[-1] = item;
+                    vm->stack_top[-2] = container;
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
                 // 默认行为：检查列表、元组、字典、字符串
@@ -557,697 +1735,204 @@ static ms_result_t run(ms_vm_t* vm) {
                         }
                     }
                 } else if (ms_value_is_dict(container)) {
-                    if (ms_value_is_string(item)) {
-                        ms_dict_t* dict = ms_value_as_dict(container);
-                        found = ms_dict_has(dict, ms_value_as_string(item));
+                    if (!ms_value_hashable(item)) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Unhashable type used as dictionary key.");
+                        return MS_RESULT_RUNTIME_ERROR;
+                    }
+                    found = ms_dict_has_value(ms_value_as_dict(container), item);
+                } else if (ms_value_is_set(container)) {
+                    if (!ms_value_hashable(item)) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Unhashable type used as set element.");
+                        return MS_RESULT_RUNTIME_ERROR;
                     }
+                    found = ms_set_contains(ms_value_as_set(container), item);
                 } else if (ms_value_is_string(container) && ms_value_is_string(item)) {
                     const char* haystack = ms_value_as_string(container);
                     const char* needle = ms_value_as_string(item);
                     found = (strstr(haystack, needle) != NULL);
+                } else if (ms_value_is_iterator(container) &&
+                           ms_value_as_iterator(container)->kind == MS_ITERATOR_RANGE) {
+                    found = ms_range_contains(ms_value_as_iterator(container), item);
+                } else if (ms_value_is_iterator(container) || ms_value_is_generator(container)) {
+                    // 一次性迭代器和生成器：和 Python 一样边找边消耗。
+                    // 生成器的函数体里可能回收，两个操作数在这期间仍留在栈上
+                    int64_t cursor = 0;
+                    ms_value_t elem;
+                    ms_iter_result_t result = MS_ITER_END;
+                    vm->stack_top += 2;
+                    while (!found && (result = ms_iter_next(container, &cursor, &elem)) == MS_ITER_ELEMENT) {
+                        found = values_equal(item, elem);
+                    }
+                    vm->stack_top -= 2;
+                    if (result == MS_ITER_ERROR) return MS_RESULT_RUNTIME_ERROR;
+                    frame = &vm->frames[vm->frame_count - 1];
                 } else {
-                    runtime_error(vm, "Argument of type '%s' is not iterable.", "unknown");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Argument of type '%s' is not iterable.", "unknown");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
                 ms_vm_push(vm, ms_value_bool(found));
-                break;
+                DISPATCH();
             }
-            case OP_ADD: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_ADD): add_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __add__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__add__")) {
-                        ms_value_t add_method = ms_dict_get(instance->klass->methods, "__add__");
-                        
-                        if (add_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = add_method.as.function;
-                            
-                            // 调用 __add__(self, other)
-                            // 栈上已经有 [a, b]，正好是我们需要的
-                            
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - 2;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - 2;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 获取返回值
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(a, "__add__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
-                // If either operand is a string, convert both to strings and concatenate
-                if (ms_value_is_string(a) || ms_value_is_string(b)) {
-                    ms_vm_pop(vm);
-                    ms_vm_pop(vm);
-                    
-                    // Convert a to string
-                    char a_str[256];
-                    if (ms_value_is_string(a)) {
-                        strcpy(a_str, ms_value_as_string(a));
-                    } else if (ms_value_is_int(a)) {
-                        snprintf(a_str, sizeof(a_str), "%lld", (long long)ms_value_as_int(a));
-                    } else if (ms_value_is_float(a)) {
-                        snprintf(a_str, sizeof(a_str), "%g", ms_value_as_float(a));
-                    } else if (ms_value_is_bool(a)) {
-                        strcpy(a_str, ms_value_as_bool(a) ? "True" : "False");
-                    } else if (ms_value_is_nil(a)) {
-                        strcpy(a_str, "None");
-                    } else {
-                        strcpy(a_str, "<object>");
-                    }
-                    
-                    // Convert b to string
-                    char b_str[256];
-                    if (ms_value_is_string(b)) {
-                        strcpy(b_str, ms_value_as_string(b));
-                    } else if (ms_value_is_int(b)) {
-                        snprintf(b_str, sizeof(b_str), "%lld", (long long)ms_value_as_int(b));
-                    } else if (ms_value_is_float(b)) {
-                        snprintf(b_str, sizeof(b_str), "%g", ms_value_as_float(b));
-                    } else if (ms_value_is_bool(b)) {
-                        strcpy(b_str, ms_value_as_bool(b) ? "True" : "False");
-                    } else if (ms_value_is_nil(b)) {
-                        strcpy(b_str, "None");
-                    } else {
-                        strcpy(b_str, "<object>");
-                    }
-                    
-                    // Concatenate
-                    char* result = malloc(strlen(a_str) + strlen(b_str) + 1);
-                    strcpy(result, a_str);
-                    strcat(result, b_str);
-                    ms_vm_push(vm, ms_value_string(result));
-                    free(result);
-                } else if (ms_value_is_int(a) && ms_value_is_int(b)) {
-                    ms_vm_pop(vm);
-                    ms_vm_pop(vm);
-                    ms_vm_push(vm, ms_value_int(ms_value_as_int(a) + ms_value_as_int(b)));
-                } else {
-                    runtime_error(vm, "Operands must be two numbers or two strings.");
-                    return MS_RESULT_RUNTIME_ERROR;
-                }
-                break;
+                // 字符串拼接等其余情况见 binary_values
+                BINARY_OP(MS_INT_VALUE, +, OP_ADD);
+                DISPATCH();
             }
-            case OP_SUBTRACT: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_SUBTRACT): subtract_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __sub__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__sub__")) {
-                        ms_value_t sub_method = ms_dict_get(instance->klass->methods, "__sub__");
-                        
-                        if (sub_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = sub_method.as.function;
-                            
-                            // 调用 __sub__(self, other)
-                            // 栈上已经有 [a, b]，正好是我们需要的
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 获取返回值
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            // 重新获取frame指针
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(a, "__sub__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
-                BINARY_OP(ms_value_int, -);
-                break;
+                BINARY_OP(MS_INT_VALUE, -, OP_SUBTRACT);
+                DISPATCH();
             }
-            case OP_MULTIPLY: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_MULTIPLY): multiply_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __mul__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__mul__")) {
-                        ms_value_t mul_method = ms_dict_get(instance->klass->methods, "__mul__");
-                        
-                        if (mul_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = mul_method.as.function;
-                            
-                            // 调用 __mul__(self, other)
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 获取返回值
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            // 重新获取frame指针
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                // 栈上已经是 [self, other]，返回值会替换这两个值
+                ms_function_t* magic = find_magic_method(a, "__mul__");
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
-                BINARY_OP(ms_value_int, *);
-                break;
+                BINARY_OP(MS_INT_VALUE, *, OP_MULTIPLY);
+                DISPATCH();
             }
-            case OP_DIVIDE: {
-                ms_value_t b = peek(vm, 0);
+            CASE(OP_DIVIDE): divide_generic: {
                 ms_value_t a = peek(vm, 1);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __div__ 或 __truediv__ 方法
-                if (ms_value_is_instance(a)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(a);
-                    
-                    // 优先尝试 __truediv__，然后是 __div__
-                    const char* method_name = ms_dict_has(instance->klass->methods, "__truediv__") ? 
-                                             "__truediv__" : "__div__";
-                    
-                    if (ms_dict_has(instance->klass->methods, method_name)) {
-                        ms_value_t div_method = ms_dict_get(instance->klass->methods, method_name);
-                        
-                        if (div_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = div_method.as.function;
-                            
-                            // 调用 __div__(self, other) 或 __truediv__(self, other)
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 获取返回值
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            // 重新获取frame指针
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                // 优先尝试 __truediv__，然后是 __div__
+                ms_function_t* magic = find_magic_method(a, "__truediv__");
+                if (magic == NULL) {
+                    magic = find_magic_method(a, "__div__");
+                }
+                if (magic != NULL) {
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
+                }
+                if (is_zero_divisor(peek(vm, 0))) {
+                    runtime_error_kind(vm, MS_ZERO_DIVISION_ERROR, "Division by zero.");
+                    return MS_RESULT_RUNTIME_ERROR;
                 }
                 
-                BINARY_OP(ms_value_int, /);
-                break;
+                BINARY_OP(MS_INT_VALUE, /, OP_DIVIDE);
+                DISPATCH();
             }
-            case OP_FLOOR_DIVIDE: {
-                ms_value_t b = peek(vm, 0);
-                ms_value_t a = peek(vm, 1);
-                if (ms_value_is_int(a) && ms_value_is_int(b)) {
-                    int64_t divisor = ms_value_as_int(b);
-                    if (divisor == 0) {
-                        runtime_error(vm, "Division by zero.");
-                        return MS_RESULT_RUNTIME_ERROR;
-                    }
-                    ms_vm_pop(vm);
-                    ms_vm_pop(vm);
-                    ms_vm_push(vm, ms_value_int(ms_value_as_int(a) / divisor));
-                } else {
-                    double da = ms_value_as_float(a);
-                    double db = ms_value_as_float(b);
-                    if (db == 0.0) {
-                        runtime_error(vm, "Division by zero.");
-                        return MS_RESULT_RUNTIME_ERROR;
-                    }
-                    ms_vm_pop(vm);
-                    ms_vm_pop(vm);
-                    ms_vm_push(vm, ms_value_int((int64_t)(da / db)));
-                }
-                break;
+            CASE(OP_FLOOR_DIVIDE): {
+                BINARY_VALUES(OP_FLOOR_DIVIDE);
+                DISPATCH();
             }
-            case OP_POWER: {
-                ms_value_t b = peek(vm, 0);
-                ms_value_t a = peek(vm, 1);
-                double da = ms_value_as_float(a);
-                double db = ms_value_as_float(b);
-                ms_vm_pop(vm);
-                ms_vm_pop(vm);
-                double result = pow(da, db);
-                // 如果结果是整数，返回整数类型
-                if (result == (int64_t)result && result >= INT64_MIN && result <= INT64_MAX) {
-                    ms_vm_push(vm, ms_value_int((int64_t)result));
-                } else {
-                    ms_vm_push(vm, ms_value_float(result));
-                }
-                break;
+            CASE(OP_POWER): {
+                BINARY_VALUES(OP_POWER);
+                DISPATCH();
             }
-            case OP_MODULO: {
+            CASE(OP_MODULO): {
                 ms_value_t b = peek(vm, 0);
                 ms_value_t a = peek(vm, 1);
-                if (ms_value_is_int(a) && ms_value_is_int(b)) {
-                    int64_t divisor = ms_value_as_int(b);
-                    if (divisor == 0) {
-                        runtime_error(vm, "Modulo by zero.");
-                        return MS_RESULT_RUNTIME_ERROR;
-                    }
+                if (MS_VALUE_TYPE(a) == MS_VAL_INT && MS_VALUE_TYPE(b) == MS_VAL_INT && MS_AS_INTEGER(b) != 0) {
                     ms_vm_pop(vm);
                     ms_vm_pop(vm);
-                    ms_vm_push(vm, ms_value_int(ms_value_as_int(a) % divisor));
-                } else {
-                    runtime_error(vm, "Modulo operands must be integers.");
-                    return MS_RESULT_RUNTIME_ERROR;
+                    ms_vm_push(vm, MS_INT_VALUE(MS_AS_INTEGER(a) % MS_AS_INTEGER(b)));
+                    DISPATCH();
                 }
-                break;
+                BINARY_VALUES(OP_MODULO);
+                DISPATCH();
             }
-            case OP_NOT:
+            CASE(OP_BIT_OR): {
+                BINARY_VALUES(OP_BIT_OR);
+                DISPATCH();
+            }
+            CASE(OP_BIT_AND): {
+                BINARY_VALUES(OP_BIT_AND);
+                DISPATCH();
+            }
+            CASE(OP_BIT_XOR): {
+                BINARY_VALUES(OP_BIT_XOR);
+                DISPATCH();
+            }
+            CASE(OP_NOT):
                 ms_vm_push(vm, ms_value_bool(is_falsey(ms_vm_pop(vm))));
-                break;
-            case OP_NEGATE: {
+                DISPATCH();
+            CASE(OP_NEGATE): {
                 if (!ms_value_is_int(peek(vm, 0))) {
-                    runtime_error(vm, "Operand must be a number.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Operand must be a number.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 ms_vm_push(vm, ms_value_int(-ms_value_as_int(ms_vm_pop(vm))));
-                break;
+                DISPATCH();
             }
-            case OP_PRINT: {
+            CASE(OP_PRINT): {
                 ms_value_t value = ms_vm_pop(vm);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __str__ 方法
-                if (ms_value_is_instance(value)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(value);
-                    
-                    // 查找 __str__ 方法
-                    if (ms_dict_has(instance->klass->methods, "__str__")) {
-                        ms_value_t str_method = ms_dict_get(instance->klass->methods, "__str__");
-                        
-                        if (str_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = str_method.as.function;
-                            
-                            // 调用 __str__(self)
-                            ms_vm_push(vm, value);  // self
-                            
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - 1;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - 1;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 获取返回的字符串
-                            ms_value_t str_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            
-                            if (ms_value_is_string(str_value)) {
-                                printf("%s\n", ms_value_as_string(str_value));
-                            } else {
-                                printf("<object>\n");
-                            }
-                            break;
-                        }
-                    }
+                // 返回时由 OP_RETURN 打印 __str__ 的结果
+                ms_function_t* magic = find_magic_method(value, "__str__");
+                if (magic != NULL) {
+                    ms_vm_push(vm, value);  // self
+                    CALL_FRAME(magic, 1, vm->stack_top - 1, MS_FRAME_RETURN_PRINT);
+                    break;
                 }
                 
-                switch (value.type) {
-                    case MS_VAL_BOOL:
-                        printf(ms_value_as_bool(value) ? "True" : "False");
-                        break;
-                    case MS_VAL_NIL: printf("None"); break;
-                    case MS_VAL_INT: printf("%lld", ms_value_as_int(value)); break;
-                    case MS_VAL_FLOAT: printf("%g", ms_value_as_float(value)); break;
-                    case MS_VAL_STRING: printf("%s", ms_value_as_string(value)); break;
-                    default: printf("<object>"); break;
-                }
-                printf("\n");
-                break;
+                char buffer[MS_FORMAT_BUFFER_SIZE];
+                size_t length;
+                const char* text = ms_format_text(value, buffer, &length);
+                fwrite(text, 1, length, stdout);
+                putchar('\n');
+                DISPATCH();
             }
-            case OP_JUMP: {
+            CASE(OP_JUMP): {
                 uint16_t offset = READ_SHORT();
                 frame->ip += offset;
-                break;
+                DISPATCH();
             }
-            case OP_JUMP_IF_FALSE: {
+            CASE(OP_JUMP_IF_FALSE): {
                 uint16_t offset = READ_SHORT();
                 if (is_falsey(peek(vm, 0))) frame->ip += offset;
-                break;
+                DISPATCH();
             }
-            case OP_JUMP_IF_TRUE: {
+            CASE(OP_JUMP_IF_TRUE): {
                 uint16_t offset = READ_SHORT();
                 if (!is_falsey(peek(vm, 0))) frame->ip += offset;
-                break;
+                DISPATCH();
             }
-            case OP_LOOP: {
+            CASE(OP_LOOP): {
                 uint16_t offset = READ_SHORT();
                 frame->ip -= offset;
-                break;
+                GC_SAFEPOINT();
+                DISPATCH();
             }
-            case OP_CALL: {
+            CASE(OP_CALL): {
                 uint8_t arg_count = READ_BYTE();
-                ms_value_t func_val = peek(vm, arg_count);
-                
-                // 调试输出
-                // fprintf(stderr, "DEBUG OP_CALL: arg_count=%d, func_val.type=%d\n", arg_count, func_val.type);
-                
-                // 检查是否是绑定方法调用
-                if (ms_value_is_bound_method(func_val)) {
-                    ms_bound_method_t* bound = (ms_bound_method_t*)ms_value_as_bound_method(func_val);
-                    ms_value_t method = bound->method;
-                    ms_value_t receiver = bound->receiver;
-                    
-                    // 将 receiver (self) 插入到参数列表的开头
-                    // 栈布局: [bound_method, arg1, arg2, ...] -> [receiver, arg1, arg2, ...]
-                    vm->stack_top[-arg_count - 1] = receiver;
-                    
-                    // 调用方法
-                    if (method.type == MS_VAL_FUNCTION) {
-                        ms_function_t* function = method.as.function;
-                        
-                        // 检查参数数量（包括 self）
-                        int min_args = function->arity - function->default_count;
-                        int max_args = function->arity;
-                        int total_args = arg_count + 1;  // +1 for self
-                        
-                        if (total_args < min_args || total_args > max_args) {
-                            runtime_error(vm, "Expected %d to %d arguments but got %d.", 
-                                        min_args, max_args, total_args);
-                            return MS_RESULT_RUNTIME_ERROR;
-                        }
-                        
-                        // 填充默认参数
-                        int missing_args = function->arity - total_args;
-                        if (missing_args > 0) {
-                            int default_start = function->default_count - missing_args;
-                            for (int i = 0; i < missing_args; i++) {
-                                ms_vm_push(vm, function->defaults[default_start + i]);
-                            }
-                        }
-                        
-                        // 创建调用帧
-                        if (vm->frame_count >= 64) {
-                            runtime_error(vm, "Stack overflow.");
-                            return MS_RESULT_RUNTIME_ERROR;
-                        }
-                        
-                        // 注意：栈上现在是 [receiver, arg1, arg2, ...]，没有bound_method
-                        // 所以call_stack_base应该指向receiver之前的位置
-                        ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                        ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                        new_frame->ip = function->chunk->code;
-                        new_frame->slots = vm->stack_top - function->arity;
-                        
-                        ms_chunk_t* prev_chunk = vm->chunk;
-                        vm->chunk = function->chunk;
-                        
-                        ms_result_t result = run(vm);
-                        
-                        vm->chunk = prev_chunk;
-                        vm->frame_count--;
-                        
-                        if (result != MS_RESULT_OK) {
-                            return result;
-                        }
-                        
-                        // 函数返回值应该在栈上
-                        ms_value_t return_value = ms_vm_pop(vm);
-                        vm->stack_top = call_stack_base;
-                        ms_vm_push(vm, return_value);
-                        
-                        // 重新获取当前frame指针（递归调用后可能失效）
-                        frame = &vm->frames[vm->frame_count - 1];
-                    }
-                    break;
-                }
-                
-                // 检查是否是类实例化
-                if (ms_value_is_class(func_val)) {
-                    ms_class_t* klass = (ms_class_t*)ms_value_as_class(func_val);
-                    
-                    // 创建实例
-                    ms_instance_t* instance = ms_instance_new(klass);
-                    ms_value_t instance_val = ms_value_instance(instance);
-                    
-                    // 查找 __init__ 方法
-                    if (ms_dict_has(klass->methods, "__init__")) {
-                        ms_value_t init_method = ms_dict_get(klass->methods, "__init__");
-                        
-                        // 将实例作为第一个参数（self）
-                        // 栈布局: [class, arg1, arg2, ...] -> [instance, arg1, arg2, ...]
-                        vm->stack_top[-arg_count - 1] = instance_val;
-                        
-                        // 调用 __init__
-                        if (init_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = init_method.as.function;
-                            
-                            // 检查参数数量（包括 self）
-                            int min_args = function->arity - function->default_count;
-                            int max_args = function->arity;
-                            int total_args = arg_count + 1;  // +1 for self
-                            
-                            if (total_args < min_args || total_args > max_args) {
-                                runtime_error(vm, "__init__() takes %d to %d arguments but %d were given.", 
-                                            min_args, max_args, total_args);
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            // 填充默认参数
-                            int missing_args = function->arity - total_args;
-                            if (missing_args > 0) {
-                                int default_start = function->default_count - missing_args;
-                                for (int i = 0; i < missing_args; i++) {
-                                    ms_vm_push(vm, function->defaults[default_start + i]);
-                                }
-                            }
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            // 注意：栈上现在是 [instance, arg1, arg2, ...]，没有class
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // __init__ 返回 None，我们返回实例
-                            ms_vm_pop(vm);  // 弹出 __init__ 的返回值
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, instance_val);
-                            
-                            // 重新获取当前frame指针（递归调用后可能失效）
-                            frame = &vm->frames[vm->frame_count - 1];
-                        }
-                    } else {
-                        // 没有 __init__，直接返回实例
-                        vm->stack_top -= arg_count + 1;
-                        ms_vm_push(vm, instance_val);
-                    }
-                    break;
-                }
-                
-                // Check if this is a module method call
-                if (func_val.type == MS_VAL_MODULE && vm->last_method_name != NULL) {
-                    // Call extension method
-                    const char* module_name = (const char*)func_val.as.module;
-                    const char* method_name = vm->last_method_name;
-                    
-                    ms_value_t* args = vm->stack_top - arg_count;
-                    
-                    // Call the extension function
-                    ms_value_t result = ms_call_extension_function(vm, module_name, method_name, arg_count, args);
-                    
-                    vm->stack_top -= arg_count + 1;
-                    ms_vm_push(vm, result);
-                    
-                    vm->last_method_name = NULL;
-                    vm->last_module_name = NULL;
-                } else if (func_val.type == MS_VAL_NATIVE_FUNC && func_val.as.native_func != NULL) {
-                    // 原生函数调用
-                    ms_value_t* args = vm->stack_top - arg_count;
-                    ms_value_t* stack_base = vm->stack_top - arg_count - 1;  // 保存栈基址
-                    ms_value_t result = func_val.as.native_func->func(vm, arg_count, args);
-                    vm->stack_top = stack_base;  // 恢复到函数调用前
-                    ms_vm_push(vm, result);
-                } else if (func_val.type == MS_VAL_FUNCTION) {
-                    // 用户定义的函数调用
-                    ms_function_t* function = func_val.as.function;
-                    
-                    // 检查参数数量（考虑默认参数）
-                    int min_args = function->arity - function->default_count;
-                    int max_args = function->arity;
-                    
-                    if (arg_count < min_args || arg_count > max_args) {
-                        if (function->default_count > 0) {
-                            runtime_error(vm, "Expected %d to %d arguments but got %d.", 
-                                        min_args, max_args, arg_count);
-                        } else {
-                            runtime_error(vm, "Expected %d arguments but got %d.", 
-                                        function->arity, arg_count);
-                        }
-                        return MS_RESULT_RUNTIME_ERROR;
-                    }
-                    
-                    if (vm->frame_count >= 64) {
-                        runtime_error(vm, "Stack overflow.");
-                        return MS_RESULT_RUNTIME_ERROR;
-                    }
-                    
-                    // 填充缺失的默认参数
-                    int missing_args = function->arity - arg_count;
-                    if (missing_args > 0) {
-                        // 从defaults数组的末尾开始填充
-                        int default_start = function->default_count - missing_args;
-                        for (int i = 0; i < missing_args; i++) {
-                            ms_vm_push(vm, function->defaults[default_start + i]);
-                        }
-                    }
-                    
-                    // 保存栈指针位置（函数和参数之前）
-                    ms_value_t* call_stack_base = vm->stack_top - function->arity - 1;
-                    
-                    // 创建新的调用帧
-                    ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                    new_frame->ip = function->chunk->code;
-                    new_frame->slots = vm->stack_top - function->arity;
-                    
-                    // 保存当前的chunk
-                    ms_chunk_t* prev_chunk = vm->chunk;
-                    vm->chunk = function->chunk;
-                    
-                    // 执行函数
-                    ms_result_t result = run(vm);
-                    
-                    // 恢复chunk
-                    vm->chunk = prev_chunk;
-                    vm->frame_count--;
-                    
-                    if (result != MS_RESULT_OK) {
-                        return result;
-                    }
-                    
-                    // 函数返回值应该在栈上，清理函数和参数
-                    ms_value_t return_value = ms_vm_pop(vm);
-                    vm->stack_top = call_stack_base;  // 恢复栈指针到函数调用前
-                    ms_vm_push(vm, return_value);      // 推送返回值
-                    
-                    // 重新获取当前frame指针（递归调用后可能失效）
-                    frame = &vm->frames[vm->frame_count - 1];
-                } else {
-                    runtime_error(vm, "Can only call functions.");
+                if (!call_value(vm, arg_count)) {
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                break;
+                // 调用脚本函数时切换到新帧
+                frame = &vm->frames[vm->frame_count - 1];
+                GC_SAFEPOINT();
+                CHECK_REGISTER_FRAME();
+                DISPATCH();
             }
-            case OP_CALL_DECORATOR: {
+            CASE(OP_CALL_DECORATOR): {
                 // Apply decorator to function/class
                 // Stack: [dec1, dec2, ..., decN, target]
                 // depth indicates which decorator to apply (1 = decN, 2 = dec(N-1), etc.)
@@ -1270,65 +1955,39 @@ static ms_result_t run(ms_vm_t* vm) {
                 ms_vm_push(vm, target);
                 
                 // Check if decorator is callable
-                if (decorator.type != MS_VAL_FUNCTION && decorator.type != MS_VAL_NATIVE_FUNC) {
-                    runtime_error(vm, "Decorator must be callable.");
+                if (MS_VALUE_TYPE(decorator) != MS_VAL_FUNCTION && MS_VALUE_TYPE(decorator) != MS_VAL_NATIVE_FUNC) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Decorator must be callable.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
                 // Call the decorator with 1 argument
-                if (decorator.type == MS_VAL_NATIVE_FUNC) {
+                if (MS_VALUE_TYPE(decorator) == MS_VAL_NATIVE_FUNC) {
                     ms_value_t* args = vm->stack_top - 1;
                     ms_value_t* stack_base = vm->stack_top - 2;
-                    ms_value_t result = decorator.as.native_func->func(vm, 1, args);
+                    ms_value_t result = MS_AS_NATIVE_FUNC(decorator)->func(vm, 1, args);
                     vm->stack_top = stack_base;
                     ms_vm_push(vm, result);
-                } else if (decorator.type == MS_VAL_FUNCTION) {
-                    ms_function_t* function = decorator.as.function;
+                } else if (MS_VALUE_TYPE(decorator) == MS_VAL_FUNCTION) {
+                    ms_function_t* function = MS_AS_FUNCTION(decorator);
                     
                     if (function->arity != 1) {
-                        runtime_error(vm, "Decorator must take exactly 1 argument.");
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Decorator must take exactly 1 argument.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     
-                    if (vm->frame_count >= 64) {
-                        runtime_error(vm, "Stack overflow.");
-                        return MS_RESULT_RUNTIME_ERROR;
-                    }
-                    
-                    ms_value_t* call_stack_base = vm->stack_top - 2;
-                    ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                    new_frame->ip = function->chunk->code;
-                    new_frame->slots = vm->stack_top - 1;
-                    
-                    ms_chunk_t* prev_chunk = vm->chunk;
-                    vm->chunk = function->chunk;
-                    
-                    ms_result_t result = run(vm);
-                    
-                    vm->chunk = prev_chunk;
-                    vm->frame_count--;
-                    
-                    if (result != MS_RESULT_OK) {
-                        return result;
-                    }
-                    
-                    ms_value_t return_value = ms_vm_pop(vm);
-                    vm->stack_top = call_stack_base;
-                    ms_vm_push(vm, return_value);
-                    
-                    frame = &vm->frames[vm->frame_count - 1];
+                    CALL_FRAME(function, 1, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
                 }
                 
-                break;
+                DISPATCH();
             }
-            case OP_CALL_ENTER: {
+            CASE(OP_CALL_ENTER): {
                 // Call __enter__() method on context manager
                 // Stack: [manager, manager] (duplicated by parser)
                 ms_value_t manager = peek(vm, 0);
                 
                 // Check if manager is an instance
                 if (!ms_value_is_instance(manager)) {
-                    runtime_error(vm, "Context manager must be an instance.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Context manager must be an instance.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
@@ -1339,79 +1998,39 @@ static ms_result_t run(ms_vm_t* vm) {
                 bool found = false;
                 
                 if (instance->klass && instance->klass->methods) {
-                    for (int i = 0; i < instance->klass->methods->count; i++) {
-                        if (instance->klass->methods->entries[i].key != NULL &&
-                            strcmp(instance->klass->methods->entries[i].key, "__enter__") == 0) {
-                            enter_method = instance->klass->methods->entries[i].value;
-                            found = true;
-                            break;
-                        }
+                    ms_dict_entry_t* entry = ms_dict_find(instance->klass->methods, "__enter__");
+                    if (entry != NULL) {
+                        enter_method = entry->value;
+                        found = true;
                     }
                 }
                 
                 if (!found) {
-                    runtime_error(vm, "Context manager has no __enter__ method.");
-                    return MS_RESULT_RUNTIME_ERROR;
-                }
-                
-                // Check if __enter__ is a function
-                if (enter_method.type != MS_VAL_FUNCTION) {
-                    runtime_error(vm, "__enter__ must be a method.");
-                    return MS_RESULT_RUNTIME_ERROR;
-                }
-                
-                ms_function_t* function = enter_method.as.function;
-                
-                // Create call frame for __enter__
-                if (vm->frame_count >= 64) {
-                    runtime_error(vm, "Stack overflow.");
-                    return MS_RESULT_RUNTIME_ERROR;
-                }
-                
-                // Stack: [manager, manager] -> push self for method call
-                ms_vm_push(vm, manager);
-                
-                ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                new_frame->ip = function->chunk->code;
-                new_frame->slots = vm->stack_top - 1;
-                
-                ms_chunk_t* prev_chunk = vm->chunk;
-                vm->chunk = function->chunk;
-                
-                ms_result_t result = run(vm);
-                
-                vm->chunk = prev_chunk;
-                vm->frame_count--;
-                
-                if (result != MS_RESULT_OK) {
-                    return result;
-                }
-                
-                // Get return value from __enter__
-                ms_value_t return_value = ms_vm_pop(vm);
-                
-                // Stack is now [manager, manager] - pop the duplicate, keep original
-                ms_vm_pop(vm);  // Pop the duplicate we used for the call
-                
-                // Stack is now [manager] - push the return value
-                ms_vm_push(vm, return_value);
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Context manager has no __enter__ method.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
                 
-                // Stack is now [manager, return_value]
-                // The parser will handle storing return_value or popping it
+                // Check if __enter__ is a function
+                if (MS_VALUE_TYPE(enter_method) != MS_VAL_FUNCTION) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "__enter__ must be a method.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
                 
-                // Refresh frame pointer
-                frame = &vm->frames[vm->frame_count - 1];
+                ms_function_t* function = MS_AS_FUNCTION(enter_method);
                 
-                break;
+                // Stack: [manager, manager] -> 栈顶的 manager 作为 self，
+                // 返回值替换它，得到 [manager, return_value]
+                CALL_FRAME(function, 1, vm->stack_top - 1, MS_FRAME_RETURN_VALUE);
+                DISPATCH();
             }
-            case OP_CALL_EXIT: {
+            CASE(OP_CALL_EXIT): {
                 // Call __exit__(None, None, None) method on context manager
                 // Stack: [manager]
                 ms_value_t manager = ms_vm_pop(vm);
                 
                 // Check if manager is an instance
                 if (!ms_value_is_instance(manager)) {
-                    runtime_error(vm, "Context manager must be an instance.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Context manager must be an instance.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
@@ -1422,34 +2041,25 @@ static ms_result_t run(ms_vm_t* vm) {
                 bool found = false;
                 
                 if (instance->klass && instance->klass->methods) {
-                    for (int i = 0; i < instance->klass->methods->count; i++) {
-                        if (instance->klass->methods->entries[i].key != NULL &&
-                            strcmp(instance->klass->methods->entries[i].key, "__exit__") == 0) {
-                            exit_method = instance->klass->methods->entries[i].value;
-                            found = true;
-                            break;
-                        }
+                    ms_dict_entry_t* entry = ms_dict_find(instance->klass->methods, "__exit__");
+                    if (entry != NULL) {
+                        exit_method = entry->value;
+                        found = true;
                     }
                 }
                 
                 if (!found) {
-                    runtime_error(vm, "Context manager has no __exit__ method.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Context manager has no __exit__ method.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
                 // Check if __exit__ is a function
-                if (exit_method.type != MS_VAL_FUNCTION) {
-                    runtime_error(vm, "__exit__ must be a method.");
+                if (MS_VALUE_TYPE(exit_method) != MS_VAL_FUNCTION) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "__exit__ must be a method.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
-                ms_function_t* function = exit_method.as.function;
-                
-                // Create call frame for __exit__
-                if (vm->frame_count >= 64) {
-                    runtime_error(vm, "Stack overflow.");
-                    return MS_RESULT_RUNTIME_ERROR;
-                }
+                ms_function_t* function = MS_AS_FUNCTION(exit_method);
                 
                 // Stack setup: [self, None, None, None] for __exit__(exc_type, exc_val, exc_tb)
                 ms_vm_push(vm, manager);
@@ -1457,32 +2067,11 @@ static ms_result_t run(ms_vm_t* vm) {
                 ms_vm_push(vm, ms_value_nil());
                 ms_vm_push(vm, ms_value_nil());
                 
-                ms_value_t* call_stack_base = vm->stack_top - 4;
-                ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                new_frame->ip = function->chunk->code;
-                new_frame->slots = vm->stack_top - 4;
-                
-                ms_chunk_t* prev_chunk = vm->chunk;
-                vm->chunk = function->chunk;
-                
-                ms_result_t result = run(vm);
-                
-                vm->chunk = prev_chunk;
-                vm->frame_count--;
-                
-                if (result != MS_RESULT_OK) {
-                    return result;
-                }
-                
-                // Pop return value (we don't use it for now)
-                ms_vm_pop(vm);
-                
-                // Refresh frame pointer
-                frame = &vm->frames[vm->frame_count - 1];
-                
-                break;
+                // 返回值暂不使用
+                CALL_FRAME(function, 4, vm->stack_top - 4, MS_FRAME_RETURN_DISCARD);
+                DISPATCH();
             }
-            case OP_ASSERT: {
+            CASE(OP_ASSERT): {
                 // assert 语句: 栈上有 [condition, message]
                 ms_value_t message = ms_vm_pop(vm);
                 ms_value_t condition = ms_vm_pop(vm);
@@ -1491,15 +2080,15 @@ static ms_result_t run(ms_vm_t* vm) {
                 if (!ms_value_as_bool(condition)) {
                     // 断言失败
                     if (ms_value_is_string(message)) {
-                        runtime_error(vm, "AssertionError: %s", ms_value_as_string(message));
+                        runtime_error_kind(vm, MS_ASSERTION_ERROR, "AssertionError: %s", ms_value_as_string(message));
                     } else {
-                        runtime_error(vm, "AssertionError");
+                        runtime_error_kind(vm, MS_ASSERTION_ERROR, "AssertionError");
                     }
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                break;
+                DISPATCH();
             }
-            case OP_DELETE: {
+            CASE(OP_DELETE): {
                 // del 语句: 删除全局变量
                 uint8_t name_index = READ_BYTE();
                 if (name_index >= name_table_count) {
@@ -1507,88 +2096,141 @@ static ms_result_t run(ms_vm_t* vm) {
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
-                char* name = name_table_names[name_index];
-                
-                // 查找并删除全局变量
-                ms_global_t* prev = NULL;
-                ms_global_t* current = vm->globals;
-                while (current != NULL) {
-                    if (strcmp(current->name, name) == 0) {
-                        // 找到了，删除它
-                        if (prev == NULL) {
-                            vm->globals = current->next;
-                        } else {
-                            prev->next = current->next;
-                        }
-                        free(current->name);
-                        free(current);
-                        goto deleted_global;
-                    }
-                    prev = current;
-                    current = current->next;
+                // 槽位保留给之后的重新定义，只清除 defined
+                ms_global_t* global = global_at(vm, name_index);
+                if (!global->defined) {
+                    runtime_error_kind(vm, MS_NAME_ERROR, "Undefined variable '%s'.", global->name);
+                    return MS_RESULT_RUNTIME_ERROR;
                 }
-                
-                runtime_error(vm, "Undefined variable '%s'.", name);
+                global->defined = false;
+                global->value = ms_value_nil();
+                DISPATCH();
+            }
+            CASE(OP_RAISE): {
+                throw_exception(vm, ms_vm_pop(vm));
                 return MS_RESULT_RUNTIME_ERROR;
-                
-            deleted_global:
-                break;
             }
-            case OP_RETURN: {
-                return MS_RESULT_OK;
+            CASE(OP_EXCEPTION_MATCH): {
+                // [exception, type] -> [是否匹配]
+                bool matches;
+                if (!exception_matches(vm, peek(vm, 1), peek(vm, 0), &matches)) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                ms_vm_pop(vm);
+                vm->stack_top[-1] = ms_value_bool(matches);
+                DISPATCH();
             }
-            case OP_GET_PROPERTY: {
-                uint8_t name_index = READ_BYTE();
-                if (name_index >= name_table_count) {
-                    runtime_error(vm, "Invalid property name index.");
+            CASE(OP_CALL_FINALLY): {
+                // finally 块执行完由 OP_END_FINALLY 跳回这条指令之后
+                uint16_t offset = READ_SHORT();
+                ms_vm_push(vm, ms_value_int(frame->ip - frame->chunk->code));
+                frame->ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_END_FINALLY): {
+                // 正常执行完 try 语句时 [None, None]；break/continue/return 时
+                // [带出去的值, 返回位置]，值留给返回位置之后的代码；出错时 [异常, 异常]
+                ms_value_t reason = ms_vm_pop(vm);
+                if (ms_value_is_nil(reason)) {
+                    ms_vm_pop(vm);
+                } else if (ms_value_is_int(reason)) {
+                    frame->ip = frame->chunk->code + ms_value_as_int(reason);
+                } else {
+                    throw_exception(vm, reason);
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                
-                ms_value_t obj = ms_vm_pop(vm);
-                const char* prop_name = name_table_names[name_index];
-                
-                // 清除模块方法状态
-                vm->last_method_name = NULL;
-                vm->last_module_name = NULL;
-                
-                // 检查是否是实例对象
-                if (ms_value_is_instance(obj)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(obj);
-                    
-                    // 先查找实例属性
-                    if (ms_dict_has(instance->attrs, prop_name)) {
-                        ms_value_t value = ms_dict_get(instance->attrs, prop_name);
-                        ms_vm_push(vm, value);
-                        break;
+                DISPATCH();
+            }
+            CASE(OP_RETURN): return_generic: {
+                // 顶层脚本（或宿主直接调用的入口帧）结束
+                if (vm->frame_count == entry_frame_count) {
+                    return MS_RESULT_OK;
+                }
+
+                return_from_frame(vm, ms_vm_pop(vm));
+                frame = &vm->frames[vm->frame_count - 1];
+                CHECK_REGISTER_FRAME();
+                DISPATCH();
+            }
+            CASE(OP_YIELD): {
+                // 生成器的帧总是 ms_generator_resume 进入 run() 时的入口帧，
+                // 生成器对象就在它的 slots[-1]。局部变量和临时值 (交出的值之下)
+                // 存回生成器，交出的值留在栈顶，由 ms_generator_resume 弹出帧
+                ms_generator_t* generator = ms_value_as_generator(frame->slots[-1]);
+                int count = (int)(vm->stack_top - 1 - frame->slots);
+                ms_generator_suspend(generator, frame->slots, count,
+                                     (int)(frame->ip - frame->chunk->code));
+                return MS_RESULT_OK;
+            }
+            CASE(OP_AWAIT): {
+                // 栈上是 [awaitable, sent]，和 OP_YIELD 一样自己在 slots[-1]。
+                // 要挂起时栈顶换成往外交的等待请求，恢复位置是这条指令本身：
+                // 恢复后栈上又是 [awaitable, 送进来的值]，再执行一遍
+                ms_value_t self = frame->slots[-1];
+                ms_value_t awaited = vm->stack_top[-2];
+                ms_value_t sent = vm->stack_top[-1];
+                ms_value_t result = sent;
+                if (ms_value_is_generator(awaited) && MS_AS_OBJECT(awaited) == MS_AS_OBJECT(self)) {
+                    // 等待请求已经交出去了，事件循环送回来的值就是结果
+                } else if (ms_value_is_generator(awaited)) {
+                    ms_generator_t* inner = ms_value_as_generator(awaited);
+                    ms_generator_t* outer = ms_value_as_generator(self);
+                    if (!inner->is_coroutine) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "object generator can't be used in 'await' expression");
+                        return MS_RESULT_RUNTIME_ERROR;
                     }
-                    
-                    // 查找方法
-                    if (ms_dict_has(instance->klass->methods, prop_name)) {
-                        ms_value_t method = ms_dict_get(instance->klass->methods, prop_name);
-                        // 创建绑定方法
-                        ms_bound_method_t* bound = ms_bound_method_new(obj, method);
-                        
-                        // 创建绑定方法值
-                        ms_value_t bound_val = ms_value_bound_method(bound);
-                        ms_vm_push(vm, bound_val);
-                        break;
+                    if (inner->state == MS_GENERATOR_DONE) {
+                        runtime_error_kind(vm, MS_RUNTIME_ERROR, "cannot reuse already awaited coroutine");
+                        return MS_RESULT_RUNTIME_ERROR;
                     }
-                    
-                    runtime_error(vm, "Undefined property '%s'.", prop_name);
+                    // 已经开始执行的协程只能由最初 await 它的协程接着驱动，交给事件循环的
+                    // 协程 (awaiter 是它自己) 也不能再 await，否则两处会交替恢复同一个帧
+                    if (inner->awaiter != outer &&
+                        (inner->awaiter != NULL || inner->state != MS_GENERATOR_CREATED)) {
+                        runtime_error_kind(vm, MS_RUNTIME_ERROR, "coroutine is being awaited already");
+                        return MS_RESULT_RUNTIME_ERROR;
+                    }
+                    inner->awaiter = outer;
+                    ms_iter_result_t step = ms_generator_resume(inner, sent, &result);
+                    frame = &vm->frames[vm->frame_count - 1];
+                    if (step != MS_ITER_ELEMENT) inner->awaiter = NULL;
+                    if (step == MS_ITER_ERROR) return MS_RESULT_RUNTIME_ERROR;
+                    if (step == MS_ITER_ELEMENT) {
+                        // 内层协程在等待，把它的等待请求原样往外交
+                        vm->stack_top[-1] = result;
+                        goto await_suspend;
+                    }
+                } else if (ms_value_is_instance(awaited) &&
+                           ((ms_instance_t*)ms_value_as_instance(awaited))->klass->is_awaitable) {
+                    // 等待请求：交给事件循环，自己占住 awaitable 的位置
+                    vm->stack_top[-2] = self;
+                    vm->stack_top[-1] = awaited;
+                    goto await_suspend;
+                } else {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "object %s can't be used in 'await' expression",
+                                       MS_AS_STRING(builtin_type(vm, 1, &awaited)));
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                // If it's a module, store the method name for the call handler
-                else if (obj.type == MS_VAL_MODULE) {
-                    vm->last_module_name = (const char*)obj.as.module;
-                    vm->last_method_name = prop_name;
-                    ms_vm_push(vm, obj);
-                } else {
-                    // For other types, just return nil
-                    ms_vm_push(vm, ms_value_nil());
+                vm->stack_top -= 2;
+                ms_vm_push(vm, result);
+                DISPATCH();
+            await_suspend:
+                ms_generator_suspend(ms_value_as_generator(self), frame->slots,
+                                     (int)(vm->stack_top - 1 - frame->slots),
+                                     (int)(frame->ip - 1 - frame->chunk->code));
+                return MS_RESULT_OK;
+            }
+            CASE(OP_GET_PROPERTY): {
+                uint8_t name_index = READ_BYTE();
+                ms_property_cache_t* cache = property_cache(frame->chunk, READ_BYTE());
+                ms_value_t value;
+                if (!get_property(vm, ms_vm_pop(vm), name_index, cache, &value)) {
+                    return MS_RESULT_RUNTIME_ERROR;
                 }
-                break;
+                ms_vm_push(vm, value);
+                DISPATCH();
             }
-            case OP_LOAD_MODULE: {
+            CASE(OP_LOAD_MODULE): {
                 uint8_t module_index = READ_BYTE();
                 if (module_index >= name_table_count) {
                     runtime_error(vm, "Invalid module name index.");
@@ -1610,14 +2252,12 @@ static ms_result_t run(ms_vm_t* vm) {
                 }
                 
                 // Create a module value
-                ms_value_t module_val;
-                module_val.type = MS_VAL_MODULE;
-                module_val.as.module = (void*)module_name;  // Store module name as pointer
+                ms_value_t module_val = ms_value_module((void*)module_name);  // Store module name as pointer
                 
                 ms_vm_push(vm, module_val);
-                break;
+                DISPATCH();
             }
-            case OP_BUILD_LIST: {
+            CASE(OP_BUILD_LIST): {
                 uint8_t count = READ_BYTE();
                 ms_list_t* list = ms_list_new();
                 for (int i = 0; i < count; i++) {
@@ -1625,24 +2265,24 @@ static ms_result_t run(ms_vm_t* vm) {
                 }
                 vm->stack_top -= count;
                 ms_vm_push(vm, ms_value_list(list));
-                break;
+                DISPATCH();
             }
-            case OP_BUILD_DICT: {
+            CASE(OP_BUILD_DICT): {
                 uint8_t pair_count = READ_BYTE();
                 ms_dict_t* dict = ms_dict_new();
+                // 按源码顺序插入：字典保持插入顺序，重复的键取最后一个值
+                ms_value_t* pairs = vm->stack_top - pair_count * 2;
                 for (int i = 0; i < pair_count; i++) {
-                    ms_value_t value = ms_vm_pop(vm);
-                    ms_value_t key_val = ms_vm_pop(vm);
-                    if (!ms_value_is_string(key_val)) {
-                        runtime_error(vm, "Dictionary keys must be strings.");
+                    if (!ms_dict_set_value(dict, pairs[i * 2], pairs[i * 2 + 1])) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Unhashable type used as dictionary key.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
-                    ms_dict_set(dict, ms_value_as_string(key_val), value);
                 }
+                vm->stack_top = pairs;
                 ms_vm_push(vm, ms_value_dict(dict));
-                break;
+                DISPATCH();
             }
-            case OP_BUILD_TUPLE: {
+            CASE(OP_BUILD_TUPLE): {
                 uint8_t count = READ_BYTE();
                 ms_tuple_t* tuple = ms_tuple_new(count);
                 for (int i = 0; i < count; i++) {
@@ -1650,193 +2290,173 @@ static ms_result_t run(ms_vm_t* vm) {
                 }
                 vm->stack_top -= count;
                 ms_vm_push(vm, ms_value_tuple(tuple));
-                break;
+                DISPATCH();
             }
-            case OP_BUILD_SET: {
+            CASE(OP_BUILD_SET): {
                 uint8_t count = READ_BYTE();
                 ms_set_t* set = ms_set_new();
-                for (int i = 0; i < count; i++) {
-                    ms_set_add(set, vm->stack_top[-count + i]);
+                if (!ms_set_add_values(set, vm->stack_top - count, count)) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Unhashable type used as set element.");
+                    return MS_RESULT_RUNTIME_ERROR;
                 }
                 vm->stack_top -= count;
                 ms_vm_push(vm, ms_value_set(set));
-                break;
+                DISPATCH();
             }
-            case OP_SET_ADD: {
+            CASE(OP_BUILD_STRING): {
+                uint8_t count = READ_BYTE();
+                ms_value_t result = build_string(vm->stack_top - count, count);
+                vm->stack_top -= count;
+                ms_vm_push(vm, result);
+                DISPATCH();
+            }
+            CASE(OP_FORMAT_VALUE): {
+                const char* spec = MS_AS_STRING(READ_CONSTANT());
+                ms_value_t result;
+                if (!ms_format_spec(vm->stack_top[-1], spec, ms_string_length(spec), &result)) {
+                    runtime_error_kind(vm, MS_VALUE_ERROR, "Invalid format specifier '%s'.", spec);
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                vm->stack_top[-1] = result;
+                DISPATCH();
+            }
+            CASE(OP_CONVERT_VALUE): {
+                uint8_t conversion = READ_BYTE();
+                ms_value_t value = vm->stack_top[-1];
+                if (conversion == 'r') {
+                    vm->stack_top[-1] = ms_format_repr(value);
+                } else if (!ms_value_is_string(value)) {
+                    char buffer[MS_FORMAT_BUFFER_SIZE];
+                    size_t length;
+                    const char* text = ms_format_text(value, buffer, &length);
+                    vm->stack_top[-1] = ms_string_copy(text, length);
+                }
+                DISPATCH();
+            }
+            CASE(OP_SET_ADD): {
                 // Stack: [set, element]
                 ms_value_t element = ms_vm_pop(vm);
                 ms_value_t set_val = ms_vm_pop(vm);
                 
                 if (!ms_value_is_set(set_val)) {
-                    runtime_error(vm, "Can only add to sets.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Can only add to sets.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
-                ms_set_t* set = ms_value_as_set(set_val);
-                ms_set_add(set, element);
+                if (!ms_value_hashable(element)) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Unhashable type used as set element.");
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
+                ms_set_add(ms_value_as_set(set_val), element);
                 
                 // Push set back
                 ms_vm_push(vm, set_val);
-                break;
+                DISPATCH();
             }
-            case OP_INDEX_GET: {
+            CASE(OP_INDEX_GET): {
                 ms_value_t index_val = ms_vm_pop(vm);
                 ms_value_t obj = ms_vm_pop(vm);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __getitem__ 方法
-                if (ms_value_is_instance(obj)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(obj);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__getitem__")) {
-                        ms_value_t getitem_method = ms_dict_get(instance->klass->methods, "__getitem__");
-                        
-                        if (getitem_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = getitem_method.as.function;
-                            
-                            // 调用 __getitem__(self, key)
-                            ms_vm_push(vm, obj);       // self
-                            ms_vm_push(vm, index_val); // key
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 获取返回值
-                            ms_value_t return_value = ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            ms_vm_push(vm, return_value);
-                            
-                            // 重新获取frame指针
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                ms_function_t* magic = find_magic_method(obj, "__getitem__");
+                if (magic != NULL) {
+                    // 调用 __getitem__(self, key)
+                    ms_vm_push(vm, obj);       // self
+                    ms_vm_push(vm, index_val); // key
+                    CALL_FRAME(magic, 2, vm->stack_top - 2, MS_FRAME_RETURN_VALUE);
+                    break;
                 }
                 
                 if (ms_value_is_list(obj)) {
                     if (!ms_value_is_int(index_val)) {
-                        runtime_error(vm, "List indices must be integers.");
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "List indices must be integers.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     int index = (int)ms_value_as_int(index_val);
                     ms_list_t* list = ms_value_as_list(obj);
                     ms_vm_push(vm, ms_list_get(list, index));
                 } else if (ms_value_is_dict(obj)) {
-                    if (!ms_value_is_string(index_val)) {
-                        runtime_error(vm, "Dictionary keys must be strings.");
+                    if (!ms_value_hashable(index_val)) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Unhashable type used as dictionary key.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     ms_dict_t* dict = ms_value_as_dict(obj);
-                    ms_vm_push(vm, ms_dict_get(dict, ms_value_as_string(index_val)));
+                    ms_vm_push(vm, ms_dict_get_value(dict, index_val));
                 } else if (ms_value_is_tuple(obj)) {
                     if (!ms_value_is_int(index_val)) {
-                        runtime_error(vm, "Tuple indices must be integers.");
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Tuple indices must be integers.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     int index = (int)ms_value_as_int(index_val);
                     ms_tuple_t* tuple = ms_value_as_tuple(obj);
                     ms_vm_push(vm, ms_tuple_get(tuple, index));
+                } else if (ms_value_is_string(obj)) {
+                    if (!ms_value_is_int(index_val)) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "String indices must be integers.");
+                        return MS_RESULT_RUNTIME_ERROR;
+                    }
+                    // 与 list/tuple 一样，越界得到 None
+                    int64_t index = ms_value_as_int(index_val);
+                    const char* str = MS_AS_STRING(obj);
+                    if (index >= 0 && index < (int64_t)ms_string_length(str)) {
+                        ms_vm_push(vm, ms_string_char((unsigned char)str[index]));
+                    } else {
+                        ms_vm_push(vm, ms_value_nil());
+                    }
+                } else if (ms_value_is_iterator(obj) &&
+                           ms_value_as_iterator(obj)->kind == MS_ITERATOR_RANGE) {
+                    if (!ms_value_is_int(index_val)) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Range indices must be integers.");
+                        return MS_RESULT_RUNTIME_ERROR;
+                    }
+                    int64_t item;
+                    if (ms_range_item(ms_value_as_iterator(obj), ms_value_as_int(index_val), &item)) {
+                        ms_vm_push(vm, ms_value_int(item));
+                    } else {
+                        ms_vm_push(vm, ms_value_nil());
+                    }
                 } else {
-                    runtime_error(vm, "Can only index lists, dicts, and tuples.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Can only index lists, dicts, tuples, strings, and ranges.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                break;
+                DISPATCH();
             }
-            case OP_INDEX_SET: {
+            CASE(OP_INDEX_SET): {
                 ms_value_t value = ms_vm_pop(vm);
                 ms_value_t index_val = ms_vm_pop(vm);
                 ms_value_t obj = ms_vm_pop(vm);
                 
                 // 检查是否是实例对象，如果是则尝试调用 __setitem__ 方法
-                if (ms_value_is_instance(obj)) {
-                    ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(obj);
-                    
-                    if (ms_dict_has(instance->klass->methods, "__setitem__")) {
-                        ms_value_t setitem_method = ms_dict_get(instance->klass->methods, "__setitem__");
-                        
-                        if (setitem_method.type == MS_VAL_FUNCTION) {
-                            ms_function_t* function = setitem_method.as.function;
-                            
-                            // 调用 __setitem__(self, key, value)
-                            ms_vm_push(vm, obj);       // self
-                            ms_vm_push(vm, index_val); // key
-                            ms_vm_push(vm, value);     // value
-                            
-                            // 创建调用帧
-                            if (vm->frame_count >= 64) {
-                                runtime_error(vm, "Stack overflow.");
-                                return MS_RESULT_RUNTIME_ERROR;
-                            }
-                            
-                            ms_value_t* call_stack_base = vm->stack_top - function->arity;
-                            ms_call_frame_t* new_frame = &vm->frames[vm->frame_count++];
-                            new_frame->ip = function->chunk->code;
-                            new_frame->slots = vm->stack_top - function->arity;
-                            
-                            ms_chunk_t* prev_chunk = vm->chunk;
-                            vm->chunk = function->chunk;
-                            
-                            ms_result_t result = run(vm);
-                            
-                            vm->chunk = prev_chunk;
-                            vm->frame_count--;
-                            
-                            if (result != MS_RESULT_OK) {
-                                return result;
-                            }
-                            
-                            // 弹出返回值（__setitem__通常返回None）
-                            ms_vm_pop(vm);
-                            vm->stack_top = call_stack_base;
-                            
-                            // 重新获取frame指针
-                            frame = &vm->frames[vm->frame_count - 1];
-                            break;
-                        }
-                    }
+                ms_function_t* magic = find_magic_method(obj, "__setitem__");
+                if (magic != NULL) {
+                    // 调用 __setitem__(self, key, value)，返回值（通常是None）被丢弃
+                    ms_vm_push(vm, obj);       // self
+                    ms_vm_push(vm, index_val); // key
+                    ms_vm_push(vm, value);     // value
+                    CALL_FRAME(magic, 3, vm->stack_top - 3, MS_FRAME_RETURN_DISCARD);
+                    break;
                 }
                 
                 if (ms_value_is_list(obj)) {
                     if (!ms_value_is_int(index_val)) {
-                        runtime_error(vm, "List indices must be integers.");
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "List indices must be integers.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     int index = (int)ms_value_as_int(index_val);
                     ms_list_t* list = ms_value_as_list(obj);
                     ms_list_set(list, index, value);
                 } else if (ms_value_is_dict(obj)) {
-                    if (!ms_value_is_string(index_val)) {
-                        runtime_error(vm, "Dictionary keys must be strings.");
+                    if (!ms_dict_set_value(ms_value_as_dict(obj), index_val, value)) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Unhashable type used as dictionary key.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
-                    ms_dict_t* dict = ms_value_as_dict(obj);
-                    ms_dict_set(dict, ms_value_as_string(index_val), value);
                 } else {
-                    runtime_error(vm, "Can only index lists and dicts.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Can only index lists and dicts.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                break;
+                DISPATCH();
             }
-            case OP_SLICE_GET: {
+            CASE(OP_SLICE_GET): {
                 // Stack: obj, start, stop, step
                 ms_value_t step_val = ms_vm_pop(vm);
                 ms_value_t stop_val = ms_vm_pop(vm);
@@ -1851,12 +2471,12 @@ static ms_result_t run(ms_vm_t* vm) {
                 // Parse step
                 if (!ms_value_is_nil(step_val)) {
                     if (!ms_value_is_int(step_val)) {
-                        runtime_error(vm, "Slice step must be an integer.");
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Slice step must be an integer.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     step = (int)ms_value_as_int(step_val);
                     if (step == 0) {
-                        runtime_error(vm, "Slice step cannot be zero.");
+                        runtime_error_kind(vm, MS_VALUE_ERROR, "Slice step cannot be zero.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                 }
@@ -1868,9 +2488,9 @@ static ms_result_t run(ms_vm_t* vm) {
                 } else if (ms_value_is_tuple(obj)) {
                     len = ms_tuple_len(ms_value_as_tuple(obj));
                 } else if (ms_value_is_string(obj)) {
-                    len = strlen(ms_value_as_string(obj));
+                    len = (int)ms_string_length(ms_value_as_string(obj));
                 } else {
-                    runtime_error(vm, "Can only slice lists, tuples, and strings.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Can only slice lists, tuples, and strings.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
@@ -1879,7 +2499,7 @@ static ms_result_t run(ms_vm_t* vm) {
                     start = (step > 0) ? 0 : len - 1;
                 } else {
                     if (!ms_value_is_int(start_val)) {
-                        runtime_error(vm, "Slice start must be an integer.");
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Slice start must be an integer.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     start = (int)ms_value_as_int(start_val);
@@ -1890,7 +2510,7 @@ static ms_result_t run(ms_vm_t* vm) {
                     stop = (step > 0) ? len : -len - 1;
                 } else {
                     if (!ms_value_is_int(stop_val)) {
-                        runtime_error(vm, "Slice stop must be an integer.");
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Slice stop must be an integer.");
                         return MS_RESULT_RUNTIME_ERROR;
                     }
                     stop = (int)ms_value_as_int(stop_val);
@@ -1903,140 +2523,74 @@ static ms_result_t run(ms_vm_t* vm) {
                 } else if (ms_value_is_tuple(obj)) {
                     result = ms_slice_tuple(ms_value_as_tuple(obj), start, stop, step);
                 } else if (ms_value_is_string(obj)) {
-                    result = ms_slice_string(ms_value_as_string(obj), start, stop, step);
+                    result = ms_string_slice(obj, start, stop, step);
                 } else {
                     result = ms_value_nil();
                 }
                 
                 ms_vm_push(vm, result);
-                break;
+                DISPATCH();
             }
-            case OP_FOR_ITER: {
+            CASE(OP_FOR_ITER): {
                 uint8_t var_slot = READ_BYTE();
                 
-                // Stack should have: [..., iterable, index]
-                // Peek at the values without popping
+                // 栈上是 [..., iterable, index]，原地更新 index
                 ms_value_t index_val = peek(vm, 0);
-                ms_value_t iterable = peek(vm, 1);
-                
                 if (!ms_value_is_int(index_val)) {
                     runtime_error(vm, "For loop index must be an integer.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                
-                int index = (int)ms_value_as_int(index_val);
+
+                int64_t cursor = MS_AS_INTEGER(index_val);
                 ms_value_t current_element = ms_value_nil();
-                bool has_next = false;
-                
-                if (ms_value_is_list(iterable)) {
-                    ms_list_t* list = ms_value_as_list(iterable);
-                    if (index < ms_list_len(list)) {
-                        current_element = ms_list_get(list, index);
-                        has_next = true;
-                    }
-                } else if (ms_value_is_dict(iterable)) {
-                    ms_dict_t* dict = ms_value_as_dict(iterable);
-                    if (index < ms_dict_len(dict)) {
-                        // For dicts, iterate over keys
-                        current_element = ms_value_string(dict->entries[index].key);
-                        has_next = true;
-                    }
-                } else if (ms_value_is_tuple(iterable)) {
-                    ms_tuple_t* tuple = ms_value_as_tuple(iterable);
-                    if (index < ms_tuple_len(tuple)) {
-                        current_element = ms_tuple_get(tuple, index);
-                        has_next = true;
-                    }
-                } else if (ms_value_is_string(iterable)) {
-                    // Support string iteration
-                    const char* str = ms_value_as_string(iterable);
-                    int str_len = strlen(str);
-                    if (index < str_len) {
-                        char char_str[2] = {str[index], '\0'};
-                        current_element = ms_value_string(char_str);
-                        has_next = true;
-                    }
-                } else {
-                    runtime_error(vm, "Can only iterate over lists, dicts, tuples, and strings.");
+                ms_iter_result_t result = ms_iter_next(peek(vm, 1), &cursor, &current_element);
+                if (result == MS_ITER_NOT_ITERABLE) {
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Can only iterate over lists, dicts, tuples, sets, strings, and iterators.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                
-                // Set the loop variable to current element
+                if (result == MS_ITER_ERROR) return MS_RESULT_RUNTIME_ERROR;
+                bool has_next = result == MS_ITER_ELEMENT;
+                frame = &vm->frames[vm->frame_count - 1];  // 见 for_iter_next
+
                 if (var_slot < MS_MAX_LOCALS) {
                     frame->slots[var_slot] = current_element;
                 }
-                
-                // Update the index on the stack (increment it for next iteration)
-                vm->stack_top[-1] = ms_value_int(index + 1);
+                vm->stack_top[-1] = MS_INT_VALUE(cursor);
                 
                 // Push whether we have more elements (for jump condition)
                 ms_vm_push(vm, ms_value_bool(has_next));
-                break;
+                DISPATCH();
             }
-            case OP_FOR_ITER_LOCAL: {
+            CASE(OP_FOR_ITER_LOCAL): {
                 uint8_t var_slot = READ_BYTE();
                 uint8_t iter_slot = READ_BYTE();
                 uint8_t index_slot = READ_BYTE();
                 
-                // Get iterable and index from local variables
-                ms_value_t iterable = frame->slots[iter_slot];
-                ms_value_t index_val = frame->slots[index_slot];
-                
-                if (!ms_value_is_int(index_val)) {
-                    runtime_error(vm, "For loop index must be an integer.");
+                bool has_next;
+                if (!for_iter_next(vm, frame->slots, var_slot, iter_slot, index_slot, &has_next)) {
                     return MS_RESULT_RUNTIME_ERROR;
                 }
+                frame = &vm->frames[vm->frame_count - 1];
                 
-                int index = (int)ms_value_as_int(index_val);
-                ms_value_t current_element = ms_value_nil();
-                bool has_next = false;
+                // Push whether we have more elements (for jump condition)
+                ms_vm_push(vm, ms_value_bool(has_next));
+                DISPATCH();
+            }
+            CASE(OP_FOR_RANGE): {
+                uint8_t var_slot = READ_BYTE();
+                uint8_t iter_slot = READ_BYTE();
+                uint8_t index_slot = READ_BYTE();
+                uint16_t offset = READ_SHORT();
                 
-                if (ms_value_is_list(iterable)) {
-                    ms_list_t* list = ms_value_as_list(iterable);
-                    if (index < ms_list_len(list)) {
-                        current_element = ms_list_get(list, index);
-                        has_next = true;
-                    }
-                } else if (ms_value_is_dict(iterable)) {
-                    ms_dict_t* dict = ms_value_as_dict(iterable);
-                    if (index < ms_dict_len(dict)) {
-                        // For dicts, iterate over keys
-                        current_element = ms_value_string(dict->entries[index].key);
-                        has_next = true;
-                    }
-                } else if (ms_value_is_tuple(iterable)) {
-                    ms_tuple_t* tuple = ms_value_as_tuple(iterable);
-                    if (index < ms_tuple_len(tuple)) {
-                        current_element = ms_tuple_get(tuple, index);
-                        has_next = true;
-                    }
-                } else if (ms_value_is_string(iterable)) {
-                    // Support string iteration
-                    const char* str = ms_value_as_string(iterable);
-                    int str_len = strlen(str);
-                    if (index < str_len) {
-                        char char_str[2] = {str[index], '\0'};
-                        current_element = ms_value_string(char_str);
-                        has_next = true;
-                    }
-                } else {
-                    runtime_error(vm, "Can only iterate over lists, dicts, tuples, and strings.");
+                bool has_next;
+                if (!for_range_next(vm, frame->slots, var_slot, iter_slot, index_slot, &has_next)) {
                     return MS_RESULT_RUNTIME_ERROR;
                 }
-                
-                // Set the loop variable to current element
-                if (var_slot < MS_MAX_LOCALS) {
-                    frame->slots[var_slot] = current_element;
-                }
-                
-                // Update the index in local variable (increment it for next iteration)
-                frame->slots[index_slot] = ms_value_int(index + 1);
-                
-                // Push whether we have more elements (for jump condition)
-                ms_vm_push(vm, ms_value_bool(has_next));
-                break;
+                frame = &vm->frames[vm->frame_count - 1];
+                if (!has_next) frame->ip += offset;
+                DISPATCH();
             }
-            case OP_TERNARY: {
+            CASE(OP_TERNARY): {
                 // 栈顶: [value_if_false, condition, value_if_true]
                 // 弹出三个值，根据条件返回相应的值
                 ms_value_t value_if_false = ms_vm_pop(vm);
@@ -2048,15 +2602,15 @@ static ms_result_t run(ms_vm_t* vm) {
                 
                 // 推送相应的值
                 ms_vm_push(vm, is_true ? value_if_true : value_if_false);
-                break;
+                DISPATCH();
             }
-            case OP_DUP: {
+            CASE(OP_DUP): {
                 // 复制栈顶值
                 ms_value_t top = *(vm->stack_top - 1);
                 ms_vm_push(vm, top);
-                break;
+                DISPATCH();
             }
-            case OP_SWAP: {
+            CASE(OP_SWAP): {
                 // 交换栈顶两个值
                 if (vm->stack_top - vm->stack < 2) {
                     runtime_error(vm, "Stack underflow in swap.");
@@ -2066,9 +2620,9 @@ static ms_result_t run(ms_vm_t* vm) {
                 ms_value_t second = *(vm->stack_top - 2);
                 *(vm->stack_top - 1) = second;
                 *(vm->stack_top - 2) = top;
-                break;
+                DISPATCH();
             }
-            case OP_BUILD_LIST_COMP: {
+            CASE(OP_BUILD_LIST_COMP): {
                 // 列表推导式: [expr for var in iterable] 或 [expr if cond else expr2 for var in iterable]
                 // 栈顶: [iterable, condition (if has_condition), expr]
                 uint8_t var_index = READ_BYTE();
@@ -2102,28 +2656,25 @@ static ms_result_t run(ms_vm_t* vm) {
                         
                         ms_list_append(result_list, item);
                     }
-                } else if (ms_value_is_string(iterable)) {
-                    const char* str = ms_value_as_string(iterable);
-                    for (int i = 0; str[i] != '\0'; i++) {
-                        char char_str[2] = {str[i], '\0'};
-                        ms_list_append(result_list, ms_value_string(char_str));
+                } else if (!ms_iter_collect(iterable, result_list)) {
+                    if (!vm->has_error) {
+                        runtime_error_kind(vm, MS_TYPE_ERROR, "Can only iterate over lists, dicts, tuples, sets, strings, and iterators in list comprehension.");
                     }
-                } else {
-                    runtime_error(vm, "Can only iterate over lists and strings in list comprehension.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
+                frame = &vm->frames[vm->frame_count - 1];
                 
                 ms_vm_push(vm, ms_value_list(result_list));
-                break;
+                DISPATCH();
             }
-            case OP_LIST_APPEND: {
+            CASE(OP_LIST_APPEND): {
                 // 向列表添加元素
                 // 栈顶: [list, element]
                 ms_value_t element = ms_vm_pop(vm);
                 ms_value_t list_val = ms_vm_pop(vm);
                 
                 if (!ms_value_is_list(list_val)) {
-                    runtime_error(vm, "Can only append to lists.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Can only append to lists.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
@@ -2132,28 +2683,28 @@ static ms_result_t run(ms_vm_t* vm) {
                 
                 // 推送列表回栈
                 ms_vm_push(vm, list_val);
-                break;
+                DISPATCH();
             }
-            case OP_CLASS: {
+            CASE(OP_CLASS): {
                 // 创建类对象
                 const char* name = READ_STRING();
                 ms_class_t* klass = ms_class_new(name);
                 ms_vm_push(vm, ms_value_class(klass));
-                break;
+                DISPATCH();
             }
-            case OP_INHERIT: {
+            CASE(OP_INHERIT): {
                 // 设置继承关系
                 // 栈顶: [superclass, subclass]
                 ms_value_t superclass = peek(vm, 1);
                 ms_value_t subclass = peek(vm, 0);
                 
                 if (!ms_value_is_class(superclass)) {
-                    runtime_error(vm, "Superclass must be a class.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Superclass must be a class.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
                 if (!ms_value_is_class(subclass)) {
-                    runtime_error(vm, "Subclass must be a class.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Subclass must be a class.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
@@ -2162,21 +2713,23 @@ static ms_result_t run(ms_vm_t* vm) {
                 
                 // 设置父类
                 sub->parent = super;
+                sub->is_exception = super->is_exception;
                 
                 // 继承父类的方法（浅拷贝）
                 if (super->methods) {
-                    for (int i = 0; i < super->methods->capacity; i++) {
-                        if (super->methods->entries[i].key != NULL) {
-                            ms_dict_set(sub->methods, super->methods->entries[i].key, 
-                                       super->methods->entries[i].value);
+                    for (int i = 0; i < super->methods->used; i++) {
+                        if (!super->methods->entries[i].deleted) {
+                            ms_dict_set_value(sub->methods, super->methods->entries[i].key,
+                                              super->methods->entries[i].value);
                         }
                     }
                 }
                 
                 ms_vm_pop(vm);  // 弹出子类
-                break;
+                ms_vm_pop(vm);  // 弹出父类
+                DISPATCH();
             }
-            case OP_METHOD: {
+            CASE(OP_METHOD): {
                 // 添加方法到类
                 // 栈顶: [class, method]
                 const char* name = READ_STRING();
@@ -2184,7 +2737,7 @@ static ms_result_t run(ms_vm_t* vm) {
                 ms_value_t class_val = peek(vm, 1);
                 
                 if (!ms_value_is_class(class_val)) {
-                    runtime_error(vm, "Can only add methods to classes.");
+                    runtime_error_kind(vm, MS_TYPE_ERROR, "Can only add methods to classes.");
                     return MS_RESULT_RUNTIME_ERROR;
                 }
                 
@@ -2192,48 +2745,245 @@ static ms_result_t run(ms_vm_t* vm) {
                 ms_dict_set(klass->methods, name, method);
                 
                 ms_vm_pop(vm);  // 弹出方法
-                break;
+                DISPATCH();
             }
-            case OP_SET_PROPERTY: {
+            CASE(OP_SET_PROPERTY): {
                 // 设置属性
-                // 栈顶: [instance, value]
-                if (!ms_value_is_instance(peek(vm, 1))) {
-                    runtime_error(vm, "Only instances have properties.");
-                    return MS_RESULT_RUNTIME_ERROR;
-                }
-                
+                // 栈顶: [instance, value]，赋值后只留下 value
                 uint8_t name_index = READ_BYTE();
-                const char* name = name_table_names[name_index];
-                ms_instance_t* instance = (ms_instance_t*)ms_value_as_instance(peek(vm, 1));
+                ms_property_cache_t* cache = property_cache(frame->chunk, READ_BYTE());
                 ms_value_t value = peek(vm, 0);
-                
-                ms_dict_set(instance->attrs, name, value);
+                if (!set_property(vm, peek(vm, 1), name_index, cache, value)) {
+                    return MS_RESULT_RUNTIME_ERROR;
+                }
                 
                 ms_vm_pop(vm);  // 弹出值
                 ms_vm_pop(vm);  // 弹出实例
                 ms_vm_push(vm, value);  // 推送值回栈
-                break;
+                DISPATCH();
+            }
+
+            // 超级指令：由 ms_chunk_optimize 改写序列的第一个字节得到。
+            // 序列中其余字节保持原样，所以操作数仍在原来的偏移处，
+            // 跳到序列中间的跳转也仍然有效。
+            // 快速路径不适用时跳回第一条原始指令的处理代码，
+            // 由原始指令逐条执行整个序列。
+            CASE(OP_GET_LOCAL_LOCAL): {
+                // GET_LOCAL a; GET_LOCAL b
+                ms_vm_push(vm, frame->slots[frame->ip[0]]);
+                ms_vm_push(vm, frame->slots[frame->ip[2]]);
+                frame->ip += 3;
+                DISPATCH();
+            }
+            CASE(OP_SET_LOCAL_POP): {
+                // SET_LOCAL a; POP
+                frame->slots[frame->ip[0]] = ms_vm_pop(vm);
+                frame->ip += 2;
+                DISPATCH();
+            }
+            CASE(OP_DEFINE_GLOBAL_POP): {
+                // DEFINE_GLOBAL n; POP
+                uint8_t name_index = frame->ip[0];
+                if (name_index >= name_table_count) goto define_global_generic;
+                define_global(vm, name_index, ms_vm_pop(vm));
+                frame->ip += 2;
+                DISPATCH();
+            }
+            CASE(OP_JUMP_IF_FALSE_POP): {
+                // JUMP_IF_FALSE off; POP
+                // 条件为假时跳转并保留条件值（与原序列一致），否则弹出它
+                uint16_t offset = READ_SHORT();
+                if (is_falsey(peek(vm, 0))) {
+                    frame->ip += offset;
+                } else {
+                    ms_vm_pop(vm);
+                    frame->ip++;
+                }
+                DISPATCH();
+            }
+            CASE(OP_POP_LOOP): {
+                // POP; LOOP off
+                ms_vm_pop(vm);
+                uint16_t offset = (uint16_t)((frame->ip[1] << 8) | frame->ip[2]);
+                frame->ip += 3 - offset;
+                GC_SAFEPOINT();
+                DISPATCH();
+            }
+
+// 比较并分支：CMP; JUMP_IF_FALSE off; POP
+// 两个整数时直接比较，条件为假时推送 False 并跳转（跳转目标会弹出它）
+#define COMPARE_JUMP(op, generic) \
+    do { \
+        ms_value_t b = peek(vm, 0); \
+        ms_value_t a = peek(vm, 1); \
+        if (!ms_value_is_int(a) || !ms_value_is_int(b)) goto generic; \
+        vm->stack_top -= 2; \
+        if (ms_value_as_int(a) op ms_value_as_int(b)) { \
+            frame->ip += 4; \
+        } else { \
+            ms_vm_push(vm, ms_value_bool(false)); \
+            uint16_t offset = (uint16_t)((frame->ip[1] << 8) | frame->ip[2]); \
+            frame->ip += 3 + offset; \
+        } \
+    } while (false)
+
+            CASE(OP_EQUAL_JUMP): {
+                COMPARE_JUMP(==, equal_generic);
+                DISPATCH();
+            }
+            CASE(OP_GREATER_JUMP): {
+                COMPARE_JUMP(>, greater_generic);
+                DISPATCH();
+            }
+            CASE(OP_LESS_JUMP): {
+                COMPARE_JUMP(<, less_generic);
+                DISPATCH();
+            }
+            CASE(OP_LESS_EQUAL_JUMP): {
+                COMPARE_JUMP(<=, less_equal_generic);
+                DISPATCH();
+            }
+            CASE(OP_GREATER_EQUAL_JUMP): {
+                COMPARE_JUMP(>=, greater_equal_generic);
+                DISPATCH();
+            }
+#undef COMPARE_JUMP
+
+            CASE(OP_ADD_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_INT_VALUE, +, OP_ADD, add_generic);
+                DISPATCH();
+            CASE(OP_SUBTRACT_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_INT_VALUE, -, OP_SUBTRACT, subtract_generic);
+                DISPATCH();
+            CASE(OP_MULTIPLY_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_INT_VALUE, *, OP_MULTIPLY, multiply_generic);
+                DISPATCH();
+            CASE(OP_EQUAL_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_BOOL_VALUE, ==, OP_EQUAL, equal_generic);
+                DISPATCH();
+            CASE(OP_GREATER_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_BOOL_VALUE, >, OP_GREATER, greater_generic);
+                DISPATCH();
+            CASE(OP_LESS_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_BOOL_VALUE, <, OP_LESS, less_generic);
+                DISPATCH();
+            CASE(OP_GREATER_EQUAL_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_BOOL_VALUE, >=, OP_GREATER_EQUAL, greater_equal_generic);
+                DISPATCH();
+            CASE(OP_LESS_EQUAL_INT):
+                QUICK_BINARY(MS_VAL_INT, MS_AS_INTEGER, MS_BOOL_VALUE, <=, OP_LESS_EQUAL, less_equal_generic);
+                DISPATCH();
+            CASE(OP_SUBTRACT_FLOAT):
+                QUICK_BINARY(MS_VAL_FLOAT, MS_AS_FLOATING, MS_FLOAT_VALUE, -, OP_SUBTRACT, subtract_generic);
+                DISPATCH();
+            CASE(OP_MULTIPLY_FLOAT):
+                QUICK_BINARY(MS_VAL_FLOAT, MS_AS_FLOATING, MS_FLOAT_VALUE, *, OP_MULTIPLY, multiply_generic);
+                DISPATCH();
+            CASE(OP_DIVIDE_FLOAT):
+                if (is_zero_divisor(vm->stack_top[-1])) goto divide_generic;
+                QUICK_BINARY(MS_VAL_FLOAT, MS_AS_FLOATING, MS_FLOAT_VALUE, /, OP_DIVIDE, divide_generic);
+                DISPATCH();
+            CASE(OP_GREATER_FLOAT):
+                QUICK_BINARY(MS_VAL_FLOAT, MS_AS_FLOATING, MS_BOOL_VALUE, >, OP_GREATER, greater_generic);
+                DISPATCH();
+            CASE(OP_LESS_FLOAT):
+                QUICK_BINARY(MS_VAL_FLOAT, MS_AS_FLOATING, MS_BOOL_VALUE, <, OP_LESS, less_generic);
+                DISPATCH();
+            CASE(OP_ADD_STRING): {
+                ms_value_t b = vm->stack_top[-1];
+                ms_value_t a = vm->stack_top[-2];
+                if (MS_VALUE_TYPE(a) != MS_VAL_STRING || MS_VALUE_TYPE(b) != MS_VAL_STRING) {
+                    frame->ip[-1] = OP_ADD;
+                    goto add_generic;
+                }
+                vm->stack_top -= 2;
+                ms_vm_push(vm, ms_string_concat(a, b));
+                DISPATCH();
+            }
+            CASE(OP_INC_LOCAL): {
+                // GET_LOCAL a; CONSTANT k; ADD; SET_LOCAL a; POP
+                // 即 a = a + k，局部变量和常量都是整数时原地更新
+                ms_value_t* slot = &frame->slots[frame->ip[0]];
+                ms_value_t step = frame->chunk->constants[frame->ip[2]];
+                if (!ms_value_is_int(*slot) || !ms_value_is_int(step)) goto get_local_generic;
+                *slot = ms_value_int(ms_value_as_int(*slot) + ms_value_as_int(step));
+                frame->ip += 7;
+                DISPATCH();
+            }
+            CASE(OP_RETURN_CONSTANT): {
+                // CONSTANT k; RETURN
+                ms_vm_push(vm, READ_CONSTANT());
+                frame->ip++;
+                goto return_generic;
             }
+            DEFAULT_CASE:
+                break;
+        }
+#ifdef MS_REGISTER_VM
+        continue;
+
+    run_register_frame:
+        // 寄存器格式的帧在 run_registers() 中执行，回到栈格式的帧时返回
+        if (run_registers(vm) != MS_RESULT_OK) {
+            return MS_RESULT_RUNTIME_ERROR;
         }
+        frame = &vm->frames[vm->frame_count - 1];
+#endif
     }
 
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef BINARY_OP
+#undef BINARY_VALUES
+#undef QUICKEN
+#undef QUICK_BINARY
+#undef CHECK_REGISTER_FRAME
+#undef CALL_FRAME
+}
+
+// 执行到入口帧返回 (或生成器交出值)。try 块不生成任何指令：出错时才按
+// 异常表找处理代码，找到了就从那里重新进入解释循环
+static ms_result_t run(ms_vm_t* vm) {
+    // 进入时的帧数；该帧执行 OP_RETURN 时 run() 返回
+    int entry_frame_count = vm->frame_count;
+    for (;;) {
+        ms_result_t result = execute(vm, entry_frame_count);
+        if (result != MS_RESULT_RUNTIME_ERROR || !unwind_exception(vm, entry_frame_count)) {
+            return result;
+        }
+    }
 }
 
 ms_vm_t* ms_vm_new(void) {
     ms_vm_t* vm = malloc(sizeof(ms_vm_t));
+    vm->stack = malloc(sizeof(ms_value_t) * MS_INITIAL_STACK_SIZE);
+    vm->stack_end = vm->stack + MS_INITIAL_STACK_SIZE;
+    vm->max_stack_size = MS_MAX_STACK_SIZE;
+    vm->frames = malloc(sizeof(ms_call_frame_t) * MS_INITIAL_FRAMES);
+    vm->frame_capacity = MS_INITIAL_FRAMES;
+    vm->max_frames = MS_MAX_FRAMES;
     ms_vm_reset_stack(vm);
     vm->globals = NULL;
+    vm->global_count = 0;
+    vm->global_capacity = 0;
+    vm->global_hash = NULL;
+    vm->global_hash_capacity = 0;
+    for (int i = 0; i < 256; i++) {
+        vm->name_slots[i] = -1;
+    }
     vm->has_error = false;
+    vm->error_kind = MS_RUNTIME_ERROR;
     vm->jit_enabled = false;
     vm->hotspot_threshold = 100;
     vm->frame_count = 0;
-    vm->last_method_name = NULL;
-    vm->last_module_name = NULL;
     vm->dynamic_extension_count = 0;
+    vm->has_exception = false;
+    vm->current_exception = ms_value_nil();
+    for (int i = 0; i < MS_EXCEPTION_KIND_COUNT; i++) {
+        vm->exception_classes[i] = ms_value_nil();
+    }
+    ms_gc_register_vm(vm);
     return vm;
 }
 
@@ -2243,15 +2993,76 @@ void ms_vm_free(ms_vm_t* vm) {
         ms_unload_extension_library((ms_dynamic_extension_t*)vm->dynamic_extensions[i]);
     }
     
+    ms_gc_unregister_vm(vm);
+
     // 释放全局变量
-    ms_global_t* current = vm->globals;
-    while (current != NULL) {
-        ms_global_t* next = current->next;
-        free(current->name);
-        free(current);
-        current = next;
+    for (int i = 0; i < vm->global_count; i++) {
+        free(vm->globals[i].name);
     }
+    free(vm->globals);
+    free(vm->global_hash);
+    free(vm->stack);
+    free(vm->frames);
     free(vm);
+
+    // 这个 VM 的全局变量和栈不再是根，回收只被它引用的对象
+    ms_gc_collect();
+}
+
+// 修改值栈 (按值的个数) 和调用帧栈的上限，已经分配的部分不会缩小
+void ms_vm_set_stack_limit(ms_vm_t* vm, int max_stack_size, int max_frames) {
+    vm->max_stack_size = max_stack_size > FRAME_STACK_RESERVE ? max_stack_size : FRAME_STACK_RESERVE;
+    vm->max_frames = max_frames > 1 ? max_frames : 1;
+}
+
+static void global_hash_insert(ms_vm_t* vm, int slot) {
+    int mask = vm->global_hash_capacity - 1;
+    int i = (int)(vm->globals[slot].hash & (uint32_t)mask);
+    while (vm->global_hash[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    vm->global_hash[i] = slot + 1;
+}
+
+// 按名字查找全局变量槽位；不存在时 create 为真则分配一个未定义的槽位，否则返回 -1
+int ms_vm_global_slot(ms_vm_t* vm, const char* name, bool create) {
+    uint32_t hash = ms_hash_string(name);
+    if (vm->global_hash_capacity > 0) {
+        int mask = vm->global_hash_capacity - 1;
+        int i = (int)(hash & (uint32_t)mask);
+        while (vm->global_hash[i] != 0) {
+            ms_global_t* global = &vm->globals[vm->global_hash[i] - 1];
+            if (global->hash == hash && strcmp(global->name, name) == 0) {
+                return vm->global_hash[i] - 1;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+    if (!create) return -1;
+
+    if (vm->global_count == vm->global_capacity) {
+        vm->global_capacity = vm->global_capacity < 64 ? 64 : vm->global_capacity * 2;
+        vm->globals = realloc(vm->globals, sizeof(ms_global_t) * vm->global_capacity);
+    }
+    // 负载因子保持在 1/2 以下
+    if ((vm->global_count + 1) * 2 > vm->global_hash_capacity) {
+        free(vm->global_hash);
+        vm->global_hash_capacity = vm->global_hash_capacity < 128 ? 128 : vm->global_hash_capacity * 2;
+        vm->global_hash = calloc(vm->global_hash_capacity, sizeof(int));
+        for (int i = 0; i < vm->global_count; i++) {
+            global_hash_insert(vm, i);
+        }
+    }
+
+    int slot = vm->global_count++;
+    ms_global_t* global = &vm->globals[slot];
+    global->name = malloc(strlen(name) + 1);
+    strcpy(global->name, name);
+    global->hash = hash;
+    global->value = ms_value_nil();
+    global->defined = false;
+    global_hash_insert(vm, slot);
+    return slot;
 }
 
 void ms_vm_reset_stack(ms_vm_t* vm) {
@@ -2259,6 +3070,9 @@ void ms_vm_reset_stack(ms_vm_t* vm) {
 }
 
 void ms_vm_push(ms_vm_t* vm, ms_value_t value) {
+    if (vm->stack_top == vm->stack_end) {
+        grow_stack(vm, (size_t)(vm->stack_end - vm->stack) + 1);
+    }
     *vm->stack_top = value;
     vm->stack_top++;
 }
@@ -2272,13 +3086,84 @@ ms_value_t ms_vm_peek(ms_vm_t* vm, int distance) {
     return vm->stack_top[-1 - distance];
 }
 
+ms_iter_result_t ms_generator_resume(ms_generator_t* generator, ms_value_t sent,
+                                     ms_value_t* element) {
+    ms_vm_t* vm = generator->vm;
+    switch (generator->state) {
+        case MS_GENERATOR_DONE:
+            return MS_ITER_END;
+        case MS_GENERATOR_RUNNING:
+            runtime_error_kind(vm, MS_VALUE_ERROR, "generator already executing");
+            return MS_ITER_ERROR;
+        default:
+            break;
+    }
+
+    // 栈上依次放生成器自己 (执行期间的根，OP_YIELD 从 slots[-1] 找到它)、
+    // 保存的局部变量和临时值，停在 yield 上时再放 yield 表达式的值
+    ptrdiff_t base_offset = vm->stack_top - vm->stack;
+    ms_vm_push(vm, ms_value_generator(generator));
+    for (int i = 0; i < generator->value_count; i++) {
+        ms_vm_push(vm, generator->values[i]);
+    }
+    if (generator->state == MS_GENERATOR_SUSPENDED) {
+        ms_vm_push(vm, sent);
+    }
+    int count = (int)(vm->stack_top - vm->stack - base_offset - 1);
+    generator->value_count = 0;
+
+    ms_function_t* function = generator->function;
+    int frame_count = vm->frame_count;
+    if (!enter_frame(vm, function, count, vm->stack + base_offset, MS_FRAME_RETURN_DISCARD)) {
+        generator->state = MS_GENERATOR_DONE;
+        return MS_ITER_ERROR;
+    }
+    vm->frames[vm->frame_count - 1].ip = function->chunk->code + generator->ip;
+    generator->state = MS_GENERATOR_RUNNING;
+
+    // OP_YIELD 和 OP_RETURN 都停在入口帧，交出/返回的值在栈顶。
+    // 出错时函数体里的帧还在帧栈上，和正常结束一样退回到恢复之前
+    ms_result_t status = run(vm);
+    ms_value_t value = status == MS_RESULT_OK ? ms_vm_pop(vm) : ms_value_nil();
+    vm->frame_count = frame_count;
+    vm->stack_top = vm->stack + base_offset;
+    if (vm->frame_count > 0) vm->chunk = vm->frames[vm->frame_count - 1].chunk;
+    if (status != MS_RESULT_OK) {
+        generator->state = MS_GENERATOR_DONE;
+        return MS_ITER_ERROR;
+    }
+
+    *element = value;
+    if (generator->state == MS_GENERATOR_RUNNING) {
+        // 函数体返回了：不再持有参数和局部变量
+        generator->state = MS_GENERATOR_DONE;
+        return MS_ITER_END;
+    }
+    return MS_ITER_ELEMENT;
+}
+
 ms_result_t ms_vm_interpret(ms_vm_t* vm, ms_chunk_t* chunk) {
+    vm->frame_count = 0;
+    ms_vm_reset_stack(vm);
+    if (!reserve_frame_stack(vm)) {
+        return MS_RESULT_RUNTIME_ERROR;
+    }
     vm->chunk = chunk;
+    vm->frames[0].chunk = chunk;
     vm->frames[0].ip = chunk->code;
     vm->frames[0].slots = vm->stack;
+    vm->frames[0].base = vm->stack;
+    vm->frames[0].on_return = MS_FRAME_RETURN_DISCARD;
     vm->frame_count = 1;
+    vm->has_error = false;
+    vm->error_kind = MS_RUNTIME_ERROR;
+    vm->has_exception = false;
     
-    return run(vm);
+    ms_result_t result = run(vm);
+    // chunk 由调用者释放，出错时留下的帧和栈上的值不能再作为 GC 的根
+    vm->frame_count = 0;
+    ms_vm_reset_stack(vm);
+    return result;
 }
 
 const char* ms_vm_get_error(ms_vm_t* vm) {
@@ -2287,4 +3172,6 @@ const char* ms_vm_get_error(ms_vm_t* vm) {
 
 void ms_vm_clear_error(ms_vm_t* vm) {
     vm->has_error = false;
+    vm->error_kind = MS_RUNTIME_ERROR;
+    vm->has_exception = false;
 }
\ No newline at end of file
@@ -3,7 +3,35 @@
 
 #include "miniscript.h"
 #include "../lexer/lexer.h"
+#include "../core/value.h"
 #include <stdint.h>
+#include <stdio.h>
+
+// 属性访问的内联缓存：每条 GET_PROPERTY/SET_PROPERTY 指令一项，
+// 按实例的 shape 命中，最多记住 MS_PROPERTY_CACHE_WAYS 个 shape (多态)
+#define MS_PROPERTY_CACHE_WAYS 4
+#define MS_NO_PROPERTY_CACHE 0xff  // 缓存表已满时指令使用的缓存号
+
+typedef struct {
+    struct ms_shape* shape;       // NULL 表示空项
+    struct ms_shape* next_shape;  // SET_PROPERTY 新增属性后的 shape，否则与 shape 相同
+    int slot;                     // 属性槽位，-1 表示命中的是类方法 method
+    ms_value_t method;
+} ms_property_cache_entry_t;
+
+typedef struct {
+    ms_property_cache_entry_t entries[MS_PROPERTY_CACHE_WAYS];
+} ms_property_cache_t;
+
+// 异常表的一项 (try 语句)：执行 [start, end) 里的指令时出错，
+// 把栈退回 slots + depth，压入异常对象，从 handler 继续执行。
+// 偏移都相对 chunk->code。内层的 try 先登记，所以第一个覆盖出错位置的就是最内层的
+typedef struct {
+    int start;
+    int end;
+    int handler;
+    int depth;
+} ms_exception_entry_t;
 
 // 字节码块
 typedef struct {
@@ -14,6 +42,13 @@ typedef struct {
     ms_value_t* constants;
     int constant_count;
     int constant_capacity;
+    int register_count;  // 寄存器格式字节码使用的寄存器数，栈字节码为 0
+    ms_property_cache_t* property_caches;
+    int property_cache_count;
+    // 异常表：只在出错时查找，进入和离开 try 块不执行任何指令
+    ms_exception_entry_t* handlers;
+    int handler_count;
+    uint32_t gc_epoch;  // GC 本轮已经遍历过这个块时等于当前轮次
 } ms_chunk_t;
 
 // 函数对象
@@ -23,6 +58,8 @@ typedef struct {
     char* name;
     int default_count;  // 有默认值的参数个数
     ms_value_t* defaults;  // 默认值数组
+    bool is_generator;  // 函数体里有 yield：调用时不执行，返回生成器 (见 generator.h)
+    bool is_coroutine;  // async def：同样返回生成器对象，作为协程只能 await 或交给事件循环
 } ms_function_t;
 
 // 字节码指令
@@ -39,8 +76,8 @@ typedef enum {
     OP_SET_GLOBAL,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
-    OP_GET_PROPERTY,
-    OP_SET_PROPERTY,
+    OP_GET_PROPERTY,   // name cache
+    OP_SET_PROPERTY,   // name cache
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
@@ -54,6 +91,9 @@ typedef enum {
     OP_FLOOR_DIVIDE,  // 整除 //
     OP_POWER,         // 幂运算 **
     OP_MODULO,
+    OP_BIT_OR,        // |  整数按位或 / 集合并集
+    OP_BIT_AND,       // &  整数按位与 / 集合交集
+    OP_BIT_XOR,       // ^  整数按位异或 / 集合对称差
     OP_NOT,
     OP_NEGATE,
     OP_PRINT,
@@ -70,6 +110,8 @@ typedef enum {
     OP_CLOSURE,
     OP_CLOSE_UPVALUE,
     OP_RETURN,
+    OP_YIELD,          // 生成器交出栈顶值并挂起，恢复时栈顶换成 send 进来的值 (next() 是 None)
+    OP_AWAIT,          // [awaitable, sent]：驱动协程或把等待请求交给事件循环，完成后换成结果
     OP_LOAD_MODULE,
     OP_CLASS,
     OP_INHERIT,
@@ -78,12 +120,16 @@ typedef enum {
     OP_BUILD_DICT,
     OP_BUILD_TUPLE,
     OP_BUILD_SET,
+    OP_BUILD_STRING,   // f-string：把栈顶 n 个值的文本拼成一个字符串
+    OP_FORMAT_VALUE,   // 按常量里的格式说明格式化栈顶值 ({x:spec})
+    OP_CONVERT_VALUE,  // 把栈顶值换成它的 str() ('s') 或 repr() ('r') 文本 ({x!r})
     OP_SET_ADD,
     OP_INDEX_GET,
     OP_INDEX_SET,
     OP_SLICE_GET,
     OP_FOR_ITER,
     OP_FOR_ITER_LOCAL,
+    OP_FOR_RANGE,      // var iter index off: for x in range(...) 的计数循环，到头时跳过 off
     OP_FOR_END,
     OP_TERNARY,  // 三元表达式
     OP_DUP,      // 复制栈顶值
@@ -94,30 +140,127 @@ typedef enum {
     OP_LAMBDA,   // lambda 表达式
     OP_ASSERT,   // assert 语句
     OP_DELETE,   // del 语句
-    OP_TRY_BEGIN,      // 标记try块开始
-    OP_TRY_END,        // 标记try块结束
-    OP_RAISE,          // 抛出异常
-    OP_JUMP_IF_EXCEPTION,  // 如果有异常则跳转
+    OP_RAISE,          // 抛出栈顶的异常 (异常类先实例化)
+    OP_EXCEPTION_MATCH,  // [exception, type]：换成异常是否属于 type (类或类的元组)
+    OP_CALL_FINALLY,   // off：压入下一条指令的偏移，跳到 finally 块 (break/continue/return 离开 try)
+    OP_END_FINALLY,    // [value, reason]：None 继续，整数跳回 OP_CALL_FINALLY 之后，异常重新抛出
+
+    // 超级指令：编译后由 ms_chunk_optimize 改写常见序列得到，
+    // 只替换序列的第一个字节，操作数留在原来的位置
+    OP_GET_LOCAL_LOCAL,      // GET_LOCAL a; GET_LOCAL b
+    OP_SET_LOCAL_POP,        // SET_LOCAL a; POP
+    OP_DEFINE_GLOBAL_POP,    // DEFINE_GLOBAL n; POP
+    OP_JUMP_IF_FALSE_POP,    // JUMP_IF_FALSE off; POP
+    OP_POP_LOOP,             // POP; LOOP off
+    OP_EQUAL_JUMP,           // EQUAL; JUMP_IF_FALSE off; POP
+    OP_GREATER_JUMP,         // GREATER; JUMP_IF_FALSE off; POP
+    OP_LESS_JUMP,            // LESS; JUMP_IF_FALSE off; POP
+    OP_LESS_EQUAL_JUMP,      // LESS_EQUAL; JUMP_IF_FALSE off; POP
+    OP_GREATER_EQUAL_JUMP,   // GREATER_EQUAL; JUMP_IF_FALSE off; POP
+    OP_INC_LOCAL,            // GET_LOCAL a; CONSTANT k; ADD; SET_LOCAL a; POP
+    OP_RETURN_CONSTANT,      // CONSTANT k; RETURN
+
+    // 特化指令 (quickening)：通用的算术/比较指令执行时按看到的操作数类型
+    // 把自己改写成下面的版本；类型不符时改回通用版本并按通用语义执行
+    OP_ADD_INT,
+    OP_SUBTRACT_INT,
+    OP_MULTIPLY_INT,
+    OP_EQUAL_INT,
+    OP_GREATER_INT,
+    OP_LESS_INT,
+    OP_GREATER_EQUAL_INT,
+    OP_LESS_EQUAL_INT,
+    OP_SUBTRACT_FLOAT,
+    OP_MULTIPLY_FLOAT,
+    OP_DIVIDE_FLOAT,
+    OP_GREATER_FLOAT,
+    OP_LESS_FLOAT,
+    OP_ADD_STRING,
+
+    // 寄存器格式指令 (MS_REGISTER_VM)：由 ms_function_to_registers 从栈字节码翻译得到，
+    // 由 run_registers() 执行。A 是帧内寄存器号 (frame->slots[A])，
+    // RK 操作数最高位为 1 时表示常量 constants[RK & 0x7f]，否则是寄存器
+    OP_R_MOVE,               // A B          R[A] = R[B]
+    OP_R_LOAD_CONSTANT,      // A k          R[A] = constants[k]
+    OP_R_GET_GLOBAL,         // A name       R[A] = globals[name]
+    OP_R_DEFINE_GLOBAL,      // name RK
+    OP_R_SET_GLOBAL,         // name RK
+    OP_R_GET_PROPERTY,       // A RK name cache       R[A] = RK.name
+    OP_R_SET_PROPERTY,       // A RK name RK cache    RK.name = RK; R[A] = 所赋的值
+    OP_R_ADD,                // A RK RK      R[A] = RK + RK
+    OP_R_SUBTRACT,
+    OP_R_MULTIPLY,
+    OP_R_DIVIDE,
+    OP_R_FLOOR_DIVIDE,
+    OP_R_POWER,
+    OP_R_MODULO,
+    OP_R_BIT_OR,
+    OP_R_BIT_AND,
+    OP_R_BIT_XOR,
+    OP_R_EQUAL,              // A RK RK      R[A] = RK == RK
+    OP_R_GREATER,
+    OP_R_LESS,
+    OP_R_GREATER_EQUAL,
+    OP_R_LESS_EQUAL,
+    OP_R_NOT,                // A RK
+    OP_R_NEGATE,             // A RK
+    OP_R_JUMP,               // off
+    OP_R_LOOP,               // off
+    OP_R_JUMP_IF_FALSE,      // RK off
+    OP_R_JUMP_IF_TRUE,       // RK off
+    OP_R_FOR_ITER,           // A var iter index   R[A] = 是否还有元素
+    OP_R_CALL,               // A n          R[A] = R[A](R[A+1] .. R[A+n])
+    OP_R_RETURN,             // RK
+    // 与随后的 OP_R_JUMP_IF_FALSE A off 融合，写 R[A] 后直接分支
+    OP_R_EQUAL_JUMP,
+    OP_R_GREATER_JUMP,
+    OP_R_LESS_JUMP,
+    OP_R_GREATER_EQUAL_JUMP,
+    OP_R_LESS_EQUAL_JUMP,
+    OP_R_FOR_ITER_JUMP,
+    OP_R_FOR_RANGE,          // var iter index off   同 OP_FOR_RANGE
 } ms_opcode_t;
 
+// 帧返回时对返回值的处理方式
+typedef enum {
+    MS_FRAME_RETURN_VALUE,     // 推送返回值
+    MS_FRAME_RETURN_DISCARD,   // 丢弃返回值 (__setitem__, __exit__)
+    MS_FRAME_RETURN_INSTANCE,  // 推送 self 而不是返回值 (__init__)
+    MS_FRAME_RETURN_PRINT      // 打印返回值 (print 调用 __str__)
+} ms_frame_return_t;
+
 // 调用帧
 typedef struct {
+    ms_chunk_t* chunk;
     uint8_t* ip;
     ms_value_t* slots;
+    ms_value_t* base;             // 返回时恢复到的栈顶
+    ms_frame_return_t on_return;
 } ms_call_frame_t;
 
-// 异常处理器
-typedef struct {
-    uint8_t* handler_ip;   // Jump target for exception handler
-    int stack_height;      // Stack height to restore
-    int frame_index;       // Frame index when handler was pushed
-} ms_exception_handler_t;
+// 内置异常类型 (builtins.c 创建类对象)。报告错误的地方同时给出类型
+// (vm->error_kind)，错误被 except 捕获时转换成这个类的实例
+typedef enum {
+    MS_EXCEPTION,
+    MS_RUNTIME_ERROR,
+    MS_TYPE_ERROR,
+    MS_VALUE_ERROR,
+    MS_NAME_ERROR,
+    MS_ATTRIBUTE_ERROR,
+    MS_INDEX_ERROR,
+    MS_KEY_ERROR,
+    MS_ZERO_DIVISION_ERROR,
+    MS_ASSERTION_ERROR,
+    MS_EXCEPTION_KIND_COUNT
+} ms_exception_kind_t;
 
-// 全局变量表
-typedef struct ms_global {
+// 全局变量槽位：稠密数组 vm->globals 的一项。
+// 槽位一旦分配就不再移动下标，del 只清除 defined
+typedef struct {
     char* name;
+    uint32_t hash;
     ms_value_t value;
-    struct ms_global* next;
+    bool defined;
 } ms_global_t;
 
 // 名称表（用于编译时）
@@ -129,23 +272,31 @@ struct ms_vm {
     ms_chunk_t* chunk;
     uint8_t* ip;
     
-    ms_value_t stack[MS_MAX_STACK_SIZE];
+    // 值栈和调用帧栈按需增长 (realloc 后修正指针)，上限见 ms_vm_set_stack_limit
+    ms_value_t* stack;
     ms_value_t* stack_top;
+    ms_value_t* stack_end;
+    int max_stack_size;
     
-    ms_call_frame_t frames[64];
+    ms_call_frame_t* frames;
     int frame_count;
+    int frame_capacity;
+    int max_frames;
     
+    // 全局变量：宿主按名字查 global_hash (开放寻址，存槽位 + 1，0 为空)，
+    // 字节码按编译期名字下标查 name_slots (-1 表示尚未解析)
     ms_global_t* globals;
+    int global_count;
+    int global_capacity;
+    int* global_hash;
+    int global_hash_capacity;
+    int name_slots[256];
     
-    // Exception handling
-    ms_exception_handler_t exception_handlers[64];
-    int exception_handler_count;
+    // 异常：has_error 时 current_exception 是正在传播的异常对象
+    // (has_exception 为 false 表示还没转换成异常对象，只有 error_message)
     ms_value_t current_exception;
     bool has_exception;
-    
-    // For tracking module method calls
-    const char* last_method_name;
-    const char* last_module_name;
+    ms_value_t exception_classes[MS_EXCEPTION_KIND_COUNT];  // 没注册内置函数时是 nil
     
     // For dynamic extensions
     void* dynamic_extensions[32];
@@ -153,6 +304,7 @@ struct ms_vm {
     
     char error_message[256];
     bool has_error;
+    ms_exception_kind_t error_kind;  // has_error 时错误对应的异常类型
     
     // JIT相关
     bool jit_enabled;
@@ -164,9 +316,30 @@ void ms_chunk_init(ms_chunk_t* chunk);
 void ms_chunk_free(ms_chunk_t* chunk);
 void ms_chunk_write(ms_chunk_t* chunk, uint8_t byte, int line);
 int ms_chunk_add_constant(ms_chunk_t* chunk, ms_value_t value);
+uint8_t ms_chunk_add_property_cache(ms_chunk_t* chunk);
+void ms_chunk_add_handler(ms_chunk_t* chunk, int start, int end, int handler, int depth);
 
 // VM操作
 ms_result_t ms_vm_interpret(ms_vm_t* vm, ms_chunk_t* chunk);
 void ms_vm_reset_stack(ms_vm_t* vm);
+int ms_vm_global_slot(ms_vm_t* vm, const char* name, bool create);
+
+// 原生函数和扩展报告错误：设置错误信息和异常类型，原生函数随后返回
+// (返回值被忽略)，解释器按异常表找处理代码，没有 try 时报告给宿主
+void ms_vm_raise(ms_vm_t* vm, ms_exception_kind_t kind, const char* format, ...);
+
+// 字节码工具 (optimize.c)
+const char* ms_opcode_name(uint8_t opcode);
+int ms_opcode_length(uint8_t opcode);
+void ms_chunk_optimize(ms_chunk_t* chunk);
+
+// 寄存器格式字节码 (regcode.c)
+bool ms_function_to_registers(ms_function_t* function);
+
+#ifdef MS_PROFILE_OPCODES
+// 操作码对统计，编译时定义 MS_PROFILE_OPCODES 启用
+extern unsigned long ms_opcode_pair_counts[256][256];
+void ms_opcode_profile_dump(FILE* out, int limit);
+#endif
 
 #endif // VM_H
\ No newline at end of file
@@ -0,0 +1,56 @@
+// 操作码对频率统计工具
+//
+// 逐个运行给定的脚本，统计运行时相邻两条指令的出现次数，用来决定
+// 哪些指令序列值得融合成超级指令 (见 src/vm/optimize.c)。
+// 统计的是未融合的原始字节码。
+//
+// 构建 (需要整个库都用 MS_PROFILE_OPCODES 编译):
+//   make opstats
+// 用法:
+//   ./opstats [-n 40] examples/*.ms benchmarks/*.ms > /dev/null
+// 脚本自己的输出走 stdout，统计结果写到 stderr。
+
+#include "miniscript.h"
+#include "vm/vm.h"
+#include "builtins/builtins.h"
+#include "ext/ext.h"
+#include "ext/math_ext.h"
+#include "ext/string_ext.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef MS_PROFILE_OPCODES
+#error "opstats must be built with -DMS_PROFILE_OPCODES"
+#endif
+
+int main(int argc, const char* argv[]) {
+    int limit = 40;
+    int first_script = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        limit = atoi(argv[2]);
+        first_script = 3;
+    }
+
+    if (first_script >= argc) {
+        fprintf(stderr, "Usage: opstats [-n limit] script.ms...\n");
+        return 64;
+    }
+
+    for (int i = first_script; i < argc; i++) {
+        ms_vm_t* vm = ms_vm_new();
+        ms_register_builtins(vm);
+        ms_register_extension(vm, ms_math_extension_create());
+        ms_register_extension(vm, ms_string_extension_create());
+
+        ms_result_t result = ms_vm_exec_file(vm, argv[i]);
+        if (result != MS_RESULT_OK) {
+            fprintf(stderr, "opstats: %s did not finish cleanly (%d)\n", argv[i], result);
+        }
+        ms_vm_free(vm);
+    }
+
+    ms_opcode_profile_dump(stderr, limit);
+    return 0;
+}